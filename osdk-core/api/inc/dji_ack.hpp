@@ -77,6 +77,12 @@ public:
     WayPointInitSettings data;
   } WayPointInitInternal; // pack(1)
 
+  typedef struct WayPointIndexInternal
+  {
+    uint8_t          ack;
+    WayPointSettings data;
+  } WayPointIndexInternal; // pack(1)
+
   typedef struct MFIOGetInternal
   {
     uint8_t  result;
@@ -193,6 +199,7 @@ public:
     HotPointReadInternal     hpReadACK;
     WayPointInitInternal     wpInitACK;
     WayPointDataInternal     wpDataACK;
+    WayPointIndexInternal    wpIndexACK;
     WayPointVelocityInternal wpVelocityACK;
     MFIOGetInternal          mfioGetACK;
 
@@ -278,13 +278,22 @@ public:
   void setUserBroadcastCallback(VehicleCallBack callback, UserData userData);
   VehicleCallBackHandler unpackHandler;
 
+  /*! Register an internal consumer (e.g. a shared-memory mirror) that runs on
+   *  the read thread after every unpacked broadcast, before the user callback.
+   *  @return false if all listener slots are taken */
+  bool addDecodeListener(VehicleCallBack listener, UserData userData = 0);
+  void removeDecodeListener(VehicleCallBack listener, UserData userData = 0);
+
+  static const int MAX_DECODE_LISTENER = 4;
+
 public:
   static void unpackCallback(Vehicle* vehicle, RecvContainer recvFrame,
                              UserData userData);
   static void setFrequencyCallback(Vehicle* vehicle, RecvContainer recvFrame,
                                    UserData userData);
 
-private:
+public:
+  //! passFlag bits, in the order the fields follow the flag in a package
   // clang-format off
   typedef enum FLAG {
     FLAG_TIME           = 0X0001,
@@ -336,6 +345,7 @@ private:
   uint16_t passFlag;
 
   VehicleCallBackHandler userCbHandler;
+  VehicleCallBackHandler decodeListener[MAX_DECODE_LISTENER];
 };
 
 } // OSDK
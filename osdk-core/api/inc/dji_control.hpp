@@ -248,6 +248,9 @@ public:
    */
 private:
   const int wait_timeout;
+  //! Protocol frame templates of the two flightCtrl() frames, or -1
+  int ctrlTemplate;
+  int advancedCtrlTemplate;
 
 public:
   Control(Vehicle* vehicle = 0);
@@ -110,6 +110,9 @@ public:
 
 private:
   Vehicle* vehicle;
+  //! Protocol frame templates of setAngle() and setSpeed(), or -1
+  int angleTemplate;
+  int speedTemplate;
 };
 
 } // OSDK
@@ -49,6 +49,7 @@ public:
   ~SubscriptionPackage();
 
   void setPackageID(uint8_t id);
+  void setTopicDataBase(Telemetry::TopicInfo* topicDataBase);
   void setConfig(uint8_t config);
 
   /*!
@@ -131,6 +132,9 @@ private: // Private variables
    *        This function is called in the end of decodeCallback function.
    */
   VehicleCallBackHandler userUnpackHandler;
+
+  // Topic table of the owning DataSubscription
+  Telemetry::TopicInfo* topicDataBase;
 }; // class SubscriptionPackage
 
 /*! @brief Telemetry API through asynchronous "Subscribe"-style messages
@@ -202,6 +206,22 @@ public: // public methods
     int packageID, VehicleCallBack userFunctionAfterPackageExtraction,
     UserData userData = NULL);
 
+  /*!
+   * @brief Register an internal consumer (e.g. a shared-memory mirror or a
+   * recorder) that runs after every package is extracted, before the user
+   * unpack callback. Call before packages start streaming.
+   * @return false if all listener slots are taken
+   */
+  bool addDecodeListener(VehicleCallBack listener, UserData userData = NULL);
+  void removeDecodeListener(VehicleCallBack listener, UserData userData = NULL);
+
+  //! @note Listeners run on the read thread and may read the package buffer
+  //! without lockMSG, as that thread is the only writer.
+  SubscriptionPackage* getPackage(int packageID);
+
+  //! @note Subscription state (freq, package, latest data) of this vehicle
+  const Telemetry::TopicInfo& getTopicInfo(Telemetry::TopicName topic) const;
+
   // Not implemented yet
   bool pausePackage(int packageID);
   bool resumePackage(int packageID);
@@ -240,7 +260,7 @@ public: // public methods
   {
     typename Telemetry::TypeMap<topic>::type ans;
 
-    void* p = Telemetry::TopicDataBase[topic].latest;
+    void* p = topicDataBase[topic].latest;
 
     protocol->getThreadHandle()->lockMSG();
     if (p)
@@ -261,6 +281,7 @@ public: // public methods
 
 public: // public variables
   const static uint8_t   MAX_NUMBER_OF_PACKAGE = 5;
+  const static uint8_t   MAX_DECODE_LISTENER   = 4;
   VehicleCallBackHandler subscriptionDataDecodeHandler;
 
 private: // private variables
@@ -268,6 +289,11 @@ private: // private variables
   Protocol*           protocol;
   SubscriptionPackage package[MAX_NUMBER_OF_PACKAGE];
 
+  //! Per-vehicle copy of Telemetry::TopicDataBase
+  Telemetry::TopicInfo topicDataBase[Telemetry::TOTAL_TOPIC_NUMBER];
+
+  VehicleCallBackHandler decodeListener[MAX_DECODE_LISTENER];
+
 private: // private methods
   void extractOnePackage(RecvContainer*       pRcvContainer,
                          SubscriptionPackage* pkg);
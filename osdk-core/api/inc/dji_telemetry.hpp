@@ -124,12 +124,12 @@ typedef enum
 #pragma pack(1)
 typedef struct
 {
-  const TopicName name;
-  const uint32_t  uid;
-  const size_t    size;    /* The size of actual data for the topic */
-  const uint16_t  maxFreq; /* max freq in Hz for the topic provided by FC */
-  uint16_t        freq;    /* Frequency at which the topic is subscribed */
-  uint8_t         pkgID;   /* Package ID in which the topic is subscribed */
+  TopicName name;
+  uint32_t  uid;
+  size_t    size;    /* The size of actual data for the topic */
+  uint16_t  maxFreq; /* max freq in Hz for the topic provided by FC */
+  uint16_t  freq;    /* Frequency at which the topic is subscribed */
+  uint8_t   pkgID;   /* Package ID in which the topic is subscribed */
   /* Point to topic's address in the data buffer which stores the latest data */
   uint8_t* latest;
 } TopicInfo; // pack(1)
@@ -499,7 +499,10 @@ typedef struct HardSyncData
 
 #pragma pack()
 
-extern TopicInfo TopicDataBase[];
+/*! @note Default topic table. Every DataSubscription works on its own
+ *  copy, so the subscription state of one Vehicle never leaks into another.
+ */
+extern const TopicInfo TopicDataBase[];
 
 /*! @brief template struct maps a topic name to the corresponding data
  * type
@@ -108,6 +108,20 @@ typedef struct Command
   uint8_t  cmd_id;
   bool     isCallback;
   int      callbackID;
+  //! Driver time after which the frame is worth nothing: it is neither sent
+  //! nor retransmitted once passed. 0 for none
+  time_ms  deadline;
+  //! Queued or retrying frames with the same non-zero key are dropped when
+  //! this one is sent, so only the newest setpoint of a stream stays alive
+  uint32_t supersedeKey;
+
+  //! Callers fill in the other fields; these default to off, so code
+  //! written before them keeps its behaviour
+  Command()
+    : deadline(0)
+    , supersedeKey(0)
+  {
+  }
 } Command;
 
 typedef struct MMU_Tab
@@ -134,6 +148,10 @@ typedef struct CMDSession
   int      callbackID;
   uint32_t preSeqNum;
   time_ms  preTimestamp;
+  uint64_t sentUs; //! last transmission, for the ACK RTT
+  uint32_t traceId;
+  time_ms  deadline;
+  uint32_t supersedeKey;
 } CMDSession;
 
 typedef struct ACKSession
@@ -151,9 +169,12 @@ typedef struct ACKSession
  */
 typedef struct DispatchInfo
 {
-  bool    isAck;
-  bool    isCallback;
-  uint8_t callbackID;
+  bool     isAck;
+  bool     isCallback;
+  uint8_t  callbackID;
+  uint32_t traceId; //! receive id for trace points, 0 when not tracing
+  uint8_t  sessionID;
+  uint16_t seqNumber; //! as on the wire; recvInfo.seqNumber is truncated
 } DispatchInfo;
 
 } // namespace OSDK
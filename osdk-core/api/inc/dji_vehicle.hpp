@@ -51,8 +51,6 @@ namespace DJI
 namespace OSDK
 {
 
-static int callbackId;
-
 /*! @brief A top-level encapsulation of a DJI drone/FC connected to your OES.
  *
  * @details This class instantiates objects for all features your drone/FC
@@ -76,8 +74,22 @@ public:
 #pragma pack()
 
 public:
-  Vehicle(const char* device, uint32_t baudRate, bool threadSupport);
+  /*! @param threadConfig priorities, affinity and memory locking for the
+   *  SDK threads and mutexes; NULL keeps the OS defaults
+   */
+  Vehicle(const char* device, uint32_t baudRate, bool threadSupport,
+          const ThreadConfig* threadConfig = NULL);
   Vehicle(bool threadSupport);
+  /*! @brief Build the vehicle on a caller-supplied driver (loopback links,
+   *  decorators, simulators). Only the protocol layer and threads are set up;
+   *  call functionalSetUp() once the link answers. The Protocol takes
+   *  ownership of the driver.
+   *  With ownThreads false no read/callback threads are created and an
+   *  external loop (e.g. LinuxReactor) must call pollReceive() and
+   *  callbackPoll() for this vehicle.
+   */
+  Vehicle(HardDriver* driver, bool threadSupport, bool ownThreads = true,
+          const ThreadConfig* threadConfig = NULL);
   ~Vehicle();
 
   Protocol*            protocolLayer;
@@ -203,6 +215,7 @@ public:
 
   void setKey(const char* key);
   void setStopCond(bool stopCond);
+  const ThreadConfig* getThreadConfig() const;
   bool            getStopCond();
   CircularBuffer* circularBuffer; //! @note not used yet
 
@@ -225,10 +238,48 @@ public:
    */
   void processReceivedData(RecvContainer receivedFrame);
 
+  /*! @brief Parse everything the driver has buffered and dispatch each
+   *  frame. Reads from the driver once; meant for external event loops.
+   *  @return number of frames dispatched
+   */
+  int pollReceive();
+
   //! User sets this to true in order to enable Callback thread with Non
   //! blocking calls.
-  void     callbackPoll();
+  //! @return true if a queued callback was executed
+  bool     callbackPoll();
   int      callbackIdIndex();
+  /*! @brief Take count consecutive callback slots out of the rotation of
+   *  callbackIdIndex() and point them at callback, for a component that
+   *  keeps its own commands in flight and routes their ACKs by slot
+   *  @return the first slot, or -1 if no such run is free
+   */
+  int  reserveCallbackIds(int count, VehicleCallBack callback,
+                          UserData userData);
+  void releaseCallbackIds(int first, int count);
+
+  /*! @brief Observe every push frame (broadcast, subscription, mission,
+   *  mobile, ...) before it is dispatched. Runs on the read thread.
+   *  @return false if all listener slots are taken
+   */
+  bool addPushDataListener(VehicleCallBack listener, UserData userData = 0);
+  void removePushDataListener(VehicleCallBack listener, UserData userData = 0);
+
+  /*! @brief Run a listener from callbackPoll() every POLL_TICK_MS, on the
+   *  callback thread or the external loop, with an empty RecvContainer.
+   *  Timers of multi-frame transfers hang off it, so it must return quickly;
+   *  register it only while it has something to time.
+   *  @return false if all listener slots are taken
+   */
+  bool addPollListener(VehicleCallBack listener, UserData userData = 0);
+  void removePollListener(VehicleCallBack listener, UserData userData = 0);
+
+  /*! @brief Link health: protocol counters, ACK RTT and callback latency
+   *  histograms, queue depths and UART error counters. Cheap enough to poll
+   *  at monitoring rates; the counters themselves are updated lock-free.
+   */
+  void getLinkStats(LinkSnapshot* snapshot);
+  void resetLinkStats();
   void*    nbCallbackFunctions[200]; //! @todo magic number
   UserData nbUserData[200];          //! @todo magic number
 
@@ -242,9 +293,12 @@ private:
   bool    stopCond;
 
   //! Initialization data
-  bool        threadSupported;
+  bool         threadSupported;
+  bool         ownThreads;
+  ThreadConfig threadConfig;
   const char* device;
   uint32_t    baudRate;
+  HardDriver* driver;
 
   //! ACK management
 
@@ -269,6 +323,11 @@ private:
 
   VehicleCallBackHandler nbVehicleCallBackHandler;
 
+  //! Last slot handed out by callbackIdIndex()
+  int callbackId;
+  //! Slots owned by reserveCallbackIds(), skipped by callbackIdIndex()
+  bool nbReserved[200]; //! @todo magic number
+
   //! Added for connecting protocolLayer to Vehicle
   RecvContainer lastReceivedFrame;
 
@@ -291,6 +350,7 @@ private:
    *  @return false if error, true if success
    */
   bool initPlatformSupport();
+  void setThreadConfig(const ThreadConfig* config);
   void initCallbacks();
   void initCMD_SetSupportMatrix();
   bool initSubscriber();
@@ -347,6 +407,16 @@ private:
   VehicleCallBackHandler wayPointCallback;
   VehicleCallBackHandler missionCallback;
 
+  static const int       MAX_PUSH_LISTENER = 4;
+  VehicleCallBackHandler pushListener[MAX_PUSH_LISTENER];
+
+  static const int       MAX_POLL_LISTENER = 4;
+  static const int       POLL_TICK_MS      = 2;
+  //! Written under the nbAck lock; pollListenerNumber is read lock-free
+  VehicleCallBackHandler pollListener[MAX_POLL_LISTENER];
+  int                    pollListenerNumber;
+  time_ms                pollTickMs; //! last session sweep and listener run
+
 public:
   static bool parseDroneVersionInfo(Version::VersionData& versionData,
                                     uint8_t*              ackPtr);
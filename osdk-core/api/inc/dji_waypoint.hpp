@@ -12,12 +12,74 @@
 #define DJI_WAYPOINT_H
 
 #include "dji_mission_base.hpp"
+#include "dji_waypoint_preprocess.hpp"
 
 namespace DJI
 {
 namespace OSDK
 {
 
+/*! @brief Progress of WaypointMission::uploadAllIndexData()
+ */
+typedef struct WaypointUploadStatus
+{
+  uint16_t       total;
+  uint16_t       acked;
+  uint16_t       inFlight;
+  uint32_t       sent;        //! frames, retransmissions included
+  uint32_t       retransmits;
+  uint32_t       elapsedMs;
+  int            failedIndex; //! -1, or the waypoint rejected or never acked
+  ACK::ErrorCode ack;         //! of the failed waypoint, else the last ACK
+  bool           running;
+} WaypointUploadStatus;
+
+/*! @brief What WaypointMission::sync() sent, against a full upload
+ *  @note Byte counts are nominal frame sizes, command and ACK, without
+ *  encryption padding
+ */
+typedef struct WaypointSyncReport
+{
+  bool     reinit;  //! init settings or count changed, or nothing cached
+  uint16_t total;
+  uint16_t changed; //! waypoints uploaded
+  uint32_t roundTrips;
+  uint32_t roundTripsSaved;
+  uint32_t bytes;
+  uint32_t bytesSaved;
+} WaypointSyncReport;
+
+/*! @brief Fields of WayPointSettings, as bits of a readback diff
+ */
+typedef enum WaypointField
+{
+  WP_FIELD_INDEX             = 1 << 0,
+  WP_FIELD_LATITUDE          = 1 << 1,
+  WP_FIELD_LONGITUDE         = 1 << 2,
+  WP_FIELD_ALTITUDE          = 1 << 3,
+  WP_FIELD_DAMPING           = 1 << 4,
+  WP_FIELD_YAW               = 1 << 5,
+  WP_FIELD_GIMBAL_PITCH      = 1 << 6,
+  WP_FIELD_TURN_MODE         = 1 << 7,
+  WP_FIELD_HAS_ACTION        = 1 << 8,
+  WP_FIELD_ACTION_TIME_LIMIT = 1 << 9,
+  WP_FIELD_ACTION_NUMBER     = 1 << 10,
+  WP_FIELD_ACTION_REPEAT     = 1 << 11,
+  WP_FIELD_COMMAND_LIST      = 1 << 12,
+  WP_FIELD_COMMAND_PARAMETER = 1 << 13
+} WaypointField;
+
+/*! @brief Result of WaypointMission::downloadMission()
+ */
+typedef struct WaypointReadback
+{
+  uint16_t             total;
+  uint16_t             different;      //! waypoints with a field differing
+  int                  firstDifferent; //! -1 if none
+  bool                 infoDifferent;
+  WayPointInitSettings info;           //! as read from the aircraft
+} WaypointReadback;
+
 /*! @brief APIs for GPS Waypoint Missions
  *
  *  @details This class inherits from MissionBase and can be used with
@@ -160,6 +222,92 @@ public:
    *  @param timer timeout to wait for ACK
    */
   ACK::WayPointIndex uploadIndexData(WayPointSettings* data, int timer);
+  /*! @brief
+   *
+   *  upload all waypoints of the mission set up by init(), keeping up to
+   *  window of them in flight, each in its own ACK session. ACKs are matched
+   *  to waypoints by the index they carry; only waypoints without an ACK
+   *  after UPLOAD_TIMEOUT_MS are sent again, up to UPLOAD_ATTEMPTS times.
+   *  Retransmission timing runs on the callback thread, see
+   *  Vehicle::addPollListener().
+   *
+   *  @param data info.indexNumber waypoints; index fields are set from the
+   *  position in the array
+   *  @param window waypoints in flight, 1 to MAX_UPLOAD_WINDOW
+   *  @param callback called once, when the last waypoint is acknowledged or
+   *  the upload fails, with the last ACK frame; see getUploadStatus()
+   *  @param userData user data (void ptr)
+   *  @return false if an upload is running or the arguments are invalid
+   */
+  bool uploadAllIndexData(WayPointSettings* data,
+                          int               window   = DEFAULT_UPLOAD_WINDOW,
+                          VehicleCallBack   callback = 0,
+                          UserData          userData = 0);
+  /*! @brief
+   *
+   *  upload all waypoints, blocking until done or failed
+   *
+   *  @param timeout in seconds for the whole upload
+   *  @return ACK of the waypoint that failed, or success
+   */
+  ACK::ErrorCode uploadAllIndexData(WayPointSettings* data, int window,
+                                    int timeout);
+  //! Progress of the running or last upload or readback
+  void getUploadStatus(WaypointUploadStatus* status) const;
+  /*! @brief
+   *
+   *  check the mission set up by init() against the preprocessor limits
+   *  without sending anything. Uploads and sync() run the same check and
+   *  fail with the ACK code of the first violation.
+   *
+   *  @param data info.indexNumber waypoints
+   *  @param violations room for maxViolations reports, may be NULL
+   *  @return violations found, -1 if out of memory
+   */
+  int validate(const WayPointSettings* data, WaypointViolation* violations,
+               int maxViolations);
+  //! Limits used by validate(), and path simplification for dense missions
+  WaypointPreprocessor* getPreprocessor();
+  /*! @brief
+   *
+   *  bring the aircraft to newInfo and data with as little traffic as the
+   *  last successful uploadAllIndexData() or sync() allows: only waypoints
+   *  whose content changed are uploaded. Different init settings, a
+   *  different count, or an init() or single waypoint upload since then
+   *  re-run init() and upload everything. Blocking.
+   *
+   *  @note Call before start(); the cache is not told about missions
+   *  changed by other means.
+   *  @param newInfo init settings of the edited mission
+   *  @param data newInfo->indexNumber waypoints, by position
+   *  @param timeout in seconds, for the init and for the upload
+   *  @param report if not NULL, what was sent and saved
+   *  @return ACK of the init or of the waypoint that failed, or success
+   */
+  ACK::ErrorCode sync(WayPointInitSettings* newInfo, WayPointSettings* data,
+                      int timeout, WaypointSyncReport* report = NULL);
+  /*! @brief
+   *
+   *  read the mission back from the aircraft and compare it with the local
+   *  copy. The init settings and all info.indexNumber waypoints are
+   *  requested with up to MAX_UPLOAD_WINDOW in flight, so it returns once
+   *  the last one is in. Blocking.
+   *
+   *  @param data receives info.indexNumber waypoints
+   *  @param timeout in seconds, for the whole readback
+   *  @param report if not NULL, the init settings read and a summary
+   *  @param fieldDiff if not NULL, info.indexNumber WaypointField masks of
+   *  the fields that differ from what was last set or uploaded
+   *  @return ACK of the request that failed, or success
+   */
+  ACK::ErrorCode downloadMission(WayPointSettings* data, int timeout,
+                                 WaypointReadback* report    = NULL,
+                                 uint16_t*         fieldDiff = NULL);
+  //! WaypointField mask of the fields that differ between a and b
+  static uint16_t diffIndex(const WayPointSettings& a,
+                            const WayPointSettings& b);
+  //! Name of the lowest WaypointField set in field
+  static const char* getFieldName(uint16_t field);
   /*! @brief
    *
    *  getting waypt idle velocity
@@ -212,6 +360,33 @@ public:
    */
   static void uploadIndexDataCallback(Vehicle* vehicle, RecvContainer recvFrame,
                                       UserData userData);
+  /*! @brief
+   *
+   *  ACK handler of uploadAllIndexData()
+   *
+   *  @param recvFrame the data comes with the callback function
+   *  @param userData the WaypointMission
+   */
+  static void uploadAllCallback(Vehicle* vehicle, RecvContainer recvFrame,
+                                UserData userData);
+  /*! @brief
+   *
+   *  Poll listener of uploadAllIndexData(): fills the window and resends
+   *  waypoints whose ACK is overdue
+   *
+   *  @param userData the WaypointMission
+   */
+  static void uploadPollCallback(Vehicle* vehicle, RecvContainer recvFrame,
+                                 UserData userData);
+  /*! @brief
+   *
+   *  ACK handler of downloadMission()
+   *
+   *  @param recvFrame the data comes with the callback function
+   *  @param userData the WaypointMission
+   */
+  static void downloadCallback(Vehicle* vehicle, RecvContainer recvFrame,
+                               UserData userData);
   /*! @brief
    *
    *  Set waypoint push data callback
@@ -229,9 +404,78 @@ public:
    */
   void setWaypointCallback(VehicleCallBack callback, UserData userData);
 
+public:
+  static const int DEFAULT_UPLOAD_WINDOW = 4;
+  //! The MMU holds about nine waypoint frames; leave room for other commands
+  static const int MAX_UPLOAD_WINDOW = 8;
+  static const int UPLOAD_TIMEOUT_MS = 500;
+  static const int UPLOAD_ATTEMPTS   = 4;
+
+private:
+  typedef enum UploadState
+  {
+    UPLOAD_PENDING,
+    UPLOAD_IN_FLIGHT,
+    UPLOAD_ACKED
+  } UploadState;
+
+  typedef struct UploadSlot
+  {
+    uint8_t state;
+    uint8_t attempts;
+    int     cbIndex; //! of the attempt in flight
+    time_ms sentMs;
+  } UploadSlot;
+
+  bool startUpload(WayPointSettings* data, int window, const bool* changed,
+                   VehicleCallBack callback, UserData userData, int timeout);
+  ACK::ErrorCode runUpload(WayPointSettings* data, int window,
+                           const bool* changed, int timeout);
+  bool isTransferRunning();
+  bool startTransfer(int count, int window, const bool* changed,
+                     VehicleCallBack callback, UserData userData, int timeout);
+  ACK::ErrorCode waitTransfer();
+  void ackTransfer(const RecvContainer& recvFrame, int pos,
+                   ACK::ErrorCode ack);
+  void sendUploadIndex(int pos);
+  void fillUploadWindow();
+  void finishUpload(const RecvContainer& recvFrame, int failedIndex,
+                    ACK::ErrorCode ack);
+  void updateSyncCache(bool uploaded);
+  //! MissionACK code of the first violation, or SUCCESS
+  uint8_t checkMission(const WayPointInitSettings* mission,
+                       const WayPointSettings*     data);
+
+  //! An ACK made up for an upload the aircraft did not answer, or skipped
+  static ACK::ErrorCode uploadAck(uint32_t data);
+  static uint32_t hashIndex(const WayPointSettings* wp);
+
 private:
   WayPointInitSettings info;
   WayPointSettings*    index;
+
+  //! Upload or readback state; after start only touched from the
+  //! callback thread
+  UploadSlot*            uploadSlot;
+  int                    uploadCount;
+  int                    uploadWindow;
+  int                    uploadNext;
+  time_ms                uploadStartMs;
+  time_ms                uploadDeadlineMs; //! 0 when not blocking
+  WaypointUploadStatus   uploadStatus;
+  VehicleCallBackHandler uploadCallback;
+
+  //! What the aircraft holds after the last successful upload
+  WayPointInitSettings syncInfo;
+  WayPointSettings*    syncIndex;
+  uint32_t*            syncHash;
+  bool                 syncValid;
+
+  //! Where a running readback puts what it reads, else NULL
+  WayPointSettings*    downloadIndex;
+  WayPointInitSettings downloadInfo;
+
+  WaypointPreprocessor preprocessor;
 };
 
 } // namespace OSDK
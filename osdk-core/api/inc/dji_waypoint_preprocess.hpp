@@ -0,0 +1,114 @@
+/*! @file dji_waypoint_preprocess.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Local preprocessing of waypoint missions: path simplification and the
+ *  flight controller's constraint checks, run before anything is sent
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#ifndef DJI_WAYPOINT_PREPROCESS_H
+#define DJI_WAYPOINT_PREPROCESS_H
+
+#include "dji_mission_type.hpp"
+
+namespace DJI
+{
+namespace OSDK
+{
+
+/*! @brief Limits the flight controller enforces on waypoint missions
+ */
+typedef struct WaypointLimits
+{
+  uint16_t  maxPoints;      //! indexNumber is a uint8_t
+  float32_t minDistance;    //! m, between adjacent waypoints
+  float32_t maxDistance;    //! m, between adjacent waypoints
+  float32_t minAltitude;    //! m, relative to takeoff
+  float32_t maxAltitude;    //! m, relative to takeoff
+  float32_t minMaxVelocity; //! m/s, for WayPointInitSettings::maxVelocity
+  float32_t maxMaxVelocity; //! m/s
+  uint8_t   maxActions;     //! per waypoint
+  uint8_t   maxActionType;  //! highest valid commandList entry
+} WaypointLimits;
+
+/*! @brief One constraint a mission breaks
+ */
+typedef struct WaypointViolation
+{
+  int         index; //! waypoint, or -1 for the init settings
+  uint8_t     ack;   //! ErrorCode::MissionACK code the aircraft would send
+  const char* field;
+  float32_t   value;
+  float32_t   limit;
+} WaypointViolation;
+
+/*! @brief Simplifies dense paths and checks missions against
+ *  WaypointLimits, so WaypointMission uploads only what the aircraft
+ *  will accept.
+ *
+ *  @details Positions are converted once to a local east-north-up frame
+ *  around the first waypoint and kept as one array per axis; the checks
+ *  then run as flat loops over those arrays. Scratch memory grows to the
+ *  largest mission seen and is reused, so repeated calls do not allocate.
+ *  @note Not thread safe; use one instance per thread.
+ */
+class WaypointPreprocessor
+{
+public:
+  WaypointPreprocessor();
+  ~WaypointPreprocessor();
+
+  static void getDefaultLimits(WaypointLimits* limits);
+  void setLimits(const WaypointLimits& limits);
+  void getLimits(WaypointLimits* limits) const;
+
+  /*! @brief Douglas-Peucker simplification in local ENU
+   *
+   *  Keeps the first and last waypoint and every waypoint with actions,
+   *  and between those only the waypoints needed to stay within tolerance
+   *  of the input path. Kept waypoints are copied unchanged except for
+   *  their index, which is renumbered from 0.
+   *
+   *  @param tolerance m, largest 3D distance of a dropped waypoint from
+   *  the simplified path
+   *  @param out room for maxOut waypoints; may not alias in
+   *  @return waypoints kept, written up to maxOut; -1 if out of memory
+   */
+  int simplify(const WayPointSettings* in, int count, float32_t tolerance,
+               WayPointSettings* out, int maxOut);
+
+  /*! @brief Check a mission against the limits
+   *
+   *  @param info init settings, NULL to check only the waypoints
+   *  @param violations room for maxViolations reports, may be NULL
+   *  @return violations found, also those not written; -1 if out of
+   *  memory
+   */
+  int validate(const WayPointInitSettings* info, const WayPointSettings* wp,
+               int count, WaypointViolation* violations, int maxViolations);
+
+private:
+  bool reserve(int count);
+  void toLocal(const WayPointSettings* wp, int count);
+
+private:
+  WaypointLimits limits;
+
+  //! Scratch, capacity entries each
+  int        capacity;
+  float32_t* east;
+  float32_t* north;
+  float32_t* up;
+  float32_t* length; //! squared, of the segment to the next waypoint
+  uint8_t*   keep;
+  int*       stack;
+};
+
+} // namespace OSDK
+} // namespace DJI
+
+#endif // DJI_WAYPOINT_PREPROCESS_H
@@ -21,6 +21,12 @@ DataBroadcast::unpackCallback(Vehicle* vehicle, RecvContainer recvFrame,
 {
   DataBroadcast* broadcastPtr = (DataBroadcast*)data;
   broadcastPtr->unpackData(&recvFrame);
+  for (int i = 0; i < MAX_DECODE_LISTENER; i++)
+  {
+    VehicleCallBackHandler l = broadcastPtr->decodeListener[i];
+    if (l.callback)
+      l.callback(vehicle, recvFrame, l.userData);
+  }
   if (broadcastPtr->userCbHandler.callback)
     broadcastPtr->userCbHandler.callback(vehicle, recvFrame,
                                          broadcastPtr->userCbHandler.userData);
@@ -37,6 +43,12 @@ DataBroadcast::DataBroadcast(Vehicle* vehiclePtr)
 
   userCbHandler.callback = 0;
   userCbHandler.userData = 0;
+
+  for (int i = 0; i < MAX_DECODE_LISTENER; i++)
+  {
+    decodeListener[i].callback = 0;
+    decodeListener[i].userData = 0;
+  }
 }
 
 DataBroadcast::~DataBroadcast()
@@ -314,3 +326,34 @@ DataBroadcast::getPassFlag()
 {
   return passFlag;
 }
+
+bool
+DataBroadcast::addDecodeListener(VehicleCallBack listener, UserData userData)
+{
+  for (int i = 0; i < MAX_DECODE_LISTENER; i++)
+  {
+    if (!decodeListener[i].callback)
+    {
+      decodeListener[i].userData = userData;
+      decodeListener[i].callback = listener;
+      return true;
+    }
+  }
+  DERROR("No free decode listener slot.\n");
+  return false;
+}
+
+void
+DataBroadcast::removeDecodeListener(VehicleCallBack listener,
+                                    UserData        userData)
+{
+  for (int i = 0; i < MAX_DECODE_LISTENER; i++)
+  {
+    if (decodeListener[i].callback == listener &&
+        decodeListener[i].userData == userData)
+    {
+      decodeListener[i].callback = 0;
+      decodeListener[i].userData = 0;
+    }
+  }
+}
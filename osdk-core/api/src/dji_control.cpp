@@ -18,11 +18,28 @@ using namespace DJI::OSDK;
 Control::Control(Vehicle* vehicle)
   : vehicle(vehicle)
   , wait_timeout(10)
+  , ctrlTemplate(-1)
+  , advancedCtrlTemplate(-1)
 {
+  //! Sent at control rates, so kept prebuilt; plain like the send below.
+  //! Each one replaces the setpoints still in flight, as sendSetpoint() does
+  if (vehicle && vehicle->protocolLayer && !DJI::OSDK::encrypt)
+  {
+    uint32_t key = Protocol::streamKey(OpenProtocol::CMDSet::Control::control);
+    ctrlTemplate = vehicle->protocolLayer->registerTemplate(
+      OpenProtocol::CMDSet::Control::control, sizeof(CtrlData), key);
+    advancedCtrlTemplate = vehicle->protocolLayer->registerTemplate(
+      OpenProtocol::CMDSet::Control::control, sizeof(AdvancedCtrlData), key);
+  }
 }
 
 Control::~Control()
 {
+  if (vehicle && vehicle->protocolLayer)
+  {
+    vehicle->protocolLayer->releaseTemplate(ctrlTemplate);
+    vehicle->protocolLayer->releaseTemplate(advancedCtrlTemplate);
+  }
 }
 
 void
@@ -125,17 +142,21 @@ Control::land(VehicleCallBack callback, UserData userData)
 void
 Control::flightCtrl(CtrlData data)
 {
-  vehicle->protocolLayer->send(
-    0, DJI::OSDK::encrypt, OpenProtocol::CMDSet::Control::control,
-    static_cast<void*>(&data), sizeof(CtrlData), 500, 2, false, 1);
+  if (vehicle->protocolLayer->sendTemplate(ctrlTemplate, &data) == 0)
+    return;
+  vehicle->protocolLayer->sendSetpoint(OpenProtocol::CMDSet::Control::control,
+                                       DJI::OSDK::encrypt, &data,
+                                       sizeof(CtrlData));
 }
 
 void
 Control::flightCtrl(AdvancedCtrlData data)
 {
-  vehicle->protocolLayer->send(
-    0, DJI::OSDK::encrypt, OpenProtocol::CMDSet::Control::control,
-    static_cast<void*>(&data), sizeof(AdvancedCtrlData), 500, 2, false, 1);
+  if (vehicle->protocolLayer->sendTemplate(advancedCtrlTemplate, &data) == 0)
+    return;
+  vehicle->protocolLayer->sendSetpoint(OpenProtocol::CMDSet::Control::control,
+                                       DJI::OSDK::encrypt, &data,
+                                       sizeof(AdvancedCtrlData));
 }
 
 void
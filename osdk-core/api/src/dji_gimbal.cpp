@@ -16,26 +16,49 @@ using namespace DJI::OSDK;
 
 DJI::OSDK::Gimbal::Gimbal(Vehicle* vehicle)
   : vehicle(vehicle)
+  , angleTemplate(-1)
+  , speedTemplate(-1)
 {
+  //! Sent at control rates, so kept prebuilt; plain like the send below.
+  //! Each one replaces the commands still in flight, as sendSetpoint() does
+  if (vehicle && vehicle->protocolLayer && !encrypt)
+  {
+    const uint8_t* angle = OpenProtocol::CMDSet::Control::gimbalAngle;
+    const uint8_t* speed = OpenProtocol::CMDSet::Control::gimbalSpeed;
+
+    angleTemplate = vehicle->protocolLayer->registerTemplate(
+      angle, sizeof(Gimbal::AngleData), Protocol::streamKey(angle));
+    speedTemplate = vehicle->protocolLayer->registerTemplate(
+      speed, sizeof(Gimbal::SpeedData), Protocol::streamKey(speed));
+  }
 }
 
 DJI::OSDK::Gimbal::~Gimbal()
 {
+  if (vehicle && vehicle->protocolLayer)
+  {
+    vehicle->protocolLayer->releaseTemplate(angleTemplate);
+    vehicle->protocolLayer->releaseTemplate(speedTemplate);
+  }
 }
 
 void
 DJI::OSDK::Gimbal::setAngle(Gimbal::AngleData* data)
 {
-  vehicle->protocolLayer->send(0, encrypt,
-                               OpenProtocol::CMDSet::Control::gimbalAngle,
-                               (unsigned char*)data, sizeof(Gimbal::AngleData));
+  if (vehicle->protocolLayer->sendTemplate(angleTemplate, data) == 0)
+    return;
+  vehicle->protocolLayer->sendSetpoint(
+    OpenProtocol::CMDSet::Control::gimbalAngle, encrypt, data,
+    sizeof(Gimbal::AngleData));
 }
 
 void
 DJI::OSDK::Gimbal::setSpeed(Gimbal::SpeedData* data)
 {
   data->reserved = 0x80;
-  vehicle->protocolLayer->send(0, encrypt,
-                               OpenProtocol::CMDSet::Control::gimbalSpeed,
-                               (unsigned char*)data, sizeof(Gimbal::SpeedData));
+  if (vehicle->protocolLayer->sendTemplate(speedTemplate, data) == 0)
+    return;
+  vehicle->protocolLayer->sendSetpoint(
+    OpenProtocol::CMDSet::Control::gimbalSpeed, encrypt, data,
+    sizeof(Gimbal::SpeedData));
 }
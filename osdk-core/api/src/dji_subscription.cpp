@@ -21,7 +21,7 @@ const uint32_t DBVersion               = 0x00000100;
 // definition
 //
 // clang-format off
-TopicInfo Telemetry::TopicDataBase[] =
+const TopicInfo Telemetry::TopicDataBase[] =
 {  // Topic Name ,                     UID,
   {TOPIC_QUATERNION                , UID_QUATERNION               , sizeof(TypeMap<TOPIC_QUATERNION              >::type), 200 ,   0,  255,  0},
   {TOPIC_ACCELERATION_GROUND       , UID_ACCELERATION_GROUND      , sizeof(TypeMap<TOPIC_ACCELERATION_GROUND     >::type), 200 ,   0,  255,  0},
@@ -70,9 +70,21 @@ DataSubscription::DataSubscription(Vehicle* vehiclePtr)
   : vehicle(vehiclePtr)
   , protocol(vehicle->protocolLayer)
 {
+  for (int i = 0; i < Telemetry::TOTAL_TOPIC_NUMBER; i++)
+  {
+    topicDataBase[i] = Telemetry::TopicDataBase[i];
+  }
+
   for (int i = 0; i < MAX_NUMBER_OF_PACKAGE; i++)
   {
     package[i].setPackageID(i);
+    package[i].setTopicDataBase(topicDataBase);
+  }
+
+  for (int i = 0; i < MAX_DECODE_LISTENER; i++)
+  {
+    decodeListener[i].callback = NULL;
+    decodeListener[i].userData = NULL;
   }
 
   subscriptionDataDecodeHandler.callback = decodeCallback;
@@ -123,6 +135,15 @@ DataSubscription::decodeCallback(Vehicle*      vehiclePtr,
 
   subscriptionHandle->extractOnePackage(&rcvContainer, p);
 
+  for (int i = 0; i < MAX_DECODE_LISTENER; i++)
+  {
+    VehicleCallBackHandler l = subscriptionHandle->decodeListener[i];
+    if (NULL != l.callback)
+    {
+      (*(l.callback))(vehiclePtr, rcvContainer, l.userData);
+    }
+  }
+
   VehicleCallBackHandler h = p->getUnpackHandler();
   if (NULL != h.callback)
   {
@@ -158,6 +179,54 @@ DataSubscription::registerUserPackageUnpackCallback(
                                            userData);
 }
 
+bool
+DataSubscription::addDecodeListener(VehicleCallBack listener,
+                                    UserData        userData)
+{
+  for (int i = 0; i < MAX_DECODE_LISTENER; i++)
+  {
+    if (NULL == decodeListener[i].callback)
+    {
+      decodeListener[i].userData = userData;
+      decodeListener[i].callback = listener;
+      return true;
+    }
+  }
+  DERROR("No free decode listener slot.\n");
+  return false;
+}
+
+void
+DataSubscription::removeDecodeListener(VehicleCallBack listener,
+                                       UserData        userData)
+{
+  for (int i = 0; i < MAX_DECODE_LISTENER; i++)
+  {
+    if (decodeListener[i].callback == listener &&
+        decodeListener[i].userData == userData)
+    {
+      decodeListener[i].callback = NULL;
+      decodeListener[i].userData = NULL;
+    }
+  }
+}
+
+SubscriptionPackage*
+DataSubscription::getPackage(int packageID)
+{
+  if (packageID < 0 || packageID >= MAX_NUMBER_OF_PACKAGE)
+  {
+    return NULL;
+  }
+  return &package[packageID];
+}
+
+const Telemetry::TopicInfo&
+DataSubscription::getTopicInfo(Telemetry::TopicName topic) const
+{
+  return topicDataBase[topic];
+}
+
 bool
 DataSubscription::pausePackage(int packageID)
 {
@@ -345,6 +414,11 @@ DataSubscription::extractOnePackage(RecvContainer*       pRcvContainer,
   //  data++;
 
   uint8_t* data = pRcvContainer->recvData.raw_ack_array;
+  DPROBE(subscription_extract, pRcvContainer->recvInfo.cmd_set,
+         pRcvContainer->recvInfo.cmd_id,
+         pRcvContainer->dispatchInfo.sessionID,
+         pRcvContainer->dispatchInfo.seqNumber, pkg->getBufferSize(),
+         protocol);
   data++; // skip the package ID
 
   /*
@@ -436,6 +510,7 @@ SubscriptionPackage::SubscriptionPackage()
   : occupied(false)
   , incomingDataBuffer(NULL)
   , packageDataSize(0)
+  , topicDataBase(NULL)
 {
   userUnpackHandler.callback = NULL;
   userUnpackHandler.userData = NULL;
@@ -452,6 +527,12 @@ SubscriptionPackage::setPackageID(uint8_t id)
   info.packageID = id;
 }
 
+void
+SubscriptionPackage::setTopicDataBase(Telemetry::TopicInfo* topicDataBase)
+{
+  this->topicDataBase = topicDataBase;
+}
+
 void
 SubscriptionPackage::setConfig(uint8_t config)
 {
@@ -625,15 +706,15 @@ SubscriptionPackage::getUnpackHandler()
 void
 SubscriptionPackage::packageAddSuccessHandler()
 {
-  // In the TopicDataBase, we set the freq, protocoland data pointer for each
+  // In the topic table of this vehicle, we set the freq, protocoland data pointer for each
   // subscribed topic
   for (size_t i = 0; i < info.numberOfTopics; ++i)
   {
-    TopicDataBase[topicList[i]].pkgID = info.packageID;
-    TopicDataBase[topicList[i]].freq  = info.freq;
+    topicDataBase[topicList[i]].pkgID = info.packageID;
+    topicDataBase[topicList[i]].freq  = info.freq;
 
     // The offset already takes time stamp into consideration
-    TopicDataBase[topicList[i]].latest = incomingDataBuffer + offsetList[i];
+    topicDataBase[topicList[i]].latest = incomingDataBuffer + offsetList[i];
   }
 
   setOccupied(true);
@@ -643,12 +724,12 @@ void
 SubscriptionPackage::packageRemoveSuccessHandler()
 {
   // Clean up
-  // Step 1. Clear fields in TopicDataBase
+  // Step 1. Clear fields in the topic table
   for (size_t i = 0; i < info.numberOfTopics; ++i)
   {
-    TopicDataBase[topicList[i]].freq   = 0;
-    TopicDataBase[topicList[i]].pkgID  = 255;  // Set pkgID to invalid
-    TopicDataBase[topicList[i]].latest = NULL; // Clear data pointer
+    topicDataBase[topicList[i]].freq   = 0;
+    topicDataBase[topicList[i]].pkgID  = 255;  // Set pkgID to invalid
+    topicDataBase[topicList[i]].latest = NULL; // Clear data pointer
   }
 
   // Step 2. Clean up package content, except packageID
@@ -15,7 +15,8 @@
 using namespace DJI;
 using namespace DJI::OSDK;
 
-Vehicle::Vehicle(const char* device, uint32_t baudRate, bool threadSupport)
+Vehicle::Vehicle(const char* device, uint32_t baudRate, bool threadSupport,
+                 const ThreadConfig* threadConfig)
   : protocolLayer(NULL)
   , subscribe(NULL)
   , broadcast(NULL)
@@ -33,10 +34,14 @@ Vehicle::Vehicle(const char* device, uint32_t baudRate, bool threadSupport)
     DERROR("Illegal serial device handle!\n");
 
   this->threadSupported = threadSupport;
+  this->ownThreads      = true;
   this->device          = device;
   this->baudRate        = baudRate;
+  this->driver          = NULL;
   callbackId            = 0;
+  stopCond              = false;
   ackErrorCode.data     = OpenProtocol::ErrorCode::CommonACK::NO_RESPONSE_ERROR;
+  setThreadConfig(threadConfig);
 
   if (threadSupport == true)
   {
@@ -61,7 +66,47 @@ Vehicle::Vehicle(bool threadSupport)
   , callbackThread(NULL)
 {
   this->threadSupported = threadSupport;
+  this->ownThreads      = true;
+  this->driver          = NULL;
   callbackId            = 0;
+  stopCond              = false;
+  setThreadConfig(NULL);
+
+  if (threadSupport == true)
+  {
+    this->circularBuffer = new CircularBuffer();
+  }
+
+  mandatorySetUp();
+}
+
+Vehicle::Vehicle(HardDriver* driver, bool threadSupport, bool ownThreads,
+                 const ThreadConfig* threadConfig)
+  : protocolLayer(NULL)
+  , subscribe(NULL)
+  , broadcast(NULL)
+  , control(NULL)
+  , camera(NULL)
+  , gimbal(NULL)
+  , mfio(NULL)
+  , moc(NULL)
+  , missionManager(NULL)
+  , hardSync(NULL)
+  , readThread(NULL)
+  , callbackThread(NULL)
+{
+  if (!driver)
+    DERROR("Illegal hardware driver handle!\n");
+
+  this->threadSupported = threadSupport;
+  this->ownThreads      = ownThreads;
+  this->device          = NULL;
+  this->baudRate        = 0;
+  this->driver          = driver;
+  callbackId            = 0;
+  stopCond              = false;
+  ackErrorCode.data     = OpenProtocol::ErrorCode::CommonACK::NO_RESPONSE_ERROR;
+  setThreadConfig(threadConfig);
 
   if (threadSupport == true)
   {
@@ -204,28 +249,91 @@ Vehicle::initCMD_SetSupportMatrix()
   cmd_setSupportMatrix[8].fwVersion = extendedVersionBase;
 }
 
-void
+bool
 Vehicle::callbackPoll()
 {
   VehicleCallBackHandler cbVal;
   RecvContainer          recvCont;
+  uint64_t               queuedUs;
+  LinkStats*             stats = protocolLayer->getLinkStats();
+
+  //! The callback loop spins; the session sweep and the transfer timers
+  //! need a few ms at most
+  time_ms now = protocolLayer->getDriver()->getTimeStamp();
+  if (now - pollTickMs >= (time_ms)POLL_TICK_MS)
+  {
+    pollTickMs = now;
+    //! No thread runs sendPoll() on Linux; stale frames are dropped here
+    protocolLayer->expireSessions();
+
+    if (__atomic_load_n(&pollListenerNumber, __ATOMIC_ACQUIRE))
+    {
+      //! Run from a copy: a listener may remove itself
+      VehicleCallBackHandler listener[MAX_POLL_LISTENER];
+      protocolLayer->getThreadHandle()->lockNonBlockCBAck();
+      memcpy(listener, pollListener, sizeof(listener));
+      protocolLayer->getThreadHandle()->freeNonBlockCBAck();
+
+      for (int i = 0; i < MAX_POLL_LISTENER; i++)
+      {
+        if (listener[i].callback)
+        {
+          RecvContainer idle;
+          memset(&idle, 0, sizeof(idle));
+          listener[i].callback(this, idle, listener[i].userData);
+        }
+      }
+    }
+  }
+
   //! If Head = Tail, there is no data in the buffer, do not call cbPop.
   protocolLayer->getThreadHandle()->lockNonBlockCBAck();
   if (this->circularBuffer->head != this->circularBuffer->tail)
   {
-    circularBuffer->cbPop(circularBuffer, &cbVal, &recvCont);
+    circularBuffer->cbPop(circularBuffer, &cbVal, &recvCont, &queuedUs);
     protocolLayer->getThreadHandle()->freeNonBlockCBAck();
+    DPROBE(cb_pop, recvCont.recvInfo.cmd_set, recvCont.recvInfo.cmd_id,
+           recvCont.dispatchInfo.sessionID, recvCont.dispatchInfo.seqNumber,
+           recvCont.recvInfo.len, protocolLayer);
+
+    uint64_t startUs = LinkStats::nowUs(protocolLayer->getDriver());
+    LinkStats::record(&stats->counters.callbackWait, startUs - queuedUs);
+    DTRACE(RX_CALLBACK_START, recvCont.dispatchInfo.traceId, protocolLayer);
     cbVal.callback(this, recvCont, cbVal.userData);
+    DTRACE(RX_CALLBACK_END, recvCont.dispatchInfo.traceId, protocolLayer);
+    LinkStats::record(&stats->counters.callbackRun,
+                      LinkStats::nowUs(protocolLayer->getDriver()) - startUs);
+    return true;
   }
   else
   {
     protocolLayer->getThreadHandle()->freeNonBlockCBAck();
+    return false;
   }
 }
 
+int
+Vehicle::pollReceive()
+{
+  RecvContainer recvCont;
+  int           frames = 0;
+
+  //! One driver read per call; the loop only walks the buffered chunk
+  do
+  {
+    if (protocolLayer->pollFrame(&recvCont))
+    {
+      processReceivedData(recvCont);
+      frames++;
+    }
+  } while (protocolLayer->hasBufferedData());
+
+  return frames;
+}
+
 Vehicle::~Vehicle()
 {
-  if (threadSupported)
+  if (threadSupported && ownThreads)
   {
     this->readThread->stopThread();
     this->callbackThread->stopThread();
@@ -248,15 +356,25 @@ Vehicle::~Vehicle()
     delete this->hardSync;
   delete this->missionManager;
   delete this->protocolLayer;
-  if (threadSupported)
+  if (threadSupported && ownThreads)
     delete this->readThread;
+  if (threadSupported)
+    delete this->circularBuffer;
 }
 
 bool
 Vehicle::initOpenProtocol()
 {
-  this->protocolLayer =
-    new (std::nothrow) Protocol(this->device, this->baudRate);
+  if (this->driver)
+  {
+    this->protocolLayer =
+      new (std::nothrow) Protocol(this->driver, &this->threadConfig);
+  }
+  else
+  {
+    this->protocolLayer = new (std::nothrow)
+      Protocol(this->device, this->baudRate, &this->threadConfig);
+  }
   if (this->protocolLayer == 0)
   {
     return false;
@@ -268,6 +386,20 @@ Vehicle::initOpenProtocol()
 bool
 Vehicle::initPlatformSupport()
 {
+#ifdef __linux__
+  //! Process-wide, so also done for vehicles driven by a reactor
+  if (threadConfig.lockMemory)
+  {
+    PosixThread::lockAllMemory();
+  }
+#endif
+
+  if (!threadSupported || !ownThreads)
+  {
+    //! Driven by the caller (or an external reactor), nothing to spawn
+    return true;
+  }
+
 #ifdef qt
   if (threadSupported)
   {
@@ -542,6 +674,20 @@ Vehicle::initCallbacks()
   wayPointCallback.userData = 0;
   missionCallback.callback  = 0;
   missionCallback.userData  = 0;
+
+  for (int i = 0; i < MAX_PUSH_LISTENER; i++)
+  {
+    pushListener[i].callback = 0;
+    pushListener[i].userData = 0;
+  }
+  for (int i = 0; i < MAX_POLL_LISTENER; i++)
+  {
+    pollListener[i].callback = 0;
+    pollListener[i].userData = 0;
+  }
+  pollListenerNumber = 0;
+  pollTickMs         = 0;
+  memset(nbReserved, 0, sizeof(nbReserved));
 }
 
 bool
@@ -731,6 +877,13 @@ Vehicle::isCmdSetSupported(const uint8_t cmdSet)
 void
 Vehicle::processReceivedData(RecvContainer receivedFrame)
 {
+  uint32_t traceId = receivedFrame.dispatchInfo.traceId;
+  DTRACE(RX_DISPATCH, traceId, protocolLayer);
+  DPROBE(dispatch, receivedFrame.recvInfo.cmd_set,
+         receivedFrame.recvInfo.cmd_id, receivedFrame.dispatchInfo.sessionID,
+         receivedFrame.dispatchInfo.seqNumber, receivedFrame.recvInfo.len,
+         protocolLayer);
+
   if (receivedFrame.dispatchInfo.isAck)
   {
     // TODO Fill up ACKErorCode Container
@@ -745,17 +898,35 @@ Vehicle::processReceivedData(RecvContainer receivedFrame)
         this->nbUserData[receivedFrame.dispatchInfo.callbackID];
       if (threadSupported)
       {
+        LinkStats* stats = protocolLayer->getLinkStats();
+        DPROBE(cb_push, receivedFrame.recvInfo.cmd_set,
+               receivedFrame.recvInfo.cmd_id,
+               receivedFrame.dispatchInfo.sessionID,
+               receivedFrame.dispatchInfo.seqNumber, receivedFrame.recvInfo.len,
+               protocolLayer);
         protocolLayer->getThreadHandle()->lockNonBlockCBAck();
-        this->circularBuffer->cbPush(
-          this->circularBuffer, this->nbVehicleCallBackHandler,
-          this->nbCallbackRecvContainer[receivedFrame.dispatchInfo.callbackID]);
+        if (this->circularBuffer->cbPush(
+              this->circularBuffer, this->nbVehicleCallBackHandler,
+              this->nbCallbackRecvContainer[receivedFrame.dispatchInfo
+                                              .callbackID],
+              LinkStats::nowUs(protocolLayer->getDriver())))
+        {
+          LinkStats::add(&stats->counters.callbackQueueOverflows);
+        }
+        LinkStats::setMax(&stats->counters.callbackQueueMax,
+                          circularBuffer->getDepth());
         protocolLayer->getThreadHandle()->freeNonBlockCBAck();
+        DTRACE(RX_ENQUEUE, traceId, protocolLayer);
       }
       else
+      {
+        DTRACE(RX_CALLBACK_START, traceId, protocolLayer);
         this->nbVehicleCallBackHandler.callback(
           this,
           this->nbCallbackRecvContainer[receivedFrame.dispatchInfo.callbackID],
           this->nbVehicleCallBackHandler.userData);
+        DTRACE(RX_CALLBACK_END, traceId, protocolLayer);
+      }
     }
 
     else
@@ -764,30 +935,133 @@ Vehicle::processReceivedData(RecvContainer receivedFrame)
       // TODO remove
       this->lastReceivedFrame = receivedFrame;
 
+      //! The waiting caller is the "callback" of a blocking command
+      DTRACE(RX_CALLBACK_START, traceId, protocolLayer);
       ACKHandler(static_cast<void*>(&receivedFrame));
       protocolLayer->getThreadHandle()->notify();
+      DTRACE(RX_CALLBACK_END, traceId, protocolLayer);
     }
   }
   else
   {
     DDEBUG("Dispatcher identified as push data\n");
+    DTRACE(RX_CALLBACK_START, traceId, protocolLayer);
     PushDataHandler(static_cast<void*>(&receivedFrame));
+    DTRACE(RX_CALLBACK_END, traceId, protocolLayer);
+  }
+}
+
+bool
+Vehicle::addPushDataListener(VehicleCallBack listener, UserData userData)
+{
+  for (int i = 0; i < MAX_PUSH_LISTENER; i++)
+  {
+    if (!pushListener[i].callback)
+    {
+      pushListener[i].userData = userData;
+      pushListener[i].callback = listener;
+      return true;
+    }
+  }
+  DERROR("No free push data listener slot.\n");
+  return false;
+}
+
+void
+Vehicle::removePushDataListener(VehicleCallBack listener, UserData userData)
+{
+  for (int i = 0; i < MAX_PUSH_LISTENER; i++)
+  {
+    if (pushListener[i].callback == listener &&
+        pushListener[i].userData == userData)
+    {
+      pushListener[i].callback = 0;
+      pushListener[i].userData = 0;
+    }
+  }
+}
+
+bool
+Vehicle::addPollListener(VehicleCallBack listener, UserData userData)
+{
+  bool added = false;
+  protocolLayer->getThreadHandle()->lockNonBlockCBAck();
+  for (int i = 0; i < MAX_POLL_LISTENER && !added; i++)
+  {
+    if (!pollListener[i].callback)
+    {
+      pollListener[i].userData = userData;
+      pollListener[i].callback = listener;
+      __atomic_add_fetch(&pollListenerNumber, 1, __ATOMIC_RELEASE);
+      added = true;
+    }
   }
+  protocolLayer->getThreadHandle()->freeNonBlockCBAck();
+
+  if (!added)
+    DERROR("No free poll listener slot.\n");
+  return added;
+}
+
+void
+Vehicle::removePollListener(VehicleCallBack listener, UserData userData)
+{
+  protocolLayer->getThreadHandle()->lockNonBlockCBAck();
+  for (int i = 0; i < MAX_POLL_LISTENER; i++)
+  {
+    if (pollListener[i].callback == listener &&
+        pollListener[i].userData == userData)
+    {
+      pollListener[i].callback = 0;
+      pollListener[i].userData = 0;
+      __atomic_sub_fetch(&pollListenerNumber, 1, __ATOMIC_RELEASE);
+    }
+  }
+  protocolLayer->getThreadHandle()->freeNonBlockCBAck();
 }
 
 int
 Vehicle::callbackIdIndex()
 {
-  if (callbackId == 200)
+  for (int i = 0; i < 200; i++)
   {
-    callbackId = 0;
-    return 0;
+    callbackId = (callbackId == 199) ? 0 : callbackId + 1;
+    if (!nbReserved[callbackId])
+      break;
   }
-  else
+  return callbackId;
+}
+
+int
+Vehicle::reserveCallbackIds(int count, VehicleCallBack callback,
+                            UserData userData)
+{
+  //! From the top down, away from the slots handed out since start-up
+  for (int first = 200 - count; first > 0; first--)
   {
-    callbackId++;
-    return callbackId;
+    int i = 0;
+    while (i < count && !nbReserved[first + i])
+      i++;
+    if (i < count)
+      continue;
+
+    for (i = first; i < first + count; i++)
+    {
+      nbCallbackFunctions[i] = (void*)callback;
+      nbUserData[i]          = userData;
+      nbReserved[i]          = true;
+    }
+    return first;
   }
+  DERROR("No %d free callback slots in a row.\n", count);
+  return -1;
+}
+
+void
+Vehicle::releaseCallbackIds(int first, int count)
+{
+  for (int i = first; i < first + count && i < 200; i++)
+    nbReserved[i] = false;
 }
 
 void
@@ -941,6 +1215,24 @@ Vehicle::getDroneVersion(int timeout)
   return droneVersionACK;
 }
 
+void
+Vehicle::getLinkStats(LinkSnapshot* snapshot)
+{
+  protocolLayer->getLinkSnapshot(snapshot);
+  if (threadSupported)
+  {
+    protocolLayer->getThreadHandle()->lockNonBlockCBAck();
+    snapshot->callbackQueueDepth = circularBuffer->getDepth();
+    protocolLayer->getThreadHandle()->freeNonBlockCBAck();
+  }
+}
+
+void
+Vehicle::resetLinkStats()
+{
+  protocolLayer->getLinkStats()->reset();
+}
+
 Vehicle::ActivateData
 Vehicle::getAccountData() const
 {
@@ -1075,6 +1367,21 @@ Vehicle::setStopCond(bool stopCond)
   protocolLayer->getThreadHandle()->freeStopCond();
 }
 
+const ThreadConfig*
+Vehicle::getThreadConfig() const
+{
+  return &threadConfig;
+}
+
+void
+Vehicle::setThreadConfig(const ThreadConfig* config)
+{
+  if (config)
+    threadConfig = *config;
+  else
+    memset(&threadConfig, 0, sizeof(threadConfig));
+}
+
 bool
 Vehicle::getStopCond()
 {
@@ -1163,6 +1470,15 @@ Vehicle::PushDataHandler(void* eventData)
 {
   RecvContainer* pushDataEntry = (RecvContainer*)eventData;
 
+  for (int i = 0; i < MAX_PUSH_LISTENER; i++)
+  {
+    if (pushListener[i].callback)
+    {
+      pushListener[i].callback(this, *(pushDataEntry),
+                               pushListener[i].userData);
+    }
+  }
+
   const uint8_t cmd[] = { pushDataEntry->recvInfo.cmd_set,
                           pushDataEntry->recvInfo.cmd_id };
 
@@ -11,6 +11,7 @@
 #include "dji_waypoint.hpp"
 #include "dji_mission_manager.hpp"
 #include "dji_vehicle.hpp"
+#include <new>
 
 using namespace DJI;
 using namespace DJI::OSDK;
@@ -18,15 +19,33 @@ using namespace DJI::OSDK;
 WaypointMission::WaypointMission(Vehicle* vehicle)
   : MissionBase(vehicle)
   , index(NULL)
+  , uploadSlot(NULL)
+  , uploadCount(0)
+  , uploadWindow(0)
+  , uploadNext(0)
+  , uploadStartMs(0)
+  , uploadDeadlineMs(0)
+  , syncIndex(NULL)
+  , syncHash(NULL)
+  , syncValid(false)
+  , downloadIndex(NULL)
 {
   wayPointEventCallback.callback = 0;
   wayPointEventCallback.userData = 0;
   wayPointCallback.callback      = 0;
   wayPointCallback.userData      = 0;
+  uploadCallback.callback        = 0;
+  uploadCallback.userData        = 0;
+  memset(&uploadStatus, 0, sizeof(uploadStatus));
+  uploadStatus.failedIndex = -1;
 }
 
 WaypointMission::~WaypointMission()
 {
+  vehicle->removePollListener(&WaypointMission::uploadPollCallback, this);
+  delete[] uploadSlot;
+  delete[] syncIndex;
+  delete[] syncHash;
 }
 
 void
@@ -35,6 +54,8 @@ WaypointMission::init(WayPointInitSettings* Info, VehicleCallBack callback,
 {
   if (Info)
     setInfo(*Info);
+  //! The aircraft drops the uploaded waypoints on init
+  syncValid = false;
 
   int cbIndex = vehicle->callbackIdIndex();
   if (callback)
@@ -64,6 +85,7 @@ WaypointMission::init(WayPointInitSettings* Info, int timeout)
   {
     setInfo(*Info);
   }
+  syncValid = false;
 
   vehicle->protocolLayer->send(2, encrypt,
                                OpenProtocol::CMDSet::Mission::waypointInit,
@@ -288,6 +310,7 @@ WaypointMission::uploadIndexData(WayPointSettings* data,
                                  VehicleCallBack callback, UserData userData)
 {
   setIndex(data, data->index);
+  syncValid = false;
 
   int cbIndex = vehicle->callbackIdIndex();
   if (callback)
@@ -320,6 +343,7 @@ WaypointMission::uploadIndexData(WayPointSettings* data, int timeout)
   ACK::WayPointIndex ack;
 
   setIndex(data, data->index);
+  syncValid = false;
 
   if (data->index < info.indexNumber)
   {
@@ -341,6 +365,551 @@ WaypointMission::uploadIndexData(WayPointSettings* data, int timeout)
   return ack;
 }
 
+bool
+WaypointMission::uploadAllIndexData(WayPointSettings* data, int window,
+                                    VehicleCallBack callback, UserData userData)
+{
+  if (data && checkMission(&info, data) !=
+                OpenProtocol::ErrorCode::MissionACK::Common::SUCCESS)
+    return false;
+  return startUpload(data, window, NULL, callback, userData, 0);
+}
+
+ACK::ErrorCode
+WaypointMission::uploadAllIndexData(WayPointSettings* data, int window,
+                                    int timeout)
+{
+  return runUpload(data, window, NULL, timeout);
+}
+
+ACK::ErrorCode
+WaypointMission::sync(WayPointInitSettings* newInfo, WayPointSettings* data,
+                      int timeout, WaypointSyncReport* report)
+{
+  ACK::ErrorCode       ack;
+  WaypointSyncReport   done;
+  WayPointInitSettings next = *newInfo;
+  bool*                changed = NULL;
+
+  for (int i = 0; i < 16; ++i)
+    next.reserved[i] = 0;
+  uint8_t rejected = checkMission(&next, data);
+  if (rejected != OpenProtocol::ErrorCode::MissionACK::Common::SUCCESS)
+    return uploadAck(rejected);
+
+  memset(&done, 0, sizeof(done));
+  done.total  = next.indexNumber;
+  done.reinit = !syncValid || memcmp(&next, &syncInfo, sizeof(next)) != 0;
+
+  //! Frame sizes without encryption padding
+  const uint32_t initBytes = Protocol::PackageMin * 2 + SET_CMD_SIZE +
+                             sizeof(WayPointInitSettings) + sizeof(uint8_t);
+  const uint32_t pointBytes =
+    Protocol::PackageMin * 2 + SET_CMD_SIZE + sizeof(WayPointSettings) +
+    sizeof(ACK::WayPointDataInternal);
+
+  if (done.reinit)
+  {
+    ack = init(newInfo, timeout);
+    if (ACK::getError(ack))
+      return ack;
+    done.roundTrips = 1;
+    done.bytes      = initBytes;
+    done.changed    = next.indexNumber;
+  }
+  else
+  {
+    changed = new (std::nothrow) bool[next.indexNumber];
+    if (changed == NULL)
+    {
+      DERROR("Lack of memory\n");
+      return uploadAck(OpenProtocol::ErrorCode::CommonACK::NO_RESPONSE_ERROR);
+    }
+    for (int i = 0; i < next.indexNumber; ++i)
+    {
+      WayPointSettings wp = data[i];
+      wp.index            = i;
+      for (int j = 0; j < 8; ++j)
+        wp.reserved[j] = 0;
+      changed[i] = syncHash[i] != hashIndex(&wp) ||
+                   memcmp(&wp, &syncIndex[i], sizeof(wp)) != 0;
+      done.changed += changed[i];
+    }
+  }
+
+  if (done.changed)
+  {
+    ack = runUpload(data, DEFAULT_UPLOAD_WINDOW, changed, timeout);
+    WaypointUploadStatus status;
+    getUploadStatus(&status);
+    done.roundTrips += status.sent;
+    done.bytes += status.sent * pointBytes;
+  }
+  else
+    ack = uploadAck(OpenProtocol::ErrorCode::MissionACK::Common::SUCCESS);
+  delete[] changed;
+
+  uint32_t fullTrips   = 1 + next.indexNumber;
+  uint32_t fullBytes   = initBytes + next.indexNumber * pointBytes;
+  done.roundTripsSaved =
+    fullTrips > done.roundTrips ? fullTrips - done.roundTrips : 0;
+  done.bytesSaved = fullBytes > done.bytes ? fullBytes - done.bytes : 0;
+  DSTATUS("Synced %d of %d waypoints%s, %u bytes and %u round trips saved\n",
+          done.changed, done.total, done.reinit ? " after init" : "",
+          done.bytesSaved, done.roundTripsSaved);
+  if (report)
+    *report = done;
+  return ack;
+}
+
+ACK::ErrorCode
+WaypointMission::runUpload(WayPointSettings* data, int window,
+                           const bool* changed, int timeout)
+{
+  if (data)
+  {
+    uint8_t rejected = checkMission(&info, data);
+    if (rejected != OpenProtocol::ErrorCode::MissionACK::Common::SUCCESS)
+      return uploadAck(rejected);
+  }
+  if (!startUpload(data, window, changed, 0, 0, timeout))
+    return uploadAck(OpenProtocol::ErrorCode::CommonACK::NO_RESPONSE_ERROR);
+  return waitTransfer();
+}
+
+ACK::ErrorCode
+WaypointMission::downloadMission(WayPointSettings* data, int timeout,
+                                 WaypointReadback* report, uint16_t* fieldDiff)
+{
+  ACK::ErrorCode   ack;
+  WaypointReadback done;
+
+  if (data == NULL || info.indexNumber == 0)
+  {
+    DERROR("No waypoints, call init() first\n");
+    return uploadAck(OpenProtocol::ErrorCode::CommonACK::NO_RESPONSE_ERROR);
+  }
+
+  downloadIndex = data;
+  memset(&downloadInfo, 0, sizeof(downloadInfo));
+  //! The init settings ride along as one more slot after the waypoints
+  if (!startTransfer(info.indexNumber + 1, MAX_UPLOAD_WINDOW, NULL, 0, 0,
+                     timeout))
+  {
+    downloadIndex = NULL;
+    return uploadAck(OpenProtocol::ErrorCode::CommonACK::NO_RESPONSE_ERROR);
+  }
+  ack           = waitTransfer();
+  downloadIndex = NULL;
+
+  memset(&done, 0, sizeof(done));
+  done.total          = info.indexNumber;
+  done.firstDifferent = -1;
+  done.info           = downloadInfo;
+  if (fieldDiff)
+    memset(fieldDiff, 0, info.indexNumber * sizeof(uint16_t));
+  if (!ACK::getError(ack))
+  {
+    WayPointInitSettings expected = info;
+    for (int i = 0; i < 16; ++i)
+      done.info.reserved[i] = expected.reserved[i] = 0;
+    done.infoDifferent =
+      memcmp(&expected, &done.info, sizeof(expected)) != 0;
+
+    for (int i = 0; index && i < info.indexNumber; ++i)
+    {
+      //! The aircraft keys waypoints by position, as uploads send them
+      WayPointSettings local = index[i];
+      local.index            = i;
+      uint16_t fields        = diffIndex(local, data[i]);
+      if (fieldDiff)
+        fieldDiff[i] = fields;
+      if (fields)
+      {
+        if (done.firstDifferent < 0)
+          done.firstDifferent = i;
+        done.different++;
+      }
+    }
+    if (done.infoDifferent || done.different)
+      DERROR("Mission on the aircraft differs: %d of %d waypoints%s\n",
+             done.different, done.total,
+             done.infoDifferent ? ", init settings" : "");
+  }
+  if (report)
+    *report = done;
+  return ack;
+}
+
+uint16_t
+WaypointMission::diffIndex(const WayPointSettings& a,
+                           const WayPointSettings& b)
+{
+  uint16_t fields = 0;
+
+  //! Compared as bits: the aircraft stores what it was sent
+  if (a.index != b.index)
+    fields |= WP_FIELD_INDEX;
+  if (memcmp(&a.latitude, &b.latitude, sizeof(a.latitude)))
+    fields |= WP_FIELD_LATITUDE;
+  if (memcmp(&a.longitude, &b.longitude, sizeof(a.longitude)))
+    fields |= WP_FIELD_LONGITUDE;
+  if (memcmp(&a.altitude, &b.altitude, sizeof(a.altitude)))
+    fields |= WP_FIELD_ALTITUDE;
+  if (memcmp(&a.damping, &b.damping, sizeof(a.damping)))
+    fields |= WP_FIELD_DAMPING;
+  if (a.yaw != b.yaw)
+    fields |= WP_FIELD_YAW;
+  if (a.gimbalPitch != b.gimbalPitch)
+    fields |= WP_FIELD_GIMBAL_PITCH;
+  if (a.turnMode != b.turnMode)
+    fields |= WP_FIELD_TURN_MODE;
+  if (a.hasAction != b.hasAction)
+    fields |= WP_FIELD_HAS_ACTION;
+  if (a.actionTimeLimit != b.actionTimeLimit)
+    fields |= WP_FIELD_ACTION_TIME_LIMIT;
+  if (a.actionNumber != b.actionNumber)
+    fields |= WP_FIELD_ACTION_NUMBER;
+  if (a.actionRepeat != b.actionRepeat)
+    fields |= WP_FIELD_ACTION_REPEAT;
+  if (memcmp(a.commandList, b.commandList, sizeof(a.commandList)))
+    fields |= WP_FIELD_COMMAND_LIST;
+  if (memcmp(a.commandParameter, b.commandParameter,
+             sizeof(a.commandParameter)))
+    fields |= WP_FIELD_COMMAND_PARAMETER;
+  return fields;
+}
+
+const char*
+WaypointMission::getFieldName(uint16_t field)
+{
+  static const char* const names[] = {
+    "index",        "latitude",        "longitude",    "altitude",
+    "damping",      "yaw",             "gimbalPitch",  "turnMode",
+    "hasAction",    "actionTimeLimit", "actionNumber", "actionRepeat",
+    "commandList",  "commandParameter"
+  };
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+    if (field & (1 << i))
+      return names[i];
+  return "none";
+}
+
+ACK::ErrorCode
+WaypointMission::waitTransfer()
+{
+  ACK::ErrorCode  ack;
+  ThreadAbstract* threadHandle = vehicle->protocolLayer->getThreadHandle();
+
+  //! The poll listener fails the transfer at the deadline and wakes us up
+  threadHandle->lockNonBlockCBAck();
+  while (uploadStatus.running)
+    threadHandle->nonBlockWait();
+  ack = uploadStatus.ack;
+  threadHandle->freeNonBlockCBAck();
+
+  return ack;
+}
+
+ACK::ErrorCode
+WaypointMission::uploadAck(uint32_t data)
+{
+  ACK::ErrorCode ack;
+
+  memset(&ack, 0, sizeof(ack));
+  ack.info.cmd_set = OpenProtocol::CMDSet::mission;
+  ack.info.cmd_id  = OpenProtocol::CMDSet::Mission::waypointAddPoint[1];
+  ack.data         = data;
+  return ack;
+}
+
+uint32_t
+WaypointMission::hashIndex(const WayPointSettings* wp)
+{
+  return Protocol::sdk_stream_crc32_calc((const uint8_t*)wp, sizeof(*wp));
+}
+
+bool
+WaypointMission::startUpload(WayPointSettings* data, int window,
+                             const bool* changed, VehicleCallBack callback,
+                             UserData userData, int timeout)
+{
+  if (data == NULL || info.indexNumber == 0)
+  {
+    DERROR("No waypoints, call init() first\n");
+    return false;
+  }
+  if (isTransferRunning())
+    return false;
+
+  //! setIndex() sizes the array once; init() may have grown the mission
+  delete[] index;
+  index = NULL;
+  for (int i = 0; i < info.indexNumber; ++i)
+  {
+    setIndex(&data[i], i);
+    index[i].index = i;
+  }
+  return startTransfer(info.indexNumber, window, changed, callback, userData,
+                       timeout);
+}
+
+bool
+WaypointMission::isTransferRunning()
+{
+  vehicle->protocolLayer->getThreadHandle()->lockNonBlockCBAck();
+  bool running = uploadStatus.running;
+  vehicle->protocolLayer->getThreadHandle()->freeNonBlockCBAck();
+  if (running)
+    DERROR("Upload or readback already running\n");
+  return running;
+}
+
+bool
+WaypointMission::startTransfer(int count, int window, const bool* changed,
+                               VehicleCallBack callback, UserData userData,
+                               int timeout)
+{
+  if (window < 1 || window > MAX_UPLOAD_WINDOW)
+  {
+    DERROR("Window %d out of range\n", window);
+    return false;
+  }
+  if (isTransferRunning())
+    return false;
+
+  //! The callback thread owns the state once the poll listener is added
+  delete[] uploadSlot;
+  uploadSlot = new (std::nothrow) UploadSlot[count];
+  if (uploadSlot == NULL)
+  {
+    DERROR("Lack of memory\n");
+    return false;
+  }
+  uint16_t total = 0;
+  for (int i = 0; i < count; ++i)
+  {
+    //! Unchanged waypoints count as acknowledged from the start
+    bool send              = changed == NULL || changed[i];
+    total                 += send;
+    uploadSlot[i].state    = send ? UPLOAD_PENDING : UPLOAD_ACKED;
+    uploadSlot[i].attempts = 0;
+    uploadSlot[i].cbIndex  = 0;
+    uploadSlot[i].sentMs   = 0;
+  }
+
+  uploadCount             = count;
+  uploadWindow            = window;
+  uploadNext              = 0;
+  uploadStartMs           = vehicle->protocolLayer->getDriver()->getTimeStamp();
+  uploadDeadlineMs        = timeout ? uploadStartMs + (time_ms)timeout * 1000 : 0;
+  uploadCallback.callback = callback;
+  uploadCallback.userData = userData;
+  memset(&uploadStatus, 0, sizeof(uploadStatus));
+  uploadStatus.total       = total;
+  uploadStatus.failedIndex = -1;
+  uploadStatus.running     = true;
+
+  if (!vehicle->addPollListener(&WaypointMission::uploadPollCallback, this))
+  {
+    DERROR("No free poll listener\n");
+    uploadStatus.running = false;
+    return false;
+  }
+  return true;
+}
+
+void
+WaypointMission::getUploadStatus(WaypointUploadStatus* status) const
+{
+  vehicle->protocolLayer->getThreadHandle()->lockNonBlockCBAck();
+  *status = uploadStatus;
+  vehicle->protocolLayer->getThreadHandle()->freeNonBlockCBAck();
+}
+
+int
+WaypointMission::validate(const WayPointSettings* data,
+                          WaypointViolation* violations, int maxViolations)
+{
+  return preprocessor.validate(&info, data, info.indexNumber, violations,
+                               maxViolations);
+}
+
+WaypointPreprocessor*
+WaypointMission::getPreprocessor()
+{
+  return &preprocessor;
+}
+
+uint8_t
+WaypointMission::checkMission(const WayPointInitSettings* mission,
+                              const WayPointSettings*     data)
+{
+  const int         maxShown = 4;
+  WaypointViolation violation[maxShown];
+
+  int found = preprocessor.validate(mission, data, mission->indexNumber,
+                                    violation, maxShown);
+  if (found < 0)
+    return OpenProtocol::ErrorCode::MissionACK::WayPoint::INVALID_DATA;
+  for (int i = 0; i < found && i < maxShown; ++i)
+    DERROR("Waypoint %d: %s %f, limit %f (0x%X)\n", violation[i].index,
+           violation[i].field, violation[i].value, violation[i].limit,
+           violation[i].ack);
+  if (found > maxShown)
+    DERROR("%d more violations\n", found - maxShown);
+  return found ? violation[0].ack
+               : OpenProtocol::ErrorCode::MissionACK::Common::SUCCESS;
+}
+
+void
+WaypointMission::sendUploadIndex(int pos)
+{
+  UploadSlot*     slot   = &uploadSlot[pos];
+  uint8_t         buf[SET_CMD_SIZE + sizeof(WayPointSettings)];
+  size_t          length = SET_CMD_SIZE;
+  VehicleCallBack handler;
+
+  if (downloadIndex == NULL)
+  {
+    buf[0] = OpenProtocol::CMDSet::Mission::waypointAddPoint[0];
+    buf[1] = OpenProtocol::CMDSet::Mission::waypointAddPoint[1];
+    memcpy(buf + SET_CMD_SIZE, &index[pos], sizeof(WayPointSettings));
+    length += sizeof(WayPointSettings);
+    handler = &WaypointMission::uploadAllCallback;
+  }
+  else
+  {
+    //! The slot after the waypoints reads the init settings
+    const uint8_t* cmd = pos < info.indexNumber
+                           ? OpenProtocol::CMDSet::Mission::waypointIndex
+                           : OpenProtocol::CMDSet::Mission::waypointDownload;
+    buf[0] = cmd[0];
+    buf[1] = cmd[1];
+    buf[SET_CMD_SIZE] = pos < info.indexNumber ? pos : 0;
+    length += sizeof(uint8_t);
+    handler = &WaypointMission::downloadCallback;
+  }
+
+  //! Nothing frees the session of a lost ACK on Linux, see sendPoll()
+  if (slot->state == UPLOAD_IN_FLIGHT)
+    vehicle->protocolLayer->releaseSession(slot->cbIndex);
+
+  //! A fresh session and callback slot each time
+  int cbIndex = vehicle->callbackIdIndex();
+  vehicle->nbCallbackFunctions[cbIndex] = (void*)handler;
+  vehicle->nbUserData[cbIndex]          = this;
+
+  Command cmd;
+  cmd.sessionMode = 2;
+  cmd.encrypt     = encrypt;
+  cmd.retry       = 1;
+  cmd.timeout     = UPLOAD_TIMEOUT_MS;
+  cmd.length      = length;
+  cmd.buf         = buf;
+  cmd.cmd_set     = buf[0];
+  cmd.cmd_id      = buf[1];
+  cmd.isCallback  = true;
+  cmd.callbackID  = cbIndex;
+
+  //! Out of sessions counts as a lost frame: resent after the timeout
+  bool sent = vehicle->protocolLayer->send(&cmd) == 0;
+
+  vehicle->protocolLayer->getThreadHandle()->lockNonBlockCBAck();
+  if (slot->state == UPLOAD_PENDING)
+    uploadStatus.inFlight++;
+  else
+    uploadStatus.retransmits++;
+  if (sent)
+    uploadStatus.sent++;
+  vehicle->protocolLayer->getThreadHandle()->freeNonBlockCBAck();
+
+  slot->state   = UPLOAD_IN_FLIGHT;
+  slot->cbIndex = cbIndex;
+  slot->sentMs  = vehicle->protocolLayer->getDriver()->getTimeStamp();
+  slot->attempts++;
+}
+
+void
+WaypointMission::fillUploadWindow()
+{
+  while (uploadStatus.running && uploadStatus.inFlight < uploadWindow &&
+         uploadNext < uploadCount)
+  {
+    if (uploadSlot[uploadNext].state == UPLOAD_PENDING)
+      sendUploadIndex(uploadNext);
+    uploadNext++;
+  }
+}
+
+void
+WaypointMission::finishUpload(const RecvContainer& recvFrame, int failedIndex,
+                              ACK::ErrorCode ack)
+{
+  time_ms now = vehicle->protocolLayer->getDriver()->getTimeStamp();
+
+  vehicle->removePollListener(&WaypointMission::uploadPollCallback, this);
+  for (int i = 0; i < uploadNext; ++i)
+    if (uploadSlot[i].state == UPLOAD_IN_FLIGHT)
+      vehicle->protocolLayer->releaseSession(uploadSlot[i].cbIndex);
+  //! Before waking a blocking sync() up
+  if (downloadIndex == NULL)
+    updateSyncCache(failedIndex < 0);
+
+  vehicle->protocolLayer->getThreadHandle()->lockNonBlockCBAck();
+  uploadStatus.inFlight    = 0;
+  uploadStatus.failedIndex = failedIndex;
+  uploadStatus.ack         = ack;
+  uploadStatus.elapsedMs   = (uint32_t)(now - uploadStartMs);
+  uploadStatus.running     = false;
+  vehicle->protocolLayer->getThreadHandle()->notifyNonBlockCBAckRecv();
+  vehicle->protocolLayer->getThreadHandle()->freeNonBlockCBAck();
+
+  if (failedIndex >= 0)
+    DERROR("Waypoint %d %s failed\n", failedIndex,
+           downloadIndex ? "readback" : "upload");
+  else
+    DSTATUS("%s %d waypoints in %u ms, %u retransmitted\n",
+            downloadIndex ? "Read back" : "Uploaded", uploadStatus.total,
+            uploadStatus.elapsedMs, uploadStatus.retransmits);
+
+  if (uploadCallback.callback)
+    uploadCallback.callback(vehicle, recvFrame, uploadCallback.userData);
+}
+
+void
+WaypointMission::updateSyncCache(bool uploaded)
+{
+  //! A failed upload may have left any waypoint on the aircraft
+  syncValid = false;
+  if (!uploaded)
+    return;
+
+  if (syncIndex == NULL || syncInfo.indexNumber != info.indexNumber)
+  {
+    delete[] syncIndex;
+    delete[] syncHash;
+    syncIndex = new (std::nothrow) WayPointSettings[info.indexNumber];
+    syncHash  = new (std::nothrow) uint32_t[info.indexNumber];
+    if (syncIndex == NULL || syncHash == NULL)
+    {
+      DERROR("Lack of memory\n");
+      delete[] syncIndex;
+      delete[] syncHash;
+      syncIndex = NULL;
+      syncHash  = NULL;
+      return;
+    }
+  }
+  syncInfo = info;
+  for (int i = 0; i < info.indexNumber; ++i)
+  {
+    syncIndex[i] = index[i];
+    syncHash[i]  = hashIndex(&index[i]);
+  }
+  syncValid = true;
+}
+
 void
 WaypointMission::readIdleVelocity(VehicleCallBack callback, UserData userData)
 {
@@ -476,6 +1045,139 @@ WaypointMission::uploadIndexDataCallback(Vehicle*      vehicle,
   DSTATUS("Index number: %d\n", wpDataInfo.index);
 }
 
+void
+WaypointMission::uploadAllCallback(Vehicle* vehicle, RecvContainer recvFrame,
+                                   UserData userData)
+{
+  WaypointMission*          wp = (WaypointMission*)userData;
+  ACK::WayPointDataInternal wpDataInfo;
+
+  if (recvFrame.recvInfo.len - Protocol::PackageMin <=
+      sizeof(ACK::WayPointDataInternal))
+  {
+    wpDataInfo = recvFrame.recvData.wpDataACK;
+  }
+  else
+  {
+    DERROR("ACK is exception, sequence %d\n", recvFrame.recvInfo.seqNumber);
+    return;
+  }
+
+  //! Late ACKs of retransmitted or finished uploads are dropped here
+  if (!wp->uploadStatus.running || wp->downloadIndex ||
+      wpDataInfo.index >= wp->uploadCount ||
+      wp->uploadSlot[wpDataInfo.index].state != UPLOAD_IN_FLIGHT)
+    return;
+
+  ACK::ErrorCode ack;
+  ack.data = wpDataInfo.ack;
+  ack.info = recvFrame.recvInfo;
+  wp->ackTransfer(recvFrame, wpDataInfo.index, ack);
+}
+
+void
+WaypointMission::downloadCallback(Vehicle* vehicle, RecvContainer recvFrame,
+                                  UserData userData)
+{
+  WaypointMission* wp  = (WaypointMission*)userData;
+  int              pos = -1;
+
+  if (!wp->uploadStatus.running || wp->downloadIndex == NULL)
+    return;
+  //! A NACK carries no index; the callback slot tells the request
+  for (int i = 0; i < wp->uploadNext && pos < 0; ++i)
+    if (wp->uploadSlot[i].state == UPLOAD_IN_FLIGHT &&
+        wp->uploadSlot[i].cbIndex == recvFrame.dispatchInfo.callbackID)
+      pos = i;
+  if (pos < 0)
+    return;
+
+  size_t         length = recvFrame.recvInfo.len - Protocol::PackageMin;
+  ACK::ErrorCode ack;
+  ack.data = recvFrame.recvData.missionACK;
+  ack.info = recvFrame.recvInfo;
+
+  if (!ACK::getError(ack))
+  {
+    if (pos < wp->info.indexNumber &&
+        length >= sizeof(ACK::WayPointIndexInternal))
+      wp->downloadIndex[pos] = recvFrame.recvData.wpIndexACK.data;
+    else if (pos == wp->info.indexNumber &&
+             length >= sizeof(ACK::WayPointInitInternal))
+      wp->downloadInfo = recvFrame.recvData.wpInitACK.data;
+    else
+    {
+      DERROR("ACK is exception, sequence %d\n", recvFrame.recvInfo.seqNumber);
+      ack.data = OpenProtocol::ErrorCode::CommonACK::NO_RESPONSE_ERROR;
+    }
+  }
+  wp->ackTransfer(recvFrame, pos, ack);
+}
+
+void
+WaypointMission::ackTransfer(const RecvContainer& recvFrame, int pos,
+                             ACK::ErrorCode ack)
+{
+  if (ACK::getError(ack))
+  {
+    ACK::getErrorCodeMessage(ack, __func__);
+    finishUpload(recvFrame, pos, ack);
+    return;
+  }
+
+  uploadSlot[pos].state = UPLOAD_ACKED;
+  vehicle->protocolLayer->getThreadHandle()->lockNonBlockCBAck();
+  uploadStatus.acked++;
+  uploadStatus.inFlight--;
+  uploadStatus.ack = ack;
+  vehicle->protocolLayer->getThreadHandle()->freeNonBlockCBAck();
+
+  if (uploadStatus.acked == uploadStatus.total)
+    finishUpload(recvFrame, -1, ack);
+  else
+    fillUploadWindow();
+}
+
+void
+WaypointMission::uploadPollCallback(Vehicle* vehicle, RecvContainer recvFrame,
+                                    UserData userData)
+{
+  WaypointMission* wp  = (WaypointMission*)userData;
+  time_ms          now = vehicle->protocolLayer->getDriver()->getTimeStamp();
+
+  if (!wp->uploadStatus.running)
+    return;
+
+  ACK::ErrorCode timeout =
+    uploadAck(OpenProtocol::ErrorCode::CommonACK::NO_RESPONSE_ERROR);
+
+  for (int i = 0; i < wp->uploadNext; ++i)
+  {
+    UploadSlot* slot = &wp->uploadSlot[i];
+    if (slot->state != UPLOAD_IN_FLIGHT ||
+        now - slot->sentMs < UPLOAD_TIMEOUT_MS)
+      continue;
+    if (slot->attempts >= UPLOAD_ATTEMPTS)
+    {
+      wp->finishUpload(recvFrame, i, timeout);
+      return;
+    }
+    wp->sendUploadIndex(i);
+  }
+
+  if (wp->uploadDeadlineMs && now >= wp->uploadDeadlineMs)
+  {
+    for (int i = 0; i < wp->uploadCount; ++i)
+      if (wp->uploadSlot[i].state != UPLOAD_ACKED)
+      {
+        wp->finishUpload(recvFrame, i, timeout);
+        return;
+      }
+  }
+
+  wp->fillUploadWindow();
+}
+
 void
 WaypointMission::setWaypointEventCallback(VehicleCallBack callback,
                                           UserData        userData)
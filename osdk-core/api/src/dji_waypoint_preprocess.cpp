@@ -0,0 +1,341 @@
+/*! @file dji_waypoint_preprocess.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Local preprocessing of waypoint missions: path simplification and the
+ *  flight controller's constraint checks, run before anything is sent
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#include "dji_waypoint_preprocess.hpp"
+#include "dji_error.hpp"
+#include "dji_log.hpp"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace DJI;
+using namespace DJI::OSDK;
+
+static const float64_t EARTH_RADIUS = 6378137.0;
+
+WaypointPreprocessor::WaypointPreprocessor()
+  : capacity(0)
+  , east(NULL)
+  , north(NULL)
+  , up(NULL)
+  , length(NULL)
+  , keep(NULL)
+  , stack(NULL)
+{
+  getDefaultLimits(&limits);
+}
+
+WaypointPreprocessor::~WaypointPreprocessor()
+{
+  free(east);
+  free(north);
+  free(up);
+  free(length);
+  free(keep);
+  free(stack);
+}
+
+void
+WaypointPreprocessor::getDefaultLimits(WaypointLimits* limits)
+{
+  limits->maxPoints      = 255;
+  limits->minDistance    = 0.5f;
+  limits->maxDistance    = 2000;
+  limits->minAltitude    = -200;
+  limits->maxAltitude    = 500;
+  limits->minMaxVelocity = 2;
+  limits->maxMaxVelocity = 15;
+  limits->maxActions     = 15;
+  //! Stay, photo, record start, record stop, yaw, gimbal pitch
+  limits->maxActionType = 5;
+}
+
+void
+WaypointPreprocessor::setLimits(const WaypointLimits& limits)
+{
+  this->limits = limits;
+}
+
+void
+WaypointPreprocessor::getLimits(WaypointLimits* limits) const
+{
+  *limits = this->limits;
+}
+
+bool
+WaypointPreprocessor::reserve(int count)
+{
+  if (count <= capacity)
+    return true;
+
+  //! Arrays that did grow are kept; capacity moves only once all have
+  float32_t* e = (float32_t*)realloc(east, count * sizeof(float32_t));
+  if (e)
+    east = e;
+  float32_t* n = (float32_t*)realloc(north, count * sizeof(float32_t));
+  if (n)
+    north = n;
+  float32_t* u = (float32_t*)realloc(up, count * sizeof(float32_t));
+  if (u)
+    up = u;
+  float32_t* l = (float32_t*)realloc(length, count * sizeof(float32_t));
+  if (l)
+    length = l;
+  uint8_t* k = (uint8_t*)realloc(keep, count * sizeof(uint8_t));
+  if (k)
+    keep = k;
+  //! Douglas-Peucker pushes at most two ranges per kept waypoint
+  int* s = (int*)realloc(stack, 2 * count * sizeof(int));
+  if (s)
+    stack = s;
+
+  if (!e || !n || !u || !l || !k || !s)
+  {
+    DERROR("Lack of memory\n");
+    return false;
+  }
+  capacity = count;
+  return true;
+}
+
+void
+WaypointPreprocessor::toLocal(const WayPointSettings* wp, int count)
+{
+  //! Flat earth around the first waypoint; missions span a few km at most,
+  //! where single precision still resolves millimetres
+  float64_t lat0   = wp[0].latitude;
+  float64_t lon0   = wp[0].longitude;
+  float64_t scaleE = EARTH_RADIUS * cos(lat0);
+
+  //! One pass over the packed settings; waypoints with actions are marked
+  //! in keep on the way
+  for (int i = 0; i < count; ++i)
+  {
+    east[i]  = (float32_t)((wp[i].longitude - lon0) * scaleE);
+    north[i] = (float32_t)((wp[i].latitude - lat0) * EARTH_RADIUS);
+    up[i]    = wp[i].altitude;
+    keep[i]  = wp[i].hasAction || wp[i].actionNumber;
+  }
+}
+
+int
+WaypointPreprocessor::simplify(const WayPointSettings* in, int count,
+                               float32_t tolerance, WayPointSettings* out,
+                               int maxOut)
+{
+  if (count <= 0)
+    return 0;
+  if (!reserve(count))
+    return -1;
+  toLocal(in, count);
+
+  //! Waypoints with actions anchor the path like its ends
+  keep[0]         = 1;
+  keep[count - 1] = 1;
+
+  float32_t tolerance2 = tolerance * tolerance;
+  int       top        = 0;
+  for (int a = 0, b = 1; b < count; ++b)
+  {
+    if (!keep[b])
+      continue;
+    stack[top++] = a;
+    stack[top++] = b;
+    a            = b;
+
+    while (top)
+    {
+      int last  = stack[--top];
+      int first = stack[--top];
+      if (last - first < 2)
+        continue;
+
+      //! Locals, so the stores below cannot alias what the loop reads
+      const float32_t* e   = east;
+      const float32_t* n   = north;
+      const float32_t* u   = up;
+      float32_t*       d2  = length;
+      float32_t        e0  = e[first];
+      float32_t        n0  = n[first];
+      float32_t        u0  = u[first];
+      float32_t        dx  = e[last] - e0;
+      float32_t        dy  = n[last] - n0;
+      float32_t        dz  = u[last] - u0;
+      float32_t        len = dx * dx + dy * dy + dz * dz;
+      float32_t        inv = len > 0 ? 1 / len : 0;
+
+      //! Squared distances to the segment, clamped to its ends, go to the
+      //! length scratch first so this loop vectorises; then the farthest
+      for (int i = first + 1; i < last; ++i)
+      {
+        float32_t px = e[i] - e0;
+        float32_t py = n[i] - n0;
+        float32_t pz = u[i] - u0;
+        float32_t t  = (px * dx + py * dy + pz * dz) * inv;
+        //! Clamp t to [0, 1] without branches, which would stop vectorising
+        t = 0.5f * (t + fabsf(t));
+        t = 0.5f * (t + 1 - fabsf(t - 1));
+        px -= t * dx;
+        py -= t * dy;
+        pz -= t * dz;
+        d2[i] = px * px + py * py + pz * pz;
+      }
+      float32_t worst = length[first + 1];
+      int       split = first + 1;
+      for (int i = first + 2; i < last; ++i)
+      {
+        if (length[i] > worst)
+        {
+          worst = length[i];
+          split = i;
+        }
+      }
+      if (worst > tolerance2)
+      {
+        keep[split]  = 1;
+        stack[top++] = first;
+        stack[top++] = split;
+        stack[top++] = split;
+        stack[top++] = last;
+      }
+    }
+  }
+
+  int kept = 0;
+  for (int i = 0; i < count; ++i)
+  {
+    if (!keep[i])
+      continue;
+    if (kept < maxOut)
+    {
+      out[kept]       = in[i];
+      out[kept].index = (uint8_t)kept;
+    }
+    kept++;
+  }
+  return kept;
+}
+
+static void
+addViolation(WaypointViolation* violations, int maxViolations, int* found,
+             int index, uint8_t ack, const char* field, float32_t value,
+             float32_t limit)
+{
+  if (violations && *found < maxViolations)
+  {
+    WaypointViolation* v = &violations[*found];
+    v->index             = index;
+    v->ack               = ack;
+    v->field             = field;
+    v->value             = value;
+    v->limit             = limit;
+  }
+  (*found)++;
+}
+
+int
+WaypointPreprocessor::validate(const WayPointInitSettings* info,
+                               const WayPointSettings* wp, int count,
+                               WaypointViolation* violations,
+                               int maxViolations)
+{
+  int found = 0;
+
+#define VIOLATION(index, ack, field, value, limit)                            \
+  addViolation(violations, maxViolations, &found, index,                     \
+               ErrorCode::MissionACK::ack, field, value, limit)
+
+  if (count > limits.maxPoints)
+    VIOLATION(-1, WayPoint::POINT_OVERFLOW, "indexNumber", count,
+              limits.maxPoints);
+  if (count < 2)
+    VIOLATION(-1, WayPoint::POINTS_NOT_ENOUGH, "indexNumber", count, 2);
+  if (info)
+  {
+    if (info->indexNumber != count)
+      VIOLATION(-1, WayPoint::INVALID_DATA, "indexNumber", info->indexNumber,
+                count);
+    if (info->maxVelocity < limits.minMaxVelocity)
+      VIOLATION(-1, WayPoint::INVALID_VELOCITY, "maxVelocity",
+                info->maxVelocity, limits.minMaxVelocity);
+    if (info->maxVelocity > limits.maxMaxVelocity)
+      VIOLATION(-1, WayPoint::INVALID_VELOCITY, "maxVelocity",
+                info->maxVelocity, limits.maxMaxVelocity);
+    if (fabsf(info->idleVelocity) > info->maxVelocity)
+      VIOLATION(-1, WayPoint::INVALID_VELOCITY, "idleVelocity",
+                info->idleVelocity, info->maxVelocity);
+  }
+  if (count <= 0)
+    return found;
+  if (!reserve(count))
+    return -1;
+  toLocal(wp, count);
+
+  //! Squared segment lengths in one pass the compiler can vectorise; the
+  //! square root is only taken for a violation
+  const float32_t* e  = east;
+  const float32_t* n  = north;
+  const float32_t* u  = up;
+  float32_t*       l2 = length;
+  for (int i = 0; i < count - 1; ++i)
+  {
+    float32_t dx = e[i + 1] - e[i];
+    float32_t dy = n[i + 1] - n[i];
+    float32_t dz = u[i + 1] - u[i];
+    l2[i]        = dx * dx + dy * dy + dz * dz;
+  }
+  l2[count - 1] = HUGE_VALF;
+
+  float32_t minDistance2 = limits.minDistance * limits.minDistance;
+  float32_t maxDistance2 = limits.maxDistance * limits.maxDistance;
+  bool      coordinated  = info && info->traceMode == 1;
+  for (int i = 0; i < count; ++i)
+  {
+    const WayPointSettings* p = &wp[i];
+    if (i < count - 1 && l2[i] < minDistance2)
+      VIOLATION(i, WayPoint::POINTS_TOO_CLOSE, "distance", sqrtf(l2[i]),
+                limits.minDistance);
+    if (i < count - 1 && l2[i] > maxDistance2)
+      VIOLATION(i, WayPoint::POINTS_TOO_FAR, "distance", sqrtf(l2[i]),
+                limits.maxDistance);
+    if (p->altitude < limits.minAltitude)
+      VIOLATION(i, Common::TOO_LOW, "altitude", p->altitude,
+                limits.minAltitude);
+    if (p->altitude > limits.maxAltitude)
+      VIOLATION(i, Common::TOO_HIGH, "altitude", p->altitude,
+                limits.maxAltitude);
+
+    //! A coordinated turn must end before half of either adjacent leg
+    float32_t leg2 = (i > 0 && l2[i - 1] < l2[i]) ? l2[i - 1] : l2[i];
+    float32_t turn = p->damping * 2;
+    if (p->damping < 0)
+      VIOLATION(i, WayPoint::INVALID_POINT_DATA, "damping", p->damping, 0);
+    else if (coordinated && turn * turn > leg2)
+      VIOLATION(i, WayPoint::INVALID_POINT_DATA, "damping", p->damping,
+                sqrtf(leg2) / 2);
+
+    if (p->actionNumber > limits.maxActions)
+      VIOLATION(i, WayPoint::INVALID_ACTION, "actionNumber", p->actionNumber,
+                limits.maxActions);
+    if (!p->hasAction != !p->actionNumber)
+      VIOLATION(i, WayPoint::INVALID_ACTION, "hasAction", p->hasAction,
+                p->actionNumber ? 1 : 0);
+    for (int a = 0; a < p->actionNumber && a < 16; ++a)
+      if (p->commandList[a] > limits.maxActionType)
+        VIOLATION(i, WayPoint::INVALID_ACTION, "commandList",
+                  p->commandList[a], limits.maxActionType);
+  }
+
+#undef VIOLATION
+  return found;
+}
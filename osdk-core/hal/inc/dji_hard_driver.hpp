@@ -22,6 +22,19 @@ namespace DJI
 {
 namespace OSDK
 {
+
+//! UART error counters as kept by the serial driver (cumulative)
+typedef struct LineCounters
+{
+  uint32_t rx;
+  uint32_t tx;
+  uint32_t frame;
+  uint32_t overrun; //! UART FIFO overrun
+  uint32_t parity;
+  uint32_t brk;
+  uint32_t bufOverrun; //! driver buffer overrun
+} LineCounters;
+
 class HardDriver
 {
 public:
@@ -82,6 +95,11 @@ public:
   {
     return true;
   }
+  //! @return false if the driver has no such counters
+  virtual bool getLineCounters(LineCounters* /*counters*/)
+  {
+    return false;
+  }
 
 public:
   //! @todo move to Logging class
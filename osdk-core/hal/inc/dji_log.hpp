@@ -20,7 +20,12 @@
 #define __func__ __FUNCTION__
 #endif // WIN32
 
+//! @note Levels are compile-time constants: a disabled level leaves a loop
+//! that never runs, so neither the call nor its arguments survive. A loop
+//! rather than if/else, so an unbraced if (x) DERROR(...); else stays
+//! unambiguous.
 #define DLOG(_title_)                                                          \
+  for (bool _dlog_on_ = (_title_); _dlog_on_; _dlog_on_ = false)               \
   DJI::OSDK::Log::instance()                                                   \
     .title((_title_), #_title_, __func__, __LINE__)                            \
     .print
@@ -43,12 +48,15 @@ namespace OSDK
 class Log : public Singleton<Log>
 {
 public:
-  Log(Mutex* m = 0);
+  Log(Mutex* m = 0, bool enabled = true);
   ~Log();
 
   //! @note if title level is 0, this log would not be print at all
-  //! this feature is used for dynamical/statical optional log output
-  Log& title(int level, const char* prefix, const char* func, int line);
+  //! this feature is used for dynamical/statical optional log output.
+  //! Disabled levels return a muted Log instead of flipping state on the
+  //! shared instance, so threads of different vehicles can log concurrently.
+  virtual Log& title(int level, const char* prefix, const char* func,
+                     int line);
 
   Log& print();
 
@@ -73,6 +81,9 @@ public:
   Log& operator<<(int8_t c);
   Log& operator<<(const char* str);
 
+protected:
+  static Log& mute();
+
 private:
   Mutex* mutex;
   bool   vaild;
@@ -10,6 +10,9 @@
 #ifndef ONBOARDSDK_THREADMANAGER_H
 #define ONBOARDSDK_THREADMANAGER_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 namespace DJI
 {
 namespace OSDK
@@ -18,6 +21,38 @@ namespace OSDK
 //! Forward Declaration of vehicle
 class Vehicle;
 
+/*! @brief Scheduling of one SDK thread. All zero keeps the OS defaults.
+ */
+typedef struct ThreadSchedule
+{
+  enum Policy
+  {
+    POLICY_DEFAULT, //! time-sharing (SCHED_OTHER)
+    POLICY_FIFO,
+    POLICY_RR
+  };
+
+  int      policy;
+  int      priority; //! 1..99 for POLICY_FIFO and POLICY_RR
+  uint64_t cpuMask;  //! bit n allows CPU n, 0 keeps the inherited affinity
+} ThreadSchedule;
+
+/*! @brief Real-time setup of the SDK threads, passed to Vehicle.
+ *  Zero-initialize and fill in what you need; real-time policies and
+ *  lockMemory need CAP_SYS_NICE / CAP_IPC_LOCK or matching rlimits.
+ *  Settings that are refused are reported and skipped.
+ */
+typedef struct ThreadConfig
+{
+  ThreadSchedule read;
+  ThreadSchedule callback;
+
+  bool   lockMemory;          //! mlockall() current and future pages
+  size_t stackSize;           //! 0 for the default
+  size_t prefaultStack;       //! bytes of stack touched at thread start
+  bool   priorityInheritance; //! PTHREAD_PRIO_INHERIT for the SDK mutexes
+} ThreadConfig;
+
 //! @todo start use this class
 class Mutex
 {
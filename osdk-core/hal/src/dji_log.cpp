@@ -17,7 +17,8 @@
 
 using namespace DJI::OSDK;
 
-Log::Log(Mutex* m)
+Log::Log(Mutex* m, bool enabled)
+  : vaild(enabled)
 {
   if (m)
   {
@@ -36,20 +37,23 @@ Log::~Log()
 Log&
 Log::title(int level, const char* prefix, const char* func, int line)
 {
-  if (level)
+  if (!level)
   {
-    vaild = true;
-
-    const char str[] = "\n%s/%d @ %s, L%d: ";
-    print(str, prefix, level, func, line);
-  }
-  else
-  {
-    vaild = false;
+    return mute();
   }
+
+  const char str[] = "\n%s/%d @ %s, L%d: ";
+  print(str, prefix, level, func, line);
   return *this;
 }
 
+Log&
+Log::mute()
+{
+  static Log muted(0, false);
+  return muted;
+}
+
 Log&
 Log::print()
 {
@@ -0,0 +1,148 @@
+/*! @file linux_async_log.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Asynchronous binary logger for DSTATUS/DERROR/DDEBUG on Linux
+ *
+ *  @copyright
+ *  2016-17 DJI. All rights reserved.
+ * */
+
+#ifndef LINUX_ASYNC_LOG_H
+#define LINUX_ASYNC_LOG_H
+
+#include "dji_log.hpp"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+namespace DJI
+{
+namespace OSDK
+{
+
+/*! @brief Destination of formatted log lines
+ *  @note write() is only ever called from the logger thread
+ */
+class LogSink
+{
+public:
+  virtual ~LogSink()
+  {
+  }
+
+  //! prefix is the level name ("STATUS", "ERROR", "DEBUG") or NULL when the
+  //! line was written without a title
+  virtual void write(const char* prefix, const char* text, size_t len) = 0;
+  virtual void flush()
+  {
+  }
+};
+
+class StdoutLogSink : public LogSink
+{
+public:
+  void write(const char* prefix, const char* text, size_t len);
+  void flush();
+};
+
+class FileLogSink : public LogSink
+{
+public:
+  FileLogSink(const char* path);
+  ~FileLogSink();
+
+  bool isOpen() const;
+  void write(const char* prefix, const char* text, size_t len);
+  void flush();
+
+private:
+  FILE* file;
+};
+
+class SyslogLogSink : public LogSink
+{
+public:
+  SyslogLogSink(const char* ident = "djiosdk");
+  ~SyslogLogSink();
+
+  void write(const char* prefix, const char* text, size_t len);
+};
+
+/*! @brief Drop-in replacement for the Log singleton
+ *
+ *  @details Once started, DSTATUS/DERROR/DDEBUG cost the calling thread a
+ *  scan of the format string and a copy of the raw arguments into a
+ *  per-thread single-producer ring; no formatting, no lock, no syscall.
+ *  A background thread drains the rings, formats the records exactly like
+ *  Log does and hands the lines to the sink.
+ *
+ *  The format string pointer is the record id, so formats must be string
+ *  literals (as they are throughout the SDK). %s arguments are copied, up
+ *  to MAX_STRING bytes. Lines of one thread keep their order; lines of
+ *  different threads are only ordered per drain pass. When a ring is full
+ *  the record is dropped and counted.
+ */
+class AsyncLog : public Log
+{
+public:
+  static const size_t RING_SIZE   = 64 * 1024; //! per thread, power of 2
+  static const size_t MAX_RECORD  = 512;
+  static const size_t MAX_STRING  = 128;
+  static const size_t MAX_LINE    = 1024;
+  static const int    IDLE_WAITUS = 1000;
+
+public:
+  /*! @brief Route Log::instance() to the async logger
+   *  @param sink destination, owned by the caller; stdout when NULL
+   */
+  static bool start(LogSink* sink = 0);
+  //! Drain everything recorded so far and restore the synchronous Log
+  static void stop();
+  //! Block until every record written before the call reached the sink
+  static void flush();
+  static uint64_t getDropped();
+
+  Log& title(int level, const char* prefix, const char* func, int line);
+  Log& print(const char* fmt, ...);
+
+private:
+  typedef struct Ring
+  {
+    uint8_t           data[RING_SIZE];
+    volatile uint64_t head; //! producer position, bytes
+    volatile uint64_t tail; //! consumer position, bytes
+    volatile uint64_t dropped;
+    volatile int      owned;
+    Ring*             next;
+  } Ring;
+
+  AsyncLog();
+  ~AsyncLog();
+
+  static Ring* localRing();
+  static void  releaseRing(void* ring);
+  static void* drainCall(void* param);
+  void         drain();
+  bool         drainOnce();
+  void         format(const uint8_t* record, uint32_t size);
+
+private:
+  static AsyncLog* logger;
+  static Log*      previous;
+
+  LogSink*          sink;
+  LogSink*          ownedSink;
+  pthread_t         thread;
+  volatile bool     running;
+  Ring* volatile    rings;
+  volatile uint64_t reported;
+  pthread_key_t     ringKey;
+};
+
+} // namespace OSDK
+} // namespace DJI
+
+#endif // LINUX_ASYNC_LOG_H
@@ -0,0 +1,231 @@
+/*! @file linux_broker.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Local broker multiplexing one Vehicle link across client processes
+ *  over a Unix-domain socket
+ *
+ *  @copyright
+ *  2016-17 DJI. All rights reserved.
+ * */
+
+#ifndef LINUX_BROKER_H
+#define LINUX_BROKER_H
+
+#include "dji_vehicle_callback.hpp"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace DJI
+{
+namespace OSDK
+{
+
+// Forward Declarations
+class Vehicle;
+
+/*! @brief Wire format between VehicleBroker and BrokerClient
+ *
+ *  @details Clients send SOCK_SEQPACKET messages holding one or more
+ *  Request records back to back, each followed by its payload. The broker
+ *  answers with one Reply (plus payload) per message.
+ */
+namespace Broker
+{
+const char* const DEFAULT_PATH  = "/tmp/djiosdk-broker.sock";
+const size_t      MAX_MESSAGE   = 4096;
+const size_t      MAX_PAYLOAD   = 256;
+const int         MAX_CLIENT    = 32;
+const int         MAX_QUEUE     = 256;
+const int         MAX_IN_FLIGHT = 24; //! of the 30 CMD sessions (2 - 31)
+
+enum RequestType
+{
+  REQUEST_COMMAND  = 1,
+  REQUEST_PUSH_ON  = 2,
+  REQUEST_PUSH_OFF = 3
+};
+
+enum ReplyType
+{
+  REPLY_ACK      = 1,
+  REPLY_TIMEOUT  = 2,
+  REPLY_REJECTED = 3,
+  REPLY_PUSH     = 4
+};
+
+#pragma pack(1)
+typedef struct Request
+{
+  uint8_t  type;
+  uint8_t  cmd_set;
+  uint8_t  cmd_id;
+  uint8_t  encrypt : 1;
+  uint8_t  needAck : 1; //! 0 sends in session 0, no reply
+  uint8_t  reserved : 6;
+  uint16_t timeout; //! ms
+  uint16_t retry;
+  uint32_t tag; //! echoed back in the Reply
+  uint16_t length;
+} Request; // pack(1)
+
+typedef struct Reply
+{
+  uint8_t  type;
+  uint8_t  cmd_set;
+  uint8_t  cmd_id;
+  uint8_t  reserved;
+  uint32_t tag;
+  uint16_t length;
+} Reply; // pack(1)
+#pragma pack()
+
+typedef struct Stats
+{
+  uint64_t requests;  //! commands received from clients
+  uint64_t forwarded; //! commands written to the link
+  uint64_t acked;
+  uint64_t timedOut;
+  uint64_t rejected;
+  uint64_t pushed;  //! push frames delivered to clients
+  uint64_t batches; //! client messages, each may carry several requests
+} Stats;
+
+} // namespace Broker
+
+/*! @brief Owns the Vehicle link and serves commands for local clients
+ *
+ *  @details A single server thread drains every readable client socket,
+ *  queues the requests, then submits as many as there are free ACK
+ *  sessions back to back so the link stays busy. ACKs are matched by the
+ *  Protocol (session + sequence number) to a callback slot, which maps
+ *  back to the requesting client and its tag. The broker reserves its
+ *  callback slots on the Vehicle for as long as it runs, so other Vehicle
+ *  calls never reuse them. Push frames are fanned out
+ *  to the clients that asked for them.
+ */
+class VehicleBroker
+{
+public:
+  VehicleBroker(Vehicle* vehicle);
+  ~VehicleBroker();
+
+  bool start(const char* path = Broker::DEFAULT_PATH);
+  void stop();
+
+  Broker::Stats getStats();
+
+  static void ackCallback(Vehicle* vehicle, RecvContainer recvFrame,
+                          UserData userData);
+  static void pushCallback(Vehicle* vehicle, RecvContainer recvFrame,
+                           UserData userData);
+
+private:
+  typedef struct Client
+  {
+    int      fd;
+    uint32_t generation;
+    bool     push;
+  } Client;
+
+  typedef struct Queued
+  {
+    int             client;
+    uint32_t        generation;
+    Broker::Request req;
+    uint8_t         buf[Broker::MAX_PAYLOAD + 2];
+  } Queued;
+
+  typedef struct Pending
+  {
+    bool     used;
+    int      client;
+    uint32_t generation;
+    uint32_t tag;
+    uint8_t  cmd_set;
+    uint8_t  cmd_id;
+    uint64_t deadline;
+    uint32_t handle; //! for Protocol::cancel() on timeout
+  } Pending;
+
+  static void* serverCall(void* param);
+  void serve();
+  void acceptClient();
+  bool readClient(int index);
+  void dropClient(int index);
+  void dispatch();
+  void expire();
+  void reply(int client, uint32_t generation, uint8_t type, uint8_t cmd_set,
+             uint8_t cmd_id, uint32_t tag, const uint8_t* data, size_t len);
+
+private:
+  Vehicle*  vehicle;
+  pthread_t serverThread;
+  bool      running; //! read by the server thread, so __atomic only
+  int       listenFd;
+  int       wakeFd[2];
+  char      path[108];
+
+  //! Guards clients, pending and stats; queue is server-thread only
+  pthread_mutex_t lock;
+  Client          clients[Broker::MAX_CLIENT];
+  uint32_t        generation;
+  Pending         pending[Broker::MAX_IN_FLIGHT];
+  int             inFlight;
+  int             ackBase; //! Vehicle callback slot of pending[0]
+  Broker::Stats   stats;
+
+  Queued queue[Broker::MAX_QUEUE];
+  int    queueHead;
+  int    queueTail;
+};
+
+/*! @brief Client side of the broker, one per process or thread
+ */
+class BrokerClient
+{
+public:
+  BrokerClient();
+  ~BrokerClient();
+
+  bool connect(const char* path = Broker::DEFAULT_PATH);
+  void close();
+
+  /*! @brief Append a command to the outgoing batch. The batch is flushed
+   *  automatically when the next command would not fit.
+   */
+  bool queue(const uint8_t cmd[], const void* data, size_t len, uint32_t tag,
+             bool needAck = true, int timeout = 500, int retry = 1,
+             bool encrypt = false);
+  bool flush();
+  bool send(const uint8_t cmd[], const void* data, size_t len, uint32_t tag,
+            bool needAck = true, int timeout = 500, int retry = 1,
+            bool encrypt = false);
+
+  bool setPushData(bool enable);
+
+  /*! @brief Receive one ACK/timeout/push
+   *  @param timeoutMs negative to block
+   *  @return false on timeout or closed broker
+   */
+  bool receive(Broker::Reply* reply, uint8_t* data, size_t maxLen,
+               int timeoutMs = -1);
+
+  int getFd() const;
+
+private:
+  bool append(const Broker::Request& req, const void* data);
+
+private:
+  int     fd;
+  uint8_t batch[Broker::MAX_MESSAGE];
+  size_t  batchLen;
+};
+
+} // namespace OSDK
+} // namespace DJI
+
+#endif // LINUX_BROKER_H
@@ -0,0 +1,215 @@
+/*! @file linux_capture.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Raw link capture to a memory-mapped file and replay through Protocol
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#ifndef LINUX_CAPTURE_H
+#define LINUX_CAPTURE_H
+
+#include "dji_hard_driver.hpp"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace DJI
+{
+namespace OSDK
+{
+
+/*! @brief Capture file layout
+ *
+ *  @details A FileHeader followed by records:
+ *  varint(length << 1 | direction), varint(us since previous record), bytes.
+ *  Zero-length records are never written, so a 0 byte ends the data; a file
+ *  left behind by a crash is readable up to its last complete record.
+ */
+namespace Capture
+{
+const uint32_t MAGIC   = 0x43494A44; // "DJIC"
+const uint16_t VERSION = 1;
+
+enum Direction
+{
+  RX = 0, //! from the flight controller
+  TX = 1  //! to the flight controller
+};
+
+typedef struct FileHeader
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t headerSize;
+  uint64_t startNs;         //! CLOCK_MONOTONIC at open
+  uint64_t startRealtimeNs; //! CLOCK_REALTIME at open
+  uint64_t dataSize;        //! record bytes, 0 until closed cleanly
+} FileHeader;
+
+typedef struct Record
+{
+  int            direction;
+  uint64_t       timeNs; //! since the start of the capture
+  const uint8_t* data;
+  size_t         length;
+} Record;
+} // namespace Capture
+
+/*! @brief Appends records to a capture file through a sliding mmap window
+ *  @details Thread safe; send() and readall() run on different threads.
+ */
+class CaptureWriter
+{
+public:
+  CaptureWriter();
+  ~CaptureWriter();
+
+  bool open(const char* path);
+  void close();
+  bool isOpen() const;
+
+  void write(int direction, const uint8_t* data, size_t length);
+  //! Bytes captured so far, both directions
+  uint64_t getBytes() const;
+
+  static const size_t WINDOW_SIZE = 4 << 20;
+
+private:
+  bool map(uint64_t offset);
+  void put(const uint8_t* data, size_t length);
+  void putVarint(uint64_t value);
+
+private:
+  int             fd;
+  uint8_t*        window;
+  uint64_t        windowOffset;
+  uint64_t        position;
+  uint64_t        lastNs;
+  uint64_t        bytes;
+  pthread_mutex_t lock;
+};
+
+class CaptureReader
+{
+public:
+  CaptureReader();
+  ~CaptureReader();
+
+  bool open(const char* path);
+  void close();
+
+  //! @return false at the end of the capture or on a damaged record
+  bool next(Capture::Record* record);
+  void rewind();
+  //! Resume from a position and record time saved with tell() and getTimeNs()
+  void seek(size_t position, uint64_t timeNs);
+  size_t   tell() const;
+  uint64_t getTimeNs() const;
+
+  const Capture::FileHeader* getHeader() const;
+
+private:
+  bool getVarint(uint64_t* value);
+
+private:
+  uint8_t* data;
+  size_t   size;
+  size_t   position;
+  size_t   end;
+  uint64_t timeNs;
+};
+
+/*! @brief Decorator that records the exact byte stream of another driver
+ *
+ *  @details Wrap the real driver and hand the decorator to Vehicle:
+ *  @code
+ *  Vehicle* v = new Vehicle(new CaptureDriver(
+ *    new LinuxSerialDevice("/dev/ttyUSB0", 230400), "flight.cap"), true);
+ *  v->functionalSetUp();
+ *  @endcode
+ *  Takes ownership of driver. Capture stops if the file cannot be opened;
+ *  the link keeps working.
+ */
+class CaptureDriver : public HardDriver
+{
+public:
+  CaptureDriver(HardDriver* driver, const char* path);
+  ~CaptureDriver();
+
+  void    init();
+  time_ms getTimeStamp();
+  size_t send(const uint8_t* buf, size_t len);
+  size_t readall(uint8_t* buf, size_t maxlen);
+  bool getDeviceStatus();
+  bool getLineCounters(LineCounters* counters);
+
+  CaptureWriter* getWriter();
+
+private:
+  HardDriver*   driver;
+  CaptureWriter writer;
+};
+
+/*! @brief Plays the receive side of a capture back into Protocol
+ *
+ *  @details TIMED keeps the recorded gaps between reads, FAST hands out the
+ *  data as quickly as Protocol asks for it, packing consecutive reads into
+ *  one buffer. What Protocol sends is dropped.
+ *  Best driven without SDK threads:
+ *  @code
+ *  Vehicle v(replay, true, false);
+ *  while (!replay->isFinished())
+ *    v.pollReceive();
+ *  @endcode
+ */
+class ReplayDriver : public HardDriver
+{
+public:
+  enum Mode
+  {
+    FAST,
+    TIMED
+  };
+
+  ReplayDriver(const char* path, Mode mode = FAST);
+  ~ReplayDriver();
+
+  void    init();
+  time_ms getTimeStamp();
+  size_t send(const uint8_t* buf, size_t len);
+  size_t readall(uint8_t* buf, size_t maxlen);
+  bool getDeviceStatus();
+
+  //! Every RX byte has been handed out
+  bool isFinished() const;
+  //! RX bytes handed out so far
+  uint64_t getReplayedBytes() const;
+  //! From the first read to the last byte, or to now while running
+  uint64_t getElapsedNs() const;
+
+private:
+  bool nextRx();
+
+private:
+  CaptureReader   reader;
+  Mode            mode;
+  bool            opened;
+  Capture::Record record;
+  size_t          recordOffset; //! bytes of record already handed out
+  bool            hasRecord;
+  volatile bool   finished;
+  uint64_t        firstReadNs;
+  uint64_t        firstRecordNs;
+  uint64_t        finishNs;
+  uint64_t        replayedBytes;
+};
+
+} // namespace OSDK
+} // namespace DJI
+
+#endif // LINUX_CAPTURE_H
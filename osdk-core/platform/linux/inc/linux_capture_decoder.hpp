@@ -0,0 +1,134 @@
+/*! @file linux_capture_decoder.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Multi-threaded offline decoder for link captures and raw serial dumps
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#ifndef LINUX_CAPTURE_DECODER_H
+#define LINUX_CAPTURE_DECODER_H
+
+#include "dji_vehicle_callback.hpp"
+#include "linux_capture.hpp"
+#include "linux_shm_telemetry.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace DJI
+{
+namespace OSDK
+{
+
+/*! @brief One frame found in the receive stream
+ */
+typedef struct DecodedFrame
+{
+  enum Type
+  {
+    FRAME     = 0, //! anything but an unencrypted broadcast package
+    BROADCAST = 1
+  };
+
+  uint64_t       offset; //! of the SOF in the receive stream
+  uint64_t       timeNs; //! capture time of the read that completed it, 0 for raw dumps
+  const uint8_t* data;   //! the whole frame, valid during the handler call
+  uint16_t       length;
+  uint16_t       seqNumber;
+  uint8_t        sessionID;
+  uint8_t        isAck;
+  uint8_t        encrypted;
+  uint8_t        cmdSet; //! commands with unencrypted data only, else 0
+  uint8_t        cmdID;
+  uint8_t        type;
+  //! BROADCAST only; fields the package does not carry are zero
+  ShmBroadcastState broadcast;
+} DecodedFrame;
+
+typedef void (*DecodeHandler)(const DecodedFrame* frame, UserData userData);
+
+typedef struct DecodeStats
+{
+  uint64_t bytes;      //! receive stream size
+  uint64_t frames;
+  uint64_t broadcasts;
+  uint64_t chunks;
+  //! Chunks whose first frames had to be found again during the merge
+  uint64_t resyncedChunks;
+} DecodeStats;
+
+/*! @brief Splits a capture into chunks and decodes them on a thread pool
+ *
+ *  @details Accepts CaptureWriter files (receive side only) and raw dumps
+ *  of the serial line. Every chunk is scanned for frames with the rules of
+ *  Protocol::byteHandler, starting at the chunk start and reading up to one
+ *  receive buffer past the chunk end to finish the frame crossing it.
+ *  Chunks are merged in order on the calling thread: where the previous
+ *  chunk's last frame ends inside what a chunk took for a frame, the merge
+ *  scans again from there until both agree. The frames reported are the
+ *  ones Protocol finds feeding the same bytes one by one.
+ *
+ *  @code
+ *  CaptureDecoder decoder;
+ *  if (decoder.open("flight.cap"))
+ *    decoder.decode(frameHandler, &log);
+ *  @endcode
+ */
+class CaptureDecoder
+{
+public:
+  CaptureDecoder();
+  ~CaptureDecoder();
+
+  bool open(const char* path);
+  void close();
+
+  /*! @brief Decode the whole stream
+   *  @param handler called on the calling thread, in stream order
+   *  @param threadNumber workers, 0 for one per CPU
+   *  @param chunkSize receive bytes per chunk
+   *  @return false if nothing is open or memory ran out
+   */
+  bool decode(DecodeHandler handler, UserData userData, int threadNumber = 0,
+              size_t chunkSize = DEFAULT_CHUNK_SIZE);
+
+  //! Of the last decode()
+  const DecodeStats* getStats() const;
+
+  static const size_t DEFAULT_CHUNK_SIZE = 1 << 20;
+  //! Chunks decoded ahead of the merge, per worker
+  static const int AHEAD = 2;
+
+public:
+  //! Used by the worker threads
+  struct Chunk;
+  struct Pool;
+  void work(Pool* pool);
+
+private:
+  bool split(size_t chunkSize);
+  bool load(Chunk* chunk, CaptureReader* reader);
+  bool scan(Chunk* chunk);
+  void merge(Chunk* chunk, uint64_t* next, DecodeHandler handler,
+             UserData userData);
+  void release(Chunk* chunk);
+
+private:
+  char*       path;
+  uint8_t*    map;
+  size_t      mapSize;
+  bool        isCapture;
+  uint64_t    streamSize;
+  Chunk*      chunks;
+  size_t      chunkNumber;
+  DecodeStats stats;
+};
+
+} // namespace OSDK
+} // namespace DJI
+
+#endif // LINUX_CAPTURE_DECODER_H
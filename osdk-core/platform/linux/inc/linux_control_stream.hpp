@@ -0,0 +1,147 @@
+/*! @file linux_control_stream.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Fixed-rate stream of flight control setpoints, paced on absolute
+ *  deadlines, with a watchdog on the producer
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#ifndef LINUX_CONTROL_STREAM_H
+#define LINUX_CONTROL_STREAM_H
+
+#include "dji_control.hpp"
+#include "dji_thread_manager.hpp"
+#include "linux_trajectory_buffer.hpp"
+
+#include <pthread.h>
+
+namespace DJI
+{
+namespace OSDK
+{
+
+/*! @brief Counters of a control stream, since start() or resetStats()
+ */
+typedef struct ControlStreamStats
+{
+  uint64_t periods;      //! deadlines the stream woke up for
+  uint64_t sent;         //! setpoint frames sent
+  uint64_t braked;       //! emergencyBrake() frames sent by the watchdog
+  uint64_t missed;       //! deadlines skipped, woken a period late or more
+  uint64_t updates;      //! setpoints given by the producer
+  uint64_t coalesced;    //! setpoints replaced before any period sent them
+  uint64_t extrapolated; //! frames sent past the end of the trajectory
+  uint32_t watchdogTrips;
+  uint32_t lastJitterUs; //! wake-up past the deadline
+  uint32_t meanJitterUs;
+  uint32_t maxJitterUs;
+  bool     running;
+  bool     braking; //! watchdog holds the aircraft until the next setpoint
+} ControlStreamStats;
+
+/*! @brief Sends the latest flight control setpoint at a fixed rate
+ *
+ *  @details Control::flightCtrl() sends a frame each time it is called, so
+ *  a loop pacing it with usleep() drifts by its own run time and jitters
+ *  with the scheduler. Here a dedicated thread sleeps with clock_nanosleep()
+ *  to absolute CLOCK_MONOTONIC deadlines, one period apart, and sends the
+ *  setpoint at each of them. Producers only store a setpoint; the latest
+ *  one wins and is sent again every period until it is replaced. A wake-up
+ *  a whole period late skips the deadlines it missed instead of sending a
+ *  burst to catch up.
+ *
+ *  Once a setpoint is given, the watchdog expects the next one within
+ *  watchdogMs. If the producer stalls, each period sends emergencyBrake()
+ *  instead, until a new setpoint arrives.
+ *
+ *  With a TrajectoryBuffer attached, each period samples the trajectory
+ *  instead, and sends its velocity and yaw as an AdvancedCtrlData with the
+ *  horizontal acceleration as feedforward. Past the last knot the
+ *  trajectory is extrapolated at its final velocity; watchdogMs later the
+ *  watchdog brakes.
+ *
+ *  @code
+ *  ControlStream stream(vehicle);
+ *  stream.start(50);
+ *  while (flying)
+ *    stream.setVelocityAndYawRate(vx, vy, vz, 0); // any rate, any thread
+ *  stream.stop();
+ *  @endcode
+ */
+class ControlStream
+{
+public:
+  static const int DEFAULT_RATE     = 50; //! Hz
+  static const int DEFAULT_WATCHDOG = 200; //! ms
+  static const int MAX_RATE         = 1000;
+
+  ControlStream(Vehicle* vehicle);
+  ~ControlStream();
+
+  /*! @brief Start sending at rateHz from a new thread
+   *
+   *  @param watchdogMs longest setpoint age before braking, 0 disables
+   *  @param schedule policy, priority and CPU affinity of the thread, NULL
+   *  for the default; see ThreadConfig for the privileges it needs
+   *  @return false if running, rateHz is out of 1..MAX_RATE, or the thread
+   *  cannot be created
+   */
+  bool start(int rateHz = DEFAULT_RATE, int watchdogMs = DEFAULT_WATCHDOG,
+             const ThreadSchedule* schedule = NULL);
+  //! Stop sending; the setpoint is kept, but not sent by a later start()
+  void stop();
+  bool isRunning();
+
+  //! Replace the setpoint; it is sent from the next deadline on
+  void setSetpoint(const Control::CtrlData& data);
+  void setSetpoint(const Control::AdvancedCtrlData& data);
+  //! Setpoints of the modes of Control::positionAndYawCtrl() and
+  //! Control::velocityAndYawRateCtrl()
+  void setPositionAndYaw(float32_t x, float32_t y, float32_t z,
+                         float32_t yaw);
+  void setVelocityAndYawRate(float32_t Vx, float32_t Vy, float32_t Vz,
+                             float32_t yawRate);
+  /*! @brief Follow a trajectory instead of the setpoint
+   *
+   *  @param trajectory sampled by the stream thread only, so that thread
+   *  is its consumer; NULL goes back to the setpoint
+   */
+  void setTrajectory(TrajectoryBuffer* trajectory);
+
+  void getStats(ControlStreamStats* stats);
+  void resetStats();
+
+private:
+  static void* streamCall(void* param);
+  void stream();
+  void tick(uint64_t nowNs, uint64_t lateNs);
+  void store(const Control::AdvancedCtrlData& data, bool advanced);
+
+private:
+  Vehicle*  vehicle;
+  pthread_t thread;
+  bool      started;
+  bool      quit;
+  uint64_t  periodNs;
+  uint64_t  watchdogNs;
+
+  //! Guards what follows; held only to copy, never while sending
+  pthread_mutex_t           lock;
+  Control::AdvancedCtrlData setpoint;
+  bool                      advanced; //! else sent as a CtrlData
+  bool                      valid;    //! a setpoint was given
+  bool                      pending;  //! not sent yet
+  TrajectoryBuffer*         trajectory;
+  uint64_t                  updatedNs;
+  ControlStreamStats        stats;
+  uint64_t                  jitterSumUs;
+};
+
+} // namespace OSDK
+} // namespace DJI
+
+#endif // LINUX_CONTROL_STREAM_H
@@ -0,0 +1,149 @@
+/*! @file linux_fault_driver.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  HardDriver decorator injecting line faults, for stress tests of the
+ *  protocol resync and retransmission paths
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#ifndef LINUX_FAULT_DRIVER_H
+#define LINUX_FAULT_DRIVER_H
+
+#include "dji_hard_driver.hpp"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace DJI
+{
+namespace OSDK
+{
+
+/*! @brief What to inject; rates are probabilities in [0, 1]
+ */
+typedef struct FaultConfig
+{
+  enum Direction
+  {
+    RX   = 1, //! from the flight controller
+    TX   = 2,
+    BOTH = 3
+  };
+
+  double   bitFlipRate;   //! per byte, one random bit
+  double   byteDropRate;  //! per byte
+  double   truncateRate;  //! per frame, cut at a random length
+  double   duplicateRate; //! per frame, delivered twice
+  uint32_t latencyUs;     //! receive direction only
+  uint32_t jitterUs;      //! uniform in [0, jitterUs), order is kept
+  uint32_t seed;
+  uint8_t  directions;
+} FaultConfig;
+
+//! Per direction
+typedef struct FaultStats
+{
+  uint64_t bytes; //! before injection
+  uint64_t frames;
+  uint64_t bitFlips;
+  uint64_t bytesDropped;
+  uint64_t framesTruncated;
+  uint64_t framesDuplicated;
+} FaultStats;
+
+/*! @brief Wraps a driver and corrupts what goes through it
+ *
+ *  @details Transmit faults apply to each send(), which Protocol always
+ *  calls with one whole frame. On the receive side the clean stream from
+ *  the wrapped driver is cut into frames by SOF and length, so frame faults
+ *  hit whole frames there too; bytes outside a frame only get byte faults.
+ *  Latency and jitter hold received frames back without blocking readall()
+ *  and never reorder them; send() is never delayed, the caller's thread
+ *  would stall with it.
+ *
+ *  @code
+ *  FaultConfig config = {};
+ *  config.bitFlipRate = 1e-4;
+ *  config.directions  = FaultConfig::BOTH;
+ *  Vehicle* vehicle =
+ *    new Vehicle(new FaultDriver(new LinuxSerialDevice(device, baud), config));
+ *  @endcode
+ */
+class FaultDriver : public HardDriver
+{
+public:
+  //! Takes ownership of driver
+  FaultDriver(HardDriver* driver, const FaultConfig& config);
+  ~FaultDriver();
+
+  void    init();
+  time_ms getTimeStamp();
+  size_t send(const uint8_t* buf, size_t len);
+  size_t readall(uint8_t* buf, size_t maxlen);
+  bool getDeviceStatus();
+  bool getLineCounters(LineCounters* counters);
+
+  //! Takes effect on the next frame in each direction
+  void setConfig(const FaultConfig& config);
+  void getConfig(FaultConfig* config);
+  void getStats(FaultStats* rx, FaultStats* tx);
+
+  static const size_t MAX_FRAME = 1024;
+
+private:
+  //! Run of received bytes due at releaseUs
+  typedef struct Pending
+  {
+    uint64_t releaseUs;
+    uint64_t end; //! stream position after the run
+  } Pending;
+
+  typedef struct Stream
+  {
+    uint64_t   random;
+    FaultStats stats;
+  } Stream;
+
+  bool     chance(Stream* stream, double rate);
+  uint32_t next(Stream* stream);
+  //! Apply frame and byte faults to one unit; returns bytes written to out
+  size_t inject(Stream* stream, const FaultConfig* config, const uint8_t* in,
+                size_t length, bool isFrame, uint8_t* out);
+
+  void frameRx(const uint8_t* in, size_t length);
+  bool queueRx(const uint8_t* data, size_t length, bool isFrame);
+
+private:
+  HardDriver*     driver;
+  pthread_mutex_t configLock;
+  FaultConfig     config;
+  Stream          rx;
+  Stream          tx;
+
+  //! Receive framing of the clean stream
+  uint8_t frame[MAX_FRAME];
+  size_t  frameUsed;
+
+  //! Received bytes waiting for their release time; positions count
+  //! bytes since the start, delay[0] is at delayBase
+  uint8_t* delay;
+  size_t   delayCapacity;
+  uint64_t delayBase;
+  uint64_t delivered;
+  uint64_t queued;
+  Pending* pending;
+  size_t   pendingCapacity;
+  size_t   pendingHead;
+  size_t   pendingTail;
+  uint64_t lastReleaseUs;
+};
+
+} // namespace OSDK
+} // namespace DJI
+
+#endif // LINUX_FAULT_DRIVER_H
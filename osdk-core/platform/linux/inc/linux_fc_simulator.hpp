@@ -0,0 +1,257 @@
+/*! @file linux_fc_simulator.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Flight controller simulator speaking the OPEN protocol on a pseudo
+ *  terminal, for end-to-end runs of Vehicle without an aircraft
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#ifndef LINUX_FC_SIMULATOR_H
+#define LINUX_FC_SIMULATOR_H
+
+#include "dji_mission_type.hpp"
+#include "dji_telemetry.hpp"
+#include "dji_type.hpp"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace DJI
+{
+namespace OSDK
+{
+
+typedef struct FCSimulatorConfig
+{
+  uint16_t    broadcastHz;   //! initial rate of every broadcast channel
+  float64_t   homeLatitude;  //! rad
+  float64_t   homeLongitude; //! rad
+  float32_t   homeAltitude;  //! m, WGS 84
+  const char* hardware;      //! reported name, e.g. "M600"
+  const char* firmware;      //! "AA.BB.CC.DD"
+  const char* serial;
+  const char* encKey;        //! 64 hex digits; NULL answers in plain only
+  uint32_t    appId;         //! 0 activates any app ID
+  uint8_t     maxWaypoints;
+  uint32_t    baudRate;      //! pace output like a UART; 0 does not pace
+} FCSimulatorConfig;
+
+typedef struct FCSimulatorStats
+{
+  uint64_t framesIn;
+  uint64_t bytesIn;
+  uint64_t crcErrors;
+  uint64_t commands;   //! frames asking for an ack
+  uint64_t acks;
+  uint64_t controls;   //! flight control setpoints
+  uint64_t unknown;    //! commands answered with a bare ack or ignored
+  uint64_t framesOut;
+  uint64_t bytesOut;
+  uint64_t broadcasts;
+  uint64_t packages;   //! subscription pushes
+  uint64_t dropped;    //! frames not queued, the line could not keep up
+  uint64_t cpuNs;      //! simulator thread CPU time
+} FCSimulatorStats;
+
+/*! @brief Flight controller end of the serial link
+ *
+ *  @details Answers activation, version, broadcast frequency, subscription,
+ *  control authority, flight tasks, waypoint and hotpoint settings, and
+ *  MFIO with the acks a real flight controller gives, and streams broadcast
+ *  and subscription packages at the requested rates, up to 400 Hz. A simple
+ *  point-mass model flies takeoff, landing, go home and the flight control
+ *  setpoints, so telemetry moves the way the samples expect. Waypoint
+ *  missions are flown point to point at the idle velocity, with the reached
+ *  and finished events pushed like the aircraft does; hotpoint missions are
+ *  stored and acknowledged but not flown.
+ *
+ *  The receive(), step() and transmit() core runs without a pty, driven by
+ *  the caller's clock. openPty() and start() put it behind a pseudo
+ *  terminal served by its own thread; the slave side then works as the
+ *  device of LinuxSerialDevice. Broadcast timestamps carry the host
+ *  CLOCK_MONOTONIC, so a client on the same host can measure telemetry
+ *  latency from them.
+ *
+ *  @code
+ *  FCSimulatorConfig config;
+ *  FCSimulator::getDefaultConfig(&config);
+ *  FCSimulator sim(config);
+ *  sim.openPty("/tmp/ttyFC");
+ *  sim.start();
+ *  Vehicle* vehicle = new Vehicle(sim.getPtyName(), 230400, true);
+ *  @endcode
+ */
+class FCSimulator
+{
+public:
+  FCSimulator(const FCSimulatorConfig& config);
+  ~FCSimulator();
+
+  static void getDefaultConfig(FCSimulatorConfig* config);
+  static uint64_t monotonicUs();
+
+  //! Feed bytes received from the onboard computer
+  void receive(const uint8_t* buf, size_t len, uint64_t nowUs);
+  //! Advance the flight model and queue the telemetry that became due
+  void step(uint64_t nowUs);
+  //! Take queued bytes for the line
+  size_t transmit(uint8_t* buf, size_t maxlen);
+  size_t getPending();
+  //! Next time step() has something to do
+  uint64_t getNextDueUs();
+
+  /*! @brief Create the pty; linkPath, if given, becomes a symlink to the
+   *  slave so configurations can name a fixed device
+   */
+  bool openPty(const char* linkPath = NULL);
+  const char* getPtyName() const;
+  bool start();
+  void stop();
+
+  void getStats(FCSimulatorStats* stats);
+
+  static const size_t MAX_FRAME       = 1024;
+  static const int    CHANNELS        = 16;
+  static const int    MAX_PACKAGES    = 5;
+  static const int    MAX_TOPICS      = 32;
+  static const size_t MAX_OUTPUT      = 64 * 1024;
+  static const int    CONTROL_TIMEOUT = 100000; //! us without a setpoint
+
+private:
+  typedef enum Phase
+  {
+    PHASE_STOPPED,
+    PHASE_MOTORS,
+    PHASE_TAKEOFF,
+    PHASE_AIR,
+    PHASE_LANDING,
+    PHASE_GOHOME
+  } Phase;
+
+  typedef struct Airframe
+  {
+    Phase    phase;
+    uint64_t phaseUs;
+    uint64_t lastUs;
+    bool     sdkControl;
+    uint8_t  gear;
+    //! Local frame at home: north, east, up in m; yaw in rad
+    float32_t north;
+    float32_t east;
+    float32_t up;
+    float32_t yaw;
+    float32_t vNorth;
+    float32_t vEast;
+    float32_t vUp;
+    float32_t yawRate;
+    float32_t battery; //! percent
+    //! Last flight control setpoint
+    uint8_t   ctrlFlag;
+    float32_t ctrl[4];
+    float32_t ctrlFeedforward[2]; //! m/s^2, of an AdvancedCtrlData
+    uint64_t  ctrlUs;
+  } Airframe;
+
+  typedef struct Package
+  {
+    bool      used;
+    uint16_t  freq;
+    uint8_t   config;
+    uint8_t   numberOfTopics;
+    uint8_t   topics[MAX_TOPICS]; //! TopicName
+    uint64_t  nextUs;
+  } Package;
+
+  typedef struct Channel
+  {
+    uint16_t hz;
+    uint64_t nextUs;
+  } Channel;
+
+  void parse(uint64_t nowUs);
+  void handle(uint8_t* frame, uint64_t nowUs);
+  void handleCommand(const Header* header, const uint8_t* data,
+                     size_t length, uint64_t nowUs);
+
+  void onActivation(uint8_t id, const uint8_t* data, size_t length);
+  void onControl(uint8_t id, const uint8_t* data, size_t length,
+                 uint64_t nowUs);
+  bool onTask(uint8_t task, uint64_t nowUs, uint16_t* result);
+  void onMission(uint8_t id, const uint8_t* data, size_t length);
+  void onMFIO(uint8_t id, const uint8_t* data, size_t length);
+  void onSubscribe(uint8_t id, const uint8_t* data, size_t length,
+                   uint64_t nowUs);
+  uint8_t addPackage(const uint8_t* data, size_t length, uint64_t nowUs);
+
+  //! Answer to the command being handled
+  void ack(const void* data, size_t length);
+  void push(const uint8_t cmd[2], const void* data, size_t length);
+  bool frame(uint8_t session, bool isAck, bool isEnc, uint16_t seq,
+             const void* data, size_t length);
+
+  void fly(uint64_t nowUs);
+  bool followWaypoints(float32_t* north, float32_t* east, float32_t* up);
+  void setPhase(Phase phase, uint64_t nowUs);
+  uint8_t displayMode(uint64_t nowUs) const;
+  uint8_t flightStatus(uint64_t nowUs) const;
+
+  void   broadcast(uint64_t nowUs);
+  void   publish(uint64_t nowUs);
+  size_t topic(uint8_t name, uint8_t* out, uint64_t nowUs) const;
+  void   position(float64_t* latitude, float64_t* longitude) const;
+  void   quaternion(Telemetry::Quaternion* q) const;
+
+  static void* loop(void* self);
+  void serve();
+
+private:
+  FCSimulatorConfig config;
+  pthread_mutex_t   lock;
+  FCSimulatorStats  stats;
+  uint8_t           key[32];
+  bool              hasKey;
+  bool              activated;
+
+  //! Command being handled, for ack()
+  uint8_t  replySession;
+  uint16_t replySeq;
+  bool     replyEnc;
+
+  Airframe state;
+  Channel  channels[CHANNELS];
+  Package  packages[MAX_PACKAGES];
+  uint32_t mfio[8];
+
+  WayPointInitSettings waypointInit;
+  WayPointSettings*    waypoints;
+  bool                 waypointReady;
+  bool                 waypointRunning;
+  int                  waypointTarget; //! index flown to
+  HotPointSettings     hotpoint;
+  bool                 hotpointRunning;
+
+  uint8_t  input[2 * MAX_FRAME];
+  size_t   inputUsed;
+  uint8_t* output;
+  size_t   outputCapacity;
+  size_t   outputHead;
+  size_t   outputTail;
+
+  int       master;
+  int       slave;
+  char      ptyName[64];
+  char*     linkPath;
+  pthread_t thread;
+  bool      running;
+  int       wakeup[2];
+};
+
+} // namespace OSDK
+} // namespace DJI
+
+#endif // LINUX_FC_SIMULATOR_H
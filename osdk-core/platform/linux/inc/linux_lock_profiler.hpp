@@ -0,0 +1,155 @@
+/*! @file linux_lock_profiler.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Contention profiling for the PosixThreadManager locks
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#ifndef LINUX_LOCK_PROFILER_H
+#define LINUX_LOCK_PROFILER_H
+
+#include "posix_thread_manager.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+namespace DJI
+{
+namespace OSDK
+{
+
+enum LockName
+{
+  LOCK_MEMORY,
+  LOCK_MSG,
+  LOCK_ACK,
+  LOCK_PROTOCOL_HEADER,
+  LOCK_NON_BLOCK_CB_ACK,
+  LOCK_STOP_COND,
+  LOCK_FRAME,
+  LOCK_NUMBER
+};
+
+//! Bucket i counts samples below 2^i ns (and from 2^(i-1) ns on)
+typedef struct LockHistogram
+{
+  static const int BUCKET_NUMBER = 32;
+
+  uint64_t count;
+  uint64_t sumNs;
+  uint64_t maxNs;
+  uint64_t bucket[BUCKET_NUMBER];
+} LockHistogram;
+
+typedef struct LockSiteStats
+{
+  int           lock;
+  const void*   site; //! return address in the caller, NULL for "other"
+  uint64_t      acquisitions;
+  uint64_t      contended; //! acquisitions that found the lock taken
+  LockHistogram wait;
+  LockHistogram hold; //! cond waits excluded, charged to the acquiring site
+} LockSiteStats;
+
+/*! @brief Process-wide lock statistics, per lock and per call site
+ *
+ *  @details Off by default. enable() before constructing the Vehicle makes
+ *  its Protocol use a ProfiledThreadManager instead of PosixThreadManager.
+ *  Several Vehicles add up into the same per-lock numbers.
+ *
+ *  Call sites are reported as symbol+offset when the executable exports its
+ *  symbols (-rdynamic), else as module+offset for addr2line.
+ */
+class LockProfiler
+{
+public:
+  static void enable(bool enable = true);
+  static bool isEnabled();
+  //! Zero all counters; samples in flight may land in either period
+  static void reset();
+
+  //! Copy the per-site counters, in first-seen order
+  static size_t snapshot(LockSiteStats* sites, size_t maxNumber);
+  //! Sum of all sites of a lock
+  static void getLockStats(int lock, LockSiteStats* total);
+
+  //! Print per-lock totals and the sites with the most wait time
+  static void report(FILE* file = stdout, size_t worstNumber = 10);
+
+  static const char* getLockName(int lock);
+  static void getSiteName(const void* site, char* name, size_t size);
+  //! Upper bound of the bucket holding the given fraction of samples
+  static uint64_t percentile(const LockHistogram* histogram, double fraction);
+
+  //! Used by ProfiledThreadManager
+  static LockSiteStats* site(int lock, const void* address);
+  static void record(LockHistogram* histogram, uint64_t ns);
+
+  static const int MAX_SITE = 256;
+
+private:
+  static volatile bool enabled;
+  static uint64_t      key[MAX_SITE];
+  static LockSiteStats sites[MAX_SITE];
+  static LockSiteStats other[LOCK_NUMBER];
+};
+
+/*! @brief PosixThreadManager that times every lock/free pair
+ */
+class ProfiledThreadManager : public PosixThreadManager
+{
+public:
+  ProfiledThreadManager(bool priorityInheritance = false);
+
+public:
+  void lockMemory();
+  void freeMemory();
+
+  void lockMSG();
+  void freeMSG();
+
+  void lockACK();
+  void freeACK();
+
+  void lockProtocolHeader();
+  void freeProtocolHeader();
+
+  void lockNonBlockCBAck();
+  void freeNonBlockCBAck();
+
+  void lockStopCond();
+  void freeStopCond();
+
+  void lockFrame();
+  void freeFrame();
+
+  void wait(int timeoutInSeconds);
+  void nonBlockWait();
+
+private:
+  void acquire(int lock, pthread_mutex_t* mutex, const void* caller);
+  void release(int lock, pthread_mutex_t* mutex);
+  //! A condition wait drops the mutex; pause the hold clock meanwhile
+  void suspend(int lock);
+  void resume(int lock);
+
+  //! Written only by the thread holding the lock
+  typedef struct Hold
+  {
+    LockSiteStats* site;
+    uint64_t       sinceNs;
+    uint64_t       heldNs;
+  } Hold;
+
+  Hold hold[LOCK_NUMBER];
+};
+
+} // namespace OSDK
+} // namespace DJI
+
+#endif // LINUX_LOCK_PROFILER_H
@@ -0,0 +1,115 @@
+/*! @file linux_reactor.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Shared event loop serving many Vehicle links from a small thread pool
+ *
+ *  @copyright
+ *  2016-17 DJI. All rights reserved.
+ * */
+
+#ifndef LINUX_REACTOR_H
+#define LINUX_REACTOR_H
+
+#include "dji_thread_manager.hpp"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+namespace DJI
+{
+namespace OSDK
+{
+
+// Forward Declarations
+class Vehicle;
+
+/*! @brief Replaces the per-vehicle read and callback threads
+ *
+ *  @details Each attached link is pinned to one worker. A worker waits on
+ *  the descriptors of its links with epoll, parses whatever arrived with
+ *  Vehicle::pollReceive() and then runs the queued non-blocking callbacks
+ *  of that vehicle on the same thread. Every TICK_MS, it also runs
+ *  Vehicle::callbackPoll() on its quiet links, so poll listeners (upload
+ *  timers and deadlines) keep running while nothing is received.
+ *
+ *  Vehicles must be built with Vehicle(driver, true, false) so that they
+ *  do not start threads of their own. Blocking API calls keep working from
+ *  application threads; they must not be made from inside a callback, as
+ *  that would stall every link served by the worker.
+ */
+class LinuxReactor
+{
+public:
+  static const int MAX_WORKER = 16;
+  static const int MAX_LINK   = 256;
+  static const int TICK_MS    = 100;
+
+public:
+  LinuxReactor(int workerNumber = 2);
+  ~LinuxReactor();
+
+  bool start();
+  void stop();
+
+  //! Scheduling for the workers started by the next start()
+  void setSchedule(const ThreadSchedule& schedule);
+
+  /*! @brief Serve a vehicle. fd is the readable side of its driver (serial
+   *  port, socket, pty) and must stay open until detach().
+   *  @return false if the reactor is full or fd cannot be polled
+   */
+  bool attach(Vehicle* vehicle, int fd);
+  void detach(Vehicle* vehicle);
+
+  int getLinkNumber();
+  //! Frames dispatched over all links since construction
+  uint64_t getFrameCount();
+  //! CPU time consumed by the worker threads, in nanoseconds
+  uint64_t getCpuTimeNs();
+
+private:
+  typedef struct Link
+  {
+    Vehicle* vehicle;
+    int      fd;
+    int      worker;
+  } Link;
+
+  typedef struct Worker
+  {
+    LinuxReactor*   reactor;
+    int             index;
+    pthread_t       thread;
+    bool            started;
+    int             epollFd;
+    int             wakeFd;
+    int             linkNumber;
+    uint64_t        frames;
+    uint64_t        exitedCpuNs;
+    uint64_t        tickNs; //! last run of the poll listeners of all links
+    //! Held while events are handled, so detach() never races a dispatch
+    pthread_mutex_t lock;
+  } Worker;
+
+  static void* workerCall(void* param);
+  void run(Worker* worker);
+
+private:
+  int            workerNumber;
+  bool           running;
+  ThreadSchedule schedule;
+  Worker         worker[MAX_WORKER];
+
+  //! Guards link[], along with the lock of the link's worker; taken before
+  //! any worker lock
+  pthread_mutex_t lock;
+  Link            link[MAX_LINK];
+};
+
+} // namespace OSDK
+} // namespace DJI
+
+#endif // LINUX_REACTOR_H
@@ -45,6 +45,10 @@ public:
 
   void init();
   bool getDeviceStatus();
+  //! Descriptor of the opened port, e.g. for LinuxReactor::attach()
+  int getFd() const;
+  //! Kernel UART counters (TIOCGICOUNT)
+  bool getLineCounters(LineCounters* counters);
 
   void setBaudrate(uint32_t baudrate);
   void setDevice(const char* device);
@@ -0,0 +1,198 @@
+/*! @file linux_shm_telemetry.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  POSIX shared-memory mirror of subscription and broadcast telemetry
+ *  for multi-process consumers on Linux
+ *
+ *  @copyright
+ *  2016-17 DJI. All rights reserved.
+ * */
+
+#ifndef LINUX_SHM_TELEMETRY_H
+#define LINUX_SHM_TELEMETRY_H
+
+#include "dji_telemetry.hpp"
+#include "dji_vehicle_callback.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace DJI
+{
+namespace OSDK
+{
+
+// Forward Declarations
+class Vehicle;
+
+/*! @brief Decoded broadcast state, as mirrored into shared memory
+ */
+#pragma pack(1)
+typedef struct ShmBroadcastState
+{
+  uint16_t                    passFlag;
+  Telemetry::TimeStamp        timeStamp;
+  Telemetry::SyncStamp        syncStamp;
+  Telemetry::Quaternion       q;
+  Telemetry::Vector3f         a;
+  Telemetry::Vector3f         v;
+  Telemetry::Vector3f         w;
+  Telemetry::VelocityInfo     vi;
+  Telemetry::GlobalPosition   gp;
+  Telemetry::RelativePosition rp;
+  Telemetry::GPSInfo          gps;
+  Telemetry::RTK              rtk;
+  Telemetry::Mag              mag;
+  Telemetry::RC               rc;
+  Telemetry::Gimbal           gimbal;
+  Telemetry::Status           status;
+  Telemetry::Battery          battery;
+  Telemetry::SDKInfo          info;
+} ShmBroadcastState; // pack(1)
+#pragma pack()
+
+/*! @brief Per-sample metadata returned by ShmTelemetryReader
+ */
+typedef struct ShmSampleInfo
+{
+  uint32_t sequence;    /*!< slot seqlock value, even, pass to waitForUpdate */
+  uint32_t fcTimeMs;    /*!< FC timestamp if the package carries one, else 0 */
+  uint64_t updateCount; /*!< number of samples published into the slot */
+  uint64_t hostTimeNs;  /*!< CLOCK_MONOTONIC time of publication */
+} ShmSampleInfo;
+
+/*! @brief Shared-memory layout. One slot per TopicName plus one for the
+ *  broadcast state. Each slot is guarded by its own seqlock (odd = writing).
+ *
+ *  @note Readers never block the publisher. waiters counters let the
+ *  publisher skip FUTEX_WAKE entirely while nobody sleeps on a slot.
+ */
+namespace ShmTelemetry
+{
+const char* const DEFAULT_NAME   = "/djiosdk_telemetry";
+const uint32_t    MAGIC          = 0x444A4953; // "DJIS"
+const uint32_t    LAYOUT_VERSION = 1;
+const size_t      SLOT_DATA_SIZE = 320;
+const int         BROADCAST_SLOT = Telemetry::TOTAL_TOPIC_NUMBER;
+const int         SLOT_NUMBER    = Telemetry::TOTAL_TOPIC_NUMBER + 1;
+//! Readers write the waiter counts, so they need write access too; share
+//! the segment through the group rather than with every local user
+const mode_t      DEFAULT_MODE   = 0660;
+
+typedef struct Slot
+{
+  volatile uint32_t seq;
+  volatile uint32_t waiters;
+  uint32_t          uid;
+  uint16_t          freq;
+  uint16_t          size;
+  uint64_t          updateCount;
+  uint64_t          hostTimeNs;
+  uint32_t          fcTimeMs;
+  uint32_t          reserved;
+  uint8_t           data[SLOT_DATA_SIZE];
+} __attribute__((aligned(64))) Slot;
+
+typedef struct Segment
+{
+  uint32_t          magic;
+  uint32_t          version;
+  uint32_t          slotNumber;
+  uint32_t          slotSize;
+  volatile int32_t  publisherPid;
+  volatile uint32_t globalSeq; //! bumped once per published package
+  volatile uint32_t globalWaiters;
+  uint32_t          reserved;
+  Slot              slot[SLOT_NUMBER];
+} __attribute__((aligned(64))) Segment;
+
+} // namespace ShmTelemetry
+
+/*! @brief Publisher side, lives in the process that owns the Vehicle
+ *
+ *  @details Registers decode listeners on DataSubscription and DataBroadcast
+ *  and copies every decoded sample into the segment from the read thread.
+ */
+class ShmTelemetryPublisher
+{
+public:
+  ShmTelemetryPublisher(Vehicle* vehicle);
+  ~ShmTelemetryPublisher();
+
+  /*! @brief Create (or take over) the segment and start mirroring
+   *  @param mode permissions of a newly created segment, before umask
+   *  @return false if the segment could not be created or mapped
+   */
+  bool start(const char* name = ShmTelemetry::DEFAULT_NAME,
+             mode_t      mode = ShmTelemetry::DEFAULT_MODE);
+  void stop();
+
+  //! Copy one sample into a slot; usable directly for custom data sources
+  void publish(int slot, const void* data, size_t size, uint32_t fcTimeMs);
+  //! Wake readers blocked in waitForAnyUpdate
+  void commit();
+
+  static void subscriptionListener(Vehicle* vehicle, RecvContainer recvFrame,
+                                   UserData userData);
+  static void broadcastListener(Vehicle* vehicle, RecvContainer recvFrame,
+                                UserData userData);
+
+private:
+  Vehicle*               vehicle;
+  ShmTelemetry::Segment* segment;
+  char                   name[64];
+};
+
+/*! @brief Reader side, for any process on the companion computer
+ *
+ *  @details Reads are wait-free: a seqlock read is retried a bounded number
+ *  of times and reports failure instead of spinning when the publisher keeps
+ *  overwriting the slot. Polling costs no syscall; waitForUpdate() only
+ *  enters the kernel when the slot has not changed yet.
+ */
+class ShmTelemetryReader
+{
+public:
+  ShmTelemetryReader();
+  ~ShmTelemetryReader();
+
+  bool open(const char* name = ShmTelemetry::DEFAULT_NAME);
+  void close();
+  bool isOpen() const;
+
+  template <Telemetry::TopicName topic>
+  bool getValue(typename Telemetry::TypeMap<topic>::type& value,
+                ShmSampleInfo*                            info = 0)
+  {
+    return readSlot(topic, &value, sizeof(value), info);
+  }
+
+  bool getBroadcast(ShmBroadcastState& state, ShmSampleInfo* info = 0);
+
+  //! @return false if the slot was never written or a consistent copy could
+  //! not be taken within the retry bound
+  bool readSlot(int slot, void* data, size_t size, ShmSampleInfo* info);
+
+  uint32_t getSequence(int slot) const;
+  uint32_t getGlobalSequence() const;
+
+  /*! @brief Block until the slot sequence moves past lastSeq
+   *  @param timeoutMs negative to wait forever
+   *  @return false on timeout
+   */
+  bool waitForUpdate(int slot, uint32_t lastSeq, int timeoutMs = -1);
+  bool waitForAnyUpdate(uint32_t lastGlobalSeq, int timeoutMs = -1);
+
+  static const int READ_RETRY = 16;
+
+private:
+  ShmTelemetry::Segment* segment;
+};
+
+} // namespace OSDK
+} // namespace DJI
+
+#endif // LINUX_SHM_TELEMETRY_H
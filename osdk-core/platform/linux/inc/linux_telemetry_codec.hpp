@@ -0,0 +1,171 @@
+/*! @file linux_telemetry_codec.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Streaming compression for recorded telemetry columns
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#ifndef LINUX_TELEMETRY_CODEC_H
+#define LINUX_TELEMETRY_CODEC_H
+
+#include "linux_telemetry_store.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace DJI
+{
+namespace OSDK
+{
+
+/*! @brief Compressed block layout
+ *
+ *  @details A block is a CodecBlock followed by a bit stream of the
+ *  records of one store column, and decodes on its own. Per record:
+ *  - host and FC timestamps as delta of delta, in a prefix-coded width
+ *  - float32_t and float64_t fields XORed with the previous value, the
+ *    meaningful bits only, reusing the previous bit window when it fits
+ *  - integer fields as the zigzag of the delta, in 7-bit varint groups
+ *
+ *  Field types come from a per-column schema matching the TypeMap type,
+ *  or ShmBroadcastState for the broadcast column.
+ */
+namespace TelemetryCodec
+{
+const uint32_t MAGIC   = 0x47494A44; // "DJIG"
+const uint16_t VERSION = 1;
+
+typedef struct CodecBlock
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t column;
+  uint32_t number; //! records
+  uint32_t size;   //! bytes, this header included
+} CodecBlock;
+
+//! Most fields a column schema has
+const int MAX_FIELDS = 96;
+
+typedef struct Field
+{
+  char     type; //! 'f', 'd', or the byte size of an integer: '1', '2', '4'
+  uint16_t offset;
+} Field;
+
+typedef struct FieldState
+{
+  uint64_t last;
+  uint8_t  leading;  //! of the last XOR window
+  uint8_t  trailing;
+} FieldState;
+
+//! @return field number, 0 if the column has no schema
+int getSchema(int column, Field* fields);
+} // namespace TelemetryCodec
+
+/*! @brief Compresses the records of one column into blocks
+ *
+ *  @details Encoding is a few shifts and table-free branches per field, so
+ *  it can run on the thread that writes the records.
+ *  @code
+ *  TelemetryEncoder encoder;
+ *  encoder.begin(Telemetry::TOPIC_ACCELERATION_RAW);
+ *  for (...)
+ *    encoder.encode(&header, &value);
+ *  size_t         size;
+ *  const uint8_t* block = encoder.finish(&size);
+ *  fwrite(block, 1, size, file);
+ *  @endcode
+ */
+class TelemetryEncoder
+{
+public:
+  TelemetryEncoder();
+  ~TelemetryEncoder();
+
+  //! Start a new block; false if the column is unknown
+  bool begin(int column);
+  bool encode(const TelemetryStore::RecordHeader* header, const void* value);
+  //! Close the block; valid until the next begin()
+  const uint8_t* finish(size_t* size);
+
+  uint32_t getNumber() const;
+  //! Bytes so far, block header included
+  size_t getSize() const;
+
+private:
+  bool reserve(size_t more);
+  void put(uint64_t value, int bits);
+  void putTime(int64_t dod);
+  void putXor(TelemetryCodec::FieldState* state, uint64_t value, int width);
+  void putVarint(uint64_t value);
+
+private:
+  int                        column;
+  int                        fieldNumber;
+  TelemetryCodec::Field      fields[TelemetryCodec::MAX_FIELDS];
+  TelemetryCodec::FieldState state[TelemetryCodec::MAX_FIELDS];
+  uint64_t                   lastHostNs;
+  int64_t                    lastHostDelta;
+  uint32_t                   lastFcMs;
+  int32_t                    lastFcDelta;
+  uint32_t                   number;
+
+  uint8_t* buffer;
+  size_t   capacity;
+  size_t   used;
+  uint64_t bitBuffer;
+  int      bitNumber;
+};
+
+/*! @brief Reads the records back out of a block
+ */
+class TelemetryDecoder
+{
+public:
+  TelemetryDecoder();
+
+  //! @return false if data is not a whole block
+  bool begin(const uint8_t* data, size_t size);
+  //! value gets TelemetryStore::getValueSize(getColumn()) bytes
+  //! @return false after the last record, or if the block is corrupt
+  bool decode(TelemetryStore::RecordHeader* header, void* value);
+
+  int      getColumn() const;
+  uint32_t getNumber() const;
+
+private:
+  uint64_t get(int bits);
+  int64_t  getTime();
+  uint64_t getXor(TelemetryCodec::FieldState* state, int width);
+  uint64_t getVarint();
+
+private:
+  int                        column;
+  int                        fieldNumber;
+  TelemetryCodec::Field      fields[TelemetryCodec::MAX_FIELDS];
+  TelemetryCodec::FieldState state[TelemetryCodec::MAX_FIELDS];
+  uint64_t                   lastHostNs;
+  int64_t                    lastHostDelta;
+  uint32_t                   lastFcMs;
+  int32_t                    lastFcDelta;
+  uint32_t                   number;
+  uint32_t                   decoded;
+
+  const uint8_t* data;
+  size_t         size;
+  size_t         position;
+  uint64_t       bitBuffer;
+  int            bitNumber;
+  bool           overrun;
+};
+
+} // namespace OSDK
+} // namespace DJI
+
+#endif // LINUX_TELEMETRY_CODEC_H
@@ -0,0 +1,241 @@
+/*! @file linux_telemetry_store.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Column-per-topic telemetry recording to memory-mapped segment files,
+ *  with a sparse time index and zero-copy range reads
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#ifndef LINUX_TELEMETRY_STORE_H
+#define LINUX_TELEMETRY_STORE_H
+
+#include "dji_telemetry.hpp"
+#include "dji_vehicle_callback.hpp"
+#include "linux_shm_telemetry.hpp"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace DJI
+{
+namespace OSDK
+{
+
+// Forward Declarations
+class Vehicle;
+
+/*! @brief On-disk layout
+ *
+ *  @details One column per TopicName plus one for the broadcast state. A
+ *  column is a series of segment files <directory>/cNN-SSSSSS.seg, each a
+ *  SegmentHeader followed by fixed-size records: a RecordHeader, then the
+ *  value (TypeMap<topic>::type, or ShmBroadcastState) padded to 8 bytes.
+ *  Records are in host time order within a column.
+ */
+namespace TelemetryStore
+{
+const uint32_t MAGIC            = 0x54494A44; // "DJIT"
+const uint16_t VERSION          = 1;
+const int      BROADCAST_COLUMN = Telemetry::TOTAL_TOPIC_NUMBER;
+const int      COLUMN_NUMBER    = Telemetry::TOTAL_TOPIC_NUMBER + 1;
+const uint32_t SEGMENT_RECORDS  = 65536;
+const uint32_t INDEX_STRIDE     = 64;
+const uint32_t INDEX_NUMBER     = SEGMENT_RECORDS / INDEX_STRIDE;
+
+typedef struct RecordHeader
+{
+  uint64_t hostTimeNs; //! CLOCK_MONOTONIC when the sample was decoded
+  uint32_t fcTimeMs;   //! FC timestamp if the package carries one, else 0
+  uint32_t reserved;
+} RecordHeader;
+
+typedef struct SegmentHeader
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t column;
+  uint32_t valueSize;
+  uint32_t recordSize;
+  uint32_t capacity;
+  uint32_t indexStride;
+  uint32_t sequence; //! of the segment within its column
+  uint32_t dataOffset;
+  //! Clock pair taken at creation, to turn host times into wall clock
+  uint64_t startMonotonicNs;
+  uint64_t startRealtimeNs;
+  //! Records written; stored after them with release ordering, so a reader
+  //! of a live segment sees whole records only
+  volatile uint64_t recordNumber;
+  //! Sparse time index: hostTimeNs of record i * indexStride
+  uint64_t index[INDEX_NUMBER];
+} SegmentHeader;
+
+//! Value bytes of a column
+size_t getValueSize(int column);
+} // namespace TelemetryStore
+
+/*! @brief Records decoded subscription and broadcast data to a store
+ *
+ *  @details The decode listeners run on the SDK thread that dispatches the
+ *  packages. They only time-stamp each sample and copy it into an in-memory
+ *  queue; a background thread moves the queue into the segment files. A
+ *  sample that finds the queue full is dropped and counted, so the flight
+ *  path never waits for the disk.
+ *
+ *  Segment numbering continues after the segments already in the
+ *  directory, so several runs can go into one store. Host times restart on
+ *  reboot; keep one directory per boot if time seeks must span runs.
+ */
+class TelemetryRecorder
+{
+public:
+  //! vehicle may be NULL when only record() is used
+  TelemetryRecorder(Vehicle* vehicle);
+  ~TelemetryRecorder();
+
+  bool start(const char* directory);
+  //! Write out everything queued, then close the segments
+  void stop();
+
+  //! Queue one sample of a column from any thread
+  //! @return false if the queue was full and the sample was dropped
+  bool record(int column, const void* data, size_t size, uint32_t fcTimeMs);
+  //! Block until every sample queued before the call is in its segment
+  void flush();
+
+  uint64_t getRecorded() const;
+  uint64_t getDropped() const;
+
+  static void subscriptionListener(Vehicle* vehicle, RecvContainer recvFrame,
+                                   UserData userData);
+  static void broadcastListener(Vehicle* vehicle, RecvContainer recvFrame,
+                                UserData userData);
+
+  static const size_t QUEUE_SIZE  = 1 << 20; //! bytes, power of 2
+  static const int    IDLE_WAITUS = 1000;
+
+private:
+  static void* writeCall(void* param);
+  void         writeLoop();
+  bool         drainOnce();
+  bool         append(int column, const TelemetryStore::RecordHeader* header,
+                      const uint8_t* value, size_t size);
+  bool openSegment(int column);
+  void closeSegment(int column);
+
+private:
+  Vehicle*          vehicle;
+  char              directory[256];
+  pthread_t         thread;
+  volatile bool     running;
+  pthread_mutex_t   producerLock;
+  uint8_t*          queue;
+  volatile uint64_t head; //! producer position, bytes
+  volatile uint64_t tail; //! writer position, bytes
+  volatile uint64_t recorded;
+  volatile uint64_t dropped;
+
+  TelemetryStore::SegmentHeader* segment[TelemetryStore::COLUMN_NUMBER];
+  size_t                         segmentSize[TelemetryStore::COLUMN_NUMBER];
+  uint32_t                       nextSequence[TelemetryStore::COLUMN_NUMBER];
+};
+
+/*! @brief Run of consecutive records inside one segment mapping
+ */
+typedef struct ColumnSpan
+{
+  const uint8_t* records;
+  size_t         number;
+  size_t         recordSize;
+} ColumnSpan;
+
+typedef struct ColumnCursor
+{
+  int      column;
+  size_t   segment;
+  uint64_t fromNs;
+  uint64_t toNs;
+} ColumnCursor;
+
+/*! @brief Zero-copy reader for a store, usable while it is being written
+ *
+ *  @details open() maps the segments present at that time; the last one of
+ *  each column keeps growing while the recorder runs.
+ *  @code
+ *  ColumnCursor c;
+ *  ColumnSpan   s;
+ *  reader.scan(Telemetry::TOPIC_QUATERNION, fromNs, toNs, &c);
+ *  while (reader.next(&c, &s))
+ *    for (size_t i = 0; i < s.number; ++i)
+ *    {
+ *      const uint8_t* r = s.records + i * s.recordSize;
+ *      use(TelemetryStoreReader::getHeader(r)->hostTimeNs,
+ *          *TelemetryStoreReader::getValue<Telemetry::TOPIC_QUATERNION>(r));
+ *    }
+ *  @endcode
+ */
+class TelemetryStoreReader
+{
+public:
+  TelemetryStoreReader();
+  ~TelemetryStoreReader();
+
+  bool open(const char* directory);
+  void close();
+
+  uint64_t getRecordNumber(int column) const;
+  //! Host time range of a column; false if it is empty
+  bool getTimeRange(int column, uint64_t* firstNs, uint64_t* lastNs) const;
+
+  //! Start a scan of the records with fromNs <= hostTimeNs < toNs
+  void scan(int column, uint64_t fromNs, uint64_t toNs,
+            ColumnCursor* cursor) const;
+  //! @return false when the range is exhausted
+  bool next(ColumnCursor* cursor, ColumnSpan* span) const;
+
+  static const TelemetryStore::RecordHeader* getHeader(const uint8_t* record)
+  {
+    return (const TelemetryStore::RecordHeader*)record;
+  }
+  template <Telemetry::TopicName topic>
+  static const typename Telemetry::TypeMap<topic>::type* getValue(
+    const uint8_t* record)
+  {
+    return (const typename Telemetry::TypeMap<topic>::type*)(
+      record + sizeof(TelemetryStore::RecordHeader));
+  }
+  static const ShmBroadcastState* getBroadcast(const uint8_t* record)
+  {
+    return (const ShmBroadcastState*)(record +
+                                      sizeof(TelemetryStore::RecordHeader));
+  }
+
+private:
+  typedef struct Segment
+  {
+    const TelemetryStore::SegmentHeader* header;
+    size_t                               mapSize;
+    uint32_t                             sequence;
+  } Segment;
+
+  //! Whole records in a segment, as far as its mapping reaches
+  static uint64_t getNumber(const Segment* segment);
+  //! First record at or after ns, using the sparse index
+  static uint64_t lowerBound(const Segment* segment, uint64_t ns);
+  static uint64_t timeAt(const Segment* segment, uint64_t i);
+  static int      compareSequence(const void* a, const void* b);
+
+private:
+  Segment* segments[TelemetryStore::COLUMN_NUMBER];
+  size_t   segmentNumber[TelemetryStore::COLUMN_NUMBER];
+};
+
+} // namespace OSDK
+} // namespace DJI
+
+#endif // LINUX_TELEMETRY_STORE_H
@@ -0,0 +1,115 @@
+/*! @file linux_trajectory_buffer.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Time-stamped trajectory fed by a planner and sampled at the control
+ *  rate, with Hermite or minimum-jerk interpolation
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#ifndef LINUX_TRAJECTORY_BUFFER_H
+#define LINUX_TRAJECTORY_BUFFER_H
+
+#include "dji_type.hpp"
+
+namespace DJI
+{
+namespace OSDK
+{
+
+/*! @brief A knot of the trajectory, in the ground frame of
+ *  Control::HORIZONTAL_GROUND: x north, y east, z up
+ */
+typedef struct TrajectoryPoint
+{
+  float64_t time; //! s, on TrajectoryBuffer::now()
+  float32_t x;    //! m
+  float32_t y;
+  float32_t z;
+  float32_t vx; //! m/s
+  float32_t vy;
+  float32_t vz;
+  float32_t yaw; //! deg
+} TrajectoryPoint;
+
+/*! @brief The trajectory at one instant
+ */
+typedef struct TrajectorySample
+{
+  float32_t position[3];
+  float32_t velocity[3];
+  float32_t acceleration[3]; //! m/s^2
+  float32_t yaw;
+  float32_t overrun; //! s past the last knot, extrapolated at its velocity
+} TrajectorySample;
+
+/*! @brief Single-producer, single-consumer trajectory queue
+ *
+ *  @details A planner appends knots with increasing times, typically a
+ *  few at 5-10 Hz; a control loop samples the trajectory at its own rate.
+ *  Both sides are lock-free: the knots live in a power-of-two ring, and
+ *  each side only moves its own index, published with release stores.
+ *  Sampling drops the knots that lie wholly in the past, which makes room
+ *  for the planner.
+ *
+ *  Between two knots, position is a cubic Hermite spline through both
+ *  positions and velocities, or a quintic that also starts and ends with
+ *  zero acceleration, which minimises jerk on the segment. The quintic
+ *  keeps acceleration continuous across knots but follows curves less
+ *  closely; Hermite suits knots sampled from a smooth plan. Velocity and
+ *  acceleration are its derivatives. Yaw turns the short way round,
+ *  linearly in time.
+ */
+class TrajectoryBuffer
+{
+public:
+  enum Interpolation
+  {
+    INTERPOLATION_HERMITE,
+    INTERPOLATION_MIN_JERK
+  };
+
+  static const int DEFAULT_CAPACITY = 256;
+
+  //! @param capacity knots, rounded up to a power of two
+  TrajectoryBuffer(int capacity = DEFAULT_CAPACITY,
+                   int interpolation = INTERPOLATION_HERMITE);
+  ~TrajectoryBuffer();
+
+  //! Seconds on CLOCK_MONOTONIC, the clock of TrajectoryPoint::time
+  static float64_t now();
+
+  /*! @brief Producer side: queue knots after those already queued
+   *  @return knots queued; stops at a full ring or a knot not later than
+   *  the one before it
+   */
+  int append(const TrajectoryPoint* points, int count);
+
+  /*! @brief Consumer side: the trajectory at time
+   *  @return false before the first knot, or if nothing was appended
+   */
+  bool sample(float64_t time, TrajectorySample* sample);
+
+  //! Knots queued, as seen by the caller
+  int size() const;
+  int getCapacity() const;
+  void setInterpolation(int interpolation);
+
+private:
+  TrajectoryPoint* ring;
+  uint32_t         mask;
+  int              interpolation;
+
+  //! head is written by the producer only, tail by the consumer only
+  uint64_t  head;
+  uint64_t  tail;
+  float64_t lastTime; //! producer's, of the last knot queued
+};
+
+} // namespace OSDK
+} // namespace DJI
+
+#endif // LINUX_TRAJECTORY_BUFFER_H
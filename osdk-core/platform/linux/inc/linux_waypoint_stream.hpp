@@ -0,0 +1,157 @@
+/*! @file linux_waypoint_stream.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Flies routes longer than one waypoint mission as a chain of
+ *  overlapping segments, handed over in flight
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#ifndef LINUX_WAYPOINT_STREAM_H
+#define LINUX_WAYPOINT_STREAM_H
+
+#include "dji_ack.hpp"
+#include "dji_vehicle_callback.hpp"
+#include "dji_waypoint_preprocess.hpp"
+
+#include <pthread.h>
+
+namespace DJI
+{
+namespace OSDK
+{
+
+// Forward Declarations
+class Vehicle;
+class WaypointMission;
+
+/*! @brief Progress of a streamed route
+ */
+typedef struct WaypointStreamStatus
+{
+  int            total;    //! route waypoints
+  int            segments; //! missions the route is split into
+  int            segment;  //! flying or last flown
+  int            reached;  //! last route waypoint reached, -1 before
+  uint32_t       handovers;
+  uint32_t       late; //! handovers after a segment had finished, so hovered
+  uint32_t       lastHandoverMs; //! stop to start ACK of the last handover
+  uint32_t       maxHandoverMs;
+  ACK::ErrorCode ack; //! of the command that failed, else success
+  bool           running;
+  bool           finished; //! last segment flown to its end
+} WaypointStreamStatus;
+
+/*! @brief Executor for routes longer than WaypointMission can hold
+ *
+ *  @details The route is split into segments of segmentSize waypoints, each
+ *  starting overlap waypoints before the end of the previous one. Segment k
+ *  starts at route index k * (segmentSize - overlap). When the aircraft
+ *  reports reaching the waypoint just before the next segment's first one,
+ *  a worker thread stops the mission, inits and uploads the next segment
+ *  with uploadAllIndexData() and starts it, so the aircraft carries on
+ *  toward the waypoint it was already flying to. The overlap is the
+ *  margin: until the new segment starts, the old one still has that many
+ *  waypoints ahead.
+ *
+ *  Reached events come from WaypointMission::wayPointEventCallback; the
+ *  handler installed before start() is still called with every event. The
+ *  callback only records the event, and the next segment is built and
+ *  checked while the current one is flown, so the handover commands all
+ *  run on the worker, off the callback and control threads. They are sent
+ *  with the non-blocking APIs and their ACKs awaited on the worker's own
+ *  condition, so a fast ACK cannot slip past the wait.
+ *
+ *  @code
+ *  WaypointStreamer streamer(vehicle);
+ *  streamer.start(info, route, count);
+ *  while (streamer.isRunning())
+ *    sleep(1);
+ *  @endcode
+ */
+class WaypointStreamer
+{
+public:
+  static const int DEFAULT_SEGMENT = 99; //! waypoints the aircraft takes
+  static const int DEFAULT_OVERLAP = 3;
+
+  WaypointStreamer(Vehicle* vehicle);
+  ~WaypointStreamer();
+
+  /*! @brief Check the route, then fly it from a worker thread
+   *
+   *  @param info settings of every segment; indexNumber is set per segment,
+   *  executiveTimes to 1, and finishAction only applies to the last one
+   *  @param route count waypoints, copied
+   *  @param segmentSize waypoints per mission, overlap + 2 or more
+   *  @param overlap waypoints shared by adjacent segments, 1 or more
+   *  @param timeout in seconds, of each command and upload
+   *  @return false if running, or the route breaks the mission limits
+   */
+  bool start(const WayPointInitSettings& info, const WayPointSettings* route,
+             int count, int segmentSize = DEFAULT_SEGMENT,
+             int overlap = DEFAULT_OVERLAP, int timeout = 1);
+  //! Stop the worker, then the mission on the aircraft
+  void stop(int timeout = 1);
+  bool isRunning();
+  void getStatus(WaypointStreamStatus* status);
+  //! Limits start() checks every segment against
+  WaypointPreprocessor* getPreprocessor();
+
+  static void eventCallback(Vehicle* vehicle, RecvContainer recvFrame,
+                            UserData userData);
+  static void commandCallback(Vehicle* vehicle, RecvContainer recvFrame,
+                              UserData userData);
+
+private:
+  static void* workerCall(void* param);
+  void work();
+  int segmentStart(int segment) const;
+  int segmentLength(int segment) const;
+  void buildSegment(int segment);
+  bool flySegment(int segment);
+  void finish(const ACK::ErrorCode* ack);
+  void onEvent(const RecvContainer& recvFrame);
+  void expectAck(const uint8_t cmd[]);
+  ACK::ErrorCode waitAck();
+
+private:
+  Vehicle*         vehicle;
+  WaypointMission* mission;
+  pthread_t        worker;
+  bool             quit;
+
+  WaypointPreprocessor preprocessor;
+  WayPointInitSettings info;
+  WayPointSettings*    route;
+  int                  count;
+  int                  size;
+  int                  overlap;
+  int                  timeout;
+
+  //! Next segment, built ahead of its handover
+  int                  nextSegment;
+  WayPointInitSettings nextInfo;
+  WayPointSettings*    next;
+
+  //! Guards what follows; wake signals the worker
+  pthread_mutex_t        lock;
+  pthread_cond_t         wake;
+  WaypointStreamStatus   status;
+  int                    flying;   //! segment whose events count, or -1
+  int                    expected; //! its next waypoint to be reached
+  bool                   segmentDone;
+  VehicleCallBackHandler chained;
+  //! ACK of the command the worker waits for
+  uint8_t                ackCmd[2];
+  bool                   ackReady;
+  ACK::ErrorCode         ack;
+};
+
+} // namespace OSDK
+} // namespace DJI
+
+#endif // LINUX_WAYPOINT_STREAM_H
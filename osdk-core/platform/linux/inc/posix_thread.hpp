@@ -40,6 +40,16 @@ public:
   bool createThread();
   int  stopThread();
 
+  /*! @brief Apply policy, priority and CPU affinity to a running thread
+   *  @return false if any part was refused; the rest is still applied
+   */
+  static bool setSchedule(pthread_t thread, const ThreadSchedule& schedule,
+                          const char* name);
+  //! mlockall() current and future pages, so page faults cannot stall us
+  static bool lockAllMemory();
+  //! Touch size bytes of the calling thread's stack
+  static void prefaultStack(size_t size);
+
 private:
   pthread_t      threadID;
   pthread_attr_t attr;
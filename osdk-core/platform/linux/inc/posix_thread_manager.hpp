@@ -27,7 +27,9 @@ namespace OSDK
 class PosixThreadManager : public ThreadAbstract
 {
 public:
-  PosixThreadManager()
+  //! @param priorityInheritance create the mutexes with PTHREAD_PRIO_INHERIT
+  PosixThreadManager(bool priorityInheritance = false)
+    : priorityInheritance(priorityInheritance)
   {
   }
   ~PosixThreadManager();
@@ -62,7 +64,7 @@ public:
   void wait(int timeoutInSeconds);
   void nonBlockWait();
 
-private:
+protected:
   pthread_mutex_t m_memLock;
   pthread_mutex_t m_msgLock;
   pthread_mutex_t m_ackLock;
@@ -77,6 +79,11 @@ private:
 
   //! Thread protection for last received frame storage
   pthread_mutex_t m_frameLock;
+
+private:
+  void initMutex(pthread_mutex_t* mutex);
+
+  bool priorityInheritance;
 };
 
 } // namespace OSDK
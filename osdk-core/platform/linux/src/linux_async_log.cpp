@@ -0,0 +1,772 @@
+/*! @file linux_async_log.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Asynchronous binary logger for DSTATUS/DERROR/DDEBUG on Linux
+ *
+ *  @copyright
+ *  2016-17 DJI. All rights reserved.
+ * */
+
+#include "linux_async_log.hpp"
+
+#include <new>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <syslog.h>
+#include <unistd.h>
+
+using namespace DJI::OSDK;
+
+AsyncLog* AsyncLog::logger   = NULL;
+Log*      AsyncLog::previous = NULL;
+
+namespace
+{
+
+//! Fixed part of every record in a ring; arguments follow
+typedef struct RecordHead
+{
+  uint32_t    size;  //! whole record, multiple of 8
+  int32_t     level; //! 0 when written without a title
+  int32_t     line;
+  uint32_t    argBytes;
+  const char* fmt; //! NULL marks padding up to the end of the ring
+  const char* prefix;
+  const char* func;
+} RecordHead;
+
+enum ArgTag
+{
+  TAG_INT     = 1,
+  TAG_UINT    = 2,
+  TAG_DOUBLE  = 3,
+  TAG_LDOUBLE = 4,
+  TAG_PTR     = 5,
+  TAG_STR     = 6
+};
+
+enum LengthModifier
+{
+  LEN_NONE,
+  LEN_HH,
+  LEN_H,
+  LEN_L,
+  LEN_LL,
+  LEN_LDOUBLE,
+  LEN_Z,
+  LEN_J,
+  LEN_T
+};
+
+//! One printf conversion, as parsed from the format string
+typedef struct Spec
+{
+  const char* begin;   //! the '%'
+  size_t      bodyLen; //! '%', flags, width and precision
+  int         length;
+  int         stars;
+  char        conv; //! 0 if the format ends inside the spec
+} Spec;
+
+//! Title of the log line in progress on this thread
+__thread const char* pendingPrefix = NULL;
+__thread const char* pendingFunc   = NULL;
+__thread int         pendingLevel  = 0;
+__thread int         pendingLine   = 0;
+
+const char*
+parseSpec(const char* p, Spec* spec)
+{
+  spec->begin  = p++;
+  spec->length = LEN_NONE;
+  spec->stars  = 0;
+  spec->conv   = 0;
+
+  while (*p && strchr("-+ #0'", *p))
+    p++;
+  while (*p == '*' || (*p >= '0' && *p <= '9') || *p == '.')
+  {
+    if (*p == '*')
+      spec->stars++;
+    p++;
+  }
+  spec->bodyLen = p - spec->begin;
+
+  switch (*p)
+  {
+    case 'h':
+      spec->length = (p[1] == 'h') ? LEN_HH : LEN_H;
+      p += (p[1] == 'h') ? 2 : 1;
+      break;
+    case 'l':
+      spec->length = (p[1] == 'l') ? LEN_LL : LEN_L;
+      p += (p[1] == 'l') ? 2 : 1;
+      break;
+    case 'L':
+      spec->length = LEN_LDOUBLE;
+      p++;
+      break;
+    case 'z':
+      spec->length = LEN_Z;
+      p++;
+      break;
+    case 'j':
+      spec->length = LEN_J;
+      p++;
+      break;
+    case 't':
+      spec->length = LEN_T;
+      p++;
+      break;
+    default:
+      break;
+  }
+
+  if (*p)
+    spec->conv = *p++;
+  return p;
+}
+
+bool
+putBytes(uint8_t* buf, size_t* pos, const void* data, size_t len)
+{
+  if (*pos + len > AsyncLog::MAX_RECORD - sizeof(RecordHead))
+    return false;
+  memcpy(buf + *pos, data, len);
+  *pos += len;
+  return true;
+}
+
+bool
+putTagged(uint8_t* buf, size_t* pos, uint8_t tag, const void* data,
+          size_t len)
+{
+  size_t start = *pos;
+  if (putBytes(buf, pos, &tag, 1) && putBytes(buf, pos, data, len))
+    return true;
+  *pos = start;
+  return false;
+}
+
+//! Copy the raw arguments described by fmt; formatting happens later
+size_t
+captureArgs(uint8_t* buf, const char* fmt, va_list args)
+{
+  size_t pos = 0;
+  Spec   spec;
+
+  for (const char* p = fmt; *p;)
+  {
+    if (*p != '%')
+    {
+      p++;
+      continue;
+    }
+    p = parseSpec(p, &spec);
+    if (!spec.conv || spec.conv == '%')
+      continue;
+
+    for (int i = 0; i < spec.stars; ++i)
+    {
+      int64_t v = va_arg(args, int);
+      putTagged(buf, &pos, TAG_INT, &v, sizeof(v));
+    }
+
+    switch (spec.conv)
+    {
+      case 'd':
+      case 'i':
+      case 'c':
+      {
+        int64_t v;
+        switch (spec.length)
+        {
+          case LEN_L:
+            v = va_arg(args, long);
+            break;
+          case LEN_LL:
+            v = va_arg(args, long long);
+            break;
+          case LEN_Z:
+            v = va_arg(args, ssize_t);
+            break;
+          case LEN_J:
+            v = va_arg(args, intmax_t);
+            break;
+          case LEN_T:
+            v = va_arg(args, ptrdiff_t);
+            break;
+          default:
+            v = va_arg(args, int);
+            break;
+        }
+        putTagged(buf, &pos, TAG_INT, &v, sizeof(v));
+        break;
+      }
+      case 'u':
+      case 'o':
+      case 'x':
+      case 'X':
+      {
+        uint64_t v;
+        switch (spec.length)
+        {
+          case LEN_L:
+            v = va_arg(args, unsigned long);
+            break;
+          case LEN_LL:
+            v = va_arg(args, unsigned long long);
+            break;
+          case LEN_Z:
+            v = va_arg(args, size_t);
+            break;
+          case LEN_J:
+            v = va_arg(args, uintmax_t);
+            break;
+          case LEN_T:
+            v = va_arg(args, ptrdiff_t);
+            break;
+          default:
+            v = va_arg(args, unsigned int);
+            break;
+        }
+        putTagged(buf, &pos, TAG_UINT, &v, sizeof(v));
+        break;
+      }
+      case 'f':
+      case 'F':
+      case 'e':
+      case 'E':
+      case 'g':
+      case 'G':
+      case 'a':
+      case 'A':
+        if (spec.length == LEN_LDOUBLE)
+        {
+          long double v = va_arg(args, long double);
+          putTagged(buf, &pos, TAG_LDOUBLE, &v, sizeof(v));
+        }
+        else
+        {
+          double v = va_arg(args, double);
+          putTagged(buf, &pos, TAG_DOUBLE, &v, sizeof(v));
+        }
+        break;
+      case 'p':
+      {
+        void* v = va_arg(args, void*);
+        putTagged(buf, &pos, TAG_PTR, &v, sizeof(v));
+        break;
+      }
+      case 's':
+      {
+        const char* s   = va_arg(args, const char*);
+        size_t      len = s ? strnlen(s, AsyncLog::MAX_STRING) : 0;
+        uint16_t    n   = len;
+        size_t      at  = pos;
+        uint8_t     tag = TAG_STR;
+        if (!(putBytes(buf, &pos, &tag, 1) && putBytes(buf, &pos, &n, 2) &&
+              putBytes(buf, &pos, s ? s : "", len)))
+          pos = at;
+        break;
+      }
+      case 'n':
+        (void)va_arg(args, void*);
+        break;
+      default:
+        break;
+    }
+  }
+  return pos;
+}
+
+template <typename T>
+int
+formatOne(char* out, size_t n, const char* spec, int stars, const int* star,
+          T value)
+{
+  switch (stars)
+  {
+    case 0:
+      return snprintf(out, n, spec, value);
+    case 1:
+      return snprintf(out, n, spec, star[0], value);
+    default:
+      return snprintf(out, n, spec, star[0], star[1], value);
+  }
+}
+
+//! Re-run one conversion with the captured value and a matching modifier
+int
+formatArg(char* out, size_t n, const Spec& spec, const uint8_t** arg,
+          const uint8_t* end)
+{
+  int star[2] = { 0, 0 };
+  for (int i = 0; i < spec.stars; ++i)
+  {
+    int64_t v = 0;
+    if (*arg + 1 + sizeof(v) <= end && **arg == TAG_INT)
+    {
+      memcpy(&v, *arg + 1, sizeof(v));
+      *arg += 1 + sizeof(v);
+    }
+    if (i < 2)
+      star[i] = (int)v;
+  }
+
+  if (*arg >= end)
+    return snprintf(out, n, "<?>");
+
+  char   fmt[32];
+  size_t body = spec.bodyLen < sizeof(fmt) - 4 ? spec.bodyLen : 0;
+  memcpy(fmt, spec.begin, body);
+
+  uint8_t tag = **arg;
+  const uint8_t* value = *arg + 1;
+  switch (tag)
+  {
+    case TAG_INT:
+    case TAG_UINT:
+    {
+      int64_t v;
+      memcpy(&v, value, sizeof(v));
+      *arg = value + sizeof(v);
+      if (spec.conv == 'c')
+      {
+        snprintf(fmt + body, sizeof(fmt) - body, "c");
+        return formatOne(out, n, fmt, spec.stars, star, (int)v);
+      }
+      snprintf(fmt + body, sizeof(fmt) - body, "ll%c", spec.conv);
+      return formatOne(out, n, fmt, spec.stars, star, (long long)v);
+    }
+    case TAG_DOUBLE:
+    {
+      double v;
+      memcpy(&v, value, sizeof(v));
+      *arg = value + sizeof(v);
+      snprintf(fmt + body, sizeof(fmt) - body, "%c", spec.conv);
+      return formatOne(out, n, fmt, spec.stars, star, v);
+    }
+    case TAG_LDOUBLE:
+    {
+      long double v;
+      memcpy(&v, value, sizeof(v));
+      *arg = value + sizeof(v);
+      snprintf(fmt + body, sizeof(fmt) - body, "L%c", spec.conv);
+      return formatOne(out, n, fmt, spec.stars, star, v);
+    }
+    case TAG_PTR:
+    {
+      void* v;
+      memcpy(&v, value, sizeof(v));
+      *arg = value + sizeof(v);
+      snprintf(fmt + body, sizeof(fmt) - body, "p");
+      return formatOne(out, n, fmt, spec.stars, star, v);
+    }
+    case TAG_STR:
+    {
+      uint16_t len;
+      char     str[AsyncLog::MAX_STRING + 1];
+      memcpy(&len, value, sizeof(len));
+      memcpy(str, value + sizeof(len), len);
+      str[len] = '\0';
+      *arg     = value + sizeof(len) + len;
+      snprintf(fmt + body, sizeof(fmt) - body, "s");
+      return formatOne(out, n, fmt, spec.stars, star, (const char*)str);
+    }
+    default:
+      *arg = end;
+      return snprintf(out, n, "<?>");
+  }
+}
+
+} // namespace
+
+void
+StdoutLogSink::write(const char* prefix, const char* text, size_t len)
+{
+  fwrite(text, 1, len, stdout);
+}
+
+void
+StdoutLogSink::flush()
+{
+  fflush(stdout);
+}
+
+FileLogSink::FileLogSink(const char* path)
+{
+  file = fopen(path, "a");
+  if (!file)
+  {
+    DERROR("cannot open log file %s\n", path);
+  }
+}
+
+FileLogSink::~FileLogSink()
+{
+  if (file)
+    fclose(file);
+}
+
+bool
+FileLogSink::isOpen() const
+{
+  return file != NULL;
+}
+
+void
+FileLogSink::write(const char* prefix, const char* text, size_t len)
+{
+  if (file)
+    fwrite(text, 1, len, file);
+}
+
+void
+FileLogSink::flush()
+{
+  if (file)
+    fflush(file);
+}
+
+SyslogLogSink::SyslogLogSink(const char* ident)
+{
+  openlog(ident, LOG_PID, LOG_USER);
+}
+
+SyslogLogSink::~SyslogLogSink()
+{
+  closelog();
+}
+
+void
+SyslogLogSink::write(const char* prefix, const char* text, size_t len)
+{
+  int priority = LOG_INFO;
+  if (prefix && strcmp(prefix, "ERROR") == 0)
+    priority = LOG_ERR;
+  else if (prefix && strcmp(prefix, "DEBUG") == 0)
+    priority = LOG_DEBUG;
+
+  //! syslog is line based, the leading newline of a title is not
+  while (len && (*text == '\n'))
+  {
+    text++;
+    len--;
+  }
+  while (len && text[len - 1] == '\n')
+    len--;
+  if (len)
+    syslog(priority, "%.*s", (int)len, text);
+}
+
+AsyncLog::AsyncLog()
+  : Log(0, true)
+  , sink(NULL)
+  , ownedSink(NULL)
+  , running(false)
+  , rings(NULL)
+  , reported(0)
+{
+  pthread_key_create(&ringKey, releaseRing);
+}
+
+AsyncLog::~AsyncLog()
+{
+  //! Never destroyed: threads keep pointers to their rings
+}
+
+bool
+AsyncLog::start(LogSink* sink)
+{
+  if (!logger)
+  {
+    logger = new (std::nothrow) AsyncLog();
+    if (!logger)
+      return false;
+  }
+  if (logger->running)
+    return true;
+
+  if (!sink)
+  {
+    if (!logger->ownedSink)
+      logger->ownedSink = new (std::nothrow) StdoutLogSink();
+    sink = logger->ownedSink;
+  }
+  logger->sink    = sink;
+  logger->running = true;
+  if (pthread_create(&logger->thread, NULL, drainCall, logger) != 0)
+  {
+    logger->running = false;
+    return false;
+  }
+  pthread_setname_np(logger->thread, "osdk-log");
+
+  previous                     = Singleton<Log>::singleInstance;
+  Singleton<Log>::singleInstance = logger;
+  return true;
+}
+
+void
+AsyncLog::stop()
+{
+  if (!logger || !logger->running)
+    return;
+
+  //! Threads that already hold the async instance finish into the rings;
+  //! the final drain below picks up what they managed to write
+  Singleton<Log>::singleInstance = previous;
+  logger->running                = false;
+  pthread_join(logger->thread, NULL);
+  while (logger->drainOnce())
+    ;
+  logger->sink->flush();
+}
+
+void
+AsyncLog::flush()
+{
+  if (!logger || !logger->running)
+    return;
+
+  for (Ring* r = logger->rings; r; r = r->next)
+  {
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    while (__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) < head &&
+           logger->running)
+    {
+      usleep(100);
+    }
+  }
+  //! The last record may still sit between tail and the sink
+  usleep(IDLE_WAITUS);
+}
+
+uint64_t
+AsyncLog::getDropped()
+{
+  uint64_t dropped = 0;
+  if (logger)
+  {
+    for (Ring* r = logger->rings; r; r = r->next)
+      dropped += r->dropped;
+  }
+  return dropped;
+}
+
+Log&
+AsyncLog::title(int level, const char* prefix, const char* func, int line)
+{
+  if (!level)
+    return mute();
+
+  pendingPrefix = prefix;
+  pendingFunc   = func;
+  pendingLevel  = level;
+  pendingLine   = line;
+  return *this;
+}
+
+Log&
+AsyncLog::print(const char* fmt, ...)
+{
+  Ring* ring = localRing();
+  if (!ring || !fmt)
+    return *this;
+
+  uint64_t    record[MAX_RECORD / sizeof(uint64_t)];
+  RecordHead* head = (RecordHead*)record;
+  uint8_t*    args = (uint8_t*)record + sizeof(RecordHead);
+
+  va_list ap;
+  va_start(ap, fmt);
+  head->argBytes = captureArgs(args, fmt, ap);
+  va_end(ap);
+
+  head->size   = (sizeof(RecordHead) + head->argBytes + 7) & ~7u;
+  head->fmt    = fmt;
+  head->prefix = pendingPrefix;
+  head->func   = pendingFunc;
+  head->level  = pendingLevel;
+  head->line   = pendingLine;
+  pendingLevel = 0;
+  pendingPrefix = NULL;
+
+  //! Single producer: only this thread moves head
+  uint64_t pos    = ring->head;
+  uint64_t tail   = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  size_t   offset = pos & (RING_SIZE - 1);
+  size_t   room   = RING_SIZE - offset;
+  size_t   skip   = (room < head->size) ? room : 0;
+
+  if (pos + skip + head->size - tail > RING_SIZE)
+  {
+    __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+    return *this;
+  }
+  if (skip >= sizeof(RecordHead))
+  {
+    RecordHead* pad = (RecordHead*)(ring->data + offset);
+    pad->size       = skip;
+    pad->fmt        = NULL;
+  }
+  memcpy(ring->data + ((pos + skip) & (RING_SIZE - 1)), record, head->size);
+  __atomic_store_n(&ring->head, pos + skip + head->size, __ATOMIC_RELEASE);
+  return *this;
+}
+
+AsyncLog::Ring*
+AsyncLog::localRing()
+{
+  static __thread Ring* ring = NULL;
+  if (ring)
+    return ring;
+
+  //! Reuse the ring of a thread that has exited
+  for (Ring* r = logger->rings; r; r = r->next)
+  {
+    int unowned = 0;
+    if (__atomic_compare_exchange_n(&r->owned, &unowned, 1, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+    {
+      ring = r;
+      break;
+    }
+  }
+
+  if (!ring)
+  {
+    void* memory = NULL;
+    if (posix_memalign(&memory, 64, sizeof(Ring)) != 0)
+      return NULL;
+    ring = (Ring*)memory;
+    memset(ring, 0, sizeof(Ring));
+    ring->owned = 1;
+
+    Ring* first = logger->rings;
+    do
+    {
+      ring->next = first;
+    } while (!__atomic_compare_exchange_n(&logger->rings, &first, ring, false,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  }
+
+  pthread_setspecific(logger->ringKey, ring);
+  return ring;
+}
+
+void
+AsyncLog::releaseRing(void* ring)
+{
+  __atomic_store_n(&((Ring*)ring)->owned, 0, __ATOMIC_RELEASE);
+}
+
+void*
+AsyncLog::drainCall(void* param)
+{
+  ((AsyncLog*)param)->drain();
+  return NULL;
+}
+
+void
+AsyncLog::drain()
+{
+  while (running)
+  {
+    if (!drainOnce())
+      usleep(IDLE_WAITUS);
+  }
+}
+
+bool
+AsyncLog::drainOnce()
+{
+  bool wrote = false;
+
+  for (Ring* r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r; r = r->next)
+  {
+    uint64_t tail = r->tail;
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    while (tail < head)
+    {
+      size_t offset = tail & (RING_SIZE - 1);
+      size_t room   = RING_SIZE - offset;
+      if (room < sizeof(RecordHead))
+      {
+        tail += room;
+        continue;
+      }
+      const RecordHead* h = (const RecordHead*)(r->data + offset);
+      if (h->fmt)
+      {
+        format(r->data + offset, h->size);
+        wrote = true;
+      }
+      tail += h->size;
+    }
+    __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+  }
+
+  uint64_t dropped = getDropped();
+  if (dropped != reported)
+  {
+    char line[64];
+    int  n = snprintf(line, sizeof(line), "\nERROR/1 @ AsyncLog, L0: "
+                                          "%llu log records dropped\n",
+                      (unsigned long long)(dropped - reported));
+    sink->write("ERROR", line, n);
+    reported = dropped;
+    wrote    = true;
+  }
+
+  if (wrote)
+    sink->flush();
+  return wrote;
+}
+
+void
+AsyncLog::format(const uint8_t* record, uint32_t size)
+{
+  const RecordHead* h    = (const RecordHead*)record;
+  const uint8_t*    arg  = record + sizeof(RecordHead);
+  const uint8_t*    end  = arg + h->argBytes;
+  char              line[MAX_LINE];
+  size_t            used = 0;
+
+  if (h->level)
+  {
+    int n = snprintf(line, sizeof(line), "\n%s/%d @ %s, L%d: ", h->prefix,
+                     h->level, h->func, h->line);
+    used  = (n > 0) ? n : 0;
+  }
+
+  Spec spec;
+  for (const char* p = h->fmt; *p && used < sizeof(line) - 1;)
+  {
+    if (*p != '%')
+    {
+      line[used++] = *p++;
+      continue;
+    }
+    p = parseSpec(p, &spec);
+    if (spec.conv == '%')
+    {
+      line[used++] = '%';
+      continue;
+    }
+    if (!spec.conv || spec.conv == 'n')
+      continue;
+
+    int n = formatArg(line + used, sizeof(line) - used, spec, &arg, end);
+    if (n > 0)
+      used += (used + n < sizeof(line)) ? n : sizeof(line) - 1 - used;
+  }
+  line[used] = '\0';
+
+  sink->write(h->level ? h->prefix : NULL, line, used);
+}
@@ -0,0 +1,739 @@
+/*! @file linux_broker.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Local broker multiplexing one Vehicle link across client processes
+ *  over a Unix-domain socket
+ *
+ *  @copyright
+ *  2016-17 DJI. All rights reserved.
+ * */
+
+#include "linux_broker.hpp"
+#include "dji_vehicle.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace DJI::OSDK;
+using namespace DJI::OSDK::Broker;
+
+static uint64_t
+monotonicMs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+VehicleBroker::VehicleBroker(Vehicle* vehicle)
+  : vehicle(vehicle)
+  , running(false)
+  , listenFd(-1)
+  , generation(0)
+  , inFlight(0)
+  , ackBase(-1)
+  , queueHead(0)
+  , queueTail(0)
+{
+  wakeFd[0] = wakeFd[1] = -1;
+  path[0]               = 0;
+  pthread_mutex_init(&lock, NULL);
+  memset(&stats, 0, sizeof(stats));
+  memset(pending, 0, sizeof(pending));
+  for (int i = 0; i < MAX_CLIENT; ++i)
+  {
+    clients[i].fd   = -1;
+    clients[i].push = false;
+  }
+}
+
+VehicleBroker::~VehicleBroker()
+{
+  stop();
+  pthread_mutex_destroy(&lock);
+}
+
+bool
+VehicleBroker::start(const char* socketPath)
+{
+  if (__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+  {
+    DERROR("Broker already running on %s\n", path);
+    return false;
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(socketPath) >= sizeof(addr.sun_path))
+  {
+    DERROR("Socket path too long: %s\n", socketPath);
+    return false;
+  }
+  strcpy(addr.sun_path, socketPath);
+  strcpy(path, socketPath);
+
+  listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (listenFd < 0)
+  {
+    DERROR("socket failed: %s\n", strerror(errno));
+    return false;
+  }
+  unlink(path);
+  if (bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+      listen(listenFd, MAX_CLIENT) != 0)
+  {
+    DERROR("Cannot listen on %s: %s\n", path, strerror(errno));
+    ::close(listenFd);
+    listenFd = -1;
+    return false;
+  }
+
+  if (pipe2(wakeFd, O_NONBLOCK | O_CLOEXEC) != 0)
+  {
+    DERROR("pipe failed: %s\n", strerror(errno));
+    ::close(listenFd);
+    listenFd = -1;
+    return false;
+  }
+
+  //! Set once here, so the server thread never writes the Vehicle's table
+  ackBase = vehicle->reserveCallbackIds(MAX_IN_FLIGHT, ackCallback, this);
+  if (ackBase < 0)
+  {
+    stop();
+    return false;
+  }
+  vehicle->addPushDataListener(pushCallback, this);
+
+  __atomic_store_n(&running, true, __ATOMIC_RELEASE);
+  if (pthread_create(&serverThread, NULL, serverCall, this) != 0)
+  {
+    DERROR("fail to create thread for broker!\n");
+    __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+    stop();
+    return false;
+  }
+  pthread_setname_np(serverThread, "broker");
+
+  DSTATUS("Broker listening on %s\n", path);
+  return true;
+}
+
+void
+VehicleBroker::stop()
+{
+  if (__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+  {
+    __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+    if (write(wakeFd[1], "q", 1) < 0)
+    {
+      DDEBUG("wake write failed\n");
+    }
+    pthread_join(serverThread, NULL);
+  }
+
+  vehicle->removePushDataListener(pushCallback, this);
+
+  //! Nothing may call back into a stopped broker
+  for (int i = 0; i < MAX_IN_FLIGHT; ++i)
+  {
+    pthread_mutex_lock(&lock);
+    uint32_t handle = pending[i].used ? pending[i].handle : 0;
+    pending[i].used = false;
+    pthread_mutex_unlock(&lock);
+    if (handle)
+      vehicle->protocolLayer->cancel(handle);
+  }
+
+  pthread_mutex_lock(&lock);
+  inFlight = 0;
+  if (ackBase >= 0)
+    vehicle->releaseCallbackIds(ackBase, MAX_IN_FLIGHT);
+  ackBase = -1;
+  for (int i = 0; i < MAX_CLIENT; ++i)
+  {
+    if (clients[i].fd >= 0)
+    {
+      ::close(clients[i].fd);
+      clients[i].fd = -1;
+    }
+  }
+  pthread_mutex_unlock(&lock);
+
+  if (listenFd >= 0)
+  {
+    ::close(listenFd);
+    listenFd = -1;
+    unlink(path);
+  }
+  for (int i = 0; i < 2; ++i)
+  {
+    if (wakeFd[i] >= 0)
+    {
+      ::close(wakeFd[i]);
+      wakeFd[i] = -1;
+    }
+  }
+}
+
+Broker::Stats
+VehicleBroker::getStats()
+{
+  pthread_mutex_lock(&lock);
+  Broker::Stats ans = stats;
+  pthread_mutex_unlock(&lock);
+  return ans;
+}
+
+void*
+VehicleBroker::serverCall(void* param)
+{
+  ((VehicleBroker*)param)->serve();
+  return NULL;
+}
+
+void
+VehicleBroker::serve()
+{
+  struct pollfd fds[MAX_CLIENT + 2];
+  int           index[MAX_CLIENT + 2];
+
+  while (__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+  {
+    int n = 0;
+
+    fds[n].fd     = listenFd;
+    fds[n].events = POLLIN;
+    index[n++]    = -1;
+    fds[n].fd     = wakeFd[0];
+    fds[n].events = POLLIN;
+    index[n++]    = -1;
+
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < MAX_CLIENT; ++i)
+    {
+      if (clients[i].fd >= 0)
+      {
+        fds[n].fd     = clients[i].fd;
+        fds[n].events = POLLIN;
+        index[n++]    = i;
+      }
+    }
+    pthread_mutex_unlock(&lock);
+
+    //! Sleep only while nothing is queued; otherwise come back quickly to
+    //! refill sessions freed by incoming ACKs.
+    int timeout = (queueHead != queueTail) ? 1 : 10;
+    if (poll(fds, n, timeout) < 0 && errno != EINTR)
+    {
+      DERROR("poll failed: %s\n", strerror(errno));
+      break;
+    }
+
+    if (fds[0].revents & POLLIN)
+      acceptClient();
+    if (fds[1].revents & POLLIN)
+    {
+      char drain[64];
+      while (read(wakeFd[0], drain, sizeof(drain)) > 0)
+        ;
+    }
+
+    //! Batch: drain every readable client before touching the link
+    for (int i = 2; i < n; ++i)
+    {
+      if (fds[i].revents & (POLLHUP | POLLERR))
+        dropClient(index[i]);
+      else if ((fds[i].revents & POLLIN) && !readClient(index[i]))
+        dropClient(index[i]);
+    }
+
+    expire();
+    dispatch();
+  }
+}
+
+void
+VehicleBroker::acceptClient()
+{
+  int fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+  if (fd < 0)
+    return;
+
+  pthread_mutex_lock(&lock);
+  for (int i = 0; i < MAX_CLIENT; ++i)
+  {
+    if (clients[i].fd < 0)
+    {
+      clients[i].fd         = fd;
+      clients[i].generation = ++generation;
+      clients[i].push       = false;
+      pthread_mutex_unlock(&lock);
+      DDEBUG("Broker client %d connected\n", i);
+      return;
+    }
+  }
+  pthread_mutex_unlock(&lock);
+
+  DERROR("Broker is full, rejecting client\n");
+  ::close(fd);
+}
+
+void
+VehicleBroker::dropClient(int index)
+{
+  pthread_mutex_lock(&lock);
+  if (clients[index].fd >= 0)
+  {
+    ::close(clients[index].fd);
+    clients[index].fd   = -1;
+    clients[index].push = false;
+  }
+  pthread_mutex_unlock(&lock);
+  DDEBUG("Broker client %d disconnected\n", index);
+}
+
+bool
+VehicleBroker::readClient(int index)
+{
+  uint8_t  msg[MAX_MESSAGE];
+  int      fd  = clients[index].fd;
+  uint32_t gen = clients[index].generation;
+
+  //! A few messages per client per round keeps one client from starving
+  //! the others
+  for (int round = 0; round < 4; ++round)
+  {
+    ssize_t len = recv(fd, msg, sizeof(msg), MSG_DONTWAIT);
+    if (len == 0)
+      return false;
+    if (len < 0)
+      return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+
+    pthread_mutex_lock(&lock);
+    stats.batches++;
+    pthread_mutex_unlock(&lock);
+
+    size_t pos = 0;
+    while (pos + sizeof(Request) <= (size_t)len)
+    {
+      Request req;
+      memcpy(&req, msg + pos, sizeof(req));
+      pos += sizeof(req);
+      if (pos + req.length > (size_t)len)
+      {
+        DERROR("Truncated broker request from client %d\n", index);
+        return false;
+      }
+
+      if (req.type == REQUEST_PUSH_ON || req.type == REQUEST_PUSH_OFF)
+      {
+        pthread_mutex_lock(&lock);
+        clients[index].push = (req.type == REQUEST_PUSH_ON);
+        pthread_mutex_unlock(&lock);
+      }
+      else if (req.type == REQUEST_COMMAND)
+      {
+        int next = (queueTail + 1) % MAX_QUEUE;
+        pthread_mutex_lock(&lock);
+        stats.requests++;
+        pthread_mutex_unlock(&lock);
+        if (next == queueHead || req.length > MAX_PAYLOAD)
+        {
+          pthread_mutex_lock(&lock);
+          stats.rejected++;
+          pthread_mutex_unlock(&lock);
+          reply(index, gen, REPLY_REJECTED, req.cmd_set, req.cmd_id, req.tag,
+                NULL, 0);
+        }
+        else
+        {
+          Queued* q     = &queue[queueTail];
+          q->client     = index;
+          q->generation = gen;
+          q->req        = req;
+          q->buf[0]     = req.cmd_set;
+          q->buf[1]     = req.cmd_id;
+          memcpy(q->buf + 2, msg + pos, req.length);
+          queueTail = next;
+        }
+      }
+      pos += req.length;
+    }
+  }
+  return true;
+}
+
+void
+VehicleBroker::dispatch()
+{
+  while (queueHead != queueTail)
+  {
+    Queued* q = &queue[queueHead];
+
+    Command cmd;
+    cmd.encrypt    = q->req.encrypt;
+    cmd.retry      = q->req.retry;
+    cmd.timeout    = q->req.timeout;
+    cmd.length     = q->req.length + 2;
+    cmd.cmd_set    = q->req.cmd_set;
+    cmd.cmd_id     = q->req.cmd_id;
+    cmd.isCallback = false;
+    cmd.callbackID = 0;
+
+    if (!q->req.needAck)
+    {
+      cmd.sessionMode = 0;
+      cmd.buf         = q->buf;
+      if (vehicle->protocolLayer->send(&cmd) != 0)
+        break;
+      pthread_mutex_lock(&lock);
+      stats.forwarded++;
+      pthread_mutex_unlock(&lock);
+      queueHead = (queueHead + 1) % MAX_QUEUE;
+      continue;
+    }
+
+    pthread_mutex_lock(&lock);
+    int slot = 0;
+    while (slot < MAX_IN_FLIGHT && pending[slot].used)
+      slot++;
+    if (slot == MAX_IN_FLIGHT)
+    {
+      //! Every slot waits for an ACK or its timeout; retry next round
+      pthread_mutex_unlock(&lock);
+      break;
+    }
+    Pending* p       = &pending[slot];
+    p->used          = true;
+    p->client        = q->client;
+    p->generation    = q->generation;
+    p->tag           = q->req.tag;
+    p->cmd_set       = q->req.cmd_set;
+    p->cmd_id        = q->req.cmd_id;
+    p->deadline =
+      monotonicMs() +
+      (uint64_t)q->req.timeout * (q->req.retry > 0 ? q->req.retry : 1) + 100;
+    p->handle = 0;
+    inFlight++;
+    pthread_mutex_unlock(&lock);
+
+    //! send() copies the payload into the session; the queue entry can go
+    cmd.sessionMode = 2;
+    cmd.buf         = q->buf;
+    cmd.isCallback  = true;
+    cmd.callbackID  = ackBase + slot;
+    uint32_t handle;
+    if (vehicle->protocolLayer->send(&cmd, &handle) != 0)
+    {
+      //! Out of sessions or MMU memory: keep it queued, retry next round
+      pthread_mutex_lock(&lock);
+      p->used = false;
+      inFlight--;
+      pthread_mutex_unlock(&lock);
+      break;
+    }
+
+    pthread_mutex_lock(&lock);
+    //! Unless the ACK already freed the slot
+    if (p->used)
+      p->handle = handle;
+    stats.forwarded++;
+    pthread_mutex_unlock(&lock);
+    queueHead = (queueHead + 1) % MAX_QUEUE;
+  }
+}
+
+void
+VehicleBroker::expire()
+{
+  uint64_t now = monotonicMs();
+  for (int i = 0; i < MAX_IN_FLIGHT; ++i)
+  {
+    pthread_mutex_lock(&lock);
+    if (!pending[i].used || pending[i].deadline > now)
+    {
+      pthread_mutex_unlock(&lock);
+      continue;
+    }
+    Pending p       = pending[i];
+    pending[i].used = false;
+    inFlight--;
+    stats.timedOut++;
+    pthread_mutex_unlock(&lock);
+
+    //! Free the session before the slot is reused, so a late ACK is dropped
+    vehicle->protocolLayer->cancel(p.handle);
+
+    reply(p.client, p.generation, REPLY_TIMEOUT, p.cmd_set, p.cmd_id, p.tag,
+          NULL, 0);
+  }
+}
+
+void
+VehicleBroker::reply(int client, uint32_t gen, uint8_t type, uint8_t cmd_set,
+                     uint8_t cmd_id, uint32_t tag, const uint8_t* data,
+                     size_t len)
+{
+  uint8_t msg[sizeof(Reply) + MAX_INCOMING_DATA_SIZE];
+  Reply   r;
+
+  if (len > MAX_INCOMING_DATA_SIZE)
+    len = MAX_INCOMING_DATA_SIZE;
+
+  r.type     = type;
+  r.cmd_set  = cmd_set;
+  r.cmd_id   = cmd_id;
+  r.reserved = 0;
+  r.tag      = tag;
+  r.length   = len;
+  memcpy(msg, &r, sizeof(r));
+  if (len)
+    memcpy(msg + sizeof(r), data, len);
+
+  pthread_mutex_lock(&lock);
+  if (clients[client].fd >= 0 && clients[client].generation == gen)
+  {
+    //! Never let a slow client stall the read or callback thread
+    if (::send(clients[client].fd, msg, sizeof(r) + len,
+               MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+    {
+      DDEBUG("Dropped reply to client %d: %s\n", client, strerror(errno));
+    }
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void
+VehicleBroker::ackCallback(Vehicle* vehicle, RecvContainer recvFrame,
+                           UserData userData)
+{
+  VehicleBroker* broker = (VehicleBroker*)userData;
+
+  pthread_mutex_lock(&broker->lock);
+  int cbIndex = recvFrame.dispatchInfo.callbackID - broker->ackBase;
+  if (broker->ackBase < 0 || cbIndex < 0 || cbIndex >= MAX_IN_FLIGHT ||
+      !broker->pending[cbIndex].used)
+  {
+    //! Already reported as timed out
+    pthread_mutex_unlock(&broker->lock);
+    return;
+  }
+  Pending p                     = broker->pending[cbIndex];
+  broker->pending[cbIndex].used = false;
+  broker->inFlight--;
+  broker->stats.acked++;
+  pthread_mutex_unlock(&broker->lock);
+
+  size_t len = 0;
+  if (recvFrame.recvInfo.len > Protocol::PackageMin)
+    len = recvFrame.recvInfo.len - Protocol::PackageMin;
+
+  broker->reply(p.client, p.generation, REPLY_ACK, p.cmd_set, p.cmd_id, p.tag,
+                recvFrame.recvData.raw_ack_array, len);
+
+  //! A session just freed up
+  if (write(broker->wakeFd[1], "a", 1) < 0)
+  {
+    DDEBUG("wake write failed\n");
+  }
+}
+
+void
+VehicleBroker::pushCallback(Vehicle* vehicle, RecvContainer recvFrame,
+                            UserData userData)
+{
+  VehicleBroker* broker = (VehicleBroker*)userData;
+
+  size_t len = 0;
+  if (recvFrame.recvInfo.len > Protocol::PackageMin + 2)
+    len = recvFrame.recvInfo.len - (Protocol::PackageMin + 2);
+
+  for (int i = 0; i < MAX_CLIENT; ++i)
+  {
+    pthread_mutex_lock(&broker->lock);
+    bool     push = broker->clients[i].fd >= 0 && broker->clients[i].push;
+    uint32_t gen  = broker->clients[i].generation;
+    if (push)
+      broker->stats.pushed++;
+    pthread_mutex_unlock(&broker->lock);
+
+    if (push)
+    {
+      broker->reply(i, gen, REPLY_PUSH, recvFrame.recvInfo.cmd_set,
+                    recvFrame.recvInfo.cmd_id, 0,
+                    recvFrame.recvData.raw_ack_array, len);
+    }
+  }
+}
+
+BrokerClient::BrokerClient()
+  : fd(-1)
+  , batchLen(0)
+{
+}
+
+BrokerClient::~BrokerClient()
+{
+  close();
+}
+
+bool
+BrokerClient::connect(const char* path)
+{
+  struct sockaddr_un addr;
+
+  close();
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+  {
+    DERROR("socket failed: %s\n", strerror(errno));
+    return false;
+  }
+  if (::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+  {
+    DERROR("Cannot connect to broker %s: %s\n", path, strerror(errno));
+    ::close(fd);
+    fd = -1;
+    return false;
+  }
+  return true;
+}
+
+void
+BrokerClient::close()
+{
+  if (fd >= 0)
+  {
+    ::close(fd);
+    fd = -1;
+  }
+  batchLen = 0;
+}
+
+int
+BrokerClient::getFd() const
+{
+  return fd;
+}
+
+bool
+BrokerClient::append(const Request& req, const void* data)
+{
+  if (sizeof(req) + req.length > MAX_MESSAGE)
+    return false;
+  if (batchLen + sizeof(req) + req.length > MAX_MESSAGE && !flush())
+    return false;
+
+  memcpy(batch + batchLen, &req, sizeof(req));
+  batchLen += sizeof(req);
+  if (req.length && data)
+  {
+    memcpy(batch + batchLen, data, req.length);
+    batchLen += req.length;
+  }
+  return true;
+}
+
+bool
+BrokerClient::queue(const uint8_t cmd[], const void* data, size_t len,
+                    uint32_t tag, bool needAck, int timeout, int retry,
+                    bool encrypt)
+{
+  if (len > MAX_PAYLOAD)
+  {
+    DERROR("Broker payload of %d bytes is too large\n", (int)len);
+    return false;
+  }
+
+  Request req;
+  memset(&req, 0, sizeof(req));
+  req.type    = REQUEST_COMMAND;
+  req.cmd_set = cmd[0];
+  req.cmd_id  = cmd[1];
+  req.encrypt = encrypt ? 1 : 0;
+  req.needAck = needAck ? 1 : 0;
+  req.timeout = timeout;
+  req.retry   = retry;
+  req.tag     = tag;
+  req.length  = len;
+  return append(req, data);
+}
+
+bool
+BrokerClient::flush()
+{
+  if (batchLen == 0)
+    return true;
+  if (fd < 0)
+    return false;
+
+  ssize_t ans = ::send(fd, batch, batchLen, MSG_NOSIGNAL);
+  batchLen    = 0;
+  if (ans < 0)
+  {
+    DERROR("Broker send failed: %s\n", strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool
+BrokerClient::send(const uint8_t cmd[], const void* data, size_t len,
+                   uint32_t tag, bool needAck, int timeout, int retry,
+                   bool encrypt)
+{
+  return queue(cmd, data, len, tag, needAck, timeout, retry, encrypt) &&
+         flush();
+}
+
+bool
+BrokerClient::setPushData(bool enable)
+{
+  Request req;
+  memset(&req, 0, sizeof(req));
+  req.type = enable ? REQUEST_PUSH_ON : REQUEST_PUSH_OFF;
+  return append(req, NULL) && flush();
+}
+
+bool
+BrokerClient::receive(Reply* reply, uint8_t* data, size_t maxLen,
+                      int timeoutMs)
+{
+  uint8_t msg[sizeof(Reply) + MAX_INCOMING_DATA_SIZE];
+
+  if (fd < 0)
+    return false;
+
+  if (timeoutMs >= 0)
+  {
+    struct pollfd pfd;
+    pfd.fd     = fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, timeoutMs) <= 0)
+      return false;
+  }
+
+  ssize_t len = recv(fd, msg, sizeof(msg), 0);
+  if (len < (ssize_t)sizeof(Reply))
+    return false;
+
+  memcpy(reply, msg, sizeof(Reply));
+  size_t n = reply->length < maxLen ? reply->length : maxLen;
+  if (data && n)
+    memcpy(data, msg + sizeof(Reply), n);
+  return true;
+}
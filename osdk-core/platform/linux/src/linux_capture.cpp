@@ -0,0 +1,529 @@
+/*! @file linux_capture.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Raw link capture to a memory-mapped file and replay through Protocol
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#include "linux_capture.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace DJI::OSDK;
+using namespace DJI::OSDK::Capture;
+
+static uint64_t
+clockNs(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+CaptureWriter::CaptureWriter()
+  : fd(-1)
+  , window(NULL)
+  , windowOffset(0)
+  , position(0)
+  , lastNs(0)
+  , bytes(0)
+{
+  pthread_mutex_init(&lock, NULL);
+}
+
+CaptureWriter::~CaptureWriter()
+{
+  close();
+  pthread_mutex_destroy(&lock);
+}
+
+bool
+CaptureWriter::open(const char* path)
+{
+  close();
+
+  fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    DERROR("Cannot create capture %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  if (!map(0))
+  {
+    close();
+    return false;
+  }
+
+  FileHeader* header      = (FileHeader*)window;
+  header->magic           = MAGIC;
+  header->version         = VERSION;
+  header->headerSize      = sizeof(FileHeader);
+  header->startNs         = clockNs(CLOCK_MONOTONIC);
+  header->startRealtimeNs = clockNs(CLOCK_REALTIME);
+  header->dataSize        = 0;
+
+  lastNs   = header->startNs;
+  position = sizeof(FileHeader);
+  bytes    = 0;
+  return true;
+}
+
+bool
+CaptureWriter::map(uint64_t offset)
+{
+  if (window)
+    munmap(window, WINDOW_SIZE);
+  window = NULL;
+
+  if (ftruncate(fd, offset + WINDOW_SIZE) != 0)
+  {
+    DERROR("Cannot grow capture: %s\n", strerror(errno));
+    return false;
+  }
+  void* p = mmap(NULL, WINDOW_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                 offset);
+  if (p == MAP_FAILED)
+  {
+    DERROR("Cannot map capture: %s\n", strerror(errno));
+    return false;
+  }
+  window       = (uint8_t*)p;
+  windowOffset = offset;
+  return true;
+}
+
+void
+CaptureWriter::close()
+{
+  if (fd < 0)
+    return;
+
+  if (window)
+    munmap(window, WINDOW_SIZE);
+  window = NULL;
+
+  uint64_t dataSize = position - sizeof(FileHeader);
+  if (ftruncate(fd, position) != 0 ||
+      pwrite(fd, &dataSize, sizeof(dataSize), offsetof(FileHeader, dataSize)) !=
+        sizeof(dataSize))
+  {
+    DERROR("Capture not closed cleanly: %s\n", strerror(errno));
+  }
+  ::close(fd);
+  fd = -1;
+}
+
+bool
+CaptureWriter::isOpen() const
+{
+  return fd >= 0;
+}
+
+uint64_t
+CaptureWriter::getBytes() const
+{
+  return bytes;
+}
+
+void
+CaptureWriter::put(const uint8_t* data, size_t length)
+{
+  while (length && window)
+  {
+    if (position >= windowOffset + WINDOW_SIZE && !map(position))
+      return;
+
+    size_t room = windowOffset + WINDOW_SIZE - position;
+    size_t n    = length < room ? length : room;
+    memcpy(window + (position - windowOffset), data, n);
+    position += n;
+    data += n;
+    length -= n;
+  }
+}
+
+void
+CaptureWriter::putVarint(uint64_t value)
+{
+  uint8_t buf[10];
+  size_t  n = 0;
+  while (value >= 0x80)
+  {
+    buf[n++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  buf[n++] = (uint8_t)value;
+  put(buf, n);
+}
+
+void
+CaptureWriter::write(int direction, const uint8_t* data, size_t length)
+{
+  if (!length)
+    return;
+
+  pthread_mutex_lock(&lock);
+  if (window)
+  {
+    uint64_t now = clockNs(CLOCK_MONOTONIC);
+    //! Whole microseconds only, the remainder carries over
+    uint64_t deltaUs = (now - lastNs) / 1000;
+    lastNs += deltaUs * 1000;
+
+    putVarint((uint64_t)length << 1 | (direction & 1));
+    putVarint(deltaUs);
+    put(data, length);
+    bytes += length;
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+CaptureReader::CaptureReader()
+  : data(NULL)
+  , size(0)
+  , position(0)
+  , end(0)
+  , timeNs(0)
+{
+}
+
+CaptureReader::~CaptureReader()
+{
+  close();
+}
+
+bool
+CaptureReader::open(const char* path)
+{
+  close();
+
+  int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    DERROR("Cannot open capture %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FileHeader))
+  {
+    DERROR("Capture %s is too short\n", path);
+    ::close(fd);
+    return false;
+  }
+
+  void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED)
+  {
+    DERROR("Cannot map capture %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  data = (uint8_t*)p;
+  size = st.st_size;
+
+  const FileHeader* header = getHeader();
+  if (header->magic != MAGIC || header->version != VERSION ||
+      header->headerSize < sizeof(FileHeader) || header->headerSize > size)
+  {
+    DERROR("%s is not a capture file\n", path);
+    close();
+    return false;
+  }
+
+  end = size;
+  if (header->dataSize && header->headerSize + header->dataSize < size)
+    end = header->headerSize + header->dataSize;
+  madvise(data, size, MADV_SEQUENTIAL);
+  rewind();
+  return true;
+}
+
+void
+CaptureReader::close()
+{
+  if (data)
+    munmap(data, size);
+  data = NULL;
+  size = 0;
+}
+
+void
+CaptureReader::rewind()
+{
+  position = data ? getHeader()->headerSize : 0;
+  timeNs   = 0;
+}
+
+void
+CaptureReader::seek(size_t position, uint64_t timeNs)
+{
+  this->position = position;
+  this->timeNs   = timeNs;
+}
+
+size_t
+CaptureReader::tell() const
+{
+  return position;
+}
+
+uint64_t
+CaptureReader::getTimeNs() const
+{
+  return timeNs;
+}
+
+const FileHeader*
+CaptureReader::getHeader() const
+{
+  return (const FileHeader*)data;
+}
+
+bool
+CaptureReader::getVarint(uint64_t* value)
+{
+  *value = 0;
+  for (int shift = 0; shift < 64 && position < end; shift += 7)
+  {
+    uint8_t b = data[position++];
+    *value |= (uint64_t)(b & 0x7F) << shift;
+    if (!(b & 0x80))
+      return true;
+  }
+  return false;
+}
+
+bool
+CaptureReader::next(Record* record)
+{
+  uint64_t tag;
+  uint64_t deltaUs;
+  if (!data || position >= end || !getVarint(&tag) || !tag ||
+      !getVarint(&deltaUs))
+    return false;
+
+  size_t length = tag >> 1;
+  if (length > end - position)
+    return false;
+
+  timeNs += deltaUs * 1000;
+  record->direction = tag & 1;
+  record->timeNs    = timeNs;
+  record->data      = data + position;
+  record->length    = length;
+  position += length;
+  return true;
+}
+
+CaptureDriver::CaptureDriver(HardDriver* driver, const char* path)
+  : driver(driver)
+{
+  writer.open(path);
+}
+
+CaptureDriver::~CaptureDriver()
+{
+  writer.close();
+  delete driver;
+}
+
+void
+CaptureDriver::init()
+{
+  driver->init();
+}
+
+time_ms
+CaptureDriver::getTimeStamp()
+{
+  return driver->getTimeStamp();
+}
+
+size_t
+CaptureDriver::send(const uint8_t* buf, size_t len)
+{
+  size_t n = driver->send(buf, len);
+  //! Drivers returning -1 through size_t wrote nothing
+  if (n > 0 && n <= len)
+    writer.write(TX, buf, n);
+  return n;
+}
+
+size_t
+CaptureDriver::readall(uint8_t* buf, size_t maxlen)
+{
+  size_t n = driver->readall(buf, maxlen);
+  if (n > 0 && n <= maxlen)
+    writer.write(RX, buf, n);
+  return n;
+}
+
+bool
+CaptureDriver::getDeviceStatus()
+{
+  return driver->getDeviceStatus();
+}
+
+bool
+CaptureDriver::getLineCounters(LineCounters* counters)
+{
+  return driver->getLineCounters(counters);
+}
+
+CaptureWriter*
+CaptureDriver::getWriter()
+{
+  return &writer;
+}
+
+ReplayDriver::ReplayDriver(const char* path, Mode mode)
+  : mode(mode)
+  , recordOffset(0)
+  , hasRecord(false)
+  , finished(false)
+  , firstReadNs(0)
+  , firstRecordNs(0)
+  , finishNs(0)
+  , replayedBytes(0)
+{
+  opened = reader.open(path);
+  if (!opened)
+    finished = true;
+}
+
+ReplayDriver::~ReplayDriver()
+{
+}
+
+void
+ReplayDriver::init()
+{
+}
+
+bool
+ReplayDriver::getDeviceStatus()
+{
+  return opened;
+}
+
+time_ms
+ReplayDriver::getTimeStamp()
+{
+  return clockNs(CLOCK_MONOTONIC) / 1000000;
+}
+
+size_t
+ReplayDriver::send(const uint8_t* buf, size_t len)
+{
+  return len;
+}
+
+bool
+ReplayDriver::nextRx()
+{
+  while (reader.next(&record))
+  {
+    if (record.direction == RX)
+    {
+      recordOffset = 0;
+      hasRecord    = true;
+      return true;
+    }
+  }
+  hasRecord = false;
+  return false;
+}
+
+size_t
+ReplayDriver::readall(uint8_t* buf, size_t maxlen)
+{
+  if (finished)
+    return 0;
+
+  uint64_t now = clockNs(CLOCK_MONOTONIC);
+  if (!firstReadNs)
+  {
+    firstReadNs = now;
+    if (!nextRx())
+    {
+      finished = true;
+      finishNs = now;
+      return 0;
+    }
+    firstRecordNs = record.timeNs;
+  }
+
+  //! In TIMED mode the first RX record plays at the first read
+  static const uint64_t MAX_SLEEP_NS = 10000000;
+  if (mode == TIMED)
+  {
+    uint64_t due = firstReadNs + (record.timeNs - firstRecordNs);
+    if (due > now)
+    {
+      uint64_t        sleepNs = due - now;
+      struct timespec ts;
+      if (sleepNs > MAX_SLEEP_NS)
+        sleepNs = MAX_SLEEP_NS;
+      ts.tv_sec  = sleepNs / 1000000000ULL;
+      ts.tv_nsec = sleepNs % 1000000000ULL;
+      nanosleep(&ts, NULL);
+      now = clockNs(CLOCK_MONOTONIC);
+      if (due > now)
+        return 0;
+    }
+  }
+
+  size_t n = 0;
+  while (hasRecord && n < maxlen)
+  {
+    size_t left  = record.length - recordOffset;
+    size_t chunk = left < maxlen - n ? left : maxlen - n;
+    memcpy(buf + n, record.data + recordOffset, chunk);
+    n += chunk;
+    recordOffset += chunk;
+    if (recordOffset < record.length)
+      break;
+
+    if (!nextRx())
+    {
+      finished = true;
+      finishNs = clockNs(CLOCK_MONOTONIC);
+      break;
+    }
+    //! TIMED mode keeps read boundaries as recorded
+    if (mode == TIMED)
+      break;
+  }
+  replayedBytes += n;
+  return n;
+}
+
+bool
+ReplayDriver::isFinished() const
+{
+  return finished;
+}
+
+uint64_t
+ReplayDriver::getReplayedBytes() const
+{
+  return replayedBytes;
+}
+
+uint64_t
+ReplayDriver::getElapsedNs() const
+{
+  if (!firstReadNs)
+    return 0;
+  return (finished ? finishNs : clockNs(CLOCK_MONOTONIC)) - firstReadNs;
+}
@@ -0,0 +1,719 @@
+/*! @file linux_capture_decoder.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Multi-threaded offline decoder for link captures and raw serial dumps
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#include "linux_capture_decoder.hpp"
+#include "dji_broadcast.hpp"
+#include "dji_open_protocol.hpp"
+#include "linux_capture.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace DJI::OSDK;
+
+//! A frame starting before the chunk end finishes within this many bytes
+static const size_t OVERLAP = Protocol::maxRecv;
+
+enum ScanResult
+{
+  SCAN_END,
+  SCAN_FRAME,
+  SCAN_OVERFLOW
+};
+
+enum ChunkState
+{
+  CHUNK_PENDING,
+  CHUNK_DONE,
+  CHUNK_FAILED
+};
+
+struct CaptureDecoder::Chunk
+{
+  uint64_t start; //! receive stream offsets
+  uint64_t end;
+  size_t   filePosition; //! of the capture record holding start
+  uint64_t fileTimeNs;   //! reader time before that record
+
+  uint8_t*       buffer; //! captures only, the receive bytes gathered
+  const uint8_t* data;   //! stream byte start
+  size_t         size;   //! bytes from start, up to OVERLAP past end
+
+  uint64_t* recordEnd; //! local offset after each receive record
+  uint64_t* recordTime;
+  size_t    recordNumber;
+
+  DecodedFrame* frames;
+  size_t        frameNumber;
+  size_t        frameCapacity;
+  uint64_t*     overflow; //! local offsets of headers skipped as overflows
+  size_t        overflowNumber;
+  size_t        overflowCapacity;
+  uint64_t      exit; //! where the chunk's scan would continue
+  volatile int  state;
+};
+
+struct CaptureDecoder::Pool
+{
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+  size_t          next;   //! next chunk to take
+  size_t          merged; //! chunks handed out to the handler
+  size_t          ahead;
+  bool            stop;
+};
+
+/*! @brief Next frame at or after *q, under the rules of Protocol::byteHandler
+ *
+ *  @details Only headers starting before limit count. On return *q is where
+ *  the search goes on: Protocol keeps the last sizeof(Header) - 1 bytes of a
+ *  frame and looks for a header there again; a header or data CRC failure
+ *  drops one byte. A header too short to ever complete makes Protocol fill
+ *  its buffer, then drop it and the byte after; that skip is reported as
+ *  SCAN_OVERFLOW with the header at *p.
+ *  @return SCAN_END if nothing starts before limit, or size ends inside a
+ *  frame
+ */
+static int
+nextFrame(const uint8_t* data, size_t size, size_t limit, size_t* q, size_t* p)
+{
+  while (*q < limit)
+  {
+    const uint8_t* sof =
+      (const uint8_t*)memchr(data + *q, Protocol::SOF, limit - *q);
+    if (!sof)
+    {
+      *q = limit;
+      return SCAN_END;
+    }
+
+    size_t at = sof - data;
+    if (at + sizeof(Header) > size)
+    {
+      *q = at;
+      return SCAN_END;
+    }
+
+    Header head;
+    memcpy(&head, sof, sizeof(Header));
+    if (head.version != 0 || head.reserved0 != 0 || head.reserved1 != 0 ||
+        Protocol::sdk_stream_crc16_calc(sof, sizeof(Header)) != 0)
+    {
+      *q = at + 1;
+      continue;
+    }
+    if (head.length < sizeof(Header))
+    {
+      *p = at;
+      *q = at + Protocol::maxRecv + 1;
+      return SCAN_OVERFLOW;
+    }
+    if (head.length > sizeof(Header))
+    {
+      if (at + head.length > size)
+      {
+        *q = at;
+        return SCAN_END;
+      }
+      if (Protocol::sdk_stream_crc32_calc(sof, head.length) != 0)
+      {
+        *q = at + 1;
+        continue;
+      }
+    }
+
+    *p = at;
+    *q = at + head.length - (sizeof(Header) - 1);
+    return SCAN_FRAME;
+  }
+  return SCAN_END;
+}
+
+static void
+unpackOne(uint16_t passFlag, uint16_t flag, void* field, size_t size,
+          const uint8_t** buf, const uint8_t* end)
+{
+  if (!(passFlag & flag))
+    return;
+  if (*buf + size <= end)
+    memcpy(field, *buf, size);
+  *buf += size;
+}
+
+//! Same layout as DataBroadcast::unpackData
+static void
+unpackBroadcast(const uint8_t* buf, size_t length, ShmBroadcastState* s)
+{
+  const uint8_t* end = buf + length;
+
+  memset(s, 0, sizeof(ShmBroadcastState));
+  if (length < sizeof(uint16_t))
+    return;
+  memcpy(&s->passFlag, buf, sizeof(uint16_t));
+  buf += sizeof(uint16_t);
+
+  uint16_t f = s->passFlag;
+  // clang-format off
+  unpackOne(f, DataBroadcast::FLAG_TIME        , &s->timeStamp, sizeof(s->timeStamp), &buf, end);
+  unpackOne(f, DataBroadcast::FLAG_TIME        , &s->syncStamp, sizeof(s->syncStamp), &buf, end);
+  unpackOne(f, DataBroadcast::FLAG_QUATERNION  , &s->q        , sizeof(s->q        ), &buf, end);
+  unpackOne(f, DataBroadcast::FLAG_ACCELERATION, &s->a        , sizeof(s->a        ), &buf, end);
+  unpackOne(f, DataBroadcast::FLAG_VELOCITY    , &s->v        , sizeof(s->v        ), &buf, end);
+  unpackOne(f, DataBroadcast::FLAG_VELOCITY    , &s->vi       , sizeof(s->vi       ), &buf, end);
+  unpackOne(f, DataBroadcast::FLAG_ANGULAR_RATE, &s->w        , sizeof(s->w        ), &buf, end);
+  unpackOne(f, DataBroadcast::FLAG_POSITION    , &s->gp       , sizeof(s->gp       ), &buf, end);
+  unpackOne(f, DataBroadcast::FLAG_POSITION    , &s->rp       , sizeof(s->rp       ), &buf, end);
+  unpackOne(f, DataBroadcast::FLAG_GPSINFO     , &s->gps      , sizeof(s->gps      ), &buf, end);
+  unpackOne(f, DataBroadcast::FLAG_RTKINFO     , &s->rtk      , sizeof(s->rtk      ), &buf, end);
+  unpackOne(f, DataBroadcast::FLAG_MAG         , &s->mag      , sizeof(s->mag      ), &buf, end);
+  unpackOne(f, DataBroadcast::FLAG_RC          , &s->rc       , sizeof(s->rc       ), &buf, end);
+  unpackOne(f, DataBroadcast::FLAG_GIMBAL      , &s->gimbal   , sizeof(s->gimbal   ), &buf, end);
+  unpackOne(f, DataBroadcast::FLAG_STATUS      , &s->status   , sizeof(s->status   ), &buf, end);
+  unpackOne(f, DataBroadcast::FLAG_BATTERY     , &s->battery  , sizeof(s->battery  ), &buf, end);
+  unpackOne(f, DataBroadcast::FLAG_DEVICE      , &s->info     , sizeof(s->info     ), &buf, end);
+  // clang-format on
+}
+
+//! Capture time of the record holding the byte before local offset end
+static uint64_t
+recordTime(const CaptureDecoder::Chunk* chunk, uint64_t end)
+{
+  size_t low  = 0;
+  size_t high = chunk->recordNumber;
+  while (low < high)
+  {
+    size_t mid = (low + high) / 2;
+    if (chunk->recordEnd[mid] < end)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low < chunk->recordNumber ? chunk->recordTime[low] : 0;
+}
+
+static void
+fillFrame(const CaptureDecoder::Chunk* chunk, size_t p, DecodedFrame* frame)
+{
+  const uint8_t* sof = chunk->data + p;
+  Header         head;
+  memcpy(&head, sof, sizeof(Header));
+
+  frame->offset    = chunk->start + p;
+  frame->timeNs    = recordTime(chunk, p + head.length);
+  frame->data      = sof;
+  frame->length    = head.length;
+  frame->seqNumber = head.sequenceNumber;
+  frame->sessionID = head.sessionID;
+  frame->isAck     = head.isAck;
+  frame->encrypted = head.enc != 0;
+  frame->cmdSet    = 0;
+  frame->cmdID     = 0;
+  frame->type      = DecodedFrame::FRAME;
+
+  if (head.isAck || head.enc ||
+      head.length < Protocol::PackageMin + SET_CMD_SIZE)
+    return;
+
+  frame->cmdSet = sof[sizeof(Header)];
+  frame->cmdID  = sof[sizeof(Header) + 1];
+  if (frame->cmdSet == OpenProtocol::CMDSet::Broadcast::broadcast[0] &&
+      frame->cmdID == OpenProtocol::CMDSet::Broadcast::broadcast[1])
+  {
+    frame->type = DecodedFrame::BROADCAST;
+    unpackBroadcast(sof + sizeof(Header) + SET_CMD_SIZE,
+                    head.length - Protocol::PackageMin - SET_CMD_SIZE,
+                    &frame->broadcast);
+  }
+}
+
+static void*
+decodeCall(void* param)
+{
+  void** args = (void**)param;
+  ((CaptureDecoder*)args[0])->work((CaptureDecoder::Pool*)args[1]);
+  return NULL;
+}
+
+CaptureDecoder::CaptureDecoder()
+  : path(NULL)
+  , map(NULL)
+  , mapSize(0)
+  , isCapture(false)
+  , streamSize(0)
+  , chunks(NULL)
+  , chunkNumber(0)
+{
+  memset(&stats, 0, sizeof(stats));
+}
+
+CaptureDecoder::~CaptureDecoder()
+{
+  close();
+}
+
+bool
+CaptureDecoder::open(const char* path)
+{
+  close();
+
+  int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    DERROR("Cannot open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    ::close(fd);
+    return false;
+  }
+
+  mapSize = st.st_size;
+  if (mapSize)
+  {
+    void* p = mmap(NULL, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+    {
+      DERROR("Cannot map %s: %s\n", path, strerror(errno));
+      ::close(fd);
+      mapSize = 0;
+      return false;
+    }
+    map = (uint8_t*)p;
+  }
+  ::close(fd);
+
+  uint32_t magic = 0;
+  if (mapSize >= sizeof(Capture::FileHeader))
+    memcpy(&magic, map, sizeof(magic));
+  isCapture  = (magic == Capture::MAGIC);
+  streamSize = isCapture ? 0 : mapSize;
+
+  this->path = strdup(path);
+  if (!this->path)
+  {
+    close();
+    return false;
+  }
+  if (!isCapture && mapSize)
+    madvise(map, mapSize, MADV_SEQUENTIAL);
+  return true;
+}
+
+void
+CaptureDecoder::close()
+{
+  if (chunks)
+  {
+    for (size_t i = 0; i < chunkNumber; ++i)
+      release(&chunks[i]);
+    free(chunks);
+  }
+  chunks      = NULL;
+  chunkNumber = 0;
+
+  if (map)
+    munmap(map, mapSize);
+  map     = NULL;
+  mapSize = 0;
+  free(path);
+  path       = NULL;
+  streamSize = 0;
+}
+
+const DecodeStats*
+CaptureDecoder::getStats() const
+{
+  return &stats;
+}
+
+//! Chunks start on receive record boundaries in a capture
+bool
+CaptureDecoder::split(size_t chunkSize)
+{
+  if (chunks)
+  {
+    for (size_t i = 0; i < chunkNumber; ++i)
+      release(&chunks[i]);
+    free(chunks);
+  }
+  chunks      = NULL;
+  chunkNumber = 0;
+
+  size_t capacity = 0;
+  if (!isCapture)
+  {
+    capacity = (streamSize + chunkSize - 1) / chunkSize;
+    chunks   = (Chunk*)calloc(capacity ? capacity : 1, sizeof(Chunk));
+    if (!chunks)
+      return false;
+    for (chunkNumber = 0; chunkNumber < capacity; ++chunkNumber)
+      chunks[chunkNumber].start = (uint64_t)chunkNumber * chunkSize;
+  }
+  else
+  {
+    CaptureReader reader;
+    if (!reader.open(path))
+      return false;
+
+    Capture::Record record;
+    uint64_t        position = 0;
+    uint64_t        boundary = 0;
+    for (;;)
+    {
+      size_t   filePosition = reader.tell();
+      uint64_t fileTimeNs   = reader.getTimeNs();
+      if (!reader.next(&record))
+        break;
+      if (record.direction != Capture::RX)
+        continue;
+
+      if (position >= boundary)
+      {
+        if (chunkNumber == capacity)
+        {
+          capacity     = capacity ? capacity * 2 : 64;
+          Chunk* grown = (Chunk*)realloc(chunks, capacity * sizeof(Chunk));
+          if (!grown)
+            return false;
+          chunks = grown;
+        }
+        Chunk* chunk = &chunks[chunkNumber++];
+        memset(chunk, 0, sizeof(Chunk));
+        chunk->start        = position;
+        chunk->filePosition = filePosition;
+        chunk->fileTimeNs   = fileTimeNs;
+        boundary            = position + chunkSize;
+      }
+      position += record.length;
+    }
+    streamSize = position;
+  }
+
+  for (size_t i = 0; i < chunkNumber; ++i)
+    chunks[i].end = (i + 1 < chunkNumber) ? chunks[i + 1].start : streamSize;
+  return true;
+}
+
+bool
+CaptureDecoder::load(Chunk* chunk, CaptureReader* reader)
+{
+  uint64_t stop = chunk->end + OVERLAP;
+  if (stop > streamSize)
+    stop = streamSize;
+  size_t want = stop - chunk->start;
+
+  if (!isCapture)
+  {
+    chunk->data = map + chunk->start;
+    chunk->size = want;
+    return true;
+  }
+
+  size_t capacity   = 64;
+  chunk->buffer     = (uint8_t*)malloc(want ? want : 1);
+  chunk->recordEnd  = (uint64_t*)malloc(capacity * sizeof(uint64_t));
+  chunk->recordTime = (uint64_t*)malloc(capacity * sizeof(uint64_t));
+  if (!chunk->buffer || !chunk->recordEnd || !chunk->recordTime)
+    return false;
+  chunk->data = chunk->buffer;
+
+  Capture::Record record;
+  reader->seek(chunk->filePosition, chunk->fileTimeNs);
+  while (chunk->size < want && reader->next(&record))
+  {
+    if (record.direction != Capture::RX)
+      continue;
+
+    size_t n = want - chunk->size;
+    if (n > record.length)
+      n = record.length;
+    memcpy(chunk->buffer + chunk->size, record.data, n);
+    chunk->size += n;
+
+    if (chunk->recordNumber == capacity)
+    {
+      capacity *= 2;
+      uint64_t* e =
+        (uint64_t*)realloc(chunk->recordEnd, capacity * sizeof(uint64_t));
+      if (e)
+        chunk->recordEnd = e;
+      uint64_t* t =
+        (uint64_t*)realloc(chunk->recordTime, capacity * sizeof(uint64_t));
+      if (t)
+        chunk->recordTime = t;
+      if (!e || !t)
+        return false;
+    }
+    chunk->recordEnd[chunk->recordNumber]  = chunk->size;
+    chunk->recordTime[chunk->recordNumber] = record.timeNs;
+    chunk->recordNumber++;
+  }
+  return chunk->size == want;
+}
+
+bool
+CaptureDecoder::scan(Chunk* chunk)
+{
+  size_t limit = chunk->end - chunk->start;
+  size_t q     = 0;
+  size_t p;
+
+  int    result;
+
+  while ((result = nextFrame(chunk->data, chunk->size, limit, &q, &p)) !=
+         SCAN_END)
+  {
+    if (result == SCAN_OVERFLOW)
+    {
+      if (chunk->overflowNumber == chunk->overflowCapacity)
+      {
+        size_t capacity =
+          chunk->overflowCapacity ? chunk->overflowCapacity * 2 : 16;
+        uint64_t* grown = (uint64_t*)realloc(chunk->overflow,
+                                             capacity * sizeof(uint64_t));
+        if (!grown)
+          return false;
+        chunk->overflow         = grown;
+        chunk->overflowCapacity = capacity;
+      }
+      chunk->overflow[chunk->overflowNumber++] = p;
+      continue;
+    }
+
+    if (chunk->frameNumber == chunk->frameCapacity)
+    {
+      size_t capacity =
+        chunk->frameCapacity ? chunk->frameCapacity * 2 : 1024;
+      DecodedFrame* grown = (DecodedFrame*)realloc(
+        chunk->frames, capacity * sizeof(DecodedFrame));
+      if (!grown)
+        return false;
+      chunk->frames        = grown;
+      chunk->frameCapacity = capacity;
+    }
+    fillFrame(chunk, p, &chunk->frames[chunk->frameNumber++]);
+  }
+  chunk->exit = chunk->start + (q > limit ? q : limit);
+  return true;
+}
+
+/*! @details *next is where the search stands after the previous chunk. The
+ *  chunk scan looked at every position from its start except the bytes it
+ *  skipped after each frame or overflow it found; as long as *next is not
+ *  among those, the first chunk frame at or after *next is the true next
+ *  frame. Otherwise scan again from *next until that holds.
+ */
+void
+CaptureDecoder::merge(Chunk* chunk, uint64_t* next, DecodeHandler handler,
+                      UserData userData)
+{
+  uint64_t position = *next;
+  size_t   limit    = chunk->end - chunk->start;
+  size_t   j        = 0;
+  size_t   o        = 0;
+  bool     resynced = false;
+
+  for (;;)
+  {
+    while (j < chunk->frameNumber && chunk->frames[j].offset < position)
+      ++j;
+    while (o < chunk->overflowNumber &&
+           chunk->start + chunk->overflow[o] < position)
+      ++o;
+
+    //! End of the last stretch the chunk skipped before position
+    uint64_t skipStart = 0;
+    uint64_t skipEnd   = chunk->start;
+    if (j)
+    {
+      skipStart = chunk->frames[j - 1].offset;
+      skipEnd   = skipStart + chunk->frames[j - 1].length - (sizeof(Header) - 1);
+    }
+    if (o && chunk->start + chunk->overflow[o - 1] >= skipStart)
+      skipEnd = chunk->start + chunk->overflow[o - 1] + Protocol::maxRecv + 1;
+    if (position >= skipEnd)
+      break;
+
+    resynced   = true;
+    size_t q   = position - chunk->start;
+    size_t p;
+    int    result = nextFrame(chunk->data, chunk->size, limit, &q, &p);
+    if (result == SCAN_END)
+    {
+      *next = chunk->start + (q > limit ? q : limit);
+      stats.resyncedChunks++;
+      return;
+    }
+    if (result == SCAN_FRAME)
+    {
+      DecodedFrame frame;
+      fillFrame(chunk, p, &frame);
+      stats.frames++;
+      if (frame.type == DecodedFrame::BROADCAST)
+        stats.broadcasts++;
+      handler(&frame, userData);
+    }
+    position = chunk->start + q;
+  }
+  if (resynced)
+    stats.resyncedChunks++;
+
+  for (; j < chunk->frameNumber; ++j)
+  {
+    stats.frames++;
+    if (chunk->frames[j].type == DecodedFrame::BROADCAST)
+      stats.broadcasts++;
+    handler(&chunk->frames[j], userData);
+  }
+  *next = position > chunk->exit ? position : chunk->exit;
+}
+
+void
+CaptureDecoder::release(Chunk* chunk)
+{
+  free(chunk->buffer);
+  free(chunk->recordEnd);
+  free(chunk->recordTime);
+  free(chunk->frames);
+  free(chunk->overflow);
+  chunk->buffer        = NULL;
+  chunk->recordEnd     = NULL;
+  chunk->recordTime    = NULL;
+  chunk->recordNumber  = 0;
+  chunk->frames        = NULL;
+  chunk->frameNumber   = 0;
+  chunk->frameCapacity = 0;
+  chunk->overflow      = NULL;
+  chunk->overflowNumber   = 0;
+  chunk->overflowCapacity = 0;
+  chunk->data          = NULL;
+  chunk->size          = 0;
+}
+
+void
+CaptureDecoder::work(Pool* pool)
+{
+  CaptureReader reader;
+  bool          ready = !isCapture || reader.open(path);
+
+  for (;;)
+  {
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stop && pool->next < chunkNumber &&
+           pool->next >= pool->merged + pool->ahead)
+      pthread_cond_wait(&pool->cond, &pool->lock);
+    if (pool->stop || pool->next >= chunkNumber)
+    {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    Chunk* chunk = &chunks[pool->next++];
+    pthread_mutex_unlock(&pool->lock);
+
+    bool ok = ready && load(chunk, &reader) && scan(chunk);
+
+    pthread_mutex_lock(&pool->lock);
+    chunk->state = ok ? CHUNK_DONE : CHUNK_FAILED;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+bool
+CaptureDecoder::decode(DecodeHandler handler, UserData userData,
+                       int threadNumber, size_t chunkSize)
+{
+  memset(&stats, 0, sizeof(stats));
+  if (!path || !chunkSize || !split(chunkSize))
+    return false;
+
+  if (threadNumber <= 0)
+    threadNumber = sysconf(_SC_NPROCESSORS_ONLN);
+  if (threadNumber <= 0)
+    threadNumber = 1;
+  if ((size_t)threadNumber > chunkNumber)
+    threadNumber = chunkNumber ? chunkNumber : 1;
+
+  Pool pool;
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.cond, NULL);
+  pool.next   = 0;
+  pool.merged = 0;
+  pool.ahead  = (size_t)threadNumber * AHEAD;
+  pool.stop   = false;
+
+  pthread_t* threads = new (std::nothrow) pthread_t[threadNumber];
+  void*      args[2] = { this, &pool };
+  int        started = 0;
+  if (threads)
+  {
+    for (; started < threadNumber; ++started)
+    {
+      if (pthread_create(&threads[started], NULL, decodeCall, args) != 0)
+        break;
+    }
+  }
+  if (!started)
+  {
+    DERROR("Cannot start decoder threads\n");
+    delete[] threads;
+    pthread_cond_destroy(&pool.cond);
+    pthread_mutex_destroy(&pool.lock);
+    return false;
+  }
+
+  bool     ok   = true;
+  uint64_t next = 0;
+  for (size_t i = 0; i < chunkNumber; ++i)
+  {
+    Chunk* chunk = &chunks[i];
+    pthread_mutex_lock(&pool.lock);
+    while (chunk->state == CHUNK_PENDING)
+      pthread_cond_wait(&pool.cond, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+
+    if (chunk->state == CHUNK_FAILED)
+    {
+      DERROR("Out of memory decoding chunk %u\n", (unsigned)i);
+      ok = false;
+      break;
+    }
+    merge(chunk, &next, handler, userData);
+    release(chunk);
+
+    pthread_mutex_lock(&pool.lock);
+    pool.merged++;
+    pthread_cond_broadcast(&pool.cond);
+    pthread_mutex_unlock(&pool.lock);
+  }
+
+  pthread_mutex_lock(&pool.lock);
+  pool.stop = true;
+  pthread_cond_broadcast(&pool.cond);
+  pthread_mutex_unlock(&pool.lock);
+  for (int i = 0; i < started; ++i)
+    pthread_join(threads[i], NULL);
+  delete[] threads;
+  pthread_cond_destroy(&pool.cond);
+  pthread_mutex_destroy(&pool.lock);
+
+  stats.bytes  = streamSize;
+  stats.chunks = chunkNumber;
+  return ok;
+}
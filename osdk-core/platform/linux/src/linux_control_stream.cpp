@@ -0,0 +1,324 @@
+/*! @file linux_control_stream.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Fixed-rate stream of flight control setpoints, paced on absolute
+ *  deadlines, with a watchdog on the producer
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#include "linux_control_stream.hpp"
+#include "dji_vehicle.hpp"
+#include "posix_thread.hpp"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+using namespace DJI::OSDK;
+
+static const uint64_t NS_PER_S = 1000000000ULL;
+
+static uint64_t
+monotonicNs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+ControlStream::ControlStream(Vehicle* vehicle)
+  : vehicle(vehicle)
+  , started(false)
+  , quit(false)
+  , periodNs(0)
+  , watchdogNs(0)
+  , setpoint(0, 0, 0, 0, 0, 0, 0)
+  , advanced(false)
+  , valid(false)
+  , pending(false)
+  , trajectory(NULL)
+  , updatedNs(0)
+  , jitterSumUs(0)
+{
+  pthread_mutex_init(&lock, NULL);
+  memset(&stats, 0, sizeof(stats));
+}
+
+ControlStream::~ControlStream()
+{
+  stop();
+  pthread_mutex_destroy(&lock);
+}
+
+bool
+ControlStream::start(int rateHz, int watchdogMs,
+                     const ThreadSchedule* schedule)
+{
+  if (started)
+  {
+    DERROR("Control stream already running\n");
+    return false;
+  }
+  if (rateHz < 1 || rateHz > MAX_RATE || watchdogMs < 0)
+  {
+    DERROR("Invalid control stream rate %d Hz or watchdog %d ms\n", rateHz,
+           watchdogMs);
+    return false;
+  }
+  periodNs   = NS_PER_S / rateHz;
+  watchdogNs = (uint64_t)watchdogMs * 1000000;
+
+  pthread_mutex_lock(&lock);
+  valid   = false;
+  pending = false;
+  quit    = false;
+  memset(&stats, 0, sizeof(stats));
+  jitterSumUs   = 0;
+  stats.running = true;
+  pthread_mutex_unlock(&lock);
+
+  if (pthread_create(&thread, NULL, streamCall, this) != 0)
+  {
+    DERROR("fail to create thread for control stream!\n");
+    pthread_mutex_lock(&lock);
+    stats.running = false;
+    pthread_mutex_unlock(&lock);
+    return false;
+  }
+  pthread_setname_np(thread, "ctrlStream");
+  if (schedule)
+    PosixThread::setSchedule(thread, *schedule, "ctrlStream");
+  started = true;
+  return true;
+}
+
+void
+ControlStream::stop()
+{
+  if (!started)
+    return;
+
+  pthread_mutex_lock(&lock);
+  quit = true;
+  pthread_mutex_unlock(&lock);
+  //! The stream sleeps at most one period before it sees quit
+  pthread_join(thread, NULL);
+  started = false;
+
+  pthread_mutex_lock(&lock);
+  stats.running = false;
+  stats.braking = false;
+  pthread_mutex_unlock(&lock);
+}
+
+bool
+ControlStream::isRunning()
+{
+  pthread_mutex_lock(&lock);
+  bool running = stats.running;
+  pthread_mutex_unlock(&lock);
+  return running;
+}
+
+void
+ControlStream::setSetpoint(const Control::CtrlData& data)
+{
+  Control::AdvancedCtrlData full(data.flag, data.x, data.y, data.z, data.yaw,
+                                 0, 0);
+  store(full, false);
+}
+
+void
+ControlStream::setSetpoint(const Control::AdvancedCtrlData& data)
+{
+  store(data, true);
+}
+
+void
+ControlStream::setPositionAndYaw(float32_t x, float32_t y, float32_t z,
+                                 float32_t yaw)
+{
+  uint8_t flag = (Control::VERTICAL_POSITION | Control::HORIZONTAL_POSITION |
+                  Control::YAW_ANGLE | Control::HORIZONTAL_GROUND |
+                  Control::STABLE_ENABLE);
+  setSetpoint(Control::CtrlData(flag, x, y, z, yaw));
+}
+
+void
+ControlStream::setVelocityAndYawRate(float32_t Vx, float32_t Vy, float32_t Vz,
+                                     float32_t yawRate)
+{
+  uint8_t flag = (Control::VERTICAL_VELOCITY | Control::HORIZONTAL_VELOCITY |
+                  Control::YAW_RATE | Control::HORIZONTAL_GROUND);
+  setSetpoint(Control::CtrlData(flag, Vx, Vy, Vz, yawRate));
+}
+
+void
+ControlStream::setTrajectory(TrajectoryBuffer* trajectory)
+{
+  pthread_mutex_lock(&lock);
+  this->trajectory = trajectory;
+  pthread_mutex_unlock(&lock);
+}
+
+void
+ControlStream::store(const Control::AdvancedCtrlData& data, bool advanced)
+{
+  uint64_t now = monotonicNs();
+
+  pthread_mutex_lock(&lock);
+  stats.updates++;
+  if (pending)
+    stats.coalesced++;
+  setpoint       = data;
+  this->advanced = advanced;
+  valid          = true;
+  pending        = true;
+  updatedNs      = now;
+  pthread_mutex_unlock(&lock);
+}
+
+void
+ControlStream::getStats(ControlStreamStats* stats)
+{
+  pthread_mutex_lock(&lock);
+  *stats = this->stats;
+  if (this->stats.periods)
+    stats->meanJitterUs = (uint32_t)(jitterSumUs / this->stats.periods);
+  pthread_mutex_unlock(&lock);
+}
+
+void
+ControlStream::resetStats()
+{
+  pthread_mutex_lock(&lock);
+  bool running  = stats.running;
+  bool braking  = stats.braking;
+  memset(&stats, 0, sizeof(stats));
+  stats.running = running;
+  stats.braking = braking;
+  jitterSumUs   = 0;
+  pthread_mutex_unlock(&lock);
+}
+
+void*
+ControlStream::streamCall(void* param)
+{
+  ((ControlStream*)param)->stream();
+  return NULL;
+}
+
+void
+ControlStream::stream()
+{
+  uint64_t deadline = monotonicNs();
+
+  for (;;)
+  {
+    //! Absolute deadlines, so the time spent sending never adds up
+    deadline += periodNs;
+    struct timespec ts;
+    ts.tv_sec  = deadline / NS_PER_S;
+    ts.tv_nsec = deadline % NS_PER_S;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+           EINTR)
+      ;
+
+    uint64_t now  = monotonicNs();
+    uint64_t late = now > deadline ? now - deadline : 0;
+    pthread_mutex_lock(&lock);
+    bool stop = quit;
+    if (late >= periodNs)
+    {
+      //! Skip what was missed rather than send a burst
+      uint64_t skipped = late / periodNs;
+      stats.missed += skipped;
+      deadline += skipped * periodNs;
+    }
+    pthread_mutex_unlock(&lock);
+    if (stop)
+      break;
+
+    tick(now, late);
+  }
+}
+
+void
+ControlStream::tick(uint64_t nowNs, uint64_t lateNs)
+{
+  Control::AdvancedCtrlData data(0, 0, 0, 0, 0, 0, 0);
+  bool                      send    = false;
+  bool                      brake   = false;
+  bool                      full    = false;
+  bool                      tripped = false;
+  uint32_t                  us      = (uint32_t)(lateNs / 1000);
+
+  pthread_mutex_lock(&lock);
+  stats.periods++;
+  stats.lastJitterUs = us;
+  if (us > stats.maxJitterUs)
+    stats.maxJitterUs = us;
+  jitterSumUs += us;
+
+  //! The trajectory is lock-free; holding the lock only keeps it attached
+  bool             have  = false;
+  bool             stale = false;
+  TrajectorySample sample;
+  if (trajectory && trajectory->sample(nowNs * 1e-9, &sample))
+  {
+    uint8_t flag = (Control::VERTICAL_VELOCITY | Control::HORIZONTAL_VELOCITY |
+                    Control::YAW_ANGLE | Control::HORIZONTAL_GROUND);
+    data  = Control::AdvancedCtrlData(
+      flag, sample.velocity[0], sample.velocity[1], sample.velocity[2],
+      sample.yaw, sample.acceleration[0], sample.acceleration[1]);
+    full  = true;
+    have  = true;
+    stale = watchdogNs && sample.overrun * 1e9 > watchdogNs;
+    if (!stale && sample.overrun > 0)
+      stats.extrapolated++;
+  }
+  else if (!trajectory && valid)
+  {
+    data = setpoint;
+    full = advanced;
+    have = true;
+    //! A setpoint stored after nowNs was taken is fresh, not stale
+    stale = watchdogNs && nowNs > updatedNs + watchdogNs;
+    if (!stale)
+      pending = false;
+  }
+
+  if (have && stale)
+  {
+    if (!stats.braking)
+    {
+      stats.watchdogTrips++;
+      tripped = true;
+    }
+    stats.braking = true;
+    brake         = true;
+    stats.braked++;
+  }
+  else if (have)
+  {
+    stats.braking = false;
+    send          = true;
+    stats.sent++;
+  }
+  pthread_mutex_unlock(&lock);
+
+  if (tripped)
+    DERROR("Setpoints stalled for %u ms, braking\n",
+           (uint32_t)(watchdogNs / 1000000));
+  if (brake)
+    vehicle->control->emergencyBrake();
+  else if (send && full)
+    vehicle->control->flightCtrl(data);
+  else if (send)
+    vehicle->control->flightCtrl(
+      Control::CtrlData(data.flag, data.x, data.y, data.z, data.yaw));
+}
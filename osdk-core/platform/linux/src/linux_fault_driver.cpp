@@ -0,0 +1,333 @@
+/*! @file linux_fault_driver.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  HardDriver decorator injecting line faults, for stress tests of the
+ *  protocol resync and retransmission paths
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#include "linux_fault_driver.hpp"
+#include "dji_log.hpp"
+#include "dji_type.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+using namespace DJI::OSDK;
+
+//! Frame bounds of the OPEN protocol; kept here so the driver does not
+//! pull in the protocol layer it sits under
+static const uint8_t SOF       = 0xAA;
+static const size_t  FRAME_MIN = sizeof(Header) + sizeof(uint32_t);
+
+static uint64_t
+nowUs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+FaultDriver::FaultDriver(HardDriver* driver, const FaultConfig& config)
+  : driver(driver)
+  , config(config)
+  , frameUsed(0)
+  , delay(NULL)
+  , delayCapacity(0)
+  , delayBase(0)
+  , delivered(0)
+  , queued(0)
+  , pending(NULL)
+  , pendingCapacity(0)
+  , pendingHead(0)
+  , pendingTail(0)
+  , lastReleaseUs(0)
+{
+  pthread_mutex_init(&configLock, NULL);
+  memset(&rx, 0, sizeof(rx));
+  memset(&tx, 0, sizeof(tx));
+  //! xorshift state must not be zero
+  rx.random = ((uint64_t)config.seed << 1) | 1;
+  tx.random = ((uint64_t)config.seed << 1) ^ 0x9E3779B97F4A7C15ULL;
+}
+
+FaultDriver::~FaultDriver()
+{
+  delete driver;
+  free(delay);
+  free(pending);
+  pthread_mutex_destroy(&configLock);
+}
+
+void
+FaultDriver::init()
+{
+  driver->init();
+}
+
+time_ms
+FaultDriver::getTimeStamp()
+{
+  return driver->getTimeStamp();
+}
+
+bool
+FaultDriver::getDeviceStatus()
+{
+  return driver->getDeviceStatus();
+}
+
+bool
+FaultDriver::getLineCounters(LineCounters* counters)
+{
+  return driver->getLineCounters(counters);
+}
+
+void
+FaultDriver::setConfig(const FaultConfig& config)
+{
+  pthread_mutex_lock(&configLock);
+  this->config = config;
+  pthread_mutex_unlock(&configLock);
+}
+
+void
+FaultDriver::getConfig(FaultConfig* config)
+{
+  pthread_mutex_lock(&configLock);
+  *config = this->config;
+  pthread_mutex_unlock(&configLock);
+}
+
+void
+FaultDriver::getStats(FaultStats* rx, FaultStats* tx)
+{
+  if (rx)
+    *rx = this->rx.stats;
+  if (tx)
+    *tx = this->tx.stats;
+}
+
+uint32_t
+FaultDriver::next(Stream* stream)
+{
+  //! xorshift64*
+  uint64_t x = stream->random;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  stream->random = x;
+  return (uint32_t)((x * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+bool
+FaultDriver::chance(Stream* stream, double rate)
+{
+  if (rate <= 0)
+    return false;
+  return next(stream) < rate * 4294967296.0;
+}
+
+size_t
+FaultDriver::inject(Stream* stream, const FaultConfig* config,
+                    const uint8_t* in, size_t length, bool isFrame,
+                    uint8_t* out)
+{
+  FaultStats* stats  = &stream->stats;
+  int         copies = 1;
+  size_t      n      = 0;
+
+  stats->bytes += length;
+  if (isFrame)
+  {
+    stats->frames++;
+    if (chance(stream, config->duplicateRate))
+    {
+      copies = 2;
+      stats->framesDuplicated++;
+    }
+  }
+
+  for (int c = 0; c < copies; ++c)
+  {
+    size_t cut = length;
+    if (isFrame && length > 1 && chance(stream, config->truncateRate))
+    {
+      cut = 1 + next(stream) % (length - 1);
+      stats->framesTruncated++;
+    }
+    for (size_t i = 0; i < cut; ++i)
+    {
+      if (chance(stream, config->byteDropRate))
+      {
+        stats->bytesDropped++;
+        continue;
+      }
+      uint8_t byte = in[i];
+      if (chance(stream, config->bitFlipRate))
+      {
+        byte ^= 1 << (next(stream) % 8);
+        stats->bitFlips++;
+      }
+      out[n++] = byte;
+    }
+  }
+  return n;
+}
+
+size_t
+FaultDriver::send(const uint8_t* buf, size_t len)
+{
+  FaultConfig c;
+  getConfig(&c);
+  if (!(c.directions & FaultConfig::TX) || len > MAX_FRAME)
+    return driver->send(buf, len);
+
+  uint8_t out[2 * MAX_FRAME];
+  size_t  n = inject(&tx, &c, buf, len, true, out);
+  if (n)
+    driver->send(out, n);
+  //! What was lost, was lost on the line
+  return len;
+}
+
+//! Inject into one unit of the clean stream and queue it for release
+bool
+FaultDriver::queueRx(const uint8_t* data, size_t length, bool isFrame)
+{
+  FaultConfig c;
+  getConfig(&c);
+
+  uint8_t out[2 * MAX_FRAME];
+  size_t  n;
+  if (c.directions & FaultConfig::RX)
+    n = inject(&rx, &c, data, length, isFrame, out);
+  else
+  {
+    memcpy(out, data, length);
+    n           = length;
+    c.latencyUs = 0;
+    c.jitterUs  = 0;
+  }
+  if (!n)
+    return true;
+
+  //! Make room: drop what was handed out, then grow
+  size_t used = queued - delivered;
+  if (queued - delayBase + n > delayCapacity)
+  {
+    if (used)
+      memmove(delay, delay + (delivered - delayBase), used);
+    delayBase = delivered;
+    if (used + n > delayCapacity)
+    {
+      size_t capacity = delayCapacity ? delayCapacity : 4 * MAX_FRAME;
+      while (capacity < used + n)
+        capacity *= 2;
+      uint8_t* grown = (uint8_t*)realloc(delay, capacity);
+      if (!grown)
+        return false;
+      delay         = grown;
+      delayCapacity = capacity;
+    }
+  }
+  if (pendingTail == pendingCapacity)
+  {
+    if (pendingTail > pendingHead)
+      memmove(pending, pending + pendingHead,
+              (pendingTail - pendingHead) * sizeof(Pending));
+    pendingTail -= pendingHead;
+    pendingHead = 0;
+    if (pendingTail == pendingCapacity)
+    {
+      size_t   capacity = pendingCapacity ? pendingCapacity * 2 : 64;
+      Pending* grown =
+        (Pending*)realloc(pending, capacity * sizeof(Pending));
+      if (!grown)
+        return false;
+      pending         = grown;
+      pendingCapacity = capacity;
+    }
+  }
+
+  memcpy(delay + (queued - delayBase), out, n);
+  queued += n;
+
+  uint64_t release = nowUs() + c.latencyUs;
+  if (c.jitterUs)
+    release += next(&rx) % c.jitterUs;
+  //! A serial line does not reorder
+  if (release < lastReleaseUs)
+    release = lastReleaseUs;
+  lastReleaseUs = release;
+
+  pending[pendingTail].releaseUs = release;
+  pending[pendingTail].end       = queued;
+  pendingTail++;
+  return true;
+}
+
+void
+FaultDriver::frameRx(const uint8_t* in, size_t length)
+{
+  for (size_t i = 0; i < length; ++i)
+  {
+    uint8_t byte = in[i];
+    if (!frameUsed)
+    {
+      if (byte == SOF)
+        frame[frameUsed++] = byte;
+      else
+        queueRx(&byte, 1, false);
+      continue;
+    }
+
+    frame[frameUsed++] = byte;
+    if (frameUsed < 3)
+      continue;
+
+    //! Length is the low 10 bits after the SOF
+    size_t frameLength = frame[1] | ((frame[2] & 0x03) << 8);
+    if (frameLength < FRAME_MIN || frameLength > MAX_FRAME)
+    {
+      queueRx(frame, frameUsed, false);
+      frameUsed = 0;
+    }
+    else if (frameUsed == frameLength)
+    {
+      queueRx(frame, frameUsed, true);
+      frameUsed = 0;
+    }
+  }
+}
+
+size_t
+FaultDriver::readall(uint8_t* buf, size_t maxlen)
+{
+  uint8_t in[MAX_FRAME];
+  size_t  n = driver->readall(in, sizeof(in));
+  //! Drivers returning -1 through size_t read nothing
+  if (n > 0 && n <= sizeof(in))
+    frameRx(in, n);
+
+  uint64_t now = nowUs();
+  size_t   out = 0;
+  while (pendingHead < pendingTail && out < maxlen &&
+         pending[pendingHead].releaseUs <= now)
+  {
+    size_t take = pending[pendingHead].end - delivered;
+    if (take > maxlen - out)
+      take = maxlen - out;
+    memcpy(buf + out, delay + (delivered - delayBase), take);
+    delivered += take;
+    out += take;
+    if (delivered == pending[pendingHead].end)
+      pendingHead++;
+  }
+  return out;
+}
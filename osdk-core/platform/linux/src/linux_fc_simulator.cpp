@@ -0,0 +1,1668 @@
+/*! @file linux_fc_simulator.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Flight controller simulator speaking the OPEN protocol on a pseudo
+ *  terminal, for end-to-end runs of Vehicle without an aircraft
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#include "linux_fc_simulator.hpp"
+#include "dji_aes.hpp"
+#include "dji_command.hpp"
+#include "dji_error.hpp"
+#include "dji_log.hpp"
+#include "dji_open_protocol.hpp"
+#include "dji_status.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace DJI::OSDK;
+
+static const uint8_t SOF       = 0xAA;
+static const size_t  CRC_HEAD  = sizeof(Header) - sizeof(uint16_t);
+static const size_t  FRAME_MIN = sizeof(Header) + sizeof(uint32_t);
+
+//! Rates behind the codes of Activation::frequency; 5 holds the channel
+static const uint16_t FREQ_HZ[8] = { 0, 1, 10, 50, 100, 0, 200, 400 };
+static const uint8_t  FREQ_HOLD  = 5;
+static const uint16_t MAX_HZ     = 400;
+//! Subscription rates the flight controller accepts
+static const uint16_t PACKAGE_HZ[] = { 1, 10, 50, 100, 200, 400 };
+static const size_t   PACKAGE_MAX  = 200;
+static const uint32_t DB_VERSION   = 0x00000100;
+
+//! Flight model
+static const float64_t EARTH_RADIUS   = 6378137.0;
+static const float32_t TAKEOFF_HEIGHT = 1.2f;
+static const float32_t CLIMB_SPEED    = 1.0f;  //! m/s, takeoff and landing
+static const float32_t MAX_SPEED      = 10.0f; //! m/s horizontal
+static const float32_t MAX_CLIMB      = 4.0f;
+static const float32_t GO_HOME_SPEED  = 5.0f;
+static const float32_t POSITION_GAIN  = 1.0f; //! 1/s, offsets to velocity
+static const float32_t YAW_GAIN       = 2.0f;
+static const float32_t MAX_YAW_RATE   = (float32_t)(100 * M_PI / 180);
+static const float32_t ANGLE_SPEED    = 0.5f; //! m/s per degree of tilt
+static const float32_t RESPONSE       = 0.3f; //! s, velocity time constant
+static const uint64_t  SPOOL_US       = 500000;
+static const float32_t ARRIVAL        = 1.0f; //! m, waypoint counts as reached
+
+//! Flight control flag fields, see Control::CtrlData
+static const uint8_t HORIZONTAL_MASK     = 0xC0;
+static const uint8_t HORIZONTAL_ANGLE    = 0x00;
+static const uint8_t HORIZONTAL_VELOCITY = 0x40;
+static const uint8_t HORIZONTAL_POSITION = 0x80;
+static const uint8_t VERTICAL_MASK       = 0x30;
+static const uint8_t VERTICAL_VELOCITY   = 0x00;
+static const uint8_t VERTICAL_POSITION   = 0x10;
+static const uint8_t YAW_RATE            = 0x08;
+static const uint8_t BODY_FRAME          = 0x02;
+
+static float32_t
+clamp(float32_t value, float32_t limit)
+{
+  if (value > limit)
+    return limit;
+  if (value < -limit)
+    return -limit;
+  return value;
+}
+
+static float32_t
+radians(float32_t degrees)
+{
+  return (float32_t)(degrees * M_PI / 180);
+}
+
+static float32_t
+degrees(float32_t radians)
+{
+  return (float32_t)(radians * 180 / M_PI);
+}
+
+FCSimulator::FCSimulator(const FCSimulatorConfig& config)
+  : config(config)
+  , hasKey(false)
+  , activated(false)
+  , replySession(0)
+  , replySeq(0)
+  , replyEnc(false)
+  , waypoints(NULL)
+  , waypointReady(false)
+  , waypointRunning(false)
+  , waypointTarget(0)
+  , hotpointRunning(false)
+  , inputUsed(0)
+  , output(NULL)
+  , outputCapacity(0)
+  , outputHead(0)
+  , outputTail(0)
+  , master(-1)
+  , slave(-1)
+  , linkPath(NULL)
+  , running(false)
+{
+  pthread_mutex_init(&lock, NULL);
+  memset(&stats, 0, sizeof(stats));
+  memset(&state, 0, sizeof(state));
+  memset(packages, 0, sizeof(packages));
+  memset(mfio, 0, sizeof(mfio));
+  memset(&waypointInit, 0, sizeof(waypointInit));
+  memset(&hotpoint, 0, sizeof(hotpoint));
+  memset(ptyName, 0, sizeof(ptyName));
+  wakeup[0] = wakeup[1] = -1;
+
+  state.phase   = PHASE_STOPPED;
+  state.gear    = VehicleStatus::LANDING_GEAR_DOWN;
+  state.battery = 100;
+
+  if (this->config.broadcastHz > MAX_HZ)
+    this->config.broadcastHz = MAX_HZ;
+  for (int i = 0; i < CHANNELS; ++i)
+  {
+    channels[i].hz     = this->config.broadcastHz;
+    channels[i].nextUs = 0;
+  }
+
+  if (config.encKey && strlen(config.encKey) == 2 * sizeof(key))
+  {
+    hasKey = true;
+    for (size_t i = 0; i < sizeof(key); ++i)
+    {
+      unsigned int byte;
+      if (sscanf(config.encKey + 2 * i, "%2x", &byte) != 1)
+        hasKey = false;
+      key[i] = (uint8_t)byte;
+    }
+  }
+  if (config.encKey && !hasKey)
+    DERROR("Simulator key is not 64 hex digits, answering in plain\n");
+}
+
+FCSimulator::~FCSimulator()
+{
+  stop();
+  if (master >= 0)
+    close(master);
+  if (slave >= 0)
+    close(slave);
+  if (linkPath)
+  {
+    unlink(linkPath);
+    free(linkPath);
+  }
+  free(output);
+  free(waypoints);
+  pthread_mutex_destroy(&lock);
+}
+
+void
+FCSimulator::getDefaultConfig(FCSimulatorConfig* config)
+{
+  memset(config, 0, sizeof(*config));
+  config->broadcastHz   = 50;
+  config->homeLatitude  = radians(22.5362f);
+  config->homeLongitude = radians(113.9454f);
+  config->homeAltitude  = 20;
+  config->hardware      = "M600";
+  config->firmware      = "03.02.44.07";
+  config->serial        = "SIMFC0000000001";
+  config->encKey        = NULL;
+  config->appId         = 0;
+  config->maxWaypoints  = 99;
+  config->baudRate      = 0;
+}
+
+uint64_t
+FCSimulator::monotonicUs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+void
+FCSimulator::getStats(FCSimulatorStats* stats)
+{
+  pthread_mutex_lock(&lock);
+  *stats = this->stats;
+  pthread_mutex_unlock(&lock);
+}
+
+/******************************Frames*****************************************/
+
+void
+FCSimulator::receive(const uint8_t* buf, size_t len, uint64_t nowUs)
+{
+  pthread_mutex_lock(&lock);
+  stats.bytesIn += len;
+  while (len)
+  {
+    size_t take = sizeof(input) - inputUsed;
+    if (take > len)
+      take = len;
+    memcpy(input + inputUsed, buf, take);
+    inputUsed += take;
+    buf += take;
+    len -= take;
+    parse(nowUs);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void
+FCSimulator::parse(uint64_t nowUs)
+{
+  size_t start = 0;
+  while (start < inputUsed)
+  {
+    uint8_t* p = input + start;
+    if (*p != SOF)
+    {
+      uint8_t* sof = (uint8_t*)memchr(p, SOF, inputUsed - start);
+      start        = sof ? (size_t)(sof - input) : inputUsed;
+      continue;
+    }
+    if (inputUsed - start < sizeof(Header))
+      break;
+
+    Header header;
+    memcpy(&header, p, sizeof(header));
+    if (header.version != 0 || header.length > MAX_FRAME ||
+        header.length < sizeof(Header) ||
+        (header.length > sizeof(Header) && header.length < FRAME_MIN) ||
+        Protocol::sdk_stream_crc16_calc(p, CRC_HEAD) != header.crc)
+    {
+      stats.crcErrors++;
+      start++;
+      continue;
+    }
+    if (inputUsed - start < header.length)
+      break;
+    if (header.length >= FRAME_MIN)
+    {
+      uint32_t crc;
+      memcpy(&crc, p + header.length - sizeof(crc), sizeof(crc));
+      if (Protocol::sdk_stream_crc32_calc(p, header.length - sizeof(crc)) !=
+          crc)
+      {
+        stats.crcErrors++;
+        start++;
+        continue;
+      }
+    }
+
+    stats.framesIn++;
+    handle(p, nowUs);
+    start += header.length;
+  }
+
+  inputUsed -= start;
+  if (inputUsed && start)
+    memmove(input, input + start, inputUsed);
+}
+
+void
+FCSimulator::handle(uint8_t* frame, uint64_t nowUs)
+{
+  Header header;
+  memcpy(&header, frame, sizeof(header));
+  //! Acks of our pushes, and bare headers, need no answer
+  if (header.isAck || header.length < FRAME_MIN)
+    return;
+
+  uint8_t* data   = frame + sizeof(Header);
+  size_t   length = header.length - FRAME_MIN;
+  if (header.enc)
+  {
+    if (!hasKey || length % 16 || header.padding > length)
+    {
+      stats.unknown++;
+      return;
+    }
+    aes256_context ctx;
+    aes256_init(&ctx, key);
+    for (size_t i = 0; i < length; i += 16)
+      aes256_decrypt_ecb(&ctx, data + i);
+    aes256_done(&ctx);
+    length -= header.padding;
+  }
+  if (length < 2)
+  {
+    stats.unknown++;
+    return;
+  }
+  handleCommand(&header, data, length, nowUs);
+}
+
+bool
+FCSimulator::frame(uint8_t session, bool isAck, bool isEnc, uint16_t seq,
+                   const void* data, size_t length)
+{
+  uint8_t buf[MAX_FRAME];
+  size_t  padding = 0;
+  isEnc           = isEnc && hasKey && length;
+  if (isEnc)
+    padding = 16 - length % 16;
+  size_t total = length ? FRAME_MIN + length + padding : sizeof(Header);
+  if (total > MAX_FRAME)
+    return false;
+
+  Header header;
+  memset(&header, 0, sizeof(header));
+  header.sof            = SOF;
+  header.length         = total;
+  header.sessionID      = session;
+  header.isAck          = isAck ? 1 : 0;
+  header.padding        = padding;
+  header.enc            = isEnc ? 1 : 0;
+  header.sequenceNumber = seq;
+  memcpy(buf, &header, sizeof(header));
+  if (length)
+  {
+    memcpy(buf + sizeof(Header), data, length);
+    memset(buf + sizeof(Header) + length, 0, padding);
+  }
+  if (isEnc)
+  {
+    aes256_context ctx;
+    aes256_init(&ctx, key);
+    for (size_t i = 0; i < length + padding; i += 16)
+      aes256_encrypt_ecb(&ctx, buf + sizeof(Header) + i);
+    aes256_done(&ctx);
+  }
+  Protocol::calculateCRC(buf);
+
+  //! Queue it whole or not at all
+  if (outputTail - outputHead + total > MAX_OUTPUT)
+  {
+    stats.dropped++;
+    return false;
+  }
+  if (outputTail + total > outputCapacity)
+  {
+    if (outputTail > outputHead)
+      memmove(output, output + outputHead, outputTail - outputHead);
+    outputTail -= outputHead;
+    outputHead = 0;
+    if (outputTail + total > outputCapacity)
+    {
+      size_t   capacity = outputCapacity ? 2 * outputCapacity : 4 * MAX_FRAME;
+      uint8_t* grown    = (uint8_t*)realloc(output, capacity);
+      if (!grown)
+      {
+        stats.dropped++;
+        return false;
+      }
+      output         = grown;
+      outputCapacity = capacity;
+    }
+  }
+  memcpy(output + outputTail, buf, total);
+  outputTail += total;
+  stats.framesOut++;
+  stats.bytesOut += total;
+  return true;
+}
+
+void
+FCSimulator::ack(const void* data, size_t length)
+{
+  if (frame(replySession, true, replyEnc, replySeq, data, length))
+    stats.acks++;
+}
+
+void
+FCSimulator::push(const uint8_t cmd[2], const void* data, size_t length)
+{
+  uint8_t buf[MAX_FRAME];
+  if (2 + length > sizeof(buf))
+    return;
+  buf[0] = cmd[0];
+  buf[1] = cmd[1];
+  memcpy(buf + 2, data, length);
+  frame(0, false, false, 0, buf, 2 + length);
+}
+
+size_t
+FCSimulator::transmit(uint8_t* buf, size_t maxlen)
+{
+  pthread_mutex_lock(&lock);
+  size_t n = outputTail - outputHead;
+  if (n > maxlen)
+    n = maxlen;
+  memcpy(buf, output + outputHead, n);
+  outputHead += n;
+  pthread_mutex_unlock(&lock);
+  return n;
+}
+
+size_t
+FCSimulator::getPending()
+{
+  pthread_mutex_lock(&lock);
+  size_t n = outputTail - outputHead;
+  pthread_mutex_unlock(&lock);
+  return n;
+}
+
+/******************************Commands***************************************/
+
+void
+FCSimulator::handleCommand(const Header* header, const uint8_t* data,
+                           size_t length, uint64_t nowUs)
+{
+  uint8_t set = data[0];
+  uint8_t id  = data[1];
+  data += 2;
+  length -= 2;
+
+  replySession = header->sessionID;
+  replySeq     = header->sequenceNumber;
+  replyEnc     = header->enc;
+  if (header->sessionID)
+    stats.commands++;
+
+  if (set == OpenProtocol::CMDSet::activation)
+    onActivation(id, data, length);
+  else if (set == OpenProtocol::CMDSet::control)
+    onControl(id, data, length, nowUs);
+  else if (set == OpenProtocol::CMDSet::mission)
+    onMission(id, data, length);
+  else if (set == OpenProtocol::CMDSet::mfio)
+    onMFIO(id, data, length);
+  else if (set == OpenProtocol::CMDSet::subscribe)
+    onSubscribe(id, data, length, nowUs);
+  else
+  {
+    //! Virtual RC, hardware sync and mobile data are taken silently
+    stats.unknown++;
+    if (header->sessionID)
+    {
+      uint16_t result = ErrorCode::CommonACK::SUCCESS;
+      ack(&result, sizeof(result));
+    }
+  }
+}
+
+void
+FCSimulator::onActivation(uint8_t id, const uint8_t* data, size_t length)
+{
+  if (id == OpenProtocol::CMDSet::Activation::getVersion[1])
+  {
+    //! ack, serial, then the 32 byte version name parsed by Vehicle
+    uint8_t  reply[2 + 16 + 32];
+    uint16_t result = ErrorCode::CommonACK::SUCCESS;
+    size_t   serial = strlen(config.serial);
+    //! Vehicle keeps 15 characters and the terminator
+    if (serial > 15)
+      serial = 15;
+    memcpy(reply, &result, sizeof(result));
+    memcpy(reply + 2, config.serial, serial);
+    reply[2 + serial] = 0;
+    char* name        = (char*)reply + 3 + serial;
+    memset(name, 0, 32);
+    snprintf(name, 32, "SDK-v1.0 BETA %s-%s", config.hardware,
+             config.firmware);
+    ack(reply, 3 + serial + 32);
+  }
+  else if (id == OpenProtocol::CMDSet::Activation::activate[1])
+  {
+    uint16_t result = ErrorCode::ActivationACK::SUCCESS;
+    uint32_t appId;
+    if (length < 3 * sizeof(uint32_t))
+      result = ErrorCode::ActivationACK::PARAMETER_ERROR;
+    else
+    {
+      memcpy(&appId, data, sizeof(appId));
+      if (config.appId && appId != config.appId)
+        result = ErrorCode::ActivationACK::ACCESS_LEVEL_ERROR;
+    }
+    activated = result == ErrorCode::ActivationACK::SUCCESS;
+    ack(&result, sizeof(result));
+  }
+  else if (id == OpenProtocol::CMDSet::Activation::frequency[1])
+  {
+    uint16_t result = ErrorCode::CommonACK::SUCCESS;
+    for (size_t i = 0; i < length && i < (size_t)CHANNELS; ++i)
+    {
+      uint8_t code = data[i] > 7 ? FREQ_HOLD : data[i];
+      if (code != FREQ_HOLD)
+      {
+        channels[i].hz     = FREQ_HZ[code];
+        channels[i].nextUs = 0;
+      }
+    }
+    ack(&result, sizeof(result));
+  }
+  else
+  {
+    stats.unknown++;
+    uint16_t result = ErrorCode::CommonACK::SUCCESS;
+    if (replySession)
+      ack(&result, sizeof(result));
+  }
+}
+
+void
+FCSimulator::onControl(uint8_t id, const uint8_t* data, size_t length,
+                       uint64_t nowUs)
+{
+  if (id == OpenProtocol::CMDSet::Control::control[1])
+  {
+    //! CtrlData is flag and four floats, AdvancedCtrlData adds a flag byte
+    //! in front of them and feedforward terms behind
+    size_t offset = length >= 2 + 6 * sizeof(float32_t) ? 2 : 1;
+    if (length < offset + sizeof(state.ctrl))
+    {
+      stats.unknown++;
+      return;
+    }
+    state.ctrlFlag = data[0];
+    memcpy(state.ctrl, data + offset, sizeof(state.ctrl));
+    if (offset == 2 && data[1])
+      memcpy(state.ctrlFeedforward, data + offset + sizeof(state.ctrl),
+             sizeof(state.ctrlFeedforward));
+    else
+      memset(state.ctrlFeedforward, 0, sizeof(state.ctrlFeedforward));
+    state.ctrlUs = nowUs;
+    stats.controls++;
+    return;
+  }
+
+  uint16_t result = ErrorCode::CommonACK::SUCCESS;
+  if (id == OpenProtocol::CMDSet::Control::setControl[1] && length >= 1)
+  {
+    state.sdkControl = data[0] == 1;
+    result           = state.sdkControl
+               ? ErrorCode::ControlACK::SetControl::OBTAIN_CONTROL_SUCCESS
+               : ErrorCode::ControlACK::SetControl::RELEASE_CONTROL_SUCCESS;
+  }
+  else if (id == OpenProtocol::CMDSet::Control::task[1] && length >= 1)
+  {
+    if (!onTask(data[0], nowUs, &result))
+      stats.unknown++;
+  }
+  else
+  {
+    //! Camera and gimbal commands only move hardware we do not have
+    stats.unknown++;
+  }
+  if (replySession)
+    ack(&result, sizeof(result));
+}
+
+bool
+FCSimulator::onTask(uint8_t task, uint64_t nowUs, uint16_t* result)
+{
+  bool inAir = state.phase == PHASE_TAKEOFF || state.phase == PHASE_AIR ||
+               state.phase == PHASE_LANDING || state.phase == PHASE_GOHOME;
+
+  *result = ErrorCode::ControlACK::Task::SUCCESS;
+  switch (task)
+  {
+    case 1: // takeoff
+      if (inAir)
+        *result = ErrorCode::ControlACK::Task::IN_AIR;
+      else
+        setPhase(PHASE_TAKEOFF, nowUs);
+      return true;
+    case 2: // landing
+      if (!inAir)
+        *result = ErrorCode::ControlACK::Task::NOT_IN_AIR;
+      else if (state.phase != PHASE_LANDING)
+        setPhase(PHASE_LANDING, nowUs);
+      return true;
+    case 6: // go home
+      if (!inAir)
+        *result = ErrorCode::ControlACK::Task::NOT_IN_AIR;
+      else
+        setPhase(PHASE_GOHOME, nowUs);
+      return true;
+    case 7: // start motors
+      if (inAir)
+        *result = ErrorCode::ControlACK::Task::IN_AIR;
+      else if (state.phase == PHASE_MOTORS)
+        *result = ErrorCode::ControlACK::Task::MOTOR_ON;
+      else
+        setPhase(PHASE_MOTORS, nowUs);
+      return true;
+    case 8: // stop motors
+      if (inAir)
+        *result = ErrorCode::ControlACK::Task::IN_AIR;
+      else if (state.phase == PHASE_STOPPED)
+        *result = ErrorCode::ControlACK::Task::MOTOR_OFF;
+      else
+        setPhase(PHASE_STOPPED, nowUs);
+      return true;
+    case 28: // landing gear down
+      state.gear = VehicleStatus::LANDING_GEAR_DOWN;
+      return true;
+    case 29: // landing gear up
+      state.gear = VehicleStatus::LANDING_GEAR_UP;
+      return true;
+    case 12: // exit go home, landing, takeoff
+    case 13:
+    case 14:
+      if (inAir && state.phase != PHASE_AIR)
+        setPhase(PHASE_AIR, nowUs);
+      return true;
+    default:
+      *result = ErrorCode::ControlACK::Task::INVAILD_COMMAND;
+      return false;
+  }
+}
+
+void
+FCSimulator::onMission(uint8_t id, const uint8_t* data, size_t length)
+{
+  uint8_t reply[1 + sizeof(WayPointSettings)];
+  size_t  size = 1;
+  reply[0]     = ErrorCode::MissionACK::Common::SUCCESS;
+
+  if (id == OpenProtocol::CMDSet::Mission::waypointInit[1])
+  {
+    WayPointInitSettings init;
+    if (length < sizeof(init))
+      reply[0] = ErrorCode::MissionACK::Common::INVALID_PARAMETER;
+    else
+    {
+      memcpy(&init, data, sizeof(init));
+      if (waypointRunning)
+        reply[0] = ErrorCode::MissionACK::Common::IN_PROGRESS;
+      else if (init.indexNumber == 0 ||
+               init.indexNumber > config.maxWaypoints)
+        reply[0] = ErrorCode::MissionACK::WayPoint::INVALID_DATA;
+      else
+      {
+        WayPointSettings* points = (WayPointSettings*)realloc(
+          waypoints, init.indexNumber * sizeof(WayPointSettings));
+        if (!points)
+          reply[0] = ErrorCode::MissionACK::Common::UNKNOWN_ERROR;
+        else
+        {
+          waypoints = points;
+          memset(waypoints, 0, init.indexNumber * sizeof(WayPointSettings));
+          waypointInit    = init;
+          waypointReady   = true;
+          waypointRunning = false;
+        }
+      }
+    }
+  }
+  else if (id == OpenProtocol::CMDSet::Mission::waypointAddPoint[1])
+  {
+    WayPointSettings point;
+    reply[1] = 0;
+    size     = 2;
+    if (!waypointReady)
+      reply[0] = ErrorCode::MissionACK::Common::NOT_INITIALIZED;
+    else if (length < sizeof(point))
+      reply[0] = ErrorCode::MissionACK::Common::INVALID_PARAMETER;
+    else
+    {
+      memcpy(&point, data, sizeof(point));
+      reply[1] = point.index;
+      if (point.index >= waypointInit.indexNumber)
+        reply[0] = ErrorCode::MissionACK::WayPoint::POINT_OVERFLOW;
+      else
+        waypoints[point.index] = point;
+    }
+  }
+  else if (id == OpenProtocol::CMDSet::Mission::waypointSetStart[1])
+  {
+    if (!waypointReady)
+      reply[0] = ErrorCode::MissionACK::Common::NOT_INITIALIZED;
+    else
+    {
+      waypointRunning = length && data[0] == 0;
+      waypointTarget  = 0;
+    }
+  }
+  else if (id == OpenProtocol::CMDSet::Mission::waypointSetPause[1])
+  {
+    if (!waypointRunning)
+      reply[0] = ErrorCode::MissionACK::Common::NOT_RUNNING;
+  }
+  else if (id == OpenProtocol::CMDSet::Mission::waypointDownload[1])
+  {
+    if (!waypointReady)
+      reply[0] = ErrorCode::MissionACK::Common::NOT_INITIALIZED;
+    else
+    {
+      memcpy(reply + 1, &waypointInit, sizeof(waypointInit));
+      size += sizeof(waypointInit);
+    }
+  }
+  else if (id == OpenProtocol::CMDSet::Mission::waypointIndex[1])
+  {
+    if (!waypointReady)
+      reply[0] = ErrorCode::MissionACK::Common::NOT_INITIALIZED;
+    else if (!length || data[0] >= waypointInit.indexNumber)
+      reply[0] = ErrorCode::MissionACK::Common::WRONG_WAYPOINT_INDEX;
+    else
+    {
+      memcpy(reply + 1, &waypoints[data[0]], sizeof(WayPointSettings));
+      size += sizeof(WayPointSettings);
+    }
+  }
+  else if (id == OpenProtocol::CMDSet::Mission::waypointSetVelocity[1] ||
+           id == OpenProtocol::CMDSet::Mission::waypointGetVelocity[1])
+  {
+    if (!waypointReady)
+      reply[0] = ErrorCode::MissionACK::Common::NOT_INITIALIZED;
+    else
+    {
+      if (id == OpenProtocol::CMDSet::Mission::waypointSetVelocity[1] &&
+          length >= sizeof(float32_t))
+        memcpy(&waypointInit.idleVelocity, data, sizeof(float32_t));
+      memcpy(reply + 1, &waypointInit.idleVelocity, sizeof(float32_t));
+      size += sizeof(float32_t);
+    }
+  }
+  else if (id == OpenProtocol::CMDSet::Mission::hotpointStart[1])
+  {
+    float32_t maxRadius = 500;
+    if (length < sizeof(hotpoint))
+      reply[0] = ErrorCode::MissionACK::Common::INVALID_PARAMETER;
+    else
+    {
+      memcpy(&hotpoint, data, sizeof(hotpoint));
+      hotpointRunning = true;
+    }
+    memcpy(reply + 1, &maxRadius, sizeof(maxRadius));
+    size += sizeof(maxRadius);
+  }
+  else if (id == OpenProtocol::CMDSet::Mission::hotpointStop[1])
+  {
+    if (!hotpointRunning)
+      reply[0] = ErrorCode::MissionACK::Common::NOT_RUNNING;
+    hotpointRunning = false;
+  }
+  else if (id == OpenProtocol::CMDSet::Mission::hotpointDownload[1])
+  {
+    memcpy(reply + 1, &hotpoint, sizeof(hotpoint));
+    size += sizeof(hotpoint);
+  }
+  else
+  {
+    //! Pause, yaw, radius and follow me settings are taken as they come
+    stats.unknown++;
+  }
+  if (replySession)
+    ack(reply, size);
+}
+
+void
+FCSimulator::onMFIO(uint8_t id, const uint8_t* data, size_t length)
+{
+  uint8_t channel = length ? data[0] : 0xFF;
+  uint8_t reply[1 + sizeof(uint32_t)];
+  size_t  size = 1;
+  reply[0]     = ErrorCode::MFIOACK::init::SUCCESS;
+
+  if (channel >= sizeof(mfio) / sizeof(mfio[0]))
+    reply[0] = ErrorCode::MFIOACK::init::PORT_NUMBER_ERROR;
+  else if (id == OpenProtocol::CMDSet::MFIO::init[1])
+  {
+    if (length >= 3 + sizeof(uint32_t))
+      memcpy(&mfio[channel], data + 2, sizeof(uint32_t));
+  }
+  else if (id == OpenProtocol::CMDSet::MFIO::set[1])
+  {
+    if (length >= 1 + sizeof(uint32_t))
+      memcpy(&mfio[channel], data + 1, sizeof(uint32_t));
+  }
+  else if (id == OpenProtocol::CMDSet::MFIO::get[1])
+  {
+    memcpy(reply + 1, &mfio[channel], sizeof(uint32_t));
+    size += sizeof(uint32_t);
+  }
+  else
+    stats.unknown++;
+
+  if (id == OpenProtocol::CMDSet::MFIO::get[1] && size == 1)
+  {
+    memset(reply + 1, 0, sizeof(uint32_t));
+    size += sizeof(uint32_t);
+  }
+  if (replySession)
+    ack(reply, size);
+}
+
+void
+FCSimulator::onSubscribe(uint8_t id, const uint8_t* data, size_t length,
+                         uint64_t nowUs)
+{
+  uint8_t result = ErrorCode::SubscribeACK::SUCCESS;
+
+  if (id == OpenProtocol::CMDSet::Subscribe::versionMatch[1])
+  {
+    uint32_t version = 0;
+    if (length >= sizeof(version))
+      memcpy(&version, data, sizeof(version));
+    if (version != DB_VERSION)
+      result = ErrorCode::SubscribeACK::VERSION_DOES_NOT_MATCH;
+  }
+  else if (id == OpenProtocol::CMDSet::Subscribe::addPackage[1])
+    result = addPackage(data, length, nowUs);
+  else if (id == OpenProtocol::CMDSet::Subscribe::reset[1])
+    memset(packages, 0, sizeof(packages));
+  else if (id == OpenProtocol::CMDSet::Subscribe::removePackage[1])
+  {
+    if (!length || data[0] >= MAX_PACKAGES)
+      result = ErrorCode::SubscribeACK::PACKAGE_OUT_OF_RANGE;
+    else if (!packages[data[0]].used)
+      result = ErrorCode::SubscribeACK::PACKAGE_DOES_NOT_EXIST;
+    else
+      packages[data[0]].used = false;
+  }
+  else
+    stats.unknown++;
+
+  if (replySession)
+    ack(&result, sizeof(result));
+}
+
+uint8_t
+FCSimulator::addPackage(const uint8_t* data, size_t length, uint64_t nowUs)
+{
+  //! PackageInfo: id, uint16 freq, config, number of topics; then UIDs
+  const size_t INFO = 5;
+  if (length < INFO)
+    return ErrorCode::SubscribeACK::ILLEGAL_INPUT;
+
+  uint8_t  packageID = data[0];
+  uint16_t freq;
+  memcpy(&freq, data + 1, sizeof(freq));
+  uint8_t config = data[3];
+  uint8_t count  = data[4];
+
+  if (packageID >= MAX_PACKAGES)
+    return ErrorCode::SubscribeACK::PACKAGE_OUT_OF_RANGE;
+  if (packages[packageID].used)
+    return ErrorCode::SubscribeACK::PACKAGE_ALREADY_EXISTS;
+  if (!count)
+    return ErrorCode::SubscribeACK::PACKAGE_EMPTY;
+  if (count > MAX_TOPICS || length < INFO + count * sizeof(uint32_t))
+    return ErrorCode::SubscribeACK::ILLEGAL_INPUT;
+
+  bool legal = false;
+  for (size_t i = 0; i < sizeof(PACKAGE_HZ) / sizeof(PACKAGE_HZ[0]); ++i)
+    legal = legal || freq == PACKAGE_HZ[i];
+  if (!legal)
+    return ErrorCode::SubscribeACK::ILLEGAL_FREQUENCY;
+
+  Package package;
+  memset(&package, 0, sizeof(package));
+  size_t size = config == 1 ? sizeof(Telemetry::TimeStamp) : 0;
+  for (uint8_t i = 0; i < count; ++i)
+  {
+    uint32_t uid;
+    memcpy(&uid, data + INFO + i * sizeof(uid), sizeof(uid));
+    int t = 0;
+    while (t < Telemetry::TOTAL_TOPIC_NUMBER &&
+           Telemetry::TopicDataBase[t].uid != uid)
+      t++;
+    if (t == Telemetry::TOTAL_TOPIC_NUMBER)
+      return ErrorCode::SubscribeACK::ILLEGAL_UID;
+    if (freq > Telemetry::TopicDataBase[t].maxFreq)
+      return ErrorCode::SubscribeACK::ILLEGAL_FREQUENCY;
+    package.topics[i] = t;
+    size += Telemetry::TopicDataBase[t].size;
+  }
+  if (size > PACKAGE_MAX)
+    return ErrorCode::SubscribeACK::PACKAGE_TOO_LARGE;
+
+  package.used           = true;
+  package.freq           = freq;
+  package.config         = config;
+  package.numberOfTopics = count;
+  package.nextUs         = nowUs;
+  packages[packageID]    = package;
+  return ErrorCode::SubscribeACK::SUCCESS;
+}
+
+/******************************Flight model***********************************/
+
+void
+FCSimulator::setPhase(Phase phase, uint64_t nowUs)
+{
+  state.phase   = phase;
+  state.phaseUs = nowUs;
+  if (phase == PHASE_STOPPED)
+  {
+    state.up      = 0;
+    state.vNorth  = 0;
+    state.vEast   = 0;
+    state.vUp     = 0;
+    state.yawRate = 0;
+  }
+}
+
+uint8_t
+FCSimulator::flightStatus(uint64_t nowUs) const
+{
+  switch (state.phase)
+  {
+    case PHASE_STOPPED:
+      return ErrorCode::CommonACK::FlightStatus::STOPED;
+    case PHASE_MOTORS:
+      return ErrorCode::CommonACK::FlightStatus::ON_GROUND;
+    case PHASE_TAKEOFF:
+      return nowUs - state.phaseUs < SPOOL_US
+               ? ErrorCode::CommonACK::FlightStatus::ON_GROUND
+               : ErrorCode::CommonACK::FlightStatus::IN_AIR;
+    default:
+      return ErrorCode::CommonACK::FlightStatus::IN_AIR;
+  }
+}
+
+uint8_t
+FCSimulator::displayMode(uint64_t nowUs) const
+{
+  switch (state.phase)
+  {
+    case PHASE_MOTORS:
+      return VehicleStatus::MODE_ENGINE_START;
+    case PHASE_TAKEOFF:
+      return nowUs - state.phaseUs < SPOOL_US
+               ? VehicleStatus::MODE_ENGINE_START
+               : VehicleStatus::MODE_AUTO_TAKEOFF;
+    case PHASE_AIR:
+      return state.sdkControl && nowUs - state.ctrlUs < CONTROL_TIMEOUT
+               ? VehicleStatus::MODE_NAVI_SDK_CTRL
+               : VehicleStatus::MODE_P_GPS;
+    case PHASE_LANDING:
+      return VehicleStatus::MODE_AUTO_LANDING;
+    case PHASE_GOHOME:
+      return VehicleStatus::MODE_NAVI_GO_HOME;
+    default:
+      return VehicleStatus::MODE_P_GPS;
+  }
+}
+
+void
+FCSimulator::fly(uint64_t nowUs)
+{
+  float32_t dt = state.lastUs ? (nowUs - state.lastUs) * 1e-6f : 0;
+  state.lastUs = nowUs;
+  if (dt > 0.1f)
+    dt = 0.1f;
+  if (state.phase == PHASE_STOPPED || state.phase == PHASE_MOTORS)
+  {
+    state.battery -= dt * (state.phase == PHASE_MOTORS ? 0.02f : 0.001f);
+    if (state.battery < 0)
+      state.battery = 0;
+    return;
+  }
+
+  float32_t north = 0, east = 0, up = 0, yawRate = 0;
+  switch (state.phase)
+  {
+    case PHASE_TAKEOFF:
+      if (nowUs - state.phaseUs >= SPOOL_US)
+        up = CLIMB_SPEED;
+      if (state.up >= TAKEOFF_HEIGHT)
+        setPhase(PHASE_AIR, nowUs);
+      break;
+    case PHASE_LANDING:
+      up = -CLIMB_SPEED;
+      break;
+    case PHASE_GOHOME:
+    {
+      float32_t distance = sqrtf(state.north * state.north +
+                                 state.east * state.east);
+      if (distance < 0.5f)
+        setPhase(PHASE_LANDING, nowUs);
+      else
+      {
+        float32_t speed = distance < GO_HOME_SPEED ? distance : GO_HOME_SPEED;
+        north           = -state.north / distance * speed;
+        east            = -state.east / distance * speed;
+      }
+      break;
+    }
+    case PHASE_AIR:
+      if (state.sdkControl && nowUs - state.ctrlUs < CONTROL_TIMEOUT)
+      {
+        uint8_t   flag = state.ctrlFlag;
+        float32_t x    = state.ctrl[0];
+        float32_t y    = state.ctrl[1];
+        float32_t z    = state.ctrl[2];
+        float32_t yaw  = state.ctrl[3];
+        bool      body = (flag & BODY_FRAME) != 0;
+
+        switch (flag & HORIZONTAL_MASK)
+        {
+          case HORIZONTAL_VELOCITY:
+            //! Feedforward leads the velocity response by its time constant
+            north = x + RESPONSE * state.ctrlFeedforward[0];
+            east  = y + RESPONSE * state.ctrlFeedforward[1];
+            break;
+          case HORIZONTAL_POSITION:
+            north = POSITION_GAIN * x;
+            east  = POSITION_GAIN * y;
+            break;
+          default:
+            //! Tilt, or tilt rate, sets a speed: pitch forward, roll right
+            north = -ANGLE_SPEED * y;
+            east  = ANGLE_SPEED * x;
+            if ((flag & HORIZONTAL_MASK) != HORIZONTAL_ANGLE)
+            {
+              north *= 0.1f;
+              east *= 0.1f;
+            }
+            body = true;
+            break;
+        }
+        if (body)
+        {
+          float32_t c = cosf(state.yaw), s = sinf(state.yaw);
+          float32_t n = c * north - s * east;
+          east        = s * north + c * east;
+          north       = n;
+        }
+        float32_t speed = sqrtf(north * north + east * east);
+        if (speed > MAX_SPEED)
+        {
+          north *= MAX_SPEED / speed;
+          east *= MAX_SPEED / speed;
+        }
+
+        if ((flag & VERTICAL_MASK) == VERTICAL_VELOCITY)
+          up = z;
+        else if ((flag & VERTICAL_MASK) == VERTICAL_POSITION)
+          up = POSITION_GAIN * (z - state.up);
+        else
+          up = (z - 50) / 50 * MAX_CLIMB;
+        up = clamp(up, MAX_CLIMB);
+
+        if (flag & YAW_RATE)
+          yawRate = radians(yaw);
+        else
+        {
+          float32_t error = radians(yaw) - state.yaw;
+          error   = atan2f(sinf(error), cosf(error));
+          yawRate = YAW_GAIN * error;
+        }
+        yawRate = clamp(yawRate, MAX_YAW_RATE);
+      }
+      else if (waypointRunning)
+        followWaypoints(&north, &east, &up);
+      //! Without a fresh setpoint the aircraft brakes and holds
+      break;
+    default:
+      break;
+  }
+
+  float32_t k = dt < RESPONSE ? dt / RESPONSE : 1;
+  state.vNorth += (north - state.vNorth) * k;
+  state.vEast += (east - state.vEast) * k;
+  state.vUp += (up - state.vUp) * k;
+  state.yawRate += (yawRate - state.yawRate) * k;
+
+  state.north += state.vNorth * dt;
+  state.east += state.vEast * dt;
+  state.up += state.vUp * dt;
+  state.yaw += state.yawRate * dt;
+  state.yaw = atan2f(sinf(state.yaw), cosf(state.yaw));
+  state.battery -= dt * 0.05f;
+  if (state.battery < 0)
+    state.battery = 0;
+
+  if (state.up <= 0)
+  {
+    state.up = 0;
+    if (state.vUp < 0)
+      state.vUp = 0;
+    if (state.phase == PHASE_LANDING)
+      setPhase(PHASE_STOPPED, nowUs);
+  }
+}
+
+//! Head for the target waypoint, passing through each one at speed
+bool
+FCSimulator::followWaypoints(float32_t* north, float32_t* east, float32_t* up)
+{
+  const WayPointSettings* target = &waypoints[waypointTarget];
+  float64_t               dLat   = target->latitude - config.homeLatitude;
+  float64_t               dLon   = target->longitude - config.homeLongitude;
+
+  float32_t dn = (float32_t)(dLat * EARTH_RADIUS) - state.north;
+  float32_t de =
+    (float32_t)(dLon * EARTH_RADIUS * cos(config.homeLatitude)) - state.east;
+  float32_t du       = target->altitude - state.up;
+  float32_t distance = sqrtf(dn * dn + de * de + du * du);
+
+  if (distance < ARRIVAL)
+  {
+    ACK::WayPointReachedData reached;
+    memset(&reached, 0, sizeof(reached));
+    reached.incident_type  = NAVI_MISSION_WP_REACH_POINT;
+    reached.waypoint_index = waypointTarget;
+    reached.current_status = 6; //! post-action
+    push(OpenProtocol::CMDSet::Broadcast::waypoint, &reached,
+         sizeof(reached));
+
+    if (++waypointTarget < waypointInit.indexNumber)
+      return followWaypoints(north, east, up);
+
+    WayPointFinishData finish;
+    memset(&finish, 0, sizeof(finish));
+    finish.incident_type = NAVI_MISSION_FINISH;
+    push(OpenProtocol::CMDSet::Broadcast::waypoint, &finish, sizeof(finish));
+    waypointRunning = false;
+    return false;
+  }
+
+  float32_t speed = waypointInit.idleVelocity > 0 ? waypointInit.idleVelocity
+                                                   : waypointInit.maxVelocity;
+  if (speed > MAX_SPEED)
+    speed = MAX_SPEED;
+  *north = dn / distance * speed;
+  *east  = de / distance * speed;
+  *up    = clamp(du / distance * speed, MAX_CLIMB);
+  return true;
+}
+
+void
+FCSimulator::position(float64_t* latitude, float64_t* longitude) const
+{
+  *latitude  = config.homeLatitude + state.north / EARTH_RADIUS;
+  *longitude = config.homeLongitude +
+               state.east / (EARTH_RADIUS * cos(config.homeLatitude));
+}
+
+void
+FCSimulator::quaternion(Telemetry::Quaternion* q) const
+{
+  q->q0 = cosf(state.yaw / 2);
+  q->q1 = 0;
+  q->q2 = 0;
+  q->q3 = sinf(state.yaw / 2);
+}
+
+/******************************Telemetry**************************************/
+
+uint64_t
+FCSimulator::getNextDueUs()
+{
+  pthread_mutex_lock(&lock);
+  //! The flight model wants a step every 10 ms while it moves
+  uint64_t due = state.lastUs + 10000;
+  for (int i = 0; i < CHANNELS; ++i)
+    if (channels[i].hz && channels[i].nextUs < due)
+      due = channels[i].nextUs;
+  for (int i = 0; i < MAX_PACKAGES; ++i)
+    if (packages[i].used && packages[i].nextUs < due)
+      due = packages[i].nextUs;
+  pthread_mutex_unlock(&lock);
+  return due;
+}
+
+void
+FCSimulator::step(uint64_t nowUs)
+{
+  pthread_mutex_lock(&lock);
+  fly(nowUs);
+  broadcast(nowUs);
+  publish(nowUs);
+  pthread_mutex_unlock(&lock);
+}
+
+void
+FCSimulator::broadcast(uint64_t nowUs)
+{
+  uint16_t flag = 0;
+  for (int i = 0; i < 14; ++i)
+  {
+    Channel* channel = &channels[i];
+    if (!channel->hz || channel->nextUs > nowUs)
+      continue;
+    flag |= 1 << i;
+    uint64_t period = 1000000 / channel->hz;
+    channel->nextUs += period;
+    //! Fell behind or just enabled: restart from now rather than burst
+    if (channel->nextUs <= nowUs)
+      channel->nextUs = nowUs + period;
+  }
+  if (!flag)
+    return;
+
+  uint8_t  buf[MAX_FRAME];
+  uint8_t* p = buf;
+#define APPEND(value)                                                          \
+  do                                                                           \
+  {                                                                            \
+    memcpy(p, &(value), sizeof(value));                                        \
+    p += sizeof(value);                                                        \
+  } while (0)
+
+  float64_t latitude, longitude;
+  position(&latitude, &longitude);
+  APPEND(flag);
+  if (flag & 0x0001)
+  {
+    Telemetry::TimeStamp time;
+    Telemetry::SyncStamp sync;
+    time.time_ms = (uint32_t)(nowUs / 1000);
+    time.time_ns = (uint32_t)(nowUs % 1000) * 1000;
+    memset(&sync, 0, sizeof(sync));
+    APPEND(time);
+    APPEND(sync);
+  }
+  if (flag & 0x0002)
+  {
+    Telemetry::Quaternion q;
+    quaternion(&q);
+    APPEND(q);
+  }
+  if (flag & 0x0004)
+  {
+    Telemetry::Vector3f a = { 0, 0, 0 };
+    APPEND(a);
+  }
+  if (flag & 0x0008)
+  {
+    Telemetry::Vector3f     v = { state.vNorth, state.vEast, state.vUp };
+    Telemetry::VelocityInfo info;
+    memset(&info, 0, sizeof(info));
+    info.health = 1;
+    APPEND(v);
+    APPEND(info);
+  }
+  if (flag & 0x0010)
+  {
+    Telemetry::Vector3f w = { 0, 0, state.yawRate };
+    APPEND(w);
+  }
+  if (flag & 0x0020)
+  {
+    Telemetry::GlobalPosition   global;
+    Telemetry::RelativePosition relative;
+    global.latitude  = latitude;
+    global.longitude = longitude;
+    global.altitude  = config.homeAltitude + state.up;
+    global.height    = state.up;
+    global.health    = 5;
+    memset(&relative, 0, sizeof(relative));
+    APPEND(global);
+    APPEND(relative);
+  }
+  if (flag & 0x0040)
+  {
+    Telemetry::GPSInfo gps;
+    memset(&gps, 0, sizeof(gps));
+    gps.latitude      = (int32_t)(degrees(latitude) * 1e7);
+    gps.longitude     = (int32_t)(degrees(longitude) * 1e7);
+    gps.HFSL          = (int32_t)((config.homeAltitude + state.up) * 1000);
+    gps.velocityNED.x = state.vNorth * 100;
+    gps.velocityNED.y = state.vEast * 100;
+    gps.velocityNED.z = -state.vUp * 100;
+    gps.detail.NSV    = 14;
+    APPEND(gps);
+  }
+  if (flag & 0x0080)
+  {
+    Telemetry::RTK rtk;
+    memset(&rtk, 0, sizeof(rtk));
+    APPEND(rtk);
+  }
+  if (flag & 0x0100)
+  {
+    Telemetry::Mag mag = { (int16_t)(1000 * cosf(state.yaw)),
+                           (int16_t)(-1000 * sinf(state.yaw)), 0 };
+    APPEND(mag);
+  }
+  if (flag & 0x0200)
+  {
+    //! Sticks centered, mode switch in F so the SDK may take control
+    Telemetry::RC rc = { 0, 0, 0, 0, 8000, -4545 };
+    APPEND(rc);
+  }
+  if (flag & 0x0400)
+  {
+    Telemetry::Gimbal gimbal;
+    memset(&gimbal, 0, sizeof(gimbal));
+    gimbal.yaw = degrees(state.yaw);
+    APPEND(gimbal);
+  }
+  if (flag & 0x0800)
+  {
+    Telemetry::Status status = { flightStatus(nowUs), displayMode(nowUs),
+                                 state.gear, 0 };
+    APPEND(status);
+  }
+  if (flag & 0x1000)
+  {
+    Telemetry::Battery battery = { 5700, 22800, -8000,
+                                   (uint8_t)state.battery };
+    APPEND(battery);
+  }
+  if (flag & 0x2000)
+  {
+    Telemetry::SDKInfo info;
+    memset(&info, 0, sizeof(info));
+    info.deviceStatus = state.sdkControl ? 2 : 0;
+    info.flightStatus = state.sdkControl ? 1 : 0;
+    APPEND(info);
+  }
+#undef APPEND
+
+  push(OpenProtocol::CMDSet::Broadcast::broadcast, buf, p - buf);
+  stats.broadcasts++;
+}
+
+size_t
+FCSimulator::topic(uint8_t name, uint8_t* out, uint64_t nowUs) const
+{
+  size_t size = Telemetry::TopicDataBase[name].size;
+  memset(out, 0, size);
+
+  float64_t latitude, longitude;
+  position(&latitude, &longitude);
+  float32_t altitude = config.homeAltitude + state.up;
+  switch (name)
+  {
+    case Telemetry::TOPIC_QUATERNION:
+      quaternion((Telemetry::Quaternion*)out);
+      break;
+    case Telemetry::TOPIC_VELOCITY:
+    {
+      Telemetry::Velocity v;
+      memset(&v, 0, sizeof(v));
+      v.data.x      = state.vNorth;
+      v.data.y      = state.vEast;
+      v.data.z      = state.vUp;
+      v.info.health = 1;
+      memcpy(out, &v, sizeof(v));
+      break;
+    }
+    case Telemetry::TOPIC_ANGULAR_RATE_FUSIONED:
+    case Telemetry::TOPIC_ANGULAR_RATE_RAW:
+    {
+      Telemetry::Vector3f w = { 0, 0, state.yawRate };
+      memcpy(out, &w, sizeof(w));
+      break;
+    }
+    case Telemetry::TOPIC_ALTITUDE_FUSIONED:
+    case Telemetry::TOPIC_ALTITUDE_BAROMETER:
+      memcpy(out, &altitude, sizeof(altitude));
+      break;
+    case Telemetry::TOPIC_HEIGHT_HOMEPOOINT:
+      memcpy(out, &config.homeAltitude, sizeof(config.homeAltitude));
+      break;
+    case Telemetry::TOPIC_HEIGHT_FUSION:
+      memcpy(out, &state.up, sizeof(state.up));
+      break;
+    case Telemetry::TOPIC_GPS_FUSED:
+    {
+      Telemetry::GPSFused fused;
+      fused.longitude              = longitude;
+      fused.latitude               = latitude;
+      fused.altitude               = altitude;
+      fused.visibleSatelliteNumber = 14;
+      memcpy(out, &fused, sizeof(fused));
+      break;
+    }
+    case Telemetry::TOPIC_GPS_POSITION:
+    {
+      Telemetry::Vector3d gps = { (int32_t)(degrees(longitude) * 1e7),
+                                  (int32_t)(degrees(latitude) * 1e7),
+                                  (int32_t)(altitude * 1000) };
+      memcpy(out, &gps, sizeof(gps));
+      break;
+    }
+    case Telemetry::TOPIC_GPS_VELOCITY:
+    {
+      Telemetry::Vector3f v = { state.vNorth * 100, state.vEast * 100,
+                                -state.vUp * 100 };
+      memcpy(out, &v, sizeof(v));
+      break;
+    }
+    case Telemetry::TOPIC_COMPASS:
+    {
+      Telemetry::Mag mag = { (int16_t)(1000 * cosf(state.yaw)),
+                             (int16_t)(-1000 * sinf(state.yaw)), 0 };
+      memcpy(out, &mag, sizeof(mag));
+      break;
+    }
+    case Telemetry::TOPIC_RC:
+    {
+      Telemetry::RC rc = { 0, 0, 0, 0, 8000, -4545 };
+      memcpy(out, &rc, sizeof(rc));
+      break;
+    }
+    case Telemetry::TOPIC_GIMBAL_ANGLES:
+    {
+      Telemetry::Vector3f angles = { 0, 0, degrees(state.yaw) };
+      memcpy(out, &angles, sizeof(angles));
+      break;
+    }
+    case Telemetry::TOPIC_STATUS_FLIGHT:
+      out[0] = flightStatus(nowUs);
+      break;
+    case Telemetry::TOPIC_STATUS_DISPLAYMODE:
+      out[0] = displayMode(nowUs);
+      break;
+    case Telemetry::TOPIC_STATUS_LANDINGGEAR:
+      out[0] = state.gear;
+      break;
+    case Telemetry::TOPIC_BATTERY_INFO:
+    {
+      Telemetry::Battery battery = { 5700, 22800, -8000,
+                                     (uint8_t)state.battery };
+      memcpy(out, &battery, sizeof(battery));
+      break;
+    }
+    case Telemetry::TOPIC_CONTROL_DEVICE:
+    {
+      Telemetry::SDKInfo info;
+      memset(&info, 0, sizeof(info));
+      info.deviceStatus = state.sdkControl ? 2 : 0;
+      info.flightStatus = state.sdkControl ? 1 : 0;
+      memcpy(out, &info, sizeof(info));
+      break;
+    }
+    case Telemetry::TOPIC_HARD_SYNC:
+    {
+      Telemetry::HardSyncData sync;
+      memset(&sync, 0, sizeof(sync));
+      sync.ts.time2p5ms = (uint32_t)(nowUs / 2500);
+      sync.ts.time1ns   = (uint32_t)(nowUs % 2500) * 1000;
+      quaternion(&sync.q);
+      memcpy(out, &sync, sizeof(sync));
+      break;
+    }
+    case Telemetry::TOPIC_GPS_SIGNAL_LEVEL:
+    case Telemetry::TOPIC_GPS_CONTROL_LEVEL:
+      out[0] = 5;
+      break;
+    default:
+      //! Accelerations, RTK and GPS details stay zero
+      break;
+  }
+  return size;
+}
+
+void
+FCSimulator::publish(uint64_t nowUs)
+{
+  for (int i = 0; i < MAX_PACKAGES; ++i)
+  {
+    Package* package = &packages[i];
+    if (!package->used || package->nextUs > nowUs)
+      continue;
+    uint64_t period = 1000000 / package->freq;
+    package->nextUs += period;
+    if (package->nextUs <= nowUs)
+      package->nextUs = nowUs + period;
+
+    uint8_t  buf[1 + PACKAGE_MAX];
+    uint8_t* p = buf;
+    *p++       = i;
+    if (package->config == 1)
+    {
+      Telemetry::TimeStamp time;
+      time.time_ms = (uint32_t)(nowUs / 1000);
+      time.time_ns = (uint32_t)(nowUs % 1000) * 1000;
+      memcpy(p, &time, sizeof(time));
+      p += sizeof(time);
+    }
+    for (uint8_t t = 0; t < package->numberOfTopics; ++t)
+      p += topic(package->topics[t], p, nowUs);
+
+    push(OpenProtocol::CMDSet::Broadcast::subscribe, buf, p - buf);
+    stats.packages++;
+  }
+}
+
+/******************************Pty********************************************/
+
+bool
+FCSimulator::openPty(const char* linkPath)
+{
+  master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+  {
+    DERROR("Failed to create a pty: %s\n", strerror(errno));
+    return false;
+  }
+  const char* name = ptsname(master);
+  if (!name || strlen(name) >= sizeof(ptyName))
+    return false;
+  strcpy(ptyName, name);
+
+  //! Holding the slave open keeps the master from seeing hangups while no
+  //! client is attached; raw mode keeps the line discipline off the bytes
+  slave = open(ptyName, O_RDWR | O_NOCTTY);
+  if (slave < 0)
+  {
+    DERROR("Failed to open %s: %s\n", ptyName, strerror(errno));
+    return false;
+  }
+  struct termios options;
+  if (tcgetattr(slave, &options) == 0)
+  {
+    cfmakeraw(&options);
+    tcsetattr(slave, TCSANOW, &options);
+  }
+
+  if (linkPath)
+  {
+    unlink(linkPath);
+    if (symlink(ptyName, linkPath) != 0)
+    {
+      DERROR("Failed to link %s to %s: %s\n", linkPath, ptyName,
+             strerror(errno));
+      return false;
+    }
+    this->linkPath = strdup(linkPath);
+  }
+  return true;
+}
+
+const char*
+FCSimulator::getPtyName() const
+{
+  return linkPath ? linkPath : ptyName;
+}
+
+bool
+FCSimulator::start()
+{
+  if (master < 0 || running)
+    return false;
+  if (pipe(wakeup) != 0)
+    return false;
+  running = true;
+  if (pthread_create(&thread, NULL, loop, this) != 0)
+  {
+    running = false;
+    close(wakeup[0]);
+    close(wakeup[1]);
+    wakeup[0] = wakeup[1] = -1;
+    return false;
+  }
+  return true;
+}
+
+void
+FCSimulator::stop()
+{
+  if (!running)
+    return;
+  running = false;
+  if (write(wakeup[1], "", 1) < 0)
+    DERROR("Failed to wake the simulator thread\n");
+  pthread_join(thread, NULL);
+  close(wakeup[0]);
+  close(wakeup[1]);
+  wakeup[0] = wakeup[1] = -1;
+}
+
+void*
+FCSimulator::loop(void* self)
+{
+  ((FCSimulator*)self)->serve();
+  return NULL;
+}
+
+void
+FCSimulator::serve()
+{
+  uint8_t  buf[MAX_FRAME];
+  //! Line budget in bytes, refilled at baudRate / 10 per second
+  double   credit   = MAX_FRAME;
+  uint64_t refillUs = monotonicUs();
+  //! Writes go out as soon as there is output; POLLOUT is only waited for
+  //! once the slave side stops taking it
+  bool     blocked  = false;
+
+  while (running)
+  {
+    uint64_t now     = monotonicUs();
+    uint64_t due     = getNextDueUs();
+    size_t   pending = getPending();
+
+    if (config.baudRate)
+    {
+      credit += (now - refillUs) * (config.baudRate / 10.0) / 1e6;
+      if (credit > MAX_FRAME)
+        credit = MAX_FRAME;
+    }
+    refillUs = now;
+
+    uint64_t waitUs = due > now ? due - now : 0;
+    if (pending && config.baudRate && credit < 1)
+    {
+      uint64_t refill = (uint64_t)((1 - credit) * 1e7 / config.baudRate) + 1;
+      if (refill < waitUs)
+        waitUs = refill;
+    }
+
+    struct pollfd fds[2];
+    fds[0].fd      = master;
+    fds[0].events  = POLLIN | (pending && blocked ? POLLOUT : 0);
+    fds[0].revents = 0;
+    fds[1].fd      = wakeup[0];
+    fds[1].events  = POLLIN;
+    fds[1].revents = 0;
+    struct timespec timeout;
+    timeout.tv_sec  = waitUs / 1000000;
+    timeout.tv_nsec = (waitUs % 1000000) * 1000;
+    if (ppoll(fds, 2, &timeout, NULL) < 0 && errno != EINTR)
+    {
+      DERROR("Simulator poll failed: %s\n", strerror(errno));
+      break;
+    }
+    if (fds[1].revents)
+      break;
+
+    if (fds[0].revents & POLLIN)
+    {
+      ssize_t n;
+      while ((n = read(master, buf, sizeof(buf))) > 0)
+        receive(buf, n, monotonicUs());
+    }
+    step(monotonicUs());
+
+    if (!blocked || (fds[0].revents & POLLOUT))
+    {
+      pthread_mutex_lock(&lock);
+      size_t n = outputTail - outputHead;
+      if (config.baudRate && n > credit)
+        n = (size_t)credit;
+      if (n)
+      {
+        ssize_t written = write(master, output + outputHead, n);
+        if (written > 0)
+        {
+          outputHead += written;
+          credit -= written;
+        }
+        blocked = written < 0 && errno == EAGAIN;
+      }
+      pthread_mutex_unlock(&lock);
+    }
+
+    struct timespec cpu;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    pthread_mutex_lock(&lock);
+    stats.cpuNs = (uint64_t)cpu.tv_sec * 1000000000ULL + cpu.tv_nsec;
+    pthread_mutex_unlock(&lock);
+  }
+}
@@ -0,0 +1,466 @@
+/*! @file linux_lock_profiler.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Contention profiling for the PosixThreadManager locks
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#include "linux_lock_profiler.hpp"
+#include "dji_trace.hpp"
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace DJI::OSDK;
+
+volatile bool LockProfiler::enabled = false;
+uint64_t      LockProfiler::key[LockProfiler::MAX_SITE];
+LockSiteStats LockProfiler::sites[LockProfiler::MAX_SITE];
+LockSiteStats LockProfiler::other[LOCK_NUMBER];
+
+static const char* lockName[LOCK_NUMBER] = { "memory",   "msg",
+                                             "ack",      "header",
+                                             "nbAck",    "stopCond",
+                                             "frame" };
+
+#define LOCK_LOAD(_p) __atomic_load_n((_p), __ATOMIC_RELAXED)
+#define LOCK_ADD(_p, _v) __atomic_fetch_add((_p), (_v), __ATOMIC_RELAXED)
+
+void
+LockProfiler::enable(bool enable)
+{
+  enabled = enable;
+}
+
+bool
+LockProfiler::isEnabled()
+{
+  return enabled;
+}
+
+void
+LockProfiler::reset()
+{
+  for (int i = 0; i < MAX_SITE; ++i)
+  {
+    memset(&sites[i].acquisitions, 0,
+           sizeof(LockSiteStats) - offsetof(LockSiteStats, acquisitions));
+  }
+  for (int i = 0; i < LOCK_NUMBER; ++i)
+  {
+    memset(&other[i].acquisitions, 0,
+           sizeof(LockSiteStats) - offsetof(LockSiteStats, acquisitions));
+  }
+}
+
+LockSiteStats*
+LockProfiler::site(int lock, const void* address)
+{
+  //! User-space addresses leave the top bits free for the lock
+  uint64_t wanted = ((uint64_t)(uintptr_t)address << 3 | lock) + 1;
+  uint32_t start  = (uint32_t)((wanted * 0x9E3779B97F4A7C15ULL) >> 56);
+
+  for (int n = 0; n < MAX_SITE; ++n)
+  {
+    int      i = (start + n) & (MAX_SITE - 1);
+    uint64_t k = __atomic_load_n(&key[i], __ATOMIC_ACQUIRE);
+    if (!k)
+    {
+      if (__atomic_compare_exchange_n(&key[i], &k, wanted, false,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      {
+        sites[i].lock = lock;
+        sites[i].site = address;
+        return &sites[i];
+      }
+    }
+    if (k == wanted)
+      return &sites[i];
+  }
+  return &other[lock];
+}
+
+void
+LockProfiler::record(LockHistogram* histogram, uint64_t ns)
+{
+  int bucket = 0;
+  for (uint64_t v = ns; v && bucket < LockHistogram::BUCKET_NUMBER - 1;
+       v >>= 1)
+    bucket++;
+
+  LOCK_ADD(&histogram->bucket[bucket], 1);
+  LOCK_ADD(&histogram->count, 1);
+  LOCK_ADD(&histogram->sumNs, ns);
+
+  uint64_t current = LOCK_LOAD(&histogram->maxNs);
+  while (ns > current &&
+         !__atomic_compare_exchange_n(&histogram->maxNs, &current, ns, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+static void
+copyHistogram(LockHistogram* dst, const LockHistogram* src)
+{
+  dst->count = LOCK_LOAD(&src->count);
+  dst->sumNs = LOCK_LOAD(&src->sumNs);
+  dst->maxNs = LOCK_LOAD(&src->maxNs);
+  for (int i = 0; i < LockHistogram::BUCKET_NUMBER; ++i)
+    dst->bucket[i] = LOCK_LOAD(&src->bucket[i]);
+}
+
+static void
+copySite(LockSiteStats* dst, const LockSiteStats* src, int lock,
+         const void* site)
+{
+  dst->lock         = lock;
+  dst->site         = site;
+  dst->acquisitions = LOCK_LOAD(&src->acquisitions);
+  dst->contended    = LOCK_LOAD(&src->contended);
+  copyHistogram(&dst->wait, &src->wait);
+  copyHistogram(&dst->hold, &src->hold);
+}
+
+static void
+addHistogram(LockHistogram* dst, const LockHistogram* src)
+{
+  dst->count += src->count;
+  dst->sumNs += src->sumNs;
+  if (src->maxNs > dst->maxNs)
+    dst->maxNs = src->maxNs;
+  for (int i = 0; i < LockHistogram::BUCKET_NUMBER; ++i)
+    dst->bucket[i] += src->bucket[i];
+}
+
+size_t
+LockProfiler::snapshot(LockSiteStats* out, size_t maxNumber)
+{
+  size_t number = 0;
+  for (int i = 0; i < MAX_SITE && number < maxNumber; ++i)
+  {
+    uint64_t k = __atomic_load_n(&key[i], __ATOMIC_ACQUIRE);
+    if (!k)
+      continue;
+    copySite(&out[number++], &sites[i], (k - 1) & 7,
+             (const void*)(uintptr_t)((k - 1) >> 3));
+  }
+  for (int i = 0; i < LOCK_NUMBER && number < maxNumber; ++i)
+  {
+    if (LOCK_LOAD(&other[i].acquisitions))
+      copySite(&out[number++], &other[i], i, NULL);
+  }
+  return number;
+}
+
+void
+LockProfiler::getLockStats(int lock, LockSiteStats* total)
+{
+  memset(total, 0, sizeof(LockSiteStats));
+  total->lock = lock;
+
+  LockSiteStats copy;
+  for (int i = 0; i <= MAX_SITE; ++i)
+  {
+    if (i < MAX_SITE)
+    {
+      uint64_t k = __atomic_load_n(&key[i], __ATOMIC_ACQUIRE);
+      if (!k || (int)((k - 1) & 7) != lock)
+        continue;
+      copySite(&copy, &sites[i], lock, NULL);
+    }
+    else
+    {
+      copySite(&copy, &other[lock], lock, NULL);
+    }
+    total->acquisitions += copy.acquisitions;
+    total->contended += copy.contended;
+    addHistogram(&total->wait, &copy.wait);
+    addHistogram(&total->hold, &copy.hold);
+  }
+}
+
+uint64_t
+LockProfiler::percentile(const LockHistogram* histogram, double fraction)
+{
+  if (!histogram->count)
+    return 0;
+
+  uint64_t wanted = (uint64_t)(fraction * histogram->count);
+  uint64_t seen   = 0;
+  for (int i = 0; i < LockHistogram::BUCKET_NUMBER; ++i)
+  {
+    seen += histogram->bucket[i];
+    if (seen > wanted || seen == histogram->count)
+    {
+      uint64_t bound = (uint64_t)1 << i;
+      return bound < histogram->maxNs ? bound : histogram->maxNs;
+    }
+  }
+  return histogram->maxNs;
+}
+
+const char*
+LockProfiler::getLockName(int lock)
+{
+  if (lock < 0 || lock >= LOCK_NUMBER)
+    return "unknown";
+  return lockName[lock];
+}
+
+void
+LockProfiler::getSiteName(const void* site, char* name, size_t size)
+{
+  Dl_info info;
+  if (!site)
+  {
+    snprintf(name, size, "(other sites)");
+  }
+  else if (dladdr(site, &info) && info.dli_sname)
+  {
+    int   status    = 0;
+    char* demangled = abi::__cxa_demangle(info.dli_sname, NULL, NULL, &status);
+    snprintf(name, size, "%s+0x%lx",
+             (status == 0 && demangled) ? demangled : info.dli_sname,
+             (unsigned long)((const char*)site - (const char*)info.dli_saddr));
+    free(demangled);
+  }
+  else if (dladdr(site, &info) && info.dli_fname)
+  {
+    const char* module = strrchr(info.dli_fname, '/');
+    snprintf(name, size, "%s+0x%lx", module ? module + 1 : info.dli_fname,
+             (unsigned long)((const char*)site - (const char*)info.dli_fbase));
+  }
+  else
+  {
+    snprintf(name, size, "%p", site);
+  }
+}
+
+static int
+compareWait(const void* a, const void* b)
+{
+  const LockSiteStats* x = (const LockSiteStats*)a;
+  const LockSiteStats* y = (const LockSiteStats*)b;
+  if (x->wait.sumNs != y->wait.sumNs)
+    return x->wait.sumNs > y->wait.sumNs ? -1 : 1;
+  if (x->contended != y->contended)
+    return x->contended > y->contended ? -1 : 1;
+  return 0;
+}
+
+static double
+us(uint64_t ns)
+{
+  return ns / 1000.0;
+}
+
+void
+LockProfiler::report(FILE* file, size_t worstNumber)
+{
+  fprintf(file, "%-9s %10s %10s %9s %9s %9s %9s %9s\n", "lock", "acquired",
+          "contended", "wait p50", "wait p99", "wait max", "hold p99",
+          "hold max");
+  for (int lock = 0; lock < LOCK_NUMBER; ++lock)
+  {
+    LockSiteStats total;
+    getLockStats(lock, &total);
+    if (!total.acquisitions)
+      continue;
+    fprintf(file, "%-9s %10llu %10llu %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+            lockName[lock], (unsigned long long)total.acquisitions,
+            (unsigned long long)total.contended,
+            us(percentile(&total.wait, 0.5)),
+            us(percentile(&total.wait, 0.99)), us(total.wait.maxNs),
+            us(percentile(&total.hold, 0.99)), us(total.hold.maxNs));
+  }
+  fprintf(file, "(times in us)\n");
+
+  LockSiteStats* all = (LockSiteStats*)malloc(
+    (MAX_SITE + LOCK_NUMBER) * sizeof(LockSiteStats));
+  if (!all)
+    return;
+
+  size_t number = snapshot(all, MAX_SITE + LOCK_NUMBER);
+  qsort(all, number, sizeof(LockSiteStats), compareWait);
+  if (number > worstNumber)
+    number = worstNumber;
+
+  fprintf(file, "\nWorst call sites by total wait:\n");
+  for (size_t i = 0; i < number; ++i)
+  {
+    char name[256];
+    getSiteName(all[i].site, name, sizeof(name));
+    fprintf(file,
+            "%-9s %s\n"
+            "          %llu acquired, %llu contended, wait total %.1f "
+            "p99 %.1f max %.1f, hold p99 %.1f max %.1f\n",
+            lockName[all[i].lock], name,
+            (unsigned long long)all[i].acquisitions,
+            (unsigned long long)all[i].contended, us(all[i].wait.sumNs),
+            us(percentile(&all[i].wait, 0.99)), us(all[i].wait.maxNs),
+            us(percentile(&all[i].hold, 0.99)), us(all[i].hold.maxNs));
+  }
+  free(all);
+}
+
+ProfiledThreadManager::ProfiledThreadManager(bool priorityInheritance)
+  : PosixThreadManager(priorityInheritance)
+{
+  memset(hold, 0, sizeof(hold));
+}
+
+void
+ProfiledThreadManager::acquire(int lock, pthread_mutex_t* mutex,
+                               const void* caller)
+{
+  LockSiteStats* stats = LockProfiler::site(lock, caller);
+
+  uint64_t start     = Trace::nowNs();
+  bool     contended = (pthread_mutex_trylock(mutex) != 0);
+  uint64_t now       = start;
+  if (contended)
+  {
+    pthread_mutex_lock(mutex);
+    now = Trace::nowNs();
+  }
+
+  LOCK_ADD(&stats->acquisitions, 1);
+  if (contended)
+    LOCK_ADD(&stats->contended, 1);
+  LockProfiler::record(&stats->wait, now - start);
+
+  hold[lock].site    = stats;
+  hold[lock].sinceNs = now;
+  hold[lock].heldNs  = 0;
+}
+
+void
+ProfiledThreadManager::release(int lock, pthread_mutex_t* mutex)
+{
+  LockSiteStats* stats = hold[lock].site;
+  uint64_t       held  = hold[lock].heldNs + Trace::nowNs() - hold[lock].sinceNs;
+  hold[lock].site      = NULL;
+  pthread_mutex_unlock(mutex);
+
+  //! NULL when freed without a matching lock call
+  if (stats)
+    LockProfiler::record(&stats->hold, held);
+}
+
+void
+ProfiledThreadManager::suspend(int lock)
+{
+  hold[lock].heldNs += Trace::nowNs() - hold[lock].sinceNs;
+}
+
+void
+ProfiledThreadManager::resume(int lock)
+{
+  hold[lock].sinceNs = Trace::nowNs();
+}
+
+void
+ProfiledThreadManager::lockMemory()
+{
+  acquire(LOCK_MEMORY, &m_memLock, __builtin_return_address(0));
+}
+
+void
+ProfiledThreadManager::freeMemory()
+{
+  release(LOCK_MEMORY, &m_memLock);
+}
+
+void
+ProfiledThreadManager::lockMSG()
+{
+  acquire(LOCK_MSG, &m_msgLock, __builtin_return_address(0));
+}
+
+void
+ProfiledThreadManager::freeMSG()
+{
+  release(LOCK_MSG, &m_msgLock);
+}
+
+void
+ProfiledThreadManager::lockACK()
+{
+  acquire(LOCK_ACK, &m_ackLock, __builtin_return_address(0));
+}
+
+void
+ProfiledThreadManager::freeACK()
+{
+  release(LOCK_ACK, &m_ackLock);
+}
+
+void
+ProfiledThreadManager::lockProtocolHeader()
+{
+  acquire(LOCK_PROTOCOL_HEADER, &m_headerLock, __builtin_return_address(0));
+}
+
+void
+ProfiledThreadManager::freeProtocolHeader()
+{
+  release(LOCK_PROTOCOL_HEADER, &m_headerLock);
+}
+
+void
+ProfiledThreadManager::lockNonBlockCBAck()
+{
+  acquire(LOCK_NON_BLOCK_CB_ACK, &m_nbAckLock, __builtin_return_address(0));
+}
+
+void
+ProfiledThreadManager::freeNonBlockCBAck()
+{
+  release(LOCK_NON_BLOCK_CB_ACK, &m_nbAckLock);
+}
+
+void
+ProfiledThreadManager::lockStopCond()
+{
+  acquire(LOCK_STOP_COND, &m_stopCondLock, __builtin_return_address(0));
+}
+
+void
+ProfiledThreadManager::freeStopCond()
+{
+  release(LOCK_STOP_COND, &m_stopCondLock);
+}
+
+void
+ProfiledThreadManager::lockFrame()
+{
+  acquire(LOCK_FRAME, &m_frameLock, __builtin_return_address(0));
+}
+
+void
+ProfiledThreadManager::freeFrame()
+{
+  release(LOCK_FRAME, &m_frameLock);
+}
+
+void
+ProfiledThreadManager::wait(int timeoutInSeconds)
+{
+  suspend(LOCK_ACK);
+  PosixThreadManager::wait(timeoutInSeconds);
+  resume(LOCK_ACK);
+}
+
+void
+ProfiledThreadManager::nonBlockWait()
+{
+  suspend(LOCK_NON_BLOCK_CB_ACK);
+  PosixThreadManager::nonBlockWait();
+  resume(LOCK_NON_BLOCK_CB_ACK);
+}
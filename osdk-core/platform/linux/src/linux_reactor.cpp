@@ -0,0 +1,337 @@
+/*! @file linux_reactor.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Shared event loop serving many Vehicle links from a small thread pool
+ *
+ *  @copyright
+ *  2016-17 DJI. All rights reserved.
+ * */
+
+#include "linux_reactor.hpp"
+#include "dji_vehicle.hpp"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace DJI::OSDK;
+
+static uint64_t
+timespecNs(const struct timespec& ts)
+{
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+LinuxReactor::LinuxReactor(int workerNumber)
+  : running(false)
+{
+  if (workerNumber < 1)
+    workerNumber = 1;
+  if (workerNumber > MAX_WORKER)
+    workerNumber = MAX_WORKER;
+  this->workerNumber = workerNumber;
+  memset(&schedule, 0, sizeof(schedule));
+
+  pthread_mutex_init(&lock, NULL);
+  for (int i = 0; i < MAX_LINK; ++i)
+  {
+    link[i].vehicle = NULL;
+    link[i].fd      = -1;
+    link[i].worker  = -1;
+  }
+
+  for (int i = 0; i < workerNumber; ++i)
+  {
+    Worker* w      = &worker[i];
+    w->reactor     = this;
+    w->index       = i;
+    w->started     = false;
+    w->linkNumber  = 0;
+    w->frames      = 0;
+    w->exitedCpuNs = 0;
+    w->tickNs      = 0;
+    w->epollFd     = epoll_create1(EPOLL_CLOEXEC);
+    w->wakeFd      = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    pthread_mutex_init(&w->lock, NULL);
+
+    if (w->epollFd < 0 || w->wakeFd < 0)
+    {
+      DERROR("Reactor worker %d setup failed: %s\n", i, strerror(errno));
+      continue;
+    }
+    struct epoll_event ev;
+    ev.events   = EPOLLIN;
+    ev.data.ptr = NULL; //! NULL marks the wake descriptor
+    epoll_ctl(w->epollFd, EPOLL_CTL_ADD, w->wakeFd, &ev);
+  }
+}
+
+LinuxReactor::~LinuxReactor()
+{
+  stop();
+  for (int i = 0; i < workerNumber; ++i)
+  {
+    if (worker[i].epollFd >= 0)
+      close(worker[i].epollFd);
+    if (worker[i].wakeFd >= 0)
+      close(worker[i].wakeFd);
+    pthread_mutex_destroy(&worker[i].lock);
+  }
+  pthread_mutex_destroy(&lock);
+}
+
+bool
+LinuxReactor::start()
+{
+  if (running)
+    return true;
+
+  running = true;
+  for (int i = 0; i < workerNumber; ++i)
+  {
+    Worker* w = &worker[i];
+    if (w->epollFd < 0 || w->wakeFd < 0)
+    {
+      stop();
+      return false;
+    }
+    if (pthread_create(&w->thread, NULL, workerCall, w) != 0)
+    {
+      DERROR("fail to create reactor worker %d\n", i);
+      stop();
+      return false;
+    }
+    w->started = true;
+
+    char name[16];
+    snprintf(name, sizeof(name), "osdk-reactor%d", i);
+    pthread_setname_np(w->thread, name);
+    PosixThread::setSchedule(w->thread, schedule, name);
+  }
+  return true;
+}
+
+void
+LinuxReactor::setSchedule(const ThreadSchedule& schedule)
+{
+  this->schedule = schedule;
+}
+
+void
+LinuxReactor::stop()
+{
+  running = false;
+  for (int i = 0; i < workerNumber; ++i)
+  {
+    Worker* w = &worker[i];
+    if (!w->started)
+      continue;
+
+    uint64_t one = 1;
+    if (write(w->wakeFd, &one, sizeof(one)) < 0)
+    {
+      DDEBUG("reactor wake failed\n");
+    }
+    pthread_join(w->thread, NULL);
+    w->started = false;
+  }
+}
+
+bool
+LinuxReactor::attach(Vehicle* vehicle, int fd)
+{
+  if (!vehicle || fd < 0)
+    return false;
+
+  pthread_mutex_lock(&lock);
+  int slot = -1;
+  for (int i = 0; i < MAX_LINK; ++i)
+  {
+    if (!link[i].vehicle)
+    {
+      slot = i;
+      break;
+    }
+  }
+  if (slot < 0)
+  {
+    pthread_mutex_unlock(&lock);
+    DERROR("Reactor is full, %d links\n", MAX_LINK);
+    return false;
+  }
+
+  //! Least loaded worker takes the link
+  int target = 0;
+  for (int i = 1; i < workerNumber; ++i)
+  {
+    if (worker[i].linkNumber < worker[target].linkNumber)
+      target = i;
+  }
+
+  //! The worker walks its links on each tick
+  Worker* w = &worker[target];
+  pthread_mutex_lock(&w->lock);
+  link[slot].vehicle = vehicle;
+  link[slot].fd      = fd;
+  link[slot].worker  = target;
+
+  struct epoll_event ev;
+  ev.events   = EPOLLIN;
+  ev.data.ptr = &link[slot];
+  if (epoll_ctl(w->epollFd, EPOLL_CTL_ADD, fd, &ev) != 0)
+  {
+    DERROR("Reactor cannot poll fd %d: %s\n", fd, strerror(errno));
+    link[slot].vehicle = NULL;
+    link[slot].fd      = -1;
+    link[slot].worker  = -1;
+    pthread_mutex_unlock(&w->lock);
+    pthread_mutex_unlock(&lock);
+    return false;
+  }
+  w->linkNumber++;
+  pthread_mutex_unlock(&w->lock);
+  pthread_mutex_unlock(&lock);
+  return true;
+}
+
+void
+LinuxReactor::detach(Vehicle* vehicle)
+{
+  pthread_mutex_lock(&lock);
+  for (int i = 0; i < MAX_LINK; ++i)
+  {
+    if (link[i].vehicle != vehicle)
+      continue;
+
+    Worker* w = &worker[link[i].worker];
+    pthread_mutex_lock(&w->lock);
+    epoll_ctl(w->epollFd, EPOLL_CTL_DEL, link[i].fd, NULL);
+    link[i].vehicle = NULL;
+    link[i].fd      = -1;
+    link[i].worker  = -1;
+    w->linkNumber--;
+    pthread_mutex_unlock(&w->lock);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+int
+LinuxReactor::getLinkNumber()
+{
+  int number = 0;
+  pthread_mutex_lock(&lock);
+  for (int i = 0; i < workerNumber; ++i)
+    number += worker[i].linkNumber;
+  pthread_mutex_unlock(&lock);
+  return number;
+}
+
+uint64_t
+LinuxReactor::getFrameCount()
+{
+  uint64_t frames = 0;
+  for (int i = 0; i < workerNumber; ++i)
+  {
+    pthread_mutex_lock(&worker[i].lock);
+    frames += worker[i].frames;
+    pthread_mutex_unlock(&worker[i].lock);
+  }
+  return frames;
+}
+
+uint64_t
+LinuxReactor::getCpuTimeNs()
+{
+  uint64_t total = 0;
+  for (int i = 0; i < workerNumber; ++i)
+  {
+    Worker* w = &worker[i];
+    total += w->exitedCpuNs;
+
+    clockid_t       clock;
+    struct timespec ts;
+    if (w->started && pthread_getcpuclockid(w->thread, &clock) == 0 &&
+        clock_gettime(clock, &ts) == 0)
+    {
+      total += timespecNs(ts);
+    }
+  }
+  return total;
+}
+
+void*
+LinuxReactor::workerCall(void* param)
+{
+  Worker* w = (Worker*)param;
+  w->reactor->run(w);
+  return NULL;
+}
+
+void
+LinuxReactor::run(Worker* w)
+{
+  const int          EVENT_NUMBER = 64;
+  struct epoll_event events[EVENT_NUMBER];
+
+  while (running)
+  {
+    int n = epoll_wait(w->epollFd, events, EVENT_NUMBER, TICK_MS);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      DERROR("Reactor worker %d: %s\n", w->index, strerror(errno));
+      break;
+    }
+
+    pthread_mutex_lock(&w->lock);
+    for (int i = 0; i < n; ++i)
+    {
+      Link* l = (Link*)events[i].data.ptr;
+      if (!l)
+      {
+        uint64_t count;
+        if (read(w->wakeFd, &count, sizeof(count)) < 0)
+        {
+          DDEBUG("reactor wake drain failed\n");
+        }
+        continue;
+      }
+      //! Detached after epoll_wait returned
+      if (!l->vehicle)
+        continue;
+
+      w->frames += l->vehicle->pollReceive();
+      while (l->vehicle->callbackPoll())
+        ;
+    }
+
+    //! Without it, a lost ACK on a quiet link would never time out
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now = timespecNs(ts);
+    if (now >= w->tickNs + TICK_MS * 1000000ULL)
+    {
+      w->tickNs = now;
+      for (int i = 0; i < MAX_LINK; ++i)
+      {
+        if (link[i].vehicle && link[i].worker == w->index)
+        {
+          while (link[i].vehicle->callbackPoll())
+            ;
+        }
+      }
+    }
+    pthread_mutex_unlock(&w->lock);
+  }
+
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  pthread_mutex_lock(&w->lock);
+  w->exitedCpuNs += timespecNs(ts);
+  pthread_mutex_unlock(&w->lock);
+}
@@ -14,6 +14,9 @@
 
 #include "linux_serial_device.hpp"
 #include <algorithm>
+#include <linux/serial.h>
+#include <sys/ioctl.h>
+#include <time.h>
 using namespace DJI::OSDK;
 
 /*! Implementing inherited functions from abstract class DJI_HardDriver */
@@ -53,10 +56,38 @@ LinuxSerialDevice::getDeviceStatus()
   return deviceStatus;
 }
 
+int
+LinuxSerialDevice::getFd() const
+{
+  return m_serial_fd;
+}
+
+bool
+LinuxSerialDevice::getLineCounters(LineCounters* counters)
+{
+  //! Only real UARTs keep these; USB adapters and ptys fail the ioctl
+  struct serial_icounter_struct icount;
+  if (m_serial_fd < 0 || ioctl(m_serial_fd, TIOCGICOUNT, &icount) != 0)
+    return false;
+
+  counters->rx         = icount.rx;
+  counters->tx         = icount.tx;
+  counters->frame      = icount.frame;
+  counters->overrun    = icount.overrun;
+  counters->parity     = icount.parity;
+  counters->brk        = icount.brk;
+  counters->bufOverrun = icount.buf_overrun;
+  return true;
+}
+
 DJI::OSDK::time_ms
 LinuxSerialDevice::getTimeStamp()
 {
-  return (uint32_t)time(NULL);
+  //! Milliseconds, as HardDriver promises; session timeouts and the poll
+  //! tick are counted in them. Monotonic, so clock steps stall no timer
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (time_ms)(ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000);
 }
 
 size_t
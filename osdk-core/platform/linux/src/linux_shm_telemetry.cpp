@@ -0,0 +1,461 @@
+/*! @file linux_shm_telemetry.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  POSIX shared-memory mirror of subscription and broadcast telemetry
+ *  for multi-process consumers on Linux
+ *
+ *  @copyright
+ *  2016-17 DJI. All rights reserved.
+ * */
+
+#include "linux_shm_telemetry.hpp"
+#include "dji_vehicle.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace DJI::OSDK;
+using namespace DJI::OSDK::ShmTelemetry;
+
+static_assert(sizeof(ShmBroadcastState) <= SLOT_DATA_SIZE,
+              "broadcast state does not fit in a shared-memory slot");
+
+static uint64_t
+monotonicNs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//! Segments are shared between processes, so the non-private futex ops are
+//! required here.
+static void
+futexWake(volatile uint32_t* addr)
+{
+  syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+//! @return false on timeout
+static bool
+futexWait(volatile uint32_t* addr, uint32_t expected, int64_t timeoutNs)
+{
+  struct timespec  ts;
+  struct timespec* pts = NULL;
+  if (timeoutNs >= 0)
+  {
+    ts.tv_sec  = timeoutNs / 1000000000LL;
+    ts.tv_nsec = timeoutNs % 1000000000LL;
+    pts        = &ts;
+  }
+  if (syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAIT, expected, pts, NULL,
+              0) == -1 &&
+      errno == ETIMEDOUT)
+  {
+    return false;
+  }
+  return true;
+}
+
+//! Sleep until *seq differs from lastSeq and is even (no write in progress).
+static bool
+waitForChange(volatile uint32_t* seq, volatile uint32_t* waiters,
+              uint32_t lastSeq, int timeoutMs)
+{
+  uint64_t deadline =
+    (timeoutMs < 0) ? 0 : monotonicNs() + (uint64_t)timeoutMs * 1000000ULL;
+  bool updated = false;
+
+  __atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+  while (true)
+  {
+    uint32_t cur = __atomic_load_n(seq, __ATOMIC_SEQ_CST);
+    if (cur != lastSeq && !(cur & 1))
+    {
+      updated = true;
+      break;
+    }
+
+    int64_t remaining = -1;
+    if (timeoutMs >= 0)
+    {
+      uint64_t now = monotonicNs();
+      if (now >= deadline)
+        break;
+      remaining = deadline - now;
+    }
+    if (!futexWait(seq, cur, remaining))
+      break;
+  }
+  __atomic_sub_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+
+  return updated;
+}
+
+ShmTelemetryPublisher::ShmTelemetryPublisher(Vehicle* vehicle)
+  : vehicle(vehicle)
+  , segment(NULL)
+{
+  name[0] = 0;
+}
+
+ShmTelemetryPublisher::~ShmTelemetryPublisher()
+{
+  stop();
+}
+
+bool
+ShmTelemetryPublisher::start(const char* segmentName, mode_t mode)
+{
+  if (segment)
+  {
+    DERROR("Shared-memory telemetry already started on %s\n", name);
+    return false;
+  }
+
+  strncpy(name, segmentName, sizeof(name) - 1);
+  name[sizeof(name) - 1] = 0;
+
+  int fd = shm_open(name, O_CREAT | O_RDWR, mode);
+  if (fd < 0)
+  {
+    DERROR("shm_open %s failed: %s\n", name, strerror(errno));
+    return false;
+  }
+  //! Only ever grow it: readers of a live segment would fault on a shrink
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      ((size_t)st.st_size < sizeof(Segment) &&
+       ftruncate(fd, sizeof(Segment)) != 0))
+  {
+    DERROR("ftruncate %s failed: %s\n", name, strerror(errno));
+    ::close(fd);
+    return false;
+  }
+
+  void* p =
+    mmap(NULL, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED)
+  {
+    DERROR("mmap %s failed: %s\n", name, strerror(errno));
+    return false;
+  }
+
+  //! Readers trust the live publisher's data; never wipe it from under them
+  Segment* s   = (Segment*)p;
+  pid_t    pid = s->publisherPid;
+  if (s->magic == MAGIC && pid != 0 && (kill(pid, 0) == 0 || errno == EPERM))
+  {
+    DERROR("Shared-memory telemetry %s is published by process %d\n", name,
+           (int)pid);
+    munmap(p, sizeof(Segment));
+    return false;
+  }
+
+  segment = s;
+  memset(segment, 0, sizeof(Segment));
+  segment->version      = LAYOUT_VERSION;
+  segment->slotNumber   = SLOT_NUMBER;
+  segment->slotSize     = sizeof(Slot);
+  segment->publisherPid = getpid();
+  //! Readers validate the magic last, so publish it after the layout
+  __atomic_store_n(&segment->magic, MAGIC, __ATOMIC_RELEASE);
+
+  if (vehicle && vehicle->subscribe)
+  {
+    vehicle->subscribe->addDecodeListener(subscriptionListener, this);
+  }
+  if (vehicle && vehicle->broadcast)
+  {
+    vehicle->broadcast->addDecodeListener(broadcastListener, this);
+  }
+
+  DSTATUS("Mirroring telemetry to shared memory %s\n", name);
+  return true;
+}
+
+void
+ShmTelemetryPublisher::stop()
+{
+  if (!segment)
+    return;
+
+  if (vehicle && vehicle->subscribe)
+  {
+    vehicle->subscribe->removeDecodeListener(subscriptionListener, this);
+  }
+  if (vehicle && vehicle->broadcast)
+  {
+    vehicle->broadcast->removeDecodeListener(broadcastListener, this);
+  }
+
+  segment->publisherPid = 0;
+  munmap(segment, sizeof(Segment));
+  segment = NULL;
+  shm_unlink(name);
+}
+
+void
+ShmTelemetryPublisher::publish(int slot, const void* data, size_t size,
+                               uint32_t fcTimeMs)
+{
+  if (!segment || slot < 0 || slot >= SLOT_NUMBER || size > SLOT_DATA_SIZE)
+    return;
+
+  Slot*    s   = &segment->slot[slot];
+  uint32_t seq = s->seq;
+
+  __atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  memcpy(s->data, data, size);
+  if (slot < Telemetry::TOTAL_TOPIC_NUMBER && vehicle && vehicle->subscribe)
+  {
+    const Telemetry::TopicInfo& topic =
+      vehicle->subscribe->getTopicInfo((Telemetry::TopicName)slot);
+    s->uid  = topic.uid;
+    s->freq = topic.freq;
+  }
+  s->size       = size;
+  s->fcTimeMs   = fcTimeMs;
+  s->hostTimeNs = monotonicNs();
+  s->updateCount++;
+
+  __atomic_store_n(&s->seq, seq + 2, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&s->waiters, __ATOMIC_SEQ_CST))
+  {
+    futexWake(&s->seq);
+  }
+}
+
+void
+ShmTelemetryPublisher::commit()
+{
+  if (!segment)
+    return;
+
+  __atomic_add_fetch(&segment->globalSeq, 2, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&segment->globalWaiters, __ATOMIC_SEQ_CST))
+  {
+    futexWake(&segment->globalSeq);
+  }
+}
+
+void
+ShmTelemetryPublisher::subscriptionListener(Vehicle*      vehicle,
+                                            RecvContainer recvFrame,
+                                            UserData      userData)
+{
+  ShmTelemetryPublisher* pub = (ShmTelemetryPublisher*)userData;
+  SubscriptionPackage*   pkg =
+    vehicle->subscribe->getPackage(recvFrame.recvData.subscribeACK);
+
+  if (!pkg || !pkg->getDataBuffer())
+    return;
+
+  SubscriptionPackage::PackageInfo info   = pkg->getInfo();
+  uint8_t*                         buffer = pkg->getDataBuffer();
+  uint32_t                         fcTime = 0;
+
+  //! config 1 prepends the FC timestamp to the package
+  if (info.config == 1)
+  {
+    memcpy(&fcTime, buffer, sizeof(fcTime));
+  }
+
+  for (int i = 0; i < info.numberOfTopics; ++i)
+  {
+    Telemetry::TopicName topic = pkg->getTopicList()[i];
+    pub->publish(topic, buffer + pkg->getOffsetList()[i],
+                 Telemetry::TopicDataBase[topic].size, fcTime);
+  }
+  pub->commit();
+}
+
+void
+ShmTelemetryPublisher::broadcastListener(Vehicle*      vehicle,
+                                         RecvContainer recvFrame,
+                                         UserData      userData)
+{
+  ShmTelemetryPublisher* pub = (ShmTelemetryPublisher*)userData;
+  DataBroadcast*         b   = vehicle->broadcast;
+  ShmBroadcastState      state;
+
+  state.passFlag  = b->getPassFlag();
+  state.timeStamp = b->getTimeStamp();
+  state.syncStamp = b->getSyncStamp();
+  state.q         = b->getQuaternion();
+  state.a         = b->getAcceleration();
+  state.v         = b->getVelocity();
+  state.w         = b->getAngularRate();
+  state.vi        = b->getVelocityInfo();
+  state.gp        = b->getGlobalPosition();
+  state.rp        = b->getRelativePosition();
+  state.gps       = b->getGPSInfo();
+  state.rtk       = b->getRTKInfo();
+  state.mag       = b->getMag();
+  state.rc        = b->getRC();
+  state.gimbal    = b->getGimbal();
+  state.status    = b->getStatus();
+  state.battery   = b->getBatteryInfo();
+  state.info      = b->getSDKInfo();
+
+  pub->publish(BROADCAST_SLOT, &state, sizeof(state), state.timeStamp.time_ms);
+  pub->commit();
+}
+
+ShmTelemetryReader::ShmTelemetryReader()
+  : segment(NULL)
+{
+}
+
+ShmTelemetryReader::~ShmTelemetryReader()
+{
+  close();
+}
+
+bool
+ShmTelemetryReader::open(const char* name)
+{
+  close();
+
+  //! Read-write so that waiters counters can be maintained
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0)
+  {
+    DERROR("shm_open %s failed: %s\n", name, strerror(errno));
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Segment))
+  {
+    DERROR("Segment %s is too small\n", name);
+    ::close(fd);
+    return false;
+  }
+
+  void* p =
+    mmap(NULL, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED)
+  {
+    DERROR("mmap %s failed: %s\n", name, strerror(errno));
+    return false;
+  }
+
+  Segment* seg = (Segment*)p;
+  if (__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != MAGIC ||
+      seg->version != LAYOUT_VERSION || seg->slotNumber != SLOT_NUMBER ||
+      seg->slotSize != sizeof(Slot))
+  {
+    DERROR("Segment %s has an incompatible layout\n", name);
+    munmap(p, sizeof(Segment));
+    return false;
+  }
+
+  segment = seg;
+  return true;
+}
+
+void
+ShmTelemetryReader::close()
+{
+  if (segment)
+  {
+    munmap(segment, sizeof(Segment));
+    segment = NULL;
+  }
+}
+
+bool
+ShmTelemetryReader::isOpen() const
+{
+  return segment != NULL;
+}
+
+bool
+ShmTelemetryReader::getBroadcast(ShmBroadcastState& state, ShmSampleInfo* info)
+{
+  return readSlot(BROADCAST_SLOT, &state, sizeof(state), info);
+}
+
+bool
+ShmTelemetryReader::readSlot(int slot, void* data, size_t size,
+                             ShmSampleInfo* info)
+{
+  if (!segment || slot < 0 || slot >= SLOT_NUMBER || size > SLOT_DATA_SIZE)
+    return false;
+
+  Slot* s = &segment->slot[slot];
+  for (int i = 0; i < READ_RETRY; ++i)
+  {
+    uint32_t seq0 = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+    if (seq0 == 0)
+      return false; // never written
+    if (seq0 & 1)
+      continue;
+
+    memcpy(data, s->data, size);
+    ShmSampleInfo meta;
+    meta.sequence    = seq0;
+    meta.fcTimeMs    = s->fcTimeMs;
+    meta.updateCount = s->updateCount;
+    meta.hostTimeNs  = s->hostTimeNs;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq0)
+    {
+      if (info)
+        *info = meta;
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t
+ShmTelemetryReader::getSequence(int slot) const
+{
+  if (!segment || slot < 0 || slot >= SLOT_NUMBER)
+    return 0;
+  return __atomic_load_n(&segment->slot[slot].seq, __ATOMIC_ACQUIRE);
+}
+
+uint32_t
+ShmTelemetryReader::getGlobalSequence() const
+{
+  if (!segment)
+    return 0;
+  return __atomic_load_n(&segment->globalSeq, __ATOMIC_ACQUIRE);
+}
+
+bool
+ShmTelemetryReader::waitForUpdate(int slot, uint32_t lastSeq, int timeoutMs)
+{
+  if (!segment || slot < 0 || slot >= SLOT_NUMBER)
+    return false;
+  return waitForChange(&segment->slot[slot].seq,
+                       &segment->slot[slot].waiters, lastSeq, timeoutMs);
+}
+
+bool
+ShmTelemetryReader::waitForAnyUpdate(uint32_t lastGlobalSeq, int timeoutMs)
+{
+  if (!segment)
+    return false;
+  return waitForChange(&segment->globalSeq, &segment->globalWaiters,
+                       lastGlobalSeq, timeoutMs);
+}
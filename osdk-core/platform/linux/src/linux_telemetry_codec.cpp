@@ -0,0 +1,575 @@
+/*! @file linux_telemetry_codec.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Streaming compression for recorded telemetry columns
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#include "linux_telemetry_codec.hpp"
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace DJI::OSDK;
+using namespace DJI::OSDK::Telemetry;
+using namespace DJI::OSDK::TelemetryCodec;
+
+//! Field types in struct order; pack(1), so offsets are the running sum
+// clang-format off
+static const char* const SCHEMA[TelemetryStore::COLUMN_NUMBER] = {
+  "ffff",         // TOPIC_QUATERNION
+  "fff",          // TOPIC_ACCELERATION_GROUND
+  "fff",          // TOPIC_ACCELERATION_BODY
+  "fff",          // TOPIC_ACCELERATION_RAW
+  "fff1",         // TOPIC_VELOCITY
+  "fff",          // TOPIC_ANGULAR_RATE_FUSIONED
+  "fff",          // TOPIC_ANGULAR_RATE_RAW
+  "f",            // TOPIC_ALTITUDE_FUSIONED
+  "f",            // TOPIC_ALTITUDE_BAROMETER
+  "f",            // TOPIC_HEIGHT_HOMEPOOINT
+  "f",            // TOPIC_HEIGHT_FUSION
+  "ddf2",         // TOPIC_GPS_FUSED
+  "4",            // TOPIC_GPS_DATE
+  "4",            // TOPIC_GPS_TIME
+  "444",          // TOPIC_GPS_POSITION
+  "fff",          // TOPIC_GPS_VELOCITY
+  "ffffff4422",   // TOPIC_GPS_DETAILS
+  "ddf",          // TOPIC_RTK_POSITION
+  "fff",          // TOPIC_RTK_VELOCITY
+  "2",            // TOPIC_RTK_YAW
+  "1",            // TOPIC_RTK_POSITION_INFO
+  "1",            // TOPIC_RTK_YAW_INFO
+  "222",          // TOPIC_COMPASS
+  "222222",       // TOPIC_RC
+  "fff",          // TOPIC_GIMBAL_ANGLES
+  "4",            // TOPIC_GIMBAL_STATUS
+  "1",            // TOPIC_STATUS_FLIGHT
+  "1",            // TOPIC_STATUS_DISPLAYMODE
+  "1",            // TOPIC_STATUS_LANDINGGEAR
+  "2",            // TOPIC_STATUS_MOTOR_START_ERROR
+  "4441",         // TOPIC_BATTERY_INFO
+  "11",           // TOPIC_CONTROL_DEVICE
+  "44421" "ffff" "fff" "fff", // TOPIC_HARD_SYNC
+  "1",            // TOPIC_GPS_SIGNAL_LEVEL
+  "1",            // TOPIC_GPS_CONTROL_LEVEL
+  // ShmBroadcastState
+  "2" "44" "421" "ffff" "fff" "fff" "fff" "1"   // flag, time, sync, q, a, v, w, vi
+  "ddff1" "ffffff1"                             // gp, rp
+  "44" "444" "fff" "ffffff4422"                 // gps
+  "44" "ddf" "fff" "211"                        // rtk
+  "222" "222222" "fff1" "1111" "4441" "11"      // mag, rc, gimbal, status, battery, info
+};
+// clang-format on
+
+static int
+fieldSize(char type)
+{
+  switch (type)
+  {
+    case 'f':
+      return 4;
+    case 'd':
+      return 8;
+    default:
+      return type - '0';
+  }
+}
+
+int
+TelemetryCodec::getSchema(int column, Field* fields)
+{
+  if (column < 0 || column >= TelemetryStore::COLUMN_NUMBER)
+    return 0;
+
+  int    number = 0;
+  size_t offset = 0;
+  for (const char* p = SCHEMA[column]; *p && number < MAX_FIELDS; ++p)
+  {
+    fields[number].type   = *p;
+    fields[number].offset = offset;
+    offset += fieldSize(*p);
+    number++;
+  }
+  if (offset != TelemetryStore::getValueSize(column))
+  {
+    DERROR("Codec schema of column %d is %u bytes, the value %u\n", column,
+           (unsigned)offset, (unsigned)TelemetryStore::getValueSize(column));
+    return 0;
+  }
+  return number;
+}
+
+static inline uint64_t
+zigzag(int64_t value)
+{
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t
+unzigzag(uint64_t value)
+{
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static inline uint64_t
+loadField(const uint8_t* value, const Field* field)
+{
+  uint64_t v = 0;
+  memcpy(&v, value + field->offset, fieldSize(field->type));
+  return v;
+}
+
+//! Integer delta in the field's own width, as a signed number
+static inline int64_t
+fieldDelta(uint64_t value, uint64_t last, int size)
+{
+  int shift = 64 - 8 * size;
+  return (int64_t)((value - last) << shift) >> shift;
+}
+
+static inline void
+resetState(FieldState* state, int number)
+{
+  for (int i = 0; i < number; ++i)
+  {
+    state[i].last     = 0;
+    state[i].leading  = 0xFF; //! no window yet
+    state[i].trailing = 0;
+  }
+}
+
+TelemetryEncoder::TelemetryEncoder()
+  : column(-1)
+  , fieldNumber(0)
+  , number(0)
+  , buffer(NULL)
+  , capacity(0)
+  , used(0)
+  , bitBuffer(0)
+  , bitNumber(0)
+{
+}
+
+TelemetryEncoder::~TelemetryEncoder()
+{
+  free(buffer);
+}
+
+bool
+TelemetryEncoder::begin(int column)
+{
+  fieldNumber = getSchema(column, fields);
+  if (!fieldNumber)
+    return false;
+
+  this->column  = column;
+  number        = 0;
+  lastHostNs    = 0;
+  lastHostDelta = 0;
+  lastFcMs      = 0;
+  lastFcDelta   = 0;
+  resetState(state, fieldNumber);
+
+  used      = sizeof(CodecBlock);
+  bitBuffer = 0;
+  bitNumber = 0;
+  return reserve(0);
+}
+
+bool
+TelemetryEncoder::reserve(size_t more)
+{
+  if (used + more <= capacity && buffer)
+    return true;
+
+  size_t size = capacity ? capacity : 4096;
+  while (size < used + more)
+    size *= 2;
+  uint8_t* grown = (uint8_t*)realloc(buffer, size);
+  if (!grown)
+    return false;
+  buffer   = grown;
+  capacity = size;
+  return true;
+}
+
+//! Append the low bits of value, most significant first; bits <= 56
+inline void
+TelemetryEncoder::put(uint64_t value, int bits)
+{
+  bitBuffer = (bitBuffer << bits) | (value & ((1ULL << bits) - 1));
+  bitNumber += bits;
+  while (bitNumber >= 8)
+  {
+    bitNumber -= 8;
+    buffer[used++] = (uint8_t)(bitBuffer >> bitNumber);
+  }
+}
+
+//! '0' for no change, then 14, 24, 32 or 64 bits of zigzag
+void
+TelemetryEncoder::putTime(int64_t dod)
+{
+  uint64_t z = zigzag(dod);
+  if (z == 0)
+    put(0, 1);
+  else if (z < (1ULL << 14))
+  {
+    put(2, 2);
+    put(z, 14);
+  }
+  else if (z < (1ULL << 24))
+  {
+    put(6, 3);
+    put(z, 24);
+  }
+  else if (z < (1ULL << 32))
+  {
+    put(14, 4);
+    put(z, 32);
+  }
+  else
+  {
+    put(15, 4);
+    put(z >> 32, 32);
+    put(z, 32);
+  }
+}
+
+void
+TelemetryEncoder::putXor(FieldState* s, uint64_t value, int width)
+{
+  uint64_t x = value ^ s->last;
+  s->last    = value;
+  if (!x)
+  {
+    put(0, 1);
+    return;
+  }
+
+  int leading  = __builtin_clzll(x) - (64 - width);
+  int trailing = __builtin_ctzll(x);
+  //! The length field holds width - 1 at most
+  int lengthBits = (width == 32) ? 5 : 6;
+  if (leading > (1 << lengthBits) - 1)
+    leading = (1 << lengthBits) - 1;
+
+  if (s->leading != 0xFF && leading >= s->leading && trailing >= s->trailing)
+  {
+    int length = width - s->leading - s->trailing;
+    put(2, 2);
+    if (length > 32)
+    {
+      put(x >> (s->trailing + 32), length - 32);
+      put(x >> s->trailing, 32);
+    }
+    else
+      put(x >> s->trailing, length);
+    return;
+  }
+
+  int length = width - leading - trailing;
+  put(3, 2);
+  put(leading, lengthBits);
+  put(length - 1, lengthBits);
+  if (length > 32)
+  {
+    put(x >> (trailing + 32), length - 32);
+    put(x >> trailing, 32);
+  }
+  else
+    put(x >> trailing, length);
+  s->leading  = leading;
+  s->trailing = trailing;
+}
+
+void
+TelemetryEncoder::putVarint(uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    put(0x80 | (value & 0x7F), 8);
+    value >>= 7;
+  }
+  put(value, 8);
+}
+
+bool
+TelemetryEncoder::encode(const TelemetryStore::RecordHeader* header,
+                         const void* value)
+{
+  if (column < 0)
+    return false;
+  //! Worst case: 68 + 36 time bits, 2 + 12 + width per float, 10 varint
+  //! bytes per integer
+  if (!reserve(16 + fieldNumber * 10))
+    return false;
+
+  //! Unsigned, so the first record's full-width delta wraps instead of
+  //! overflowing
+  int64_t hostDelta = header->hostTimeNs - lastHostNs;
+  putTime((int64_t)((uint64_t)hostDelta - (uint64_t)lastHostDelta));
+  lastHostNs    = header->hostTimeNs;
+  lastHostDelta = hostDelta;
+
+  int32_t fcDelta = header->fcTimeMs - lastFcMs;
+  putTime((int64_t)fcDelta - lastFcDelta);
+  lastFcMs    = header->fcTimeMs;
+  lastFcDelta = fcDelta;
+
+  const uint8_t* p = (const uint8_t*)value;
+  for (int i = 0; i < fieldNumber; ++i)
+  {
+    const Field* f = &fields[i];
+    uint64_t     v = loadField(p, f);
+    switch (f->type)
+    {
+      case 'f':
+        putXor(&state[i], v, 32);
+        break;
+      case 'd':
+        putXor(&state[i], v, 64);
+        break;
+      default:
+        putVarint(zigzag(fieldDelta(v, state[i].last, f->type - '0')));
+        state[i].last = v;
+        break;
+    }
+  }
+  number++;
+  return true;
+}
+
+const uint8_t*
+TelemetryEncoder::finish(size_t* size)
+{
+  if (column < 0)
+    return NULL;
+
+  if (bitNumber)
+  {
+    buffer[used++] = (uint8_t)(bitBuffer << (8 - bitNumber));
+    bitNumber      = 0;
+  }
+
+  CodecBlock* block = (CodecBlock*)buffer;
+  block->magic      = MAGIC;
+  block->version    = VERSION;
+  block->column     = column;
+  block->number     = number;
+  block->size       = used;
+
+  column = -1;
+  *size  = used;
+  return buffer;
+}
+
+uint32_t
+TelemetryEncoder::getNumber() const
+{
+  return number;
+}
+
+size_t
+TelemetryEncoder::getSize() const
+{
+  return used + (bitNumber ? 1 : 0);
+}
+
+TelemetryDecoder::TelemetryDecoder()
+  : column(-1)
+  , fieldNumber(0)
+  , number(0)
+  , decoded(0)
+  , data(NULL)
+  , size(0)
+  , position(0)
+  , bitBuffer(0)
+  , bitNumber(0)
+  , overrun(false)
+{
+}
+
+bool
+TelemetryDecoder::begin(const uint8_t* data, size_t size)
+{
+  column = -1;
+  if (size < sizeof(CodecBlock))
+    return false;
+
+  CodecBlock block;
+  memcpy(&block, data, sizeof(block));
+  if (block.magic != MAGIC || block.version != VERSION ||
+      block.size < sizeof(CodecBlock) || block.size > size)
+    return false;
+
+  fieldNumber = getSchema(block.column, fields);
+  if (!fieldNumber)
+    return false;
+
+  column        = block.column;
+  number        = block.number;
+  decoded       = 0;
+  lastHostNs    = 0;
+  lastHostDelta = 0;
+  lastFcMs      = 0;
+  lastFcDelta   = 0;
+  resetState(state, fieldNumber);
+
+  this->data = data;
+  this->size = block.size;
+  position   = sizeof(CodecBlock);
+  bitBuffer  = 0;
+  bitNumber  = 0;
+  overrun    = false;
+  return true;
+}
+
+//! bits <= 56; reads past the block give zeros and flag the overrun
+inline uint64_t
+TelemetryDecoder::get(int bits)
+{
+  while (bitNumber < bits)
+  {
+    uint8_t byte = 0;
+    if (position < size)
+      byte = data[position];
+    else
+      overrun = true;
+    position++;
+    bitBuffer = (bitBuffer << 8) | byte;
+    bitNumber += 8;
+  }
+  bitNumber -= bits;
+  return (bitBuffer >> bitNumber) & ((1ULL << bits) - 1);
+}
+
+int64_t
+TelemetryDecoder::getTime()
+{
+  if (!get(1))
+    return 0;
+  if (!get(1))
+    return unzigzag(get(14));
+  if (!get(1))
+    return unzigzag(get(24));
+  if (!get(1))
+    return unzigzag(get(32));
+  uint64_t high = get(32);
+  return unzigzag((high << 32) | get(32));
+}
+
+uint64_t
+TelemetryDecoder::getXor(FieldState* s, int width)
+{
+  if (!get(1))
+    return s->last;
+
+  if (!get(1))
+  {
+    if (s->leading == 0xFF)
+    {
+      overrun = true; //! no window to reuse: not our stream
+      return s->last;
+    }
+  }
+  else
+  {
+    int lengthBits = (width == 32) ? 5 : 6;
+    int leading    = get(lengthBits);
+    int length     = get(lengthBits) + 1;
+    if (leading + length > width)
+    {
+      overrun = true;
+      return s->last;
+    }
+    s->leading  = leading;
+    s->trailing = width - leading - length;
+  }
+
+  int      length = width - s->leading - s->trailing;
+  uint64_t x;
+  if (length > 32)
+  {
+    uint64_t high = get(length - 32);
+    x             = (high << 32) | get(32);
+  }
+  else
+    x = get(length);
+  s->last ^= x << s->trailing;
+  return s->last;
+}
+
+uint64_t
+TelemetryDecoder::getVarint()
+{
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7)
+  {
+    uint64_t byte = get(8);
+    value |= (byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return value;
+  }
+  overrun = true;
+  return value;
+}
+
+bool
+TelemetryDecoder::decode(TelemetryStore::RecordHeader* header, void* value)
+{
+  if (column < 0 || decoded == number || overrun)
+    return false;
+
+  //! Wrapping sums, mirroring the encoder
+  lastHostDelta = (int64_t)((uint64_t)lastHostDelta + (uint64_t)getTime());
+  lastHostNs += lastHostDelta;
+  lastFcDelta = (int32_t)((uint32_t)lastFcDelta + (uint32_t)getTime());
+  lastFcMs += lastFcDelta;
+  header->hostTimeNs = lastHostNs;
+  header->fcTimeMs   = lastFcMs;
+  header->reserved   = 0;
+
+  uint8_t* p = (uint8_t*)value;
+  for (int i = 0; i < fieldNumber; ++i)
+  {
+    const Field* f = &fields[i];
+    uint64_t     v;
+    switch (f->type)
+    {
+      case 'f':
+        v = getXor(&state[i], 32);
+        break;
+      case 'd':
+        v = getXor(&state[i], 64);
+        break;
+      default:
+        v             = state[i].last + unzigzag(getVarint());
+        state[i].last = v;
+        break;
+    }
+    memcpy(p + f->offset, &v, fieldSize(f->type));
+  }
+
+  if (overrun)
+    return false;
+  decoded++;
+  return true;
+}
+
+int
+TelemetryDecoder::getColumn() const
+{
+  return column;
+}
+
+uint32_t
+TelemetryDecoder::getNumber() const
+{
+  return number;
+}
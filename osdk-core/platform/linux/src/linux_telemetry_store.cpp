@@ -0,0 +1,709 @@
+/*! @file linux_telemetry_store.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Column-per-topic telemetry recording to memory-mapped segment files,
+ *  with a sparse time index and zero-copy range reads
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#include "linux_telemetry_store.hpp"
+#include "dji_vehicle.hpp"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace DJI::OSDK;
+using namespace DJI::OSDK::TelemetryStore;
+
+//! Queue record; the value follows, padded to 8 bytes
+typedef struct QueueEntry
+{
+  uint16_t column;
+  uint16_t size;
+  uint32_t fcTimeMs;
+  uint64_t hostTimeNs;
+} QueueEntry;
+
+//! Rest of the queue is unused, go on at its start
+static const uint16_t QUEUE_PAD = 0xFFFF;
+
+static const size_t PAGE_SIZE = 4096;
+
+static size_t
+align8(size_t size)
+{
+  return (size + 7) & ~(size_t)7;
+}
+
+static uint64_t
+clockNs(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+segmentPath(char* path, size_t size, const char* directory, int column,
+            uint32_t sequence)
+{
+  snprintf(path, size, "%s/c%02d-%06u.seg", directory, column, sequence);
+}
+
+//! @return false if name is not a segment file
+static bool
+parseSegmentName(const char* name, int* column, uint32_t* sequence)
+{
+  unsigned c, s;
+  char     tail;
+  if (sscanf(name, "c%2u-%6u.se%c", &c, &s, &tail) != 3 || tail != 'g' ||
+      strlen(name) != 14 || c >= (unsigned)COLUMN_NUMBER)
+    return false;
+  *column   = c;
+  *sequence = s;
+  return true;
+}
+
+size_t
+TelemetryStore::getValueSize(int column)
+{
+  if (column == BROADCAST_COLUMN)
+    return sizeof(ShmBroadcastState);
+  return Telemetry::TopicDataBase[column].size;
+}
+
+TelemetryRecorder::TelemetryRecorder(Vehicle* vehicle)
+  : vehicle(vehicle)
+  , running(false)
+  , queue(NULL)
+  , head(0)
+  , tail(0)
+  , recorded(0)
+  , dropped(0)
+{
+  directory[0] = 0;
+  pthread_mutex_init(&producerLock, NULL);
+  for (int i = 0; i < COLUMN_NUMBER; ++i)
+  {
+    segment[i]      = NULL;
+    segmentSize[i]  = 0;
+    nextSequence[i] = 0;
+  }
+}
+
+TelemetryRecorder::~TelemetryRecorder()
+{
+  stop();
+  pthread_mutex_destroy(&producerLock);
+}
+
+bool
+TelemetryRecorder::start(const char* directory)
+{
+  if (running)
+    return true;
+
+  if (mkdir(directory, 0755) != 0 && errno != EEXIST)
+  {
+    DERROR("Cannot create %s: %s\n", directory, strerror(errno));
+    return false;
+  }
+  DIR* dir = opendir(directory);
+  if (!dir)
+  {
+    DERROR("Cannot open %s: %s\n", directory, strerror(errno));
+    return false;
+  }
+  for (struct dirent* e = readdir(dir); e; e = readdir(dir))
+  {
+    int      column;
+    uint32_t sequence;
+    if (parseSegmentName(e->d_name, &column, &sequence) &&
+        sequence >= nextSequence[column])
+      nextSequence[column] = sequence + 1;
+  }
+  closedir(dir);
+
+  queue = new (std::nothrow) uint8_t[QUEUE_SIZE];
+  if (!queue)
+    return false;
+  strncpy(this->directory, directory, sizeof(this->directory) - 1);
+  this->directory[sizeof(this->directory) - 1] = 0;
+  head                                         = 0;
+  tail                                         = 0;
+
+  running = true;
+  if (pthread_create(&thread, NULL, writeCall, this) != 0)
+  {
+    DERROR("Cannot start the telemetry writer\n");
+    running = false;
+    delete[] queue;
+    queue = NULL;
+    return false;
+  }
+
+  if (vehicle && vehicle->subscribe)
+  {
+    vehicle->subscribe->addDecodeListener(subscriptionListener, this);
+  }
+  if (vehicle && vehicle->broadcast)
+  {
+    vehicle->broadcast->addDecodeListener(broadcastListener, this);
+  }
+
+  DSTATUS("Recording telemetry to %s\n", directory);
+  return true;
+}
+
+void
+TelemetryRecorder::stop()
+{
+  if (!running)
+    return;
+
+  if (vehicle && vehicle->subscribe)
+  {
+    vehicle->subscribe->removeDecodeListener(subscriptionListener, this);
+  }
+  if (vehicle && vehicle->broadcast)
+  {
+    vehicle->broadcast->removeDecodeListener(broadcastListener, this);
+  }
+
+  running = false;
+  pthread_join(thread, NULL);
+  for (int i = 0; i < COLUMN_NUMBER; ++i)
+    closeSegment(i);
+
+  pthread_mutex_lock(&producerLock);
+  delete[] queue;
+  queue = NULL;
+  pthread_mutex_unlock(&producerLock);
+}
+
+bool
+TelemetryRecorder::record(int column, const void* data, size_t size,
+                          uint32_t fcTimeMs)
+{
+  if (column < 0 || column >= COLUMN_NUMBER || size > getValueSize(column))
+    return false;
+
+  size_t total = align8(sizeof(QueueEntry) + size);
+
+  pthread_mutex_lock(&producerLock);
+  if (!queue)
+  {
+    pthread_mutex_unlock(&producerLock);
+    return false;
+  }
+
+  uint64_t h      = head;
+  uint64_t t      = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+  size_t   offset = h & (QUEUE_SIZE - 1);
+  size_t   room   = QUEUE_SIZE - offset;
+  size_t   need   = total + (room < total ? room : 0);
+  if (h + need - t > QUEUE_SIZE)
+  {
+    dropped++;
+    pthread_mutex_unlock(&producerLock);
+    return false;
+  }
+  if (room < total)
+  {
+    ((QueueEntry*)(queue + offset))->column = QUEUE_PAD;
+    h += room;
+    offset = 0;
+  }
+
+  QueueEntry* entry = (QueueEntry*)(queue + offset);
+  entry->column     = column;
+  entry->size       = size;
+  entry->fcTimeMs   = fcTimeMs;
+  entry->hostTimeNs = clockNs(CLOCK_MONOTONIC);
+  memcpy(entry + 1, data, size);
+
+  __atomic_store_n(&head, h + total, __ATOMIC_RELEASE);
+  recorded++;
+  pthread_mutex_unlock(&producerLock);
+  return true;
+}
+
+void
+TelemetryRecorder::flush()
+{
+  uint64_t target = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+  while (running && __atomic_load_n(&tail, __ATOMIC_ACQUIRE) < target)
+    usleep(100);
+}
+
+uint64_t
+TelemetryRecorder::getRecorded() const
+{
+  return recorded;
+}
+
+uint64_t
+TelemetryRecorder::getDropped() const
+{
+  return dropped;
+}
+
+void*
+TelemetryRecorder::writeCall(void* param)
+{
+  ((TelemetryRecorder*)param)->writeLoop();
+  return NULL;
+}
+
+void
+TelemetryRecorder::writeLoop()
+{
+  while (running)
+  {
+    if (!drainOnce())
+      usleep(IDLE_WAITUS);
+  }
+  //! Whatever was queued before stop()
+  while (drainOnce())
+    ;
+}
+
+bool
+TelemetryRecorder::drainOnce()
+{
+  uint64_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+  uint64_t t = tail;
+  if (t == h)
+    return false;
+
+  while (t < h)
+  {
+    size_t      offset = t & (QUEUE_SIZE - 1);
+    QueueEntry* entry  = (QueueEntry*)(queue + offset);
+    if (entry->column == QUEUE_PAD)
+    {
+      t += QUEUE_SIZE - offset;
+      continue;
+    }
+
+    RecordHeader header;
+    header.hostTimeNs = entry->hostTimeNs;
+    header.fcTimeMs   = entry->fcTimeMs;
+    header.reserved   = 0;
+    append(entry->column, &header, (const uint8_t*)(entry + 1), entry->size);
+
+    t += align8(sizeof(QueueEntry) + entry->size);
+    __atomic_store_n(&tail, t, __ATOMIC_RELEASE);
+  }
+  __atomic_store_n(&tail, t, __ATOMIC_RELEASE);
+  return true;
+}
+
+bool
+TelemetryRecorder::append(int column, const RecordHeader* header,
+                          const uint8_t* value, size_t size)
+{
+  SegmentHeader* s = segment[column];
+  if (!s || s->recordNumber == s->capacity)
+  {
+    closeSegment(column);
+    if (!openSegment(column))
+      return false;
+    s = segment[column];
+  }
+
+  uint64_t n      = s->recordNumber;
+  uint8_t* record = (uint8_t*)s + s->dataOffset + n * s->recordSize;
+  memcpy(record, header, sizeof(RecordHeader));
+  memcpy(record + sizeof(RecordHeader), value, size);
+  if (n % s->indexStride == 0)
+    s->index[n / s->indexStride] = header->hostTimeNs;
+
+  __atomic_store_n(&s->recordNumber, n + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+bool
+TelemetryRecorder::openSegment(int column)
+{
+  char path[300];
+  segmentPath(path, sizeof(path), directory, column, nextSequence[column]);
+
+  size_t valueSize  = getValueSize(column);
+  size_t recordSize = align8(sizeof(RecordHeader) + valueSize);
+  size_t dataOffset = (sizeof(SegmentHeader) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+  size_t size       = dataOffset + (size_t)SEGMENT_RECORDS * recordSize;
+
+  int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    DERROR("Cannot create %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  void* p = MAP_FAILED;
+  if (ftruncate(fd, size) == 0)
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED)
+  {
+    DERROR("Cannot map %s: %s\n", path, strerror(errno));
+    unlink(path);
+    return false;
+  }
+
+  SegmentHeader* s    = (SegmentHeader*)p;
+  s->magic            = MAGIC;
+  s->version          = VERSION;
+  s->column           = column;
+  s->valueSize        = valueSize;
+  s->recordSize       = recordSize;
+  s->capacity         = SEGMENT_RECORDS;
+  s->indexStride      = INDEX_STRIDE;
+  s->sequence         = nextSequence[column]++;
+  s->dataOffset       = dataOffset;
+  s->startMonotonicNs = clockNs(CLOCK_MONOTONIC);
+  s->startRealtimeNs  = clockNs(CLOCK_REALTIME);
+  __atomic_store_n(&s->recordNumber, 0, __ATOMIC_RELEASE);
+
+  segment[column]     = s;
+  segmentSize[column] = size;
+  return true;
+}
+
+//! Cut the file down to the records it holds
+void
+TelemetryRecorder::closeSegment(int column)
+{
+  SegmentHeader* s = segment[column];
+  if (!s)
+    return;
+
+  char path[300];
+  segmentPath(path, sizeof(path), directory, column, s->sequence);
+  size_t used = s->dataOffset + s->recordNumber * s->recordSize;
+
+  munmap(s, segmentSize[column]);
+  segment[column]     = NULL;
+  segmentSize[column] = 0;
+  if (truncate(path, used) != 0)
+    DERROR("Cannot trim %s: %s\n", path, strerror(errno));
+}
+
+void
+TelemetryRecorder::subscriptionListener(Vehicle*      vehicle,
+                                        RecvContainer recvFrame,
+                                        UserData      userData)
+{
+  TelemetryRecorder*   recorder = (TelemetryRecorder*)userData;
+  SubscriptionPackage* pkg =
+    vehicle->subscribe->getPackage(recvFrame.recvData.subscribeACK);
+
+  if (!pkg || !pkg->getDataBuffer())
+    return;
+
+  SubscriptionPackage::PackageInfo info   = pkg->getInfo();
+  uint8_t*                         buffer = pkg->getDataBuffer();
+  uint32_t                         fcTime = 0;
+
+  //! config 1 prepends the FC timestamp to the package
+  if (info.config == 1)
+  {
+    memcpy(&fcTime, buffer, sizeof(fcTime));
+  }
+
+  for (int i = 0; i < info.numberOfTopics; ++i)
+  {
+    Telemetry::TopicName topic = pkg->getTopicList()[i];
+    recorder->record(topic, buffer + pkg->getOffsetList()[i],
+                     Telemetry::TopicDataBase[topic].size, fcTime);
+  }
+}
+
+void
+TelemetryRecorder::broadcastListener(Vehicle*      vehicle,
+                                     RecvContainer recvFrame,
+                                     UserData      userData)
+{
+  TelemetryRecorder* recorder = (TelemetryRecorder*)userData;
+  DataBroadcast*     b        = vehicle->broadcast;
+  ShmBroadcastState  state;
+
+  state.passFlag  = b->getPassFlag();
+  state.timeStamp = b->getTimeStamp();
+  state.syncStamp = b->getSyncStamp();
+  state.q         = b->getQuaternion();
+  state.a         = b->getAcceleration();
+  state.v         = b->getVelocity();
+  state.w         = b->getAngularRate();
+  state.vi        = b->getVelocityInfo();
+  state.gp        = b->getGlobalPosition();
+  state.rp        = b->getRelativePosition();
+  state.gps       = b->getGPSInfo();
+  state.rtk       = b->getRTKInfo();
+  state.mag       = b->getMag();
+  state.rc        = b->getRC();
+  state.gimbal    = b->getGimbal();
+  state.status    = b->getStatus();
+  state.battery   = b->getBatteryInfo();
+  state.info      = b->getSDKInfo();
+
+  recorder->record(BROADCAST_COLUMN, &state, sizeof(state),
+                   state.timeStamp.time_ms);
+}
+
+TelemetryStoreReader::TelemetryStoreReader()
+{
+  for (int i = 0; i < COLUMN_NUMBER; ++i)
+  {
+    segments[i]      = NULL;
+    segmentNumber[i] = 0;
+  }
+}
+
+TelemetryStoreReader::~TelemetryStoreReader()
+{
+  close();
+}
+
+int
+TelemetryStoreReader::compareSequence(const void* a, const void* b)
+{
+  uint32_t x = ((const Segment*)a)->sequence;
+  uint32_t y = ((const Segment*)b)->sequence;
+  return x < y ? -1 : (x > y);
+}
+
+bool
+TelemetryStoreReader::open(const char* directory)
+{
+  close();
+
+  DIR* dir = opendir(directory);
+  if (!dir)
+  {
+    DERROR("Cannot open %s: %s\n", directory, strerror(errno));
+    return false;
+  }
+
+  size_t capacity[COLUMN_NUMBER] = { 0 };
+  for (struct dirent* e = readdir(dir); e; e = readdir(dir))
+  {
+    int      column;
+    uint32_t sequence;
+    if (!parseSegmentName(e->d_name, &column, &sequence))
+      continue;
+
+    char path[300];
+    segmentPath(path, sizeof(path), directory, column, sequence);
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      continue;
+    struct stat st;
+    void*       p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(SegmentHeader))
+      p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+      continue;
+
+    const SegmentHeader* h = (const SegmentHeader*)p;
+    if (h->magic != MAGIC || h->version != VERSION || h->column != column ||
+        h->recordSize < sizeof(RecordHeader) || !h->indexStride ||
+        h->dataOffset > (size_t)st.st_size)
+    {
+      DERROR("%s is not a telemetry segment\n", path);
+      munmap(p, st.st_size);
+      continue;
+    }
+
+    if (segmentNumber[column] == capacity[column])
+    {
+      capacity[column] = capacity[column] ? capacity[column] * 2 : 16;
+      Segment* grown   = (Segment*)realloc(segments[column],
+                                         capacity[column] * sizeof(Segment));
+      if (!grown)
+      {
+        munmap(p, st.st_size);
+        continue;
+      }
+      segments[column] = grown;
+    }
+    Segment* s  = &segments[column][segmentNumber[column]++];
+    s->header   = h;
+    s->mapSize  = st.st_size;
+    s->sequence = sequence;
+  }
+  closedir(dir);
+
+  for (int i = 0; i < COLUMN_NUMBER; ++i)
+  {
+    if (segmentNumber[i] > 1)
+      qsort(segments[i], segmentNumber[i], sizeof(Segment), compareSequence);
+  }
+  return true;
+}
+
+void
+TelemetryStoreReader::close()
+{
+  for (int i = 0; i < COLUMN_NUMBER; ++i)
+  {
+    for (size_t j = 0; j < segmentNumber[i]; ++j)
+      munmap((void*)segments[i][j].header, segments[i][j].mapSize);
+    free(segments[i]);
+    segments[i]      = NULL;
+    segmentNumber[i] = 0;
+  }
+}
+
+uint64_t
+TelemetryStoreReader::getNumber(const Segment* segment)
+{
+  const SegmentHeader* h = segment->header;
+  uint64_t n      = __atomic_load_n(&h->recordNumber, __ATOMIC_ACQUIRE);
+  uint64_t mapped = (segment->mapSize - h->dataOffset) / h->recordSize;
+  return n < mapped ? n : mapped;
+}
+
+uint64_t
+TelemetryStoreReader::timeAt(const Segment* segment, uint64_t i)
+{
+  const SegmentHeader* h = segment->header;
+  return ((const RecordHeader*)((const uint8_t*)h + h->dataOffset +
+                                i * h->recordSize))
+    ->hostTimeNs;
+}
+
+uint64_t
+TelemetryStoreReader::lowerBound(const Segment* segment, uint64_t ns)
+{
+  const SegmentHeader* h      = segment->header;
+  uint64_t             n      = getNumber(segment);
+  uint64_t             stride = h->indexStride;
+
+  //! First index entry at or after ns; the answer is in the stride before
+  uint64_t low  = 0;
+  uint64_t high = (n + stride - 1) / stride;
+  if (high > INDEX_NUMBER)
+    high = INDEX_NUMBER;
+  while (low < high)
+  {
+    uint64_t mid = (low + high) / 2;
+    if (h->index[mid] < ns)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  uint64_t i = low ? (low - 1) * stride : 0;
+  while (i < n && timeAt(segment, i) < ns)
+    ++i;
+  return i;
+}
+
+uint64_t
+TelemetryStoreReader::getRecordNumber(int column) const
+{
+  if (column < 0 || column >= COLUMN_NUMBER)
+    return 0;
+
+  uint64_t number = 0;
+  for (size_t i = 0; i < segmentNumber[column]; ++i)
+    number += getNumber(&segments[column][i]);
+  return number;
+}
+
+bool
+TelemetryStoreReader::getTimeRange(int column, uint64_t* firstNs,
+                                   uint64_t* lastNs) const
+{
+  if (column < 0 || column >= COLUMN_NUMBER)
+    return false;
+
+  bool found = false;
+  for (size_t i = 0; i < segmentNumber[column]; ++i)
+  {
+    const Segment* s = &segments[column][i];
+    uint64_t       n = getNumber(s);
+    if (!n)
+      continue;
+    if (!found)
+      *firstNs = timeAt(s, 0);
+    *lastNs = timeAt(s, n - 1);
+    found   = true;
+  }
+  return found;
+}
+
+void
+TelemetryStoreReader::scan(int column, uint64_t fromNs, uint64_t toNs,
+                           ColumnCursor* cursor) const
+{
+  cursor->column  = column;
+  cursor->segment = 0;
+  cursor->fromNs  = fromNs;
+  cursor->toNs    = toNs;
+  if (column < 0 || column >= COLUMN_NUMBER)
+  {
+    cursor->column = -1;
+    return;
+  }
+
+  //! Skip the segments that end before the range
+  size_t low  = 0;
+  size_t high = segmentNumber[column];
+  while (low < high)
+  {
+    size_t         mid = (low + high) / 2;
+    const Segment* s   = &segments[column][mid];
+    uint64_t       n   = getNumber(s);
+    if (n && timeAt(s, n - 1) < fromNs)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  cursor->segment = low;
+}
+
+bool
+TelemetryStoreReader::next(ColumnCursor* cursor, ColumnSpan* span) const
+{
+  if (cursor->column < 0)
+    return false;
+
+  while (cursor->segment < segmentNumber[cursor->column])
+  {
+    const Segment* s = &segments[cursor->column][cursor->segment++];
+    uint64_t       n = getNumber(s);
+    if (!n)
+      continue;
+    if (timeAt(s, 0) >= cursor->toNs)
+      break;
+
+    uint64_t begin = lowerBound(s, cursor->fromNs);
+    uint64_t end   = lowerBound(s, cursor->toNs);
+    if (begin < end)
+    {
+      const SegmentHeader* h = s->header;
+      span->records = (const uint8_t*)h + h->dataOffset + begin * h->recordSize;
+      span->number  = end - begin;
+      span->recordSize = h->recordSize;
+      return true;
+    }
+  }
+  cursor->segment = segmentNumber[cursor->column];
+  return false;
+}
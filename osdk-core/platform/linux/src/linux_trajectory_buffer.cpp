@@ -0,0 +1,173 @@
+/*! @file linux_trajectory_buffer.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Time-stamped trajectory fed by a planner and sampled at the control
+ *  rate, with Hermite or minimum-jerk interpolation
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#include "linux_trajectory_buffer.hpp"
+#include "dji_log.hpp"
+
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+
+using namespace DJI::OSDK;
+
+TrajectoryBuffer::TrajectoryBuffer(int capacity, int interpolation)
+  : ring(NULL)
+  , mask(0)
+  , interpolation(interpolation)
+  , head(0)
+  , tail(0)
+  , lastTime(-HUGE_VAL)
+{
+  uint32_t size = 2;
+  while ((int)size < capacity)
+    size <<= 1;
+  ring = (TrajectoryPoint*)malloc(size * sizeof(TrajectoryPoint));
+  if (ring)
+    mask = size - 1;
+  else
+    DERROR("Lack of memory\n");
+}
+
+TrajectoryBuffer::~TrajectoryBuffer()
+{
+  free(ring);
+}
+
+float64_t
+TrajectoryBuffer::now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int
+TrajectoryBuffer::append(const TrajectoryPoint* points, int count)
+{
+  if (!ring)
+    return 0;
+
+  uint64_t h    = head;
+  uint64_t used = h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+  int      room = (int)(mask + 1 - used);
+  int      n    = 0;
+  while (n < count && n < room && points[n].time > lastTime)
+  {
+    ring[(h + n) & mask] = points[n];
+    lastTime             = points[n].time;
+    n++;
+  }
+  //! The knots are written before the consumer can see them
+  __atomic_store_n(&head, h + n, __ATOMIC_RELEASE);
+  return n;
+}
+
+bool
+TrajectoryBuffer::sample(float64_t time, TrajectorySample* sample)
+{
+  uint64_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+  uint64_t t = tail;
+  if (t == h)
+    return false;
+
+  //! Keep the last knot at or before time; the ones before it are done
+  while (t + 1 < h && ring[(t + 1) & mask].time <= time)
+    t++;
+  if (t != tail)
+    __atomic_store_n(&tail, t, __ATOMIC_RELEASE);
+
+  const TrajectoryPoint* a = &ring[t & mask];
+  if (time < a->time)
+    return false;
+
+  float32_t p0[3] = { a->x, a->y, a->z };
+  float32_t v0[3] = { a->vx, a->vy, a->vz };
+  if (t + 1 == h)
+  {
+    //! Past the end: carry on at the last velocity until more knots come
+    float32_t dt    = (float32_t)(time - a->time);
+    sample->overrun = dt;
+    sample->yaw     = a->yaw;
+    for (int i = 0; i < 3; ++i)
+    {
+      sample->position[i]     = p0[i] + v0[i] * dt;
+      sample->velocity[i]     = v0[i];
+      sample->acceleration[i] = 0;
+    }
+    return true;
+  }
+
+  const TrajectoryPoint* b = &ring[(t + 1) & mask];
+  float32_t p1[3] = { b->x, b->y, b->z };
+  float32_t v1[3] = { b->vx, b->vy, b->vz };
+  float32_t h1    = (float32_t)(b->time - a->time);
+  float32_t s     = (float32_t)(time - a->time) / h1;
+  float32_t s2    = s * s;
+  float32_t s3    = s2 * s;
+  int       mode  = __atomic_load_n(&interpolation, __ATOMIC_RELAXED);
+
+  sample->overrun = 0;
+  for (int i = 0; i < 3; ++i)
+  {
+    //! Normalised to s in [0, 1], so velocities scale by the segment time
+    float32_t m0 = v0[i] * h1;
+    float32_t m1 = v1[i] * h1;
+    float32_t p, v, acc;
+    if (mode == INTERPOLATION_MIN_JERK)
+    {
+      float32_t d  = p1[i] - p0[i];
+      float32_t c3 = 10 * d - 6 * m0 - 4 * m1;
+      float32_t c4 = -15 * d + 8 * m0 + 7 * m1;
+      float32_t c5 = 6 * d - 3 * m0 - 3 * m1;
+      p   = p0[i] + m0 * s + c3 * s3 + c4 * s3 * s + c5 * s3 * s2;
+      v   = m0 + 3 * c3 * s2 + 4 * c4 * s3 + 5 * c5 * s3 * s;
+      acc = 6 * c3 * s + 12 * c4 * s2 + 20 * c5 * s3;
+    }
+    else
+    {
+      p = (2 * s3 - 3 * s2 + 1) * p0[i] + (s3 - 2 * s2 + s) * m0 +
+          (-2 * s3 + 3 * s2) * p1[i] + (s3 - s2) * m1;
+      v = (6 * s2 - 6 * s) * p0[i] + (3 * s2 - 4 * s + 1) * m0 +
+          (-6 * s2 + 6 * s) * p1[i] + (3 * s2 - 2 * s) * m1;
+      acc = (12 * s - 6) * p0[i] + (6 * s - 4) * m0 + (-12 * s + 6) * p1[i] +
+            (6 * s - 2) * m1;
+    }
+    sample->position[i]     = p;
+    sample->velocity[i]     = v / h1;
+    sample->acceleration[i] = acc / (h1 * h1);
+  }
+
+  float32_t turn = b->yaw - a->yaw;
+  turn -= 360 * floorf((turn + 180) / 360);
+  float32_t yaw = a->yaw + s * turn;
+  sample->yaw   = yaw - 360 * floorf((yaw + 180) / 360);
+  return true;
+}
+
+int
+TrajectoryBuffer::size() const
+{
+  uint64_t t = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+  return (int)(__atomic_load_n(&head, __ATOMIC_ACQUIRE) - t);
+}
+
+int
+TrajectoryBuffer::getCapacity() const
+{
+  return ring ? (int)mask + 1 : 0;
+}
+
+void
+TrajectoryBuffer::setInterpolation(int interpolation)
+{
+  __atomic_store_n(&this->interpolation, interpolation, __ATOMIC_RELAXED);
+}
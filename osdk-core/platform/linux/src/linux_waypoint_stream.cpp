@@ -0,0 +1,486 @@
+/*! @file linux_waypoint_stream.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Flies routes longer than one waypoint mission as a chain of
+ *  overlapping segments, handed over in flight
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#include "linux_waypoint_stream.hpp"
+#include "dji_vehicle.hpp"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+using namespace DJI::OSDK;
+
+WaypointStreamer::WaypointStreamer(Vehicle* vehicle)
+  : vehicle(vehicle)
+  , mission(NULL)
+  , quit(false)
+  , route(NULL)
+  , count(0)
+  , size(0)
+  , overlap(0)
+  , timeout(1)
+  , nextSegment(-1)
+  , next(NULL)
+  , flying(-1)
+  , expected(0)
+  , segmentDone(false)
+  , ackReady(false)
+{
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&wake, &attr);
+  pthread_condattr_destroy(&attr);
+  memset(ackCmd, 0, sizeof(ackCmd));
+  memset(&ack, 0, sizeof(ack));
+  memset(&info, 0, sizeof(info));
+  memset(&nextInfo, 0, sizeof(nextInfo));
+  memset(&status, 0, sizeof(status));
+  chained.callback = 0;
+  chained.userData = 0;
+}
+
+WaypointStreamer::~WaypointStreamer()
+{
+  stop();
+  free(route);
+  free(next);
+  pthread_cond_destroy(&wake);
+  pthread_mutex_destroy(&lock);
+}
+
+bool
+WaypointStreamer::start(const WayPointInitSettings& info,
+                        const WayPointSettings* route, int count,
+                        int segmentSize, int overlap, int timeout)
+{
+  if (isRunning())
+  {
+    DERROR("Route already streaming\n");
+    return false;
+  }
+  if (vehicle->missionManager == NULL)
+  {
+    DERROR("No mission manager\n");
+    return false;
+  }
+  if (overlap < 1 || segmentSize < overlap + 2 || segmentSize > 255 ||
+      count < 2)
+  {
+    DERROR("Invalid segment size %d or overlap %d for %d waypoints\n",
+           segmentSize, overlap, count);
+    return false;
+  }
+  //! The worker is joined, so nothing else touches the route
+  if (status.segments)
+    stop(timeout);
+
+  WayPointSettings* copy =
+    (WayPointSettings*)realloc(this->route, count * sizeof(WayPointSettings));
+  if (copy)
+    this->route = copy;
+  WayPointSettings* segment =
+    (WayPointSettings*)realloc(next, segmentSize * sizeof(WayPointSettings));
+  if (segment)
+    next = segment;
+  if (!copy || !segment)
+  {
+    DERROR("Lack of memory\n");
+    return false;
+  }
+  memcpy(this->route, route, count * sizeof(WayPointSettings));
+  this->info    = info;
+  this->count   = count;
+  this->size    = segmentSize;
+  this->overlap = overlap;
+  this->timeout = timeout;
+
+  int step     = size - overlap;
+  int segments = count <= size ? 1 : 1 + (count - size + step - 1) / step;
+
+  //! Every segment is checked before the first command is sent
+  for (int i = 0; i < segments; ++i)
+  {
+    buildSegment(i);
+    WaypointViolation violation;
+    int found = preprocessor.validate(&nextInfo, next, segmentLength(i),
+                                      &violation, 1);
+    if (found != 0)
+    {
+      if (found > 0)
+        DERROR("Segment %d, waypoint %d: %s %f, limit %f (0x%X)\n", i,
+               segmentStart(i) + violation.index, violation.field,
+               violation.value, violation.limit, violation.ack);
+      return false;
+    }
+  }
+  buildSegment(0);
+
+  pthread_mutex_lock(&lock);
+  memset(&status, 0, sizeof(status));
+  status.total    = count;
+  status.segments = segments;
+  status.reached  = -1;
+  status.running  = true;
+  flying          = -1;
+  expected        = 0;
+  segmentDone     = false;
+  quit            = false;
+  pthread_mutex_unlock(&lock);
+
+  if (pthread_create(&worker, NULL, workerCall, this) != 0)
+  {
+    DERROR("fail to create thread for waypoint streaming!\n");
+    pthread_mutex_lock(&lock);
+    status.running  = false;
+    status.segments = 0;
+    pthread_mutex_unlock(&lock);
+    return false;
+  }
+  pthread_setname_np(worker, "wpStream");
+  DSTATUS("Streaming %d waypoints as %d segments\n", count, segments);
+  return true;
+}
+
+void
+WaypointStreamer::stop(int timeout)
+{
+  pthread_mutex_lock(&lock);
+  bool started = status.segments != 0;
+  quit         = true;
+  pthread_cond_signal(&wake);
+  pthread_mutex_unlock(&lock);
+  if (!started)
+    return;
+
+  pthread_join(worker, NULL);
+  if (mission)
+  {
+    pthread_mutex_lock(&lock);
+    bool wasFlying = flying >= 0 && !status.finished;
+    flying         = -1;
+    pthread_mutex_unlock(&lock);
+    if (wasFlying)
+      mission->stop(timeout);
+
+    //! Hand the event callback back
+    mission->setWaypointEventCallback(chained.callback, chained.userData);
+    mission = NULL;
+  }
+
+  pthread_mutex_lock(&lock);
+  status.running  = false;
+  status.segments = 0;
+  pthread_mutex_unlock(&lock);
+}
+
+bool
+WaypointStreamer::isRunning()
+{
+  pthread_mutex_lock(&lock);
+  bool running = status.running;
+  pthread_mutex_unlock(&lock);
+  return running;
+}
+
+void
+WaypointStreamer::getStatus(WaypointStreamStatus* status)
+{
+  pthread_mutex_lock(&lock);
+  *status = this->status;
+  pthread_mutex_unlock(&lock);
+}
+
+WaypointPreprocessor*
+WaypointStreamer::getPreprocessor()
+{
+  return &preprocessor;
+}
+
+int
+WaypointStreamer::segmentStart(int segment) const
+{
+  return segment * (size - overlap);
+}
+
+int
+WaypointStreamer::segmentLength(int segment) const
+{
+  int left = count - segmentStart(segment);
+  return left < size ? left : size;
+}
+
+void
+WaypointStreamer::buildSegment(int segment)
+{
+  int  first = segmentStart(segment);
+  int  n     = segmentLength(segment);
+  bool last  = first + n == count;
+
+  nextSegment             = segment;
+  nextInfo                = info;
+  nextInfo.indexNumber    = n;
+  nextInfo.executiveTimes = 1;
+  //! Earlier segments end in a hover, should a handover come too late
+  nextInfo.finishAction = last ? info.finishAction : 0;
+  memcpy(next, route + first, n * sizeof(WayPointSettings));
+  for (int i = 0; i < n; ++i)
+    next[i].index = i;
+}
+
+/*! @brief Stop the segment flown, then init, upload and start the next one.
+ *  Runs on the worker without the lock held.
+ */
+bool
+WaypointStreamer::flySegment(int segment)
+{
+  ACK::ErrorCode ack;
+
+  if (nextSegment != segment)
+    buildSegment(segment);
+
+  pthread_mutex_lock(&lock);
+  flying = -1;
+  pthread_mutex_unlock(&lock);
+
+  if (mission == NULL && vehicle->missionManager->wpMission == NULL)
+  {
+    //! Only the blocking init creates the mission; nothing flies yet
+    ack = vehicle->missionManager->init(DJI_MISSION_TYPE::WAYPOINT, timeout,
+                                        &nextInfo);
+    mission = vehicle->missionManager->wpMission;
+    if (mission == NULL)
+    {
+      finish(&ack);
+      return false;
+    }
+  }
+  else
+  {
+    if (mission)
+    {
+      //! Refused if the segment already finished; init tells if it runs
+      expectAck(OpenProtocol::CMDSet::Mission::waypointSetStart);
+      mission->stop(commandCallback, this);
+      if (ACK::getError(waitAck()))
+        DDEBUG("Stop before segment %d refused\n", segment);
+    }
+    else
+      mission = vehicle->missionManager->wpMission;
+    expectAck(OpenProtocol::CMDSet::Mission::waypointInit);
+    mission->init(&nextInfo, commandCallback, this);
+    ack = waitAck();
+  }
+  if (segment == 0)
+  {
+    WaypointLimits limits;
+    preprocessor.getLimits(&limits);
+    mission->getPreprocessor()->setLimits(limits);
+    chained = mission->wayPointEventCallback;
+    mission->setWaypointEventCallback(eventCallback, this);
+  }
+
+  if (!ACK::getError(ack))
+    ack = mission->uploadAllIndexData(
+      next, WaypointMission::DEFAULT_UPLOAD_WINDOW, timeout);
+  if (!ACK::getError(ack))
+  {
+    expectAck(OpenProtocol::CMDSet::Mission::waypointSetStart);
+    mission->start(commandCallback, this);
+    ack = waitAck();
+  }
+  if (ACK::getError(ack))
+  {
+    DERROR("Segment %d failed\n", segment);
+    ACK::getErrorCodeMessage(ack, __func__);
+    finish(&ack);
+    return false;
+  }
+
+  pthread_mutex_lock(&lock);
+  status.segment = segment;
+  flying         = segment;
+  expected       = 0;
+  segmentDone    = false;
+  pthread_mutex_unlock(&lock);
+  return true;
+}
+
+void
+WaypointStreamer::expectAck(const uint8_t cmd[])
+{
+  pthread_mutex_lock(&lock);
+  ackCmd[0] = cmd[0];
+  ackCmd[1] = cmd[1];
+  ackReady  = false;
+  pthread_mutex_unlock(&lock);
+}
+
+ACK::ErrorCode
+WaypointStreamer::waitAck()
+{
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += timeout;
+
+  pthread_mutex_lock(&lock);
+  while (!ackReady && !quit)
+  {
+    if (pthread_cond_timedwait(&wake, &lock, &deadline) == ETIMEDOUT)
+      break;
+  }
+  ACK::ErrorCode result = ack;
+  if (!ackReady)
+  {
+    memset(&result, 0, sizeof(result));
+    result.info.cmd_set = ackCmd[0];
+    result.info.cmd_id  = ackCmd[1];
+    result.data = OpenProtocol::ErrorCode::CommonACK::NO_RESPONSE_ERROR;
+  }
+  //! A late ACK no longer matches anything
+  ackCmd[0] = 0;
+  pthread_mutex_unlock(&lock);
+  return result;
+}
+
+void
+WaypointStreamer::commandCallback(Vehicle* vehicle, RecvContainer recvFrame,
+                                  UserData userData)
+{
+  WaypointStreamer* streamer = (WaypointStreamer*)userData;
+
+  pthread_mutex_lock(&streamer->lock);
+  if (!streamer->ackReady && recvFrame.recvInfo.cmd_set == streamer->ackCmd[0] &&
+      recvFrame.recvInfo.cmd_id == streamer->ackCmd[1])
+  {
+    streamer->ack.info = recvFrame.recvInfo;
+    streamer->ack.data = recvFrame.recvData.missionACK;
+    streamer->ackReady = true;
+    pthread_cond_signal(&streamer->wake);
+  }
+  pthread_mutex_unlock(&streamer->lock);
+}
+
+void
+WaypointStreamer::finish(const ACK::ErrorCode* ack)
+{
+  pthread_mutex_lock(&lock);
+  if (ack)
+    status.ack = *ack;
+  status.running = false;
+  pthread_mutex_unlock(&lock);
+}
+
+void*
+WaypointStreamer::workerCall(void* param)
+{
+  ((WaypointStreamer*)param)->work();
+  return NULL;
+}
+
+void
+WaypointStreamer::work()
+{
+  if (!flySegment(0))
+    return;
+  //! Built while the first segment is flown
+  if (status.segments > 1)
+    buildSegment(1);
+
+  pthread_mutex_lock(&lock);
+  for (;;)
+  {
+    int  segment  = flying;
+    int  handover = segmentStart(segment + 1) - 1;
+    bool last     = segment == status.segments - 1;
+    bool due      = !last && (status.reached >= handover || segmentDone);
+
+    if (quit)
+      break;
+    if (last && segmentDone)
+    {
+      status.finished = true;
+      DSTATUS("Route of %d waypoints flown, %u handovers, slowest %u ms\n",
+              status.total, status.handovers, status.maxHandoverMs);
+      break;
+    }
+    if (!due)
+    {
+      pthread_cond_wait(&wake, &lock);
+      continue;
+    }
+
+    bool    hovered = segmentDone;
+    time_ms startMs = vehicle->protocolLayer->getDriver()->getTimeStamp();
+    pthread_mutex_unlock(&lock);
+    bool ok = flySegment(segment + 1);
+    if (ok && segment + 2 < status.segments)
+      buildSegment(segment + 2);
+    time_ms ms =
+      vehicle->protocolLayer->getDriver()->getTimeStamp() - startMs;
+    pthread_mutex_lock(&lock);
+    if (!ok)
+      break;
+
+    status.handovers++;
+    status.late += hovered;
+    status.lastHandoverMs = ms;
+    if (ms > status.maxHandoverMs)
+      status.maxHandoverMs = ms;
+    DSTATUS("Segment %d of %d started in %u ms%s\n", segment + 2,
+            status.segments, (uint32_t)ms, hovered ? ", after a hover" : "");
+  }
+  status.running = false;
+  pthread_mutex_unlock(&lock);
+}
+
+void
+WaypointStreamer::eventCallback(Vehicle* vehicle, RecvContainer recvFrame,
+                                UserData userData)
+{
+  WaypointStreamer* streamer = (WaypointStreamer*)userData;
+  streamer->onEvent(recvFrame);
+  if (streamer->chained.callback)
+    streamer->chained.callback(vehicle, recvFrame, streamer->chained.userData);
+}
+
+void
+WaypointStreamer::onEvent(const RecvContainer& recvFrame)
+{
+  const ACK::WayPointReachedData* event =
+    &recvFrame.recvData.wayPointReachedData;
+
+  pthread_mutex_lock(&lock);
+  if (flying >= 0)
+  {
+    if (event->incident_type == NAVI_MISSION_WP_REACH_POINT)
+    {
+      //! Events of the stopped segment can still be queued after the start
+      //! of the next one; the window keeps them out
+      int index = event->waypoint_index;
+      if (index >= expected && index <= expected + overlap)
+      {
+        expected       = index + 1;
+        status.reached = segmentStart(flying) + index;
+        pthread_cond_signal(&wake);
+      }
+    }
+    else if (event->incident_type == NAVI_MISSION_FINISH)
+    {
+      segmentDone = true;
+      pthread_cond_signal(&wake);
+    }
+  }
+  pthread_mutex_unlock(&lock);
+}
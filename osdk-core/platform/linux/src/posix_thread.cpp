@@ -10,7 +10,12 @@
  * */
 
 #include "posix_thread.hpp"
+#include <alloca.h>
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
 #include <string>
+#include <sys/mman.h>
 
 using namespace DJI::OSDK;
 
@@ -33,24 +38,31 @@ PosixThread::createThread()
   int         ret = -1;
   std::string infoStr;
 
+  const ThreadConfig* config = vehicle->getThreadConfig();
+
   /* Initialize and set thread detached attribute */
   pthread_attr_init(&attr);
   pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+  if (config->stackSize &&
+      pthread_attr_setstacksize(&attr, config->stackSize) != 0)
+  {
+    DERROR("Invalid thread stack size %u\n", (unsigned)config->stackSize);
+  }
 
   if (1 == type)
   {
-    ret     = pthread_create(&threadID, NULL, send_call, (void*)vehicle);
+    ret     = pthread_create(&threadID, &attr, send_call, (void*)vehicle);
     infoStr = "sendPoll";
   }
   else if (2 == type)
   {
-    ret     = pthread_create(&threadID, NULL, read_call, vehicle);
+    ret     = pthread_create(&threadID, &attr, read_call, vehicle);
     infoStr = "readPoll";
   }
 
   else if (3 == type)
   {
-    ret     = pthread_create(&threadID, NULL, callback_call, (void*)vehicle);
+    ret     = pthread_create(&threadID, &attr, callback_call, (void*)vehicle);
     infoStr = "callback";
   }
   else
@@ -70,9 +82,80 @@ PosixThread::createThread()
     DERROR("fail to set thread name for %s!\n", infoStr.c_str());
     return false;
   }
+
+  //! A refused schedule is reported but the thread keeps running
+  if (2 == type)
+    setSchedule(threadID, config->read, infoStr.c_str());
+  else if (3 == type)
+    setSchedule(threadID, config->callback, infoStr.c_str());
   return true;
 }
 
+bool
+PosixThread::setSchedule(pthread_t thread, const ThreadSchedule& schedule,
+                         const char* name)
+{
+  bool ok = true;
+
+  if (schedule.policy != ThreadSchedule::POLICY_DEFAULT)
+  {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = schedule.priority;
+    int policy =
+      (schedule.policy == ThreadSchedule::POLICY_RR) ? SCHED_RR : SCHED_FIFO;
+
+    int ret = pthread_setschedparam(thread, policy, &param);
+    if (ret != 0)
+    {
+      DERROR("fail to set real-time priority %d for %s: %s\n",
+             schedule.priority, name, strerror(ret));
+      ok = false;
+    }
+  }
+
+  if (schedule.cpuMask)
+  {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu = 0; cpu < 64 && cpu < CPU_SETSIZE; ++cpu)
+    {
+      if (schedule.cpuMask & ((uint64_t)1 << cpu))
+        CPU_SET(cpu, &cpus);
+    }
+
+    int ret = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+    if (ret != 0)
+    {
+      DERROR("fail to set CPU affinity for %s: %s\n", name, strerror(ret));
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+bool
+PosixThread::lockAllMemory()
+{
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+  {
+    DERROR("fail to lock memory: %s\n", strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+void
+PosixThread::prefaultStack(size_t size)
+{
+  if (!size)
+    return;
+
+  volatile uint8_t* stack = (volatile uint8_t*)alloca(size);
+  for (size_t i = 0; i < size; i += 4096)
+    stack[i] = 0;
+}
+
 int
 PosixThread::stopThread()
 {
@@ -118,6 +201,7 @@ PosixThread::read_call(void* param)
 
   RecvContainer recvContainer;
   Vehicle*      vehiclePtr = (Vehicle*)param;
+  prefaultStack(vehiclePtr->getThreadConfig()->prefaultStack);
   while (!(vehiclePtr->getStopCond()))
   {
     // receive() implemented on the OpenProtocol side
@@ -126,16 +210,19 @@ PosixThread::read_call(void* param)
     usleep(10); //! @note CPU optimization, reduce the CPU usage a lot
   }
   DDEBUG("Quit read function\n");
+  return NULL;
 }
 
 void*
 PosixThread::callback_call(void* param)
 {
   Vehicle* vehiclePtr = (Vehicle*)param;
+  prefaultStack(vehiclePtr->getThreadConfig()->prefaultStack);
   while (!(vehiclePtr->getStopCond()))
   {
     vehiclePtr->callbackPoll();
     usleep(10); //! @note CPU optimization, reduce the CPU usage a lot
   }
   DDEBUG("Quit callback function\n");
+  return NULL;
 }
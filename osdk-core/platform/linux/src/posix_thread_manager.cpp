@@ -10,6 +10,7 @@
  * */
 
 #include "posix_thread_manager.hpp"
+#include "dji_log.hpp"
 
 using namespace DJI::OSDK;
 
@@ -32,21 +33,35 @@ PosixThreadManager::~PosixThreadManager()
 void
 PosixThreadManager::init()
 {
-  m_memLock = PTHREAD_MUTEX_INITIALIZER;
-  m_msgLock = PTHREAD_MUTEX_INITIALIZER;
-  m_ackLock = PTHREAD_MUTEX_INITIALIZER;
+  initMutex(&m_memLock);
+  initMutex(&m_msgLock);
+  initMutex(&m_ackLock);
   pthread_cond_init(&m_ackRecvCv, NULL);
 
   /*! These mutexes are used for the non blocking callback ACK mechanism */
-  m_nbAckLock  = PTHREAD_MUTEX_INITIALIZER;
-  m_headerLock = PTHREAD_MUTEX_INITIALIZER;
+  initMutex(&m_nbAckLock);
+  initMutex(&m_headerLock);
   pthread_cond_init(&m_nbAckRecv, NULL);
 
   /*! Mutex initializations
    * These are newly added mutexes
    */
-  m_frameLock    = PTHREAD_MUTEX_INITIALIZER;
-  m_stopCondLock = PTHREAD_MUTEX_INITIALIZER;
+  initMutex(&m_frameLock);
+  initMutex(&m_stopCondLock);
+}
+
+void
+PosixThreadManager::initMutex(pthread_mutex_t* mutex)
+{
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  if (priorityInheritance &&
+      pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT) != 0)
+  {
+    DERROR("Priority inheritance mutexes not supported\n");
+  }
+  pthread_mutex_init(mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
 }
 
 void
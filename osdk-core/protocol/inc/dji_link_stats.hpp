@@ -0,0 +1,155 @@
+/** @file dji_link_stats.hpp
+ *  @version 3.3
+ *  @date Jun 2017
+ *
+ *  @brief
+ *  Link health counters and latency histograms for the OPEN protocol
+ *
+ *  @copyright 2017 DJI. All rights reserved.
+ *
+ */
+
+#ifndef ONBOARDSDK_DJI_LINK_STATS_H
+#define ONBOARDSDK_DJI_LINK_STATS_H
+
+#include "dji_hard_driver.hpp"
+#include <stdint.h>
+
+namespace DJI
+{
+namespace OSDK
+{
+
+#ifdef STM32
+//! Cortex-M4 has no 64-bit atomics
+typedef uint32_t LinkCounter;
+#else
+typedef uint64_t LinkCounter;
+#endif
+
+/*! @brief Power-of-two latency histogram in microseconds
+ *  @details bucket[0] counts 0 us, bucket[i] counts [2^(i-1), 2^i) us; the
+ *  last bucket also takes everything above (about 8 s).
+ */
+typedef struct LinkHistogram
+{
+  static const int BUCKET_NUMBER = 24;
+
+  LinkCounter count;
+  LinkCounter sumUs;
+  LinkCounter maxUs;
+  LinkCounter bucket[BUCKET_NUMBER];
+} LinkHistogram;
+
+//! Traffic of one cmd_set/cmd_id; ACKs are counted on the command they answer
+typedef struct CommandStats
+{
+  uint8_t       cmdSet;
+  uint8_t       cmdId;
+  LinkCounter   framesOut;
+  LinkCounter   bytesOut;
+  LinkCounter   framesIn;
+  LinkCounter   bytesIn;
+  LinkCounter   retransmits;
+  LinkCounter   timeouts;
+  LinkCounter   dropped; //! stale: expired, superseded or cancelled
+  LinkHistogram ackRtt;
+} CommandStats;
+
+/*! @brief Plain copy of all counters, for export to monitoring
+ *  @note About 14 KB; keep one around instead of putting it on a small stack
+ */
+typedef struct LinkSnapshot
+{
+  static const int MAX_COMMAND = 48;
+
+  //! Wire level, valid frames or not
+  LinkCounter bytesIn;
+  LinkCounter bytesOut;
+  LinkCounter sendFailures;
+
+  //! Frame level
+  LinkCounter framesIn;
+  LinkCounter framesOut;
+  LinkCounter headerCrcErrors;
+  LinkCounter dataCrcErrors;
+  LinkCounter resyncBytes; //! dropped while hunting for the next SOF
+  LinkCounter filterOverflows;
+  LinkCounter unmatchedAcks;
+
+  //! Sessions
+  LinkCounter retransmits;
+  LinkCounter timeouts;
+  LinkCounter sessionsExhausted;
+  LinkCounter sessionsInUse;
+  LinkCounter sessionsMax;
+  //! Stale frames dropped instead of sent or retransmitted
+  LinkCounter expired;    //! past Command::deadline
+  LinkCounter superseded; //! replaced by a newer Command::supersedeKey
+  LinkCounter cancelled;  //! by Protocol::cancel()
+  LinkHistogram ackRtt;
+
+  //! Non-blocking callbacks (Vehicle)
+  LinkCounter   callbackQueueDepth;
+  LinkCounter   callbackQueueMax;
+  LinkCounter   callbackQueueOverflows;
+  LinkHistogram callbackWait; //! queued until started
+  LinkHistogram callbackRun;
+
+  //! Commands seen so far, in order of first use; commands beyond
+  //! MAX_COMMAND only show up in the totals
+  int          commandNumber;
+  CommandStats command[MAX_COMMAND];
+
+  //! UART counters from the driver, if it has them
+  bool         lineValid;
+  LineCounters line;
+} LinkSnapshot;
+
+/*! @brief Live counters of one link
+ *
+ *  @details Every update is a relaxed atomic add (or max), so the read and
+ *  send paths never take a lock for bookkeeping; snapshot() reads each
+ *  counter atomically, but not all of them at the same instant.
+ */
+class LinkStats
+{
+public:
+  LinkStats();
+
+  //! Zero everything; updates racing with reset() may survive it
+  void reset();
+  void snapshot(LinkSnapshot* out) const;
+
+  //! Microseconds from a monotonic clock; the driver's ms clock where the
+  //! platform has nothing finer
+  static uint64_t nowUs(HardDriver* driver);
+
+  static void add(LinkCounter* counter, LinkCounter value = 1)
+  {
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+#else
+    *counter += value;
+#endif
+  }
+  static void setMax(LinkCounter* counter, LinkCounter value);
+  static void record(LinkHistogram* histogram, uint64_t us);
+
+  //! Entry for cmd_set/cmd_id, created on first use; NULL once full
+  CommandStats* command(uint8_t cmdSet, uint8_t cmdId);
+
+public:
+  //! Same layout as the snapshot, minus what is computed when it is taken
+  LinkSnapshot counters;
+
+private:
+  //! cmd_set << 8 | cmd_id, plus one so that 0 marks a free slot. Slots
+  //! are claimed front to back, which keeps them in order of first use.
+  uint32_t key[LinkSnapshot::MAX_COMMAND];
+};
+
+} // namespace OSDK
+} // namespace DJI
+
+#endif // ONBOARDSDK_DJI_LINK_STATS_H
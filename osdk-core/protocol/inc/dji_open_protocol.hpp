@@ -15,8 +15,11 @@
 #include "dji_ack.hpp"
 #include "dji_aes.hpp"
 #include "dji_hard_driver.hpp"
+#include "dji_link_stats.hpp"
 #include "dji_log.hpp"
+#include "dji_probe.hpp"
 #include "dji_thread_manager.hpp"
+#include "dji_trace.hpp"
 #include "dji_type.hpp"
 /*! Platform includes:
  *  This set of macros figures out which files to include based on your
@@ -24,6 +27,7 @@
  */
 #ifdef __linux__
 //! handle array of characters
+#include "linux_lock_profiler.hpp"
 #include "linux_serial_device.hpp"
 #include "posix_thread_manager.hpp"
 #include <cstring>
@@ -192,13 +196,16 @@ class Protocol
 {
 public:
   //! Constructor
-  Protocol(const char* device, uint32_t baudRate);
+  //! @param threadConfig only priorityInheritance is used here
+  Protocol(const char* device, uint32_t baudRate,
+           const ThreadConfig* threadConfig = NULL);
+  /*! @brief Run the protocol over a caller-supplied driver (decorators,
+   *  loopback links, simulators). Protocol takes ownership of the driver.
+   */
+  Protocol(HardDriver* driver, const ThreadConfig* threadConfig = NULL);
 
   //! Destructor
-  ~Protocol()
-  {
-    delete (this->serialDevice);
-  }
+  ~Protocol();
 
   /************************Public Interfaces**********************************/
   //! Send - callers are from above the ProtocolLayer
@@ -216,15 +223,82 @@ public:
             bool hasCallback = false, int callbackID = 0
             /** @note Better interface entrance*/
             );
-  /** @note Main interface*/
-  void send(Command* parameter);
+  /** @note Main interface
+   *  @return 0 on success, -1 if the frame could not be queued (no free
+   *  session or MMU memory, over-sized, encryption failure or already past
+   *  its deadline)
+   */
+  int send(Command* parameter);
+  /** @brief send(), and return a handle for cancel()
+   *  @param handle set to 0 for session 0 frames, which are not kept
+   */
+  int send(Command* parameter, uint32_t* handle);
+  /** @brief Drop a frame still waiting for its ACK, freeing its session
+   *  now instead of after its retries; a late ACK is then dropped.
+   *  @note The callback of a cancelled command is not called
+   *  @return false if the frame was already acknowledged or dropped
+   */
+  bool cancel(uint32_t handle);
+  /** @brief send() one frame of a setpoint stream (flight control, gimbal)
+   *  in session 0, with a deadline SETPOINT_LIFETIME_MS away and the
+   *  streamKey() of cmd, so it replaces the frames of the stream in flight
+   *  @return as send()
+   */
+  int sendSetpoint(const uint8_t cmd[], bool is_enc, const void* pdata,
+                   size_t len);
 
   //! SendPoll:
   void sendPoll();
+  /** @brief Free the sessions whose Command::deadline has passed, counting
+   *  them as expired. sendPoll() runs it first; where nothing runs
+   *  sendPoll() (Linux), Vehicle::callbackPoll() does, every POLL_TICK_MS
+   */
+  void expireSessions();
+  /** @brief Give up on the ACK of a callback command, freeing its session
+   *  now instead of after its retries; a late ACK is then dropped.
+   *  @note callbackID is matched only among the sessions still waiting
+   *  @return false if no session waits with callbackID
+   */
+  bool releaseSession(int callbackID);
+
+  /************************Frame templates**********************************/
+  /*! @brief Keep a session-0 frame for cmd built, for commands sent at a
+   *  steady rate with a payload of a fixed size (flight control, gimbal).
+   *
+   *  @details The header, command bytes and the CRC states over the header
+   *  bytes before the sequence number are computed once. Each
+   *  sendTemplate() then patches the sequence number and payload in place,
+   *  finishes both CRCs from those states and writes the frame, with no
+   *  MMU allocation and no copy through encrypt().
+   *  @note Templates are plain: encrypted frames change as a whole
+   *  @param supersedeKey as Command::supersedeKey: each send drops the
+   *  frames still retrying with it
+   *  @return handle for sendTemplate(), -1 if all MAX_TEMPLATES are taken
+   *  or len is over-sized
+   */
+  int registerTemplate(const uint8_t cmd[], size_t len,
+                       uint32_t supersedeKey = 0);
+  /*! @param payload len bytes as registered, NULL to resend the last ones
+   *  @return 0 on success, -1 for a handle not registered or while
+   *  encryption is on; send() the frame instead
+   */
+  int sendTemplate(int handle, const void* payload);
+  void releaseTemplate(int handle);
+  //! Command::supersedeKey for the stream of cmd frames; never 0
+  static uint32_t streamKey(const uint8_t cmd[]);
 
   /************************Receive Management********************************/
 
   RecvContainer receive();
+
+  /*! @brief Non-blocking step for event-driven readers: reads from the
+   *  driver only once the previous chunk is consumed, then parses until the
+   *  first complete frame or the end of the chunk.
+   *  @return true if a frame was written to frame
+   */
+  bool pollFrame(RecvContainer* frame);
+  //! True while the last chunk read from the driver has unparsed bytes
+  bool hasBufferedData() const;
   /************************Getters and setters*******************************/
   /**
    * Get serial device handler.
@@ -236,21 +310,31 @@ public:
    */
   ThreadAbstract* getThreadHandle() const;
 
+  /************************Link statistics**********************************/
+  //! Live counters; Vehicle adds its callback queue figures here
+  LinkStats* getLinkStats();
+  //! Copy of all counters, plus session usage and the driver's UART counters
+  void getLinkSnapshot(LinkSnapshot* snapshot);
+
   /**********************************Fitlered******************************/
   void setKey(const char* key);
 
   /************************Useful frame-related constants*******************/
 public:
-  static const int     BUFFER_SIZE = 1024;
-  static const int     ACK_SIZE    = 10;
-  static const uint8_t SOF         = 0xAA;
-  static const int     maxRecv     = BUFFER_SIZE;
-  static const int     CRCHead     = sizeof(uint16_t);
-  static const int     CRCData     = sizeof(uint32_t);
-  static const int     CRCHeadLen  = sizeof(Header) - CRCHead;
-  static const int     PackageMin  = sizeof(Header) + CRCData;
+  static const int     BUFFER_SIZE   = 1024;
+  static const int     ACK_SIZE      = 10;
+  static const uint8_t SOF           = 0xAA;
+  static const int     maxRecv       = BUFFER_SIZE;
+  static const int     CRCHead       = sizeof(uint16_t);
+  static const int     CRCData       = sizeof(uint32_t);
+  static const int     CRCHeadLen    = sizeof(Header) - CRCHead;
+  static const int     PackageMin    = sizeof(Header) + CRCData;
+  static const int     MAX_TEMPLATES = 8;
   uint8_t              buf[BUFFER_SIZE];
 
+  //! A setpoint is stale after a few control periods
+  static const int SETPOINT_LIFETIME_MS = 50;
+
 private:
   /***************************Init*******************************************/
   void init(HardDriver* Driver, MMU* mmuPtr, bool userCallbackThread = false);
@@ -262,6 +346,9 @@ private:
     uint16_t reuseIndex;
     uint16_t reuseCount;
     uint16_t recvIndex;
+    //! Bytes of the last good frame kept at the buffer start by
+    //! sdk_stream_prepare_lambda; shifting them out is not a resync
+    uint16_t staleCount;
     uint8_t  recvBuf[BUFFER_SIZE];
     // for encrypt
     uint8_t sdkKey[32];
@@ -301,8 +388,27 @@ private:
 
   /*******************************Send Pipeline*****************************/
 
-  int sendInterface(Command* cmdContainer);
-  void sendData(uint8_t* buf);
+  int sendInterface(Command* cmdContainer, uint32_t* handle = NULL);
+  void sendData(uint8_t* buf, uint32_t traceId = 0);
+  //! Free a session whose frame went stale; reason is the total to count
+  void dropSession(CMDSession* session, LinkCounter* reason);
+  //! Drop the frames sent with key; called with the memory locked
+  void supersede(uint32_t key);
+
+  typedef struct FrameTemplate
+  {
+    uint8_t* frame; //! NULL while free
+    uint16_t payloadLength;
+    //! CRC states over the header bytes before the sequence number
+    uint16_t crc16Prefix;
+    uint32_t crc32Prefix;
+    uint32_t supersedeKey;
+  } FrameTemplate;
+
+  /*******************************Link statistics**************************/
+  void countCommandOut(uint8_t cmdSet, uint8_t cmdId, uint8_t* buf);
+  void countRetry(CMDSession* session, bool retransmit);
+  void countAck(CMDSession* session, uint16_t length);
 
   /****************************Multithreading support***********************/
   //! Thread sync for ACK
@@ -333,11 +439,16 @@ private:
 
   void transformTwoByte(const char* pstr, uint8_t* pdata);
   /***********************************CRC***********************************/
-  void calculateCRC(void* p_data);
-  uint16_t crc16_update(uint16_t crc, uint8_t ch);
-  uint32_t crc32_update(uint32_t crc, uint8_t ch);
-  uint16_t sdk_stream_crc16_calc(const uint8_t* pMsg, size_t nLen);
-  uint32_t sdk_stream_crc32_calc(const uint8_t* pMsg, size_t nLen);
+public:
+  //! Stateless, so tools that build or check frames outside a link (loopback
+  //! drivers, capture decoders) can share them.
+  static void calculateCRC(void* p_data);
+  static uint16_t crc16_update(uint16_t crc, uint8_t ch);
+  static uint32_t crc32_update(uint32_t crc, uint8_t ch);
+  static uint16_t sdk_stream_crc16_calc(const uint8_t* pMsg, size_t nLen);
+  static uint32_t sdk_stream_crc32_calc(const uint8_t* pMsg, size_t nLen);
+
+private:
   void sdk_stream_prepare_lambda(SDKFilter* p_filter);
   void sdk_stream_shift_data_lambda(SDKFilter* p_filter);
   void sdk_stream_update_reuse_part_lambda(SDKFilter* p_filter);
@@ -367,14 +478,21 @@ private:
   ThreadAbstract* threadHandle;
 
   //! Frame-related.
-  uint16_t seq_num;
-  uint32_t ackFrameStatus;
-  bool     broadcastFrameStatus;
+  uint16_t      seq_num;
+  uint32_t      ackFrameStatus;
+  bool          broadcastFrameStatus;
+  FrameTemplate templates[MAX_TEMPLATES];
 
   //! Buffer management
 
   int buf_read_pos;
   int read_len;
+
+  LinkStats stats;
+
+  //! Tracing: when the current chunk was read, id of the frame being parsed
+  uint64_t readTraceNs;
+  uint32_t rxTraceId;
 };
 
 } // namespace OSDK
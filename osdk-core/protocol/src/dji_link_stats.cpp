@@ -0,0 +1,180 @@
+/** @file dji_link_stats.cpp
+ *  @version 3.3
+ *  @date Jun 2017
+ *
+ *  @brief
+ *  Link health counters and latency histograms for the OPEN protocol
+ *
+ *  @copyright 2017 DJI. All rights reserved.
+ *
+ */
+
+#include "dji_link_stats.hpp"
+#include <string.h>
+
+#ifdef __linux__
+#include <time.h>
+#endif
+
+using namespace DJI;
+using namespace DJI::OSDK;
+
+static LinkCounter
+load(const LinkCounter* counter)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+#else
+  return *counter;
+#endif
+}
+
+static void
+copyHistogram(LinkHistogram* dst, const LinkHistogram* src)
+{
+  dst->count = load(&src->count);
+  dst->sumUs = load(&src->sumUs);
+  dst->maxUs = load(&src->maxUs);
+  for (int i = 0; i < LinkHistogram::BUCKET_NUMBER; ++i)
+    dst->bucket[i] = load(&src->bucket[i]);
+}
+
+LinkStats::LinkStats()
+{
+  reset();
+}
+
+void
+LinkStats::reset()
+{
+  memset(&counters, 0, sizeof(counters));
+  memset(key, 0, sizeof(key));
+}
+
+void
+LinkStats::snapshot(LinkSnapshot* out) const
+{
+  const LinkSnapshot* c = &counters;
+
+  out->bytesIn                = load(&c->bytesIn);
+  out->bytesOut               = load(&c->bytesOut);
+  out->sendFailures           = load(&c->sendFailures);
+  out->framesIn               = load(&c->framesIn);
+  out->framesOut              = load(&c->framesOut);
+  out->headerCrcErrors        = load(&c->headerCrcErrors);
+  out->dataCrcErrors          = load(&c->dataCrcErrors);
+  out->resyncBytes            = load(&c->resyncBytes);
+  out->filterOverflows        = load(&c->filterOverflows);
+  out->unmatchedAcks          = load(&c->unmatchedAcks);
+  out->retransmits            = load(&c->retransmits);
+  out->timeouts               = load(&c->timeouts);
+  out->sessionsExhausted      = load(&c->sessionsExhausted);
+  out->sessionsInUse          = load(&c->sessionsInUse);
+  out->sessionsMax            = load(&c->sessionsMax);
+  out->expired                = load(&c->expired);
+  out->superseded             = load(&c->superseded);
+  out->cancelled              = load(&c->cancelled);
+  out->callbackQueueDepth     = load(&c->callbackQueueDepth);
+  out->callbackQueueMax       = load(&c->callbackQueueMax);
+  out->callbackQueueOverflows = load(&c->callbackQueueOverflows);
+  copyHistogram(&out->ackRtt, &c->ackRtt);
+  copyHistogram(&out->callbackWait, &c->callbackWait);
+  copyHistogram(&out->callbackRun, &c->callbackRun);
+
+  out->commandNumber = 0;
+  for (int i = 0; i < LinkSnapshot::MAX_COMMAND; ++i)
+  {
+#if defined(__GNUC__) || defined(__clang__)
+    uint32_t k = __atomic_load_n(&key[i], __ATOMIC_ACQUIRE);
+#else
+    uint32_t k = key[i];
+#endif
+    if (!k)
+      break;
+
+    const CommandStats* src = &c->command[i];
+    CommandStats*       dst = &out->command[out->commandNumber++];
+    dst->cmdSet             = (k - 1) >> 8;
+    dst->cmdId              = (k - 1) & 0xFF;
+    dst->framesOut          = load(&src->framesOut);
+    dst->bytesOut           = load(&src->bytesOut);
+    dst->framesIn           = load(&src->framesIn);
+    dst->bytesIn            = load(&src->bytesIn);
+    dst->retransmits        = load(&src->retransmits);
+    dst->timeouts           = load(&src->timeouts);
+    dst->dropped            = load(&src->dropped);
+    copyHistogram(&dst->ackRtt, &src->ackRtt);
+  }
+
+  out->lineValid = false;
+  memset(&out->line, 0, sizeof(out->line));
+}
+
+uint64_t
+LinkStats::nowUs(HardDriver* driver)
+{
+#ifdef __linux__
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+  return (uint64_t)driver->getTimeStamp() * 1000;
+#endif
+}
+
+void
+LinkStats::setMax(LinkCounter* counter, LinkCounter value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  LinkCounter current = __atomic_load_n(counter, __ATOMIC_RELAXED);
+  while (value > current &&
+         !__atomic_compare_exchange_n(counter, &current, value, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+#else
+  if (value > *counter)
+    *counter = value;
+#endif
+}
+
+void
+LinkStats::record(LinkHistogram* histogram, uint64_t us)
+{
+  int bucket = 0;
+  for (uint64_t v = us; v && bucket < LinkHistogram::BUCKET_NUMBER - 1;
+       v >>= 1)
+    bucket++;
+
+  add(&histogram->bucket[bucket]);
+  add(&histogram->count);
+  add(&histogram->sumUs, us);
+  setMax(&histogram->maxUs, us);
+}
+
+CommandStats*
+LinkStats::command(uint8_t cmdSet, uint8_t cmdId)
+{
+  uint32_t wanted = ((uint32_t)cmdSet << 8 | cmdId) + 1;
+
+  for (int i = 0; i < LinkSnapshot::MAX_COMMAND; ++i)
+  {
+#if defined(__GNUC__) || defined(__clang__)
+    uint32_t k = __atomic_load_n(&key[i], __ATOMIC_ACQUIRE);
+    if (!k)
+    {
+      //! Claim the slot; if another thread won it, it may hold our key
+      __atomic_compare_exchange_n(&key[i], &k, wanted, false,
+                                  __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+      if (!k)
+        k = wanted;
+    }
+#else
+    uint32_t k = key[i];
+    if (!k)
+      k = key[i] = wanted;
+#endif
+    if (k == wanted)
+      return &counters.command[i];
+  }
+  return NULL;
+}
@@ -10,6 +10,8 @@
  */
 #include "dji_open_protocol.hpp"
 
+#include <stdlib.h>
+
 #ifdef STM32
 #include <stdio.h>
 #endif
@@ -18,7 +20,8 @@ using namespace DJI;
 using namespace DJI::OSDK;
 
 //! Constructor
-Protocol::Protocol(const char* device, uint32_t baudrate)
+Protocol::Protocol(const char* device, uint32_t baudrate,
+                   const ThreadConfig* threadConfig)
 {
 //! Step 1: Initialize Hardware Driver
 
@@ -31,7 +34,11 @@ Protocol::Protocol(const char* device, uint32_t baudrate)
   this->threadHandle = new STM32F4DataGuard;
 #elif defined(__linux__)
   this->serialDevice = new LinuxSerialDevice(device, baudrate);
-  this->threadHandle = new PosixThreadManager();
+  bool inherit = threadConfig && threadConfig->priorityInheritance;
+  if (LockProfiler::isEnabled())
+    this->threadHandle = new ProfiledThreadManager(inherit);
+  else
+    this->threadHandle = new PosixThreadManager(inherit);
 #endif
 
   //! Step 1.2: Initialize the hardware driver
@@ -42,6 +49,34 @@ Protocol::Protocol(const char* device, uint32_t baudrate)
   init(this->serialDevice, this->serialDevice->getMmu());
 }
 
+Protocol::Protocol(HardDriver* driver, const ThreadConfig* threadConfig)
+{
+  this->serialDevice = driver;
+#ifdef qt
+//! Add correct Qt thread manager here
+#elif STM32
+  this->threadHandle = new STM32F4DataGuard;
+#elif defined(__linux__)
+  bool inherit = threadConfig && threadConfig->priorityInheritance;
+  if (LockProfiler::isEnabled())
+    this->threadHandle = new ProfiledThreadManager(inherit);
+  else
+    this->threadHandle = new PosixThreadManager(inherit);
+#endif
+
+  this->serialDevice->init();
+  this->threadHandle->init();
+
+  init(this->serialDevice, this->serialDevice->getMmu());
+}
+
+Protocol::~Protocol()
+{
+  for (int i = 0; i < MAX_TEMPLATES; ++i)
+    free(templates[i].frame);
+  delete (this->serialDevice);
+}
+
 /***************************Init*******************************************/
 void
 Protocol::init(HardDriver* sDevice, MMU* mmuPtr, bool userCallbackThread)
@@ -53,7 +88,12 @@ Protocol::init(HardDriver* sDevice, MMU* mmuPtr, bool userCallbackThread)
   ackFrameStatus       = 11;
   broadcastFrameStatus = false;
 
+  readTraceNs = 0;
+  rxTraceId   = 0;
+  memset(templates, 0, sizeof(templates));
+
   filter.recvIndex  = 0;
+  filter.staleCount = 0;
   filter.reuseCount = 0;
   filter.reuseIndex = 0;
   filter.encode     = 0;
@@ -95,9 +135,11 @@ Protocol::setupSession()
   uint32_t i;
   for (i = 0; i < SESSION_TABLE_NUM; i++)
   {
-    CMDSessionTab[i].sessionID = i;
-    CMDSessionTab[i].usageFlag = 0;
-    CMDSessionTab[i].mmu       = (MMU_Tab*)NULL;
+    CMDSessionTab[i].sessionID    = i;
+    CMDSessionTab[i].usageFlag    = 0;
+    CMDSessionTab[i].mmu          = (MMU_Tab*)NULL;
+    CMDSessionTab[i].deadline     = 0;
+    CMDSessionTab[i].supersedeKey = 0;
   }
 
   for (i = 0; i < (SESSION_TABLE_NUM - 1); i++)
@@ -123,6 +165,7 @@ Protocol::allocSession(uint16_t session_id, uint16_t size)
     {
       /* session is busy */
       DERROR("session %d is busy\n", session_id);
+      LinkStats::add(&stats.counters.sessionsExhausted);
       return NULL;
     }
   }
@@ -141,9 +184,15 @@ Protocol::allocSession(uint16_t session_id, uint16_t size)
     else
     {
       CMDSessionTab[i].mmu = memoryTab;
+
+      LinkCounter inUse = 0;
+      for (uint32_t j = 0; j < SESSION_TABLE_NUM; ++j)
+        inUse += CMDSessionTab[j].usageFlag;
+      LinkStats::setMax(&stats.counters.sessionsMax, inUse);
       return &CMDSessionTab[i];
     }
   }
+  LinkStats::add(&stats.counters.sessionsExhausted);
   return NULL;
 }
 
@@ -252,22 +301,49 @@ Protocol::send(uint8_t session_mode, bool is_enc, const uint8_t cmd[],
 }
 
 //! v3: Minimal
-void
+int
 Protocol::send(Command* cmdContainer)
 {
-  sendInterface(cmdContainer);
+  return sendInterface(cmdContainer);
+}
+
+int
+Protocol::send(Command* cmdContainer, uint32_t* handle)
+{
+  return sendInterface(cmdContainer, handle);
 }
 
 int
-Protocol::sendInterface(Command* cmdContainer)
+Protocol::sendInterface(Command* cmdContainer, uint32_t* handle)
 {
   uint16_t    ret        = 0;
   CMDSession* cmdSession = (CMDSession*)NULL;
+  uint32_t    traceId    = 0;
+  if (DTRACE_ON())
+  {
+    traceId = Trace::newId();
+    Trace::record(TX_SUBMIT, traceId, this, cmdContainer->cmd_set,
+                  cmdContainer->cmd_id, cmdContainer->length);
+  }
   if (cmdContainer->length > PRO_PURE_DATA_MAX_SIZE)
   {
     DERROR("ERROR,length=%lu is over-sized\n", cmdContainer->length);
     return -1;
   }
+  if (handle)
+    *handle = 0;
+  if (cmdContainer->deadline &&
+      serialDevice->getTimeStamp() > cmdContainer->deadline)
+  {
+    DDEBUG("Command 0x%X/0x%X past its deadline\n", cmdContainer->cmd_set,
+           cmdContainer->cmd_id);
+    LinkStats::add(&stats.counters.expired);
+    CommandStats* command =
+      stats.command(cmdContainer->cmd_set, cmdContainer->cmd_id);
+    if (command)
+      LinkStats::add(&command->dropped);
+    return -1;
+  }
   /*! Switch on session to decide whether the command is requesting an ACK and
    * whether it is requesting
    *  guarantees on transmission
@@ -278,6 +354,7 @@ Protocol::sendInterface(Command* cmdContainer)
     case 0:
       //! No ACK required and no retries
       threadHandle->lockMemory();
+      supersede(cmdContainer->supersedeKey);
       cmdSession =
         allocSession(CMD_SESSION_0, calculateLength(cmdContainer->length,
                                                     cmdContainer->encrypt));
@@ -288,6 +365,9 @@ Protocol::sendInterface(Command* cmdContainer)
         DERROR("ERROR,there is not enough memory\n");
         return -1;
       }
+      cmdSession->cmd_set = cmdContainer->cmd_set;
+      cmdSession->cmd_id  = cmdContainer->cmd_id;
+
       //! Encrypt the data being sent
       ret =
         encrypt(cmdSession->mmu->pmem, cmdContainer->buf, cmdContainer->length,
@@ -301,9 +381,12 @@ Protocol::sendInterface(Command* cmdContainer)
       }
 
       DDEBUG("send data in session mode 0\n");
+      DTRACE(TX_ENCRYPTED, traceId, this);
+      countCommandOut(cmdContainer->cmd_set, cmdContainer->cmd_id,
+                      cmdSession->mmu->pmem);
 
       //! Actually send the data
-      sendData(cmdSession->mmu->pmem);
+      sendData(cmdSession->mmu->pmem, traceId);
       seq_num++;
       freeSession(cmdSession);
       threadHandle->freeMemory();
@@ -312,6 +395,7 @@ Protocol::sendInterface(Command* cmdContainer)
     case 1:
       //! ACK required; Session 1; will retry until failure
       threadHandle->lockMemory();
+      supersede(cmdContainer->supersedeKey);
       cmdSession =
         allocSession(CMD_SESSION_1, calculateLength(cmdContainer->length,
                                                     cmdContainer->encrypt));
@@ -340,19 +424,31 @@ Protocol::sendInterface(Command* cmdContainer)
       //@todo replace with a bool
       cmdSession->isCallback = cmdContainer->isCallback;
       cmdSession->callbackID = cmdContainer->callbackID;
+      cmdSession->cmd_set    = cmdContainer->cmd_set;
+      cmdSession->cmd_id     = cmdContainer->cmd_id;
       cmdSession->timeout =
         (cmdContainer->timeout > POLL_TICK) ? cmdContainer->timeout : POLL_TICK;
       cmdSession->preTimestamp = serialDevice->getTimeStamp();
+      cmdSession->sentUs       = LinkStats::nowUs(serialDevice);
       cmdSession->sent         = 1;
       cmdSession->retry        = 1;
+      cmdSession->traceId      = traceId;
+      cmdSession->deadline     = cmdContainer->deadline;
+      cmdSession->supersedeKey = cmdContainer->supersedeKey;
+      if (handle)
+        *handle = cmdSession->preSeqNum << 5 | cmdSession->sessionID;
       DDEBUG("sending session %d\n", cmdSession->sessionID);
-      sendData(cmdSession->mmu->pmem);
+      DTRACE(TX_ENCRYPTED, traceId, this);
+      countCommandOut(cmdContainer->cmd_set, cmdContainer->cmd_id,
+                      cmdSession->mmu->pmem);
+      sendData(cmdSession->mmu->pmem, traceId);
       threadHandle->freeMemory();
       break;
 
     case 2:
       //! ACK required, Sessions 2 - END; no guarantees and no retries.
       threadHandle->lockMemory();
+      supersede(cmdContainer->supersedeKey);
       cmdSession =
         allocSession(CMD_SESSION_AUTO, calculateLength(cmdContainer->length,
                                                        cmdContainer->encrypt));
@@ -391,10 +487,19 @@ Protocol::sendInterface(Command* cmdContainer)
       cmdSession->timeout =
         (cmdContainer->timeout > POLL_TICK) ? cmdContainer->timeout : POLL_TICK;
       cmdSession->preTimestamp = serialDevice->getTimeStamp();
+      cmdSession->sentUs       = LinkStats::nowUs(serialDevice);
       cmdSession->sent         = 1;
       cmdSession->retry        = cmdContainer->retry;
+      cmdSession->traceId      = traceId;
+      cmdSession->deadline     = cmdContainer->deadline;
+      cmdSession->supersedeKey = cmdContainer->supersedeKey;
+      if (handle)
+        *handle = cmdSession->preSeqNum << 5 | cmdSession->sessionID;
       DDEBUG("Sending session %d\n", cmdSession->sessionID);
-      sendData(cmdSession->mmu->pmem);
+      DTRACE(TX_ENCRYPTED, traceId, this);
+      countCommandOut(cmdContainer->cmd_set, cmdContainer->cmd_id,
+                      cmdSession->mmu->pmem);
+      sendData(cmdSession->mmu->pmem, traceId);
       threadHandle->freeMemory();
       break;
     default:
@@ -404,8 +509,167 @@ Protocol::sendInterface(Command* cmdContainer)
   return 0;
 }
 
+int
+Protocol::sendSetpoint(const uint8_t cmd[], bool is_enc, const void* pdata,
+                       size_t len)
+{
+  uint8_t data[SET_CMD_SIZE + PRO_PURE_DATA_MAX_SIZE];
+  Command cmdContainer;
+  if (len + SET_CMD_SIZE > PRO_PURE_DATA_MAX_SIZE)
+  {
+    DERROR("ERROR,length=%lu is over-sized\n", len + SET_CMD_SIZE);
+    return -1;
+  }
+  data[0] = cmd[0];
+  data[1] = cmd[1];
+  memcpy(data + SET_CMD_SIZE, pdata, len);
+
+  cmdContainer.sessionMode  = 0;
+  cmdContainer.encrypt      = is_enc ? 1 : 0;
+  cmdContainer.retry        = 0;
+  cmdContainer.timeout      = 0;
+  cmdContainer.length       = len + SET_CMD_SIZE;
+  cmdContainer.buf          = data;
+  cmdContainer.cmd_set      = cmd[0];
+  cmdContainer.cmd_id       = cmd[1];
+  cmdContainer.isCallback   = false;
+  cmdContainer.callbackID   = 0;
+  cmdContainer.supersedeKey = streamKey(cmd);
+  cmdContainer.deadline =
+    serialDevice->getTimeStamp() + SETPOINT_LIFETIME_MS;
+  return sendInterface(&cmdContainer);
+}
+
+//! Header bytes before the sequence number; they never change in a template
+static const int TEMPLATE_PREFIX = sizeof(Header) - 2 * sizeof(uint16_t);
+
+int
+Protocol::registerTemplate(const uint8_t cmd[], size_t len,
+                           uint32_t supersedeKey)
+{
+  if (len + SET_CMD_SIZE > PRO_PURE_DATA_MAX_SIZE)
+  {
+    DERROR("ERROR,length=%lu is over-sized\n", len + SET_CMD_SIZE);
+    return -1;
+  }
+  uint16_t size  = calculateLength(len + SET_CMD_SIZE, 0);
+  uint8_t* frame = (uint8_t*)malloc(size);
+  if (frame == NULL)
+  {
+    DERROR("ERROR,there is not enough memory\n");
+    return -1;
+  }
+
+  //! Built once the slow way; the payload is zero until the first send
+  uint8_t data[SET_CMD_SIZE + PRO_PURE_DATA_MAX_SIZE];
+  memset(data, 0, len + SET_CMD_SIZE);
+  data[0] = cmd[0];
+  data[1] = cmd[1];
+  encrypt(frame, data, len + SET_CMD_SIZE, 0, 0, CMD_SESSION_0, 0);
+
+  uint16_t crc16 = CRC_INIT;
+  uint32_t crc32 = CRC_INIT;
+  for (int i = 0; i < TEMPLATE_PREFIX; ++i)
+  {
+    crc16 = crc16_update(crc16, frame[i]);
+    crc32 = crc32_update(crc32, frame[i]);
+  }
+
+  threadHandle->lockMemory();
+  int handle = -1;
+  for (int i = 0; i < MAX_TEMPLATES && handle < 0; ++i)
+  {
+    if (templates[i].frame == NULL)
+    {
+      templates[i].frame         = frame;
+      templates[i].payloadLength = len;
+      templates[i].crc16Prefix   = crc16;
+      templates[i].crc32Prefix   = crc32;
+      templates[i].supersedeKey  = supersedeKey;
+      handle                     = i;
+    }
+  }
+  threadHandle->freeMemory();
+
+  if (handle < 0)
+  {
+    DERROR("No free frame template\n");
+    free(frame);
+  }
+  return handle;
+}
+
+int
+Protocol::sendTemplate(int handle, const void* payload)
+{
+  //! Checked on every send: encryption may be turned on after registration
+  if (handle < 0 || handle >= MAX_TEMPLATES || DJI::OSDK::encrypt)
+    return -1;
+
+  uint32_t traceId = 0;
+  threadHandle->lockMemory();
+  FrameTemplate* t     = &templates[handle];
+  uint8_t*       frame = t->frame;
+  if (frame == NULL)
+  {
+    threadHandle->freeMemory();
+    return -1;
+  }
+  Header*  header = (Header*)frame;
+  uint8_t* data   = frame + sizeof(Header);
+  if (DTRACE_ON())
+  {
+    traceId = Trace::newId();
+    Trace::record(TX_SUBMIT, traceId, this, data[0], data[1],
+                  t->payloadLength + SET_CMD_SIZE);
+  }
+  if (payload)
+    memcpy(data + SET_CMD_SIZE, payload, t->payloadLength);
+  header->sequenceNumber = seq_num++;
+
+  //! Both CRCs resume after the fixed header bytes
+  uint16_t crc16 = t->crc16Prefix;
+  for (int i = TEMPLATE_PREFIX; i < CRCHeadLen; ++i)
+    crc16 = crc16_update(crc16, frame[i]);
+  header->crc = crc16;
+
+  uint32_t crc32 = t->crc32Prefix;
+  int      end   = header->length - CRCData;
+  for (int i = TEMPLATE_PREFIX; i < end; ++i)
+    crc32 = crc32_update(crc32, frame[i]);
+  _SDK_U32_SET(frame + end, crc32);
+
+  supersede(t->supersedeKey);
+  //! For the probes in sendData(), as allocSession() would
+  CMDSessionTab[CMD_SESSION_0].cmd_set = data[0];
+  CMDSessionTab[CMD_SESSION_0].cmd_id  = data[1];
+  DTRACE(TX_ENCRYPTED, traceId, this);
+  countCommandOut(data[0], data[1], frame);
+  sendData(frame, traceId);
+  threadHandle->freeMemory();
+  return 0;
+}
+
+void
+Protocol::releaseTemplate(int handle)
+{
+  if (handle < 0 || handle >= MAX_TEMPLATES)
+    return;
+  threadHandle->lockMemory();
+  free(templates[handle].frame);
+  templates[handle].frame = NULL;
+  threadHandle->freeMemory();
+}
+
+uint32_t
+Protocol::streamKey(const uint8_t cmd[])
+{
+  //! Above every 16-bit key a caller would pick by hand
+  return 0x10000 | cmd[0] << 8 | cmd[1];
+}
+
 void
-Protocol::sendData(uint8_t* buf)
+Protocol::sendData(uint8_t* buf, uint32_t traceId)
 {
   size_t  ans;
   Header* pHeader = (Header*)buf;
@@ -414,12 +678,43 @@ Protocol::sendData(uint8_t* buf)
   printFrame(serialDevice, pHeader, true);
 #endif
 
+  //! ACKs we send answer the remote side; they have no command of ours
+  DPROBE(send_data,
+         pHeader->isAck ? 0 : CMDSessionTab[pHeader->sessionID].cmd_set,
+         pHeader->isAck ? 0 : CMDSessionTab[pHeader->sessionID].cmd_id,
+         pHeader->sessionID, pHeader->sequenceNumber, pHeader->length, this);
+
   //! Serial Device call: last link in the send pipeline
+  DTRACE(TX_WRITE, traceId, this, 0, 0, pHeader->length);
   ans = serialDevice->send(buf, pHeader->length);
+  DTRACE(TX_WRITTEN, traceId, this, 0, 0, ans);
   if (ans == 0)
     DSTATUS("Port did not send");
   if (ans == (size_t)-1)
     DERROR("Port closed");
+
+  if (ans == 0 || ans == (size_t)-1)
+  {
+    LinkStats::add(&stats.counters.sendFailures);
+    return;
+  }
+  LinkStats::add(&stats.counters.framesOut);
+  LinkStats::add(&stats.counters.bytesOut, ans);
+}
+
+void
+Protocol::countCommandOut(uint8_t cmdSet, uint8_t cmdId, uint8_t* buf)
+{
+  Header* header = (Header*)buf;
+  DPROBE(send_interface, cmdSet, cmdId, header->sessionID,
+         header->sequenceNumber, header->length, this);
+
+  CommandStats* command = stats.command(cmdSet, cmdId);
+  if (command)
+  {
+    LinkStats::add(&command->framesOut);
+    LinkStats::add(&command->bytesOut, ((Header*)buf)->length);
+  }
 }
 
 //! Session management for the send pipeline: Poll
@@ -429,6 +724,8 @@ Protocol::sendPoll()
 {
   uint8_t i;
   time_ms curTimestamp;
+  //! Stale frames are not worth the link time of another retransmission
+  expireSessions();
   for (i = 1; i < SESSION_TABLE_NUM; i++)
   {
     if (CMDSessionTab[i].usageFlag == 1)
@@ -444,21 +741,28 @@ Protocol::sendPoll()
           {
             DSTATUS("Sending timeout, Free session %d\n",
                     CMDSessionTab[i].sessionID);
+            countRetry(&CMDSessionTab[i], false);
             freeSession(&CMDSessionTab[i]);
           }
           else
           {
             DDEBUG("Retry session %d\n", CMDSessionTab[i].sessionID);
-            sendData(CMDSessionTab[i].mmu->pmem);
+            countRetry(&CMDSessionTab[i], true);
+            DTRACE(TX_RETRANSMIT, CMDSessionTab[i].traceId, this);
+            sendData(CMDSessionTab[i].mmu->pmem, CMDSessionTab[i].traceId);
             CMDSessionTab[i].preTimestamp = curTimestamp;
+            CMDSessionTab[i].sentUs       = LinkStats::nowUs(serialDevice);
             CMDSessionTab[i].sent++;
           }
         }
         else
         {
           DDEBUG("Send once %d\n", i);
-          sendData(CMDSessionTab[i].mmu->pmem);
+          countRetry(&CMDSessionTab[i], true);
+          DTRACE(TX_RETRANSMIT, CMDSessionTab[i].traceId, this);
+          sendData(CMDSessionTab[i].mmu->pmem, CMDSessionTab[i].traceId);
           CMDSessionTab[i].preTimestamp = curTimestamp;
+          CMDSessionTab[i].sentUs       = LinkStats::nowUs(serialDevice);
         }
         threadHandle->freeMemory();
       }
@@ -471,6 +775,115 @@ Protocol::sendPoll()
   //! @note Add auto resendpoll
 }
 
+void
+Protocol::expireSessions()
+{
+  time_ms curTimestamp = serialDevice->getTimeStamp();
+  for (uint8_t i = 1; i < SESSION_TABLE_NUM; i++)
+  {
+    if (CMDSessionTab[i].usageFlag == 1 && CMDSessionTab[i].deadline &&
+        curTimestamp > CMDSessionTab[i].deadline)
+    {
+      //! Checked again under the lock: the ACK may have freed it meanwhile
+      threadHandle->lockMemory();
+      if (CMDSessionTab[i].usageFlag == 1 && CMDSessionTab[i].deadline &&
+          curTimestamp > CMDSessionTab[i].deadline)
+        dropSession(&CMDSessionTab[i], &stats.counters.expired);
+      threadHandle->freeMemory();
+    }
+  }
+}
+
+bool
+Protocol::releaseSession(int callbackID)
+{
+  bool released = false;
+
+  threadHandle->lockMemory();
+  for (uint8_t i = 2; i < SESSION_TABLE_NUM; i++)
+  {
+    if (CMDSessionTab[i].usageFlag == 1 && CMDSessionTab[i].isCallback &&
+        CMDSessionTab[i].callbackID == callbackID)
+    {
+      DDEBUG("Release session %d\n", CMDSessionTab[i].sessionID);
+      countRetry(&CMDSessionTab[i], false);
+      freeSession(&CMDSessionTab[i]);
+      released = true;
+      break;
+    }
+  }
+  threadHandle->freeMemory();
+  return released;
+}
+
+bool
+Protocol::cancel(uint32_t handle)
+{
+  uint32_t id       = handle & 0x1F;
+  bool     released = false;
+  if (id == 0)
+    return false;
+
+  threadHandle->lockMemory();
+  CMDSession* session = &CMDSessionTab[id];
+  //! The sequence number tells a reused session from the one handed out
+  if (session->usageFlag == 1 && session->preSeqNum == handle >> 5)
+  {
+    dropSession(session, &stats.counters.cancelled);
+    released = true;
+  }
+  threadHandle->freeMemory();
+  return released;
+}
+
+void
+Protocol::supersede(uint32_t key)
+{
+  if (key == 0)
+    return;
+  for (uint8_t i = 1; i < SESSION_TABLE_NUM; i++)
+  {
+    if (CMDSessionTab[i].usageFlag == 1 &&
+        CMDSessionTab[i].supersedeKey == key)
+      dropSession(&CMDSessionTab[i], &stats.counters.superseded);
+  }
+}
+
+void
+Protocol::dropSession(CMDSession* session, LinkCounter* reason)
+{
+  DDEBUG("Drop stale session %d\n", session->sessionID);
+  LinkStats::add(reason);
+  CommandStats* command = stats.command(session->cmd_set, session->cmd_id);
+  if (command)
+    LinkStats::add(&command->dropped);
+  freeSession(session);
+}
+
+void
+Protocol::countRetry(CMDSession* session, bool retransmit)
+{
+  Header* header = (Header*)session->mmu->pmem;
+  if (retransmit)
+  {
+    DPROBE(retransmit, session->cmd_set, session->cmd_id, session->sessionID,
+           header->sequenceNumber, header->length, this);
+  }
+  else
+  {
+    DPROBE(timeout, session->cmd_set, session->cmd_id, session->sessionID,
+           header->sequenceNumber, header->length, this);
+  }
+
+  LinkCounter*  total   = retransmit ? &stats.counters.retransmits
+                                     : &stats.counters.timeouts;
+  CommandStats* command = stats.command(session->cmd_set, session->cmd_id);
+
+  LinkStats::add(total);
+  if (command)
+    LinkStats::add(retransmit ? &command->retransmits : &command->timeouts);
+}
+
 /*******************************Receive
  * Pipeline*************************************/
 
@@ -492,6 +905,18 @@ Protocol::receive()
   return receiveFrame;
 }
 
+bool
+Protocol::pollFrame(RecvContainer* frame)
+{
+  return readPoll(frame);
+}
+
+bool
+Protocol::hasBufferedData() const
+{
+  return buf_read_pos < read_len;
+}
+
 //! Step 1
 bool
 Protocol::readPoll(RecvContainer* allocatedFramePtr)
@@ -504,6 +929,12 @@ Protocol::readPoll(RecvContainer* allocatedFramePtr)
   {
     this->buf_read_pos = 0;
     this->read_len     = serialDevice->readall(this->buf, BUFFER_SIZE);
+    if (this->read_len > 0)
+    {
+      LinkStats::add(&stats.counters.bytesIn, this->read_len);
+      if (DTRACE_ON())
+        readTraceNs = Trace::nowNs();
+    }
   }
 
 #ifdef API_BUFFER_DATA
@@ -520,6 +951,9 @@ Protocol::readPoll(RecvContainer* allocatedFramePtr)
     isFrame = byteHandler(buf[this->buf_read_pos], allocatedFramePtr);
     if (isFrame)
     {
+      //! The byte that completed the frame is consumed; resuming on it would
+      //! feed it to the parser again as the start of the next frame
+      this->buf_read_pos++;
       return isFrame;
     }
   }
@@ -605,8 +1039,12 @@ Protocol::storeData(SDKFilter* p_filter, uint8_t in_data)
   else
   {
     DERROR("buffer overflow");
+    LinkStats::add(&stats.counters.filterOverflows);
+    LinkStats::add(&stats.counters.resyncBytes,
+                   p_filter->recvIndex - p_filter->staleCount);
     memset(p_filter->recvBuf, 0, p_filter->recvIndex);
-    p_filter->recvIndex = 0;
+    p_filter->recvIndex  = 0;
+    p_filter->staleCount = 0;
   }
 }
 
@@ -629,6 +1067,12 @@ Protocol::checkStream(SDKFilter* p_filter, RecvContainer* allocatedRecvObject)
   }
   else if (p_filter->recvIndex == p_head->length)
   {
+    if (DTRACE_ON())
+    {
+      rxTraceId = Trace::newId();
+      Trace::record(RX_READ, rxTraceId, this, 0, 0, 0, readTraceNs);
+      Trace::record(RX_FRAME, rxTraceId, this, 0, 0, p_head->length);
+    }
     isFrame = verifyData(p_filter, allocatedRecvObject);
   }
   return isFrame;
@@ -647,6 +1091,7 @@ Protocol::verifyHead(SDKFilter* p_filter, RecvContainer* allocatedRecvObject)
       (p_head->reserved1 == 0) &&
       (_SDK_CALC_CRC_HEAD(p_head, sizeof(Header)) == 0))
   {
+    p_filter->staleCount = 0;
     // check if this head is a ack or simple package
     if (p_head->length == sizeof(Header))
     {
@@ -655,6 +1100,20 @@ Protocol::verifyHead(SDKFilter* p_filter, RecvContainer* allocatedRecvObject)
   }
   else
   {
+    //! A SOF with a bad header is a corrupted frame, anything else is noise
+    //! between frames; either way one byte goes
+    if (p_filter->staleCount)
+      p_filter->staleCount--;
+    else
+    {
+      if (p_head->sof == Protocol::SOF)
+      {
+        LinkStats::add(&stats.counters.headerCrcErrors);
+        DPROBE(head_crc_fail, 0, 0, p_head->sessionID, p_head->sequenceNumber,
+               p_head->length, this);
+      }
+      LinkStats::add(&stats.counters.resyncBytes);
+    }
     sdk_stream_shift_data_lambda(p_filter);
   }
   return isFrame;
@@ -671,11 +1130,17 @@ Protocol::verifyData(SDKFilter* p_filter, RecvContainer* allocatedRecvObject)
 
   if (_SDK_CALC_CRC_TAIL(p_head, p_head->length) == 0)
   {
+    DTRACE(RX_CRC_OK, rxTraceId, this);
     isFrame = callApp(p_filter, allocatedRecvObject);
   }
   else
   {
     //! @note data crc fail, re-use the data part
+    LinkStats::add(&stats.counters.dataCrcErrors);
+    //! The command bytes may still be encrypted, so none is reported
+    DPROBE(data_crc_fail, 0, 0, p_head->sessionID, p_head->sequenceNumber,
+           p_head->length, this);
+    LinkStats::add(&stats.counters.resyncBytes);
     sdk_stream_update_reuse_part_lambda(p_filter);
   }
   return isFrame;
@@ -686,12 +1151,26 @@ bool
 Protocol::callApp(SDKFilter* p_filter, RecvContainer* allocatedRecvObject)
 {
   // pass current data to handler
-  Header* p_head = (Header*)p_filter->recvBuf;
+  Header*  p_head    = (Header*)p_filter->recvBuf;
+  uint8_t  sessionID = p_head->sessionID;
+  uint16_t seqNumber = p_head->sequenceNumber;
 
+  LinkStats::add(&stats.counters.framesIn);
   encodeData(p_filter, p_head, aes256_decrypt_ecb);
   bool isFrame = appHandler((Header*)p_filter->recvBuf, allocatedRecvObject);
   sdk_stream_prepare_lambda(p_filter);
 
+  if (isFrame)
+  {
+    allocatedRecvObject->dispatchInfo.traceId   = rxTraceId;
+    allocatedRecvObject->dispatchInfo.sessionID = sessionID;
+    allocatedRecvObject->dispatchInfo.seqNumber = seqNumber;
+    DTRACE(RX_DECRYPTED, rxTraceId, this,
+           allocatedRecvObject->recvInfo.cmd_set,
+           allocatedRecvObject->recvInfo.cmd_id);
+  }
+  rxTraceId = 0;
+
   return isFrame;
 }
 
@@ -724,6 +1203,15 @@ Protocol::appHandler(Header* protocolHeader, RecvContainer* allocatedRecvObject)
             p2protocolHeader->sequenceNumber == protocolHeader->sequenceNumber)
         {
           DDEBUG("Recv Session %d ACK\n", p2protocolHeader->sessionID);
+          countAck(&CMDSessionTab[protocolHeader->sessionID],
+                   protocolHeader->length);
+          DPROBE(ack_match, CMDSessionTab[protocolHeader->sessionID].cmd_set,
+                 CMDSessionTab[protocolHeader->sessionID].cmd_id,
+                 protocolHeader->sessionID, protocolHeader->sequenceNumber,
+                 protocolHeader->length, this);
+          DTRACE(TX_ACKED, CMDSessionTab[protocolHeader->sessionID].traceId,
+                 this, CMDSessionTab[protocolHeader->sessionID].cmd_set,
+                 CMDSessionTab[protocolHeader->sessionID].cmd_id, rxTraceId);
 
           //! Create receive container for error code management
           allocatedRecvObject->dispatchInfo.isAck = true;
@@ -757,8 +1245,13 @@ Protocol::appHandler(Header* protocolHeader, RecvContainer* allocatedRecvObject)
         else
         {
           threadHandle->freeMemory();
+          LinkStats::add(&stats.counters.unmatchedAcks);
         }
       }
+      else
+      {
+        LinkStats::add(&stats.counters.unmatchedAcks);
+      }
     }
   }
   else
@@ -845,6 +1338,26 @@ Protocol::allocateACK(Header* protocolHeader)
   return recvData;
 }
 
+void
+Protocol::countAck(CMDSession* session, uint16_t length)
+{
+  CommandStats* command = stats.command(session->cmd_set, session->cmd_id);
+  if (command)
+  {
+    LinkStats::add(&command->framesIn);
+    LinkStats::add(&command->bytesIn, length);
+  }
+
+  //! Karn: the ACK of a retransmitted frame cannot tell which copy it answers
+  if (session->sent == 1)
+  {
+    uint64_t rtt = LinkStats::nowUs(serialDevice) - session->sentUs;
+    LinkStats::record(&stats.counters.ackRtt, rtt);
+    if (command)
+      LinkStats::record(&command->ackRtt, rtt);
+  }
+}
+
 void
 Protocol::setACKFrameStatus(uint32_t usageFlag)
 {
@@ -883,6 +1396,14 @@ Protocol::recvReqData(Header*        protocolHeader,
   allocatedRecvObject->recvInfo.cmd_set = getCmdSet(protocolHeader);
   allocatedRecvObject->recvInfo.cmd_id  = getCmdCode(protocolHeader);
   allocatedRecvObject->recvInfo.len     = protocolHeader->length;
+
+  CommandStats* command = stats.command(allocatedRecvObject->recvInfo.cmd_set,
+                                        allocatedRecvObject->recvInfo.cmd_id);
+  if (command)
+  {
+    LinkStats::add(&command->framesIn);
+    LinkStats::add(&command->bytesIn, protocolHeader->length);
+  }
   //@todo: Please monitor to make sure the length is correct
   memcpy(allocatedRecvObject->recvData.raw_ack_array, payload,
          (protocolHeader->length - (Protocol::PackageMin + 2)));
@@ -1015,7 +1536,8 @@ Protocol::sdk_stream_prepare_lambda(SDKFilter* p_filter)
 
   memmove(p_filter->recvBuf, p_filter->recvBuf + index_of_move, bytes_to_move);
   memset(p_filter->recvBuf + bytes_to_move, 0, index_of_move);
-  p_filter->recvIndex = bytes_to_move;
+  p_filter->recvIndex  = bytes_to_move;
+  p_filter->staleCount = bytes_to_move;
 }
 
 void
@@ -1174,6 +1696,23 @@ Protocol::getThreadHandle() const
   return this->threadHandle;
 }
 
+LinkStats*
+Protocol::getLinkStats()
+{
+  return &stats;
+}
+
+void
+Protocol::getLinkSnapshot(LinkSnapshot* snapshot)
+{
+  stats.snapshot(snapshot);
+
+  snapshot->sessionsInUse = 0;
+  for (uint32_t i = 0; i < SESSION_TABLE_NUM; ++i)
+    snapshot->sessionsInUse += CMDSessionTab[i].usageFlag;
+  snapshot->lineValid = serialDevice->getLineCounters(&snapshot->line);
+}
+
 /**********************************Filter*******************************************/
 void
 Protocol::setKey(const char* key)
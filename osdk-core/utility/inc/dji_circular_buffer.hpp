@@ -29,10 +29,15 @@ namespace OSDK
 class CircularBuffer
 {
 public:
+  //! @return 1 if an entry was discarded: the oldest, to make room, or this
+  //! one if the queue could not be allocated; else 0
   int cbPush(CircularBuffer* CBuffer, VehicleCallBackHandler data,
-             RecvContainer data2);
+             RecvContainer data2, uint64_t stamp = 0);
+  //! @param stamp if not NULL, receives the stamp given to cbPush
   int cbPop(CircularBuffer* CBuffer, VehicleCallBackHandler* data,
-            RecvContainer* data2);
+            RecvContainer* data2, uint64_t* stamp = 0);
+  //! Entries waiting to be popped
+  int getDepth() const;
   CircularBuffer();
   ~CircularBuffer();
   int head;
@@ -41,6 +46,7 @@ public:
 private:
   VehicleCallBackHandler* buffer;
   RecvContainer*          buffer2;
+  uint64_t*               stamps;
   const int               maxLen;
 }; // class CircularBuffer
 
@@ -0,0 +1,43 @@
+/** @file dji_probe.hpp
+ *  @version 3.3
+ *  @date Jun 2017
+ *
+ *  @brief USDT static probes for bpftrace, perf and SystemTap
+ *
+ *  @copyright 2017 DJI. All rights reserved.
+ *
+ */
+
+#ifndef DJI_PROBE_H
+#define DJI_PROBE_H
+
+#include <stdint.h>
+
+/*! @note Every probe is provider "djiosdk" and carries the same arguments:
+ *  arg0 cmd_set, arg1 cmd_id, arg2 session, arg3 sequence number,
+ *  arg4 length in bytes, arg5 the Protocol (link) it belongs to.
+ *  Unattached, a probe is a single nop; the arguments are plain loads.
+ *  OSDK_USDT is defined by the build when <sys/sdt.h> is available.
+ *  See sample/linux/bpftrace for example scripts.
+ */
+#ifdef OSDK_USDT
+#include <sys/sdt.h>
+#define DPROBE(_name_, _set_, _id_, _session_, _seq_, _len_, _link_)           \
+  DTRACE_PROBE6(djiosdk, _name_, (uint8_t)(_set_), (uint8_t)(_id_),            \
+                (uint32_t)(_session_), (uint32_t)(_seq_), (uint32_t)(_len_),   \
+                (const void*)(_link_))
+#else
+//! Still evaluated, so variables kept only for a probe count as used
+#define DPROBE(_name_, _set_, _id_, _session_, _seq_, _len_, _link_)           \
+  do                                                                           \
+  {                                                                            \
+    (void)(_set_);                                                             \
+    (void)(_id_);                                                              \
+    (void)(_session_);                                                         \
+    (void)(_seq_);                                                             \
+    (void)(_len_);                                                             \
+    (void)(_link_);                                                            \
+  } while (0)
+#endif
+
+#endif // DJI_PROBE_H
@@ -0,0 +1,123 @@
+/** @file dji_trace.hpp
+ *  @version 3.3
+ *  @date Jun 2017
+ *
+ *  @brief Per-frame latency tracing with Chrome trace-event export
+ *
+ *  @copyright 2017 DJI. All rights reserved.
+ *
+ */
+
+#ifndef DJI_TRACE_H
+#define DJI_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//! @note Off by default: a disabled trace point is one load and one branch.
+//! Build with OSDK_DISABLE_TRACE to remove the trace points altogether.
+#ifdef OSDK_DISABLE_TRACE
+#define DTRACE_ON() (false)
+#else
+#define DTRACE_ON() (DJI::OSDK::Trace::enabled)
+#endif
+
+#define DTRACE(...)                                                            \
+  if (!DTRACE_ON())                                                            \
+  {                                                                            \
+  }                                                                            \
+  else                                                                         \
+    DJI::OSDK::Trace::record(__VA_ARGS__)
+
+namespace DJI
+{
+namespace OSDK
+{
+
+/*! @brief Where a frame is when a trace point fires
+ *  @details Receive points share the id handed out at RX_FRAME, send points
+ *  the id handed out at TX_SUBMIT.
+ */
+enum TracePoint
+{
+  RX_READ,           //! driver read that completed the frame
+  RX_FRAME,          //! all bytes of the frame are buffered
+  RX_CRC_OK,         //! header and data CRC verified
+  RX_DECRYPTED,      //! payload decrypted, cmd_set/cmd_id known
+  RX_DISPATCH,       //! Vehicle starts dispatching
+  RX_ENQUEUE,        //! non-blocking callback queued
+  RX_CALLBACK_START, //! user code entered
+  RX_CALLBACK_END,
+  TX_SUBMIT,      //! Protocol::send called
+  TX_ENCRYPTED,   //! frame built in its session
+  TX_WRITE,       //! handed to the driver
+  TX_WRITTEN,     //! driver returned
+  TX_RETRANSMIT,  //! session timed out, frame resent
+  TX_ACKED,       //! matching ACK received, arg is the ACK's receive id
+  TRACE_POINT_NUMBER
+};
+
+typedef struct TraceEvent
+{
+  uint64_t    timeNs;
+  const void* link; //! Protocol the frame belongs to
+  uint32_t    id;
+  uint32_t    arg;
+  uint32_t    thread;
+  uint16_t    point;
+  uint8_t     cmdSet;
+  uint8_t     cmdId;
+} TraceEvent;
+
+/*! @brief Process-wide flight recorder for trace points
+ *
+ *  @details Events go to a lock-free ring shared by all threads and links;
+ *  when it is full the oldest events are overwritten. Dump while running or
+ *  after stop().
+ */
+class Trace
+{
+public:
+  //! @param capacity events kept, rounded up to a power of 2
+  static bool start(size_t capacity = 65536);
+  //! Stop recording; the events stay available for dump
+  static void stop();
+
+  /*! @brief Write the recorded events as Chrome trace-event JSON
+   *  @details Loads in chrome://tracing and ui.perfetto.dev. Every frame is
+   *  an async slice from its first to its last point, with one nested slice
+   *  per step, named after the point that ends it.
+   */
+  static bool dumpChrome(const char* path);
+  //! Copy out the events still in the ring, oldest first
+  static size_t copyEvents(TraceEvent* events, size_t maxNumber);
+
+  static uint32_t newId();
+  //! @param timeNs 0 for now, else a timestamp taken earlier with nowNs()
+  static void record(int point, uint32_t id, const void* link,
+                     uint8_t cmdSet = 0, uint8_t cmdId = 0, uint32_t arg = 0,
+                     uint64_t timeNs = 0);
+  //! Monotonic clock in ns, 0 where the platform has none
+  static uint64_t nowNs();
+  static const char* getPointName(int point);
+
+public:
+  static volatile bool enabled;
+
+private:
+  typedef struct Slot
+  {
+    volatile uint64_t sequence; //! index + 1 once written, 0 while writing
+    TraceEvent        event;
+  } Slot;
+
+  static Slot*             slots;
+  static size_t            mask;
+  static volatile uint64_t head;
+  static volatile uint32_t lastId;
+};
+
+} // namespace OSDK
+} // namespace DJI
+
+#endif // DJI_TRACE_H
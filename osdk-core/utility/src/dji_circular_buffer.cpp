@@ -19,16 +19,30 @@ CircularBuffer::CircularBuffer()
   buffer =
     (VehicleCallBackHandler*)malloc(5000 * sizeof(VehicleCallBackHandler));
   buffer2 = (RecvContainer*)malloc(5000 * sizeof(RecvContainer));
+  stamps  = (uint64_t*)malloc(5000 * sizeof(uint64_t));
   head    = 0;
   tail    = 0;
+  if (!buffer || !buffer2 || !stamps)
+    DERROR("Lack of memory for the callback queue\n");
+}
+
+CircularBuffer::~CircularBuffer()
+{
+  free(buffer);
+  free(buffer2);
+  free(stamps);
 }
 
 int
 CircularBuffer::cbPush(CircularBuffer*                   CBuffer,
                        DJI::OSDK::VehicleCallBackHandler cbData,
-                       RecvContainer                     recvData)
+                       RecvContainer recvData, uint64_t stamp)
 {
-  int next = head + 1;
+  if (!buffer || !buffer2 || !stamps)
+    return 1;
+
+  int discarded = 0;
+  int next      = head + 1;
   if (next >= maxLen)
   {
     next = 0;
@@ -36,19 +50,23 @@ CircularBuffer::cbPush(CircularBuffer*                   CBuffer,
   //! Circular buffer is full, pop the old value and discard.
   if (next == tail)
   {
-    CBuffer->cbPop(CBuffer, &cbData, &recvData);
+    VehicleCallBackHandler oldData;
+    RecvContainer          oldRecv;
+    CBuffer->cbPop(CBuffer, &oldData, &oldRecv);
     DSTATUS("Warning: Circular Buffer Full. Discarded Callback from Tail \n");
+    discarded = 1;
   }
   buffer2[head] = recvData;
   buffer[head]  = cbData;
+  stamps[head]  = stamp;
   head          = next;
-  return 0;
+  return discarded;
 }
 
 int
 CircularBuffer::cbPop(CircularBuffer*                    CBuffer,
                       DJI::OSDK::VehicleCallBackHandler* cbData,
-                      RecvContainer*                     recvData)
+                      RecvContainer* recvData, uint64_t* stamp)
 {
   if (head == tail)
   {
@@ -57,6 +75,8 @@ CircularBuffer::cbPop(CircularBuffer*                    CBuffer,
   }
   *cbData   = buffer[tail];
   *recvData = buffer2[tail];
+  if (stamp)
+    *stamp = stamps[tail];
 
   //! Clear data
   memset(&buffer[tail], 0, sizeof(VehicleCallBackHandler));
@@ -68,3 +88,10 @@ CircularBuffer::cbPop(CircularBuffer*                    CBuffer,
   tail   = next;
   return 0;
 }
+
+int
+CircularBuffer::getDepth() const
+{
+  int depth = head - tail;
+  return depth < 0 ? depth + maxLen : depth;
+}
@@ -0,0 +1,262 @@
+/** @file dji_trace.cpp
+ *  @version 3.3
+ *  @date Jun 2017
+ *
+ *  @brief Per-frame latency tracing with Chrome trace-event export
+ *
+ *  @copyright 2017 DJI. All rights reserved.
+ *
+ */
+
+#include "dji_trace.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+using namespace DJI;
+using namespace DJI::OSDK;
+
+volatile bool     Trace::enabled = false;
+Trace::Slot*      Trace::slots   = NULL;
+size_t            Trace::mask    = 0;
+volatile uint64_t Trace::head    = 0;
+volatile uint32_t Trace::lastId  = 0;
+
+static const char* pointName[TRACE_POINT_NUMBER] = {
+  "read",    "frame", "crc",     "decrypt",  "dispatch",
+  "enqueue", "start", "callback", "submit",  "encrypt",
+  "write",   "written", "retransmit", "acked"
+};
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TRACE_LOAD(_p) __atomic_load_n((_p), __ATOMIC_ACQUIRE)
+#define TRACE_STORE(_p, _v) __atomic_store_n((_p), (_v), __ATOMIC_RELEASE)
+#define TRACE_ADD(_p, _v) __atomic_fetch_add((_p), (_v), __ATOMIC_RELAXED)
+#else
+#define TRACE_LOAD(_p) (*(_p))
+#define TRACE_STORE(_p, _v) (*(_p) = (_v))
+#define TRACE_ADD(_p, _v) ((*(_p) += (_v)) - (_v))
+#endif
+
+static uint32_t
+threadId()
+{
+#ifdef __linux__
+  static __thread uint32_t tid = 0;
+  if (!tid)
+    tid = syscall(SYS_gettid);
+  return tid;
+#else
+  return 0;
+#endif
+}
+
+bool
+Trace::start(size_t capacity)
+{
+  if (enabled)
+    return true;
+
+  //! The ring is never freed: a thread may still be inside record() when
+  //! tracing stops. Later starts reuse it at its first size.
+  if (!slots)
+  {
+    size_t size = 1;
+    while (size < capacity)
+      size <<= 1;
+    slots = (Slot*)calloc(size, sizeof(Slot));
+    if (!slots)
+      return false;
+    mask = size - 1;
+  }
+  else
+  {
+    memset(slots, 0, (mask + 1) * sizeof(Slot));
+  }
+
+  head    = 0;
+  enabled = true;
+  return true;
+}
+
+void
+Trace::stop()
+{
+  enabled = false;
+}
+
+uint32_t
+Trace::newId()
+{
+  uint32_t id = TRACE_ADD(&lastId, 1) + 1;
+  //! 0 means "no frame"
+  return id ? id : TRACE_ADD(&lastId, 1) + 1;
+}
+
+void
+Trace::record(int point, uint32_t id, const void* link, uint8_t cmdSet,
+              uint8_t cmdId, uint32_t arg, uint64_t timeNs)
+{
+  if (!slots)
+    return;
+
+  uint64_t index = TRACE_ADD(&head, 1);
+  Slot*    slot  = &slots[index & mask];
+
+  TRACE_STORE(&slot->sequence, 0);
+  slot->event.timeNs = timeNs ? timeNs : nowNs();
+  slot->event.link   = link;
+  slot->event.id     = id;
+  slot->event.arg    = arg;
+  slot->event.thread = threadId();
+  slot->event.point  = point;
+  slot->event.cmdSet = cmdSet;
+  slot->event.cmdId  = cmdId;
+  TRACE_STORE(&slot->sequence, index + 1);
+}
+
+uint64_t
+Trace::nowNs()
+{
+#ifdef __linux__
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#else
+  return 0;
+#endif
+}
+
+const char*
+Trace::getPointName(int point)
+{
+  if (point < 0 || point >= TRACE_POINT_NUMBER)
+    return "unknown";
+  return pointName[point];
+}
+
+size_t
+Trace::copyEvents(TraceEvent* events, size_t maxNumber)
+{
+  if (!slots)
+    return 0;
+
+  uint64_t end   = TRACE_LOAD(&head);
+  uint64_t begin = (end > mask + 1) ? end - (mask + 1) : 0;
+  if (end - begin > maxNumber)
+    begin = end - maxNumber;
+
+  size_t number = 0;
+  for (uint64_t i = begin; i < end; ++i)
+  {
+    Slot* slot = &slots[i & mask];
+    if (TRACE_LOAD(&slot->sequence) != i + 1)
+      continue; //! still being written, or already overwritten
+
+    events[number] = slot->event;
+    if (TRACE_LOAD(&slot->sequence) == i + 1)
+      number++;
+  }
+  return number;
+}
+
+static int
+compareEvent(const void* a, const void* b)
+{
+  const TraceEvent* x = (const TraceEvent*)a;
+  const TraceEvent* y = (const TraceEvent*)b;
+  if (x->id != y->id)
+    return x->id < y->id ? -1 : 1;
+  if (x->timeNs != y->timeNs)
+    return x->timeNs < y->timeNs ? -1 : 1;
+  return 0;
+}
+
+static void
+writeAsync(FILE* file, char phase, const char* name, const char* cat,
+           const TraceEvent* e, int pid, bool first)
+{
+  fprintf(file,
+          "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"id\":%u,"
+          "\"ts\":%llu.%03u,\"pid\":%d,\"tid\":%u",
+          first ? "" : ",", name, cat, phase, e->id,
+          (unsigned long long)(e->timeNs / 1000),
+          (unsigned)(e->timeNs % 1000), pid, e->thread);
+  if (phase == 'b')
+    fprintf(file, ",\"args\":{\"link\":\"%p\",\"arg\":%u}", e->link, e->arg);
+  fprintf(file, "}");
+}
+
+bool
+Trace::dumpChrome(const char* path)
+{
+  size_t      capacity = slots ? mask + 1 : 0;
+  TraceEvent* events   = (TraceEvent*)malloc((capacity + 1) * sizeof(TraceEvent));
+  FILE*       file     = fopen(path, "w");
+  if (!events || !file)
+  {
+    free(events);
+    if (file)
+      fclose(file);
+    return false;
+  }
+
+  size_t number = copyEvents(events, capacity);
+  qsort(events, number, sizeof(TraceEvent), compareEvent);
+
+#ifdef __linux__
+  int pid = getpid();
+#else
+  int pid = 1;
+#endif
+
+  bool first = true;
+  fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  for (size_t i = 0; i < number;)
+  {
+    size_t end = i + 1;
+    while (end < number && events[end].id == events[i].id)
+      end++;
+
+    if (!events[i].id)
+    {
+      i = end;
+      continue;
+    }
+
+    //! Name the frame after its command, once a point knows it
+    const TraceEvent* named = &events[i];
+    for (size_t k = i; k < end; ++k)
+    {
+      if (events[k].point == RX_DECRYPTED || events[k].point == TX_SUBMIT)
+        named = &events[k];
+    }
+    const char* cat = (events[i].point < TX_SUBMIT) ? "rx" : "tx";
+    char        name[32];
+    snprintf(name, sizeof(name), "%s 0x%02X/0x%02X", cat, named->cmdSet,
+             named->cmdId);
+
+    writeAsync(file, 'b', name, cat, &events[i], pid, first);
+    first = false;
+    for (size_t k = i + 1; k < end; ++k)
+    {
+      const char* step = getPointName(events[k].point);
+      writeAsync(file, 'b', step, cat, &events[k - 1], pid, false);
+      writeAsync(file, 'e', step, cat, &events[k], pid, false);
+    }
+    writeAsync(file, 'e', name, cat, &events[end - 1], pid, false);
+    i = end;
+  }
+  fprintf(file, "\n]}\n");
+
+  bool ok = (ferror(file) == 0);
+  fclose(file);
+  free(events);
+  return ok;
+}
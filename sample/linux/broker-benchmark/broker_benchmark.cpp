@@ -0,0 +1,244 @@
+/*! @file broker_benchmark.cpp
+ *  @version 3.3
+ *  @date Jun 05 2017
+ *
+ *  @brief
+ *  Command throughput of the broker with concurrent clients, measured over
+ *  a loopback link that ACKs every command at a simulated baud rate.
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#include "broker_benchmark.hpp"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace DJI::OSDK;
+
+static const char* const BENCH_SOCKET = "/tmp/djiosdk-broker-bench.sock";
+
+static uint64_t
+nowUs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+LoopbackFC::LoopbackFC(uint32_t baudRate)
+  : baudRate(baudRate)
+  , rxLen(0)
+{
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&ready, NULL);
+}
+
+LoopbackFC::~LoopbackFC()
+{
+  pthread_cond_destroy(&ready);
+  pthread_mutex_destroy(&lock);
+}
+
+void
+LoopbackFC::init()
+{
+}
+
+time_ms
+LoopbackFC::getTimeStamp()
+{
+  return nowUs() / 1000;
+}
+
+size_t
+LoopbackFC::send(const uint8_t* buf, size_t len)
+{
+  //! 10 bits per byte on the wire, both directions share the budget
+  if (baudRate)
+    usleep((useconds_t)(len * 10 * 1000000ULL / baudRate));
+
+  const Header* cmd = (const Header*)buf;
+  if (cmd->isAck || cmd->sessionID == 0)
+    return len;
+
+  uint8_t frame[sizeof(Header) + 2 + Protocol::CRCData];
+  memset(frame, 0, sizeof(frame));
+  Header* ack         = (Header*)frame;
+  ack->sof            = Protocol::SOF;
+  ack->length         = sizeof(frame);
+  ack->sessionID      = cmd->sessionID;
+  ack->isAck          = 1;
+  ack->sequenceNumber = cmd->sequenceNumber;
+  Protocol::calculateCRC(frame);
+
+  pthread_mutex_lock(&lock);
+  if (rxLen + sizeof(frame) <= sizeof(rx))
+  {
+    memcpy(rx + rxLen, frame, sizeof(frame));
+    rxLen += sizeof(frame);
+  }
+  pthread_cond_signal(&ready);
+  pthread_mutex_unlock(&lock);
+  return len;
+}
+
+size_t
+LoopbackFC::readall(uint8_t* buf, size_t maxlen)
+{
+  pthread_mutex_lock(&lock);
+  if (rxLen == 0)
+  {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += 10 * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&ready, &lock, &deadline);
+  }
+  size_t n = std::min(maxlen, rxLen);
+  memcpy(buf, rx, n);
+  memmove(rx, rx + n, rxLen - n);
+  rxLen -= n;
+  pthread_mutex_unlock(&lock);
+  return n;
+}
+
+typedef struct ClientTask
+{
+  int                   commands;
+  int                   window;
+  int                   acked;
+  int                   failed;
+  std::vector<uint64_t> latencyUs;
+} ClientTask;
+
+static void*
+clientCall(void* param)
+{
+  ClientTask*  task = (ClientTask*)param;
+  BrokerClient client;
+  if (!client.connect(BENCH_SOCKET))
+    return NULL;
+
+  std::vector<uint64_t> sentAt(task->commands, 0);
+  uint8_t               payload[4] = { 1, 2, 3, 4 };
+  int                   sent       = 0;
+  int                   done       = 0;
+
+  while (done < task->commands)
+  {
+    //! Keep the window full; queued requests go out as one message
+    while (sent < task->commands && sent - done < task->window)
+    {
+      sentAt[sent] = nowUs();
+      client.queue(OpenProtocol::CMDSet::MFIO::get, payload, sizeof(payload),
+                   sent, true, 500, 1);
+      sent++;
+    }
+    client.flush();
+
+    Broker::Reply reply;
+    uint8_t       data[MAX_INCOMING_DATA_SIZE];
+    if (!client.receive(&reply, data, sizeof(data), 2000))
+    {
+      task->failed += sent - done;
+      break;
+    }
+    if (reply.type == Broker::REPLY_PUSH)
+      continue;
+    if (reply.type == Broker::REPLY_ACK)
+    {
+      task->acked++;
+      task->latencyUs.push_back(nowUs() - sentAt[reply.tag]);
+    }
+    else
+    {
+      task->failed++;
+    }
+    done++;
+  }
+  return NULL;
+}
+
+bool
+runBrokerBenchmark(int clientNumber, int commandsPerClient, int window,
+                   uint32_t baudRate)
+{
+  Vehicle*      vehicle = new Vehicle(new LoopbackFC(baudRate), true);
+  VehicleBroker broker(vehicle);
+  if (!broker.start(BENCH_SOCKET))
+  {
+    return false;
+  }
+
+  std::vector<ClientTask> tasks(clientNumber);
+  std::vector<pthread_t>  threads(clientNumber);
+
+  uint64_t start = nowUs();
+  for (int i = 0; i < clientNumber; ++i)
+  {
+    tasks[i].commands = commandsPerClient;
+    tasks[i].window   = window;
+    tasks[i].acked    = 0;
+    tasks[i].failed   = 0;
+    pthread_create(&threads[i], NULL, clientCall, &tasks[i]);
+  }
+  for (int i = 0; i < clientNumber; ++i)
+  {
+    pthread_join(threads[i], NULL);
+  }
+  uint64_t elapsed = nowUs() - start;
+
+  Broker::Stats         stats = broker.getStats();
+  std::vector<uint64_t> all;
+  int                   acked = 0, failed = 0;
+  for (int i = 0; i < clientNumber; ++i)
+  {
+    acked += tasks[i].acked;
+    failed += tasks[i].failed;
+    all.insert(all.end(), tasks[i].latencyUs.begin(),
+               tasks[i].latencyUs.end());
+  }
+  std::sort(all.begin(), all.end());
+
+  std::cout << "clients            " << clientNumber << std::endl;
+  std::cout << "window per client  " << window << std::endl;
+  std::cout << "simulated baud     " << baudRate << std::endl;
+  std::cout << "acked / failed     " << acked << " / " << failed << std::endl;
+  std::cout << "elapsed            " << elapsed / 1000.0 << " ms" << std::endl;
+  std::cout << "throughput         " << acked * 1e6 / elapsed << " cmd/s"
+            << std::endl;
+  if (!all.empty())
+  {
+    std::cout << "latency p50 / p99  " << all[all.size() / 2] << " / "
+              << all[all.size() * 99 / 100] << " us" << std::endl;
+  }
+  std::cout << "requests per batch "
+            << (stats.batches ? (double)stats.requests / stats.batches : 0)
+            << std::endl;
+
+  broker.stop();
+  //! @note The read thread only leaves Protocol::receive() on a full frame,
+  //! so the vehicle is left to process teardown instead of being joined.
+  return failed == 0;
+}
+
+int
+main(int argc, char** argv)
+{
+  int      clients  = (argc > 1) ? atoi(argv[1]) : 8;
+  int      commands = (argc > 2) ? atoi(argv[2]) : 2000;
+  int      window   = (argc > 3) ? atoi(argv[3]) : 4;
+  uint32_t baudRate = (argc > 4) ? atoi(argv[4]) : 921600;
+
+  return runBrokerBenchmark(clients, commands, window, baudRate) ? 0 : -1;
+}
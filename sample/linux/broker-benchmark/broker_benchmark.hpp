@@ -0,0 +1,49 @@
+/*! @file broker_benchmark.hpp
+ *  @version 3.3
+ *  @date Jun 05 2017
+ *
+ *  @brief
+ *  Command throughput of the broker with concurrent clients, measured over
+ *  a loopback link that ACKs every command at a simulated baud rate.
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#ifndef DJIOSDK_BROKERBENCHMARK_HPP
+#define DJIOSDK_BROKERBENCHMARK_HPP
+
+// System Includes
+#include <iostream>
+#include <pthread.h>
+
+// DJI OSDK includes
+#include <dji_vehicle.hpp>
+#include <linux_broker.hpp>
+
+/*! @brief Flight-controller stand-in: every command frame that expects an
+ *  ACK is answered with a success ACK on the same session and sequence.
+ */
+class LoopbackFC : public DJI::OSDK::HardDriver
+{
+public:
+  LoopbackFC(uint32_t baudRate);
+  ~LoopbackFC();
+
+  void    init();
+  DJI::OSDK::time_ms getTimeStamp();
+  size_t send(const uint8_t* buf, size_t len);
+  size_t readall(uint8_t* buf, size_t maxlen);
+
+private:
+  uint32_t        baudRate;
+  pthread_mutex_t lock;
+  pthread_cond_t  ready;
+  uint8_t         rx[64 * 1024];
+  size_t          rxLen;
+};
+
+bool runBrokerBenchmark(int clientNumber, int commandsPerClient, int window,
+                        uint32_t baudRate);
+
+#endif // DJIOSDK_BROKERBENCHMARK_HPP
@@ -0,0 +1,79 @@
+/*! @file broker_sample.cpp
+ *  @version 3.3
+ *  @date Jun 05 2017
+ *
+ *  @brief
+ *  Broker daemon in a Linux environment.
+ *  Owns the serial link and serves commands, ACKs and push data to other
+ *  local processes, and mirrors telemetry into shared memory.
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#include "broker_sample.hpp"
+
+#include <signal.h>
+#include <unistd.h>
+
+using namespace DJI::OSDK;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void
+onSignal(int)
+{
+  stopRequested = 1;
+}
+
+int
+main(int argc, char** argv)
+{
+  // Setup OSDK.
+  Vehicle* vehicle = setupOSDK(argc, argv);
+  if (vehicle == NULL)
+  {
+    std::cout << "Vehicle not initialized, exiting.\n";
+    return -1;
+  }
+
+  const char* socketPath = (argc > 2) ? argv[2] : Broker::DEFAULT_PATH;
+  runBroker(vehicle, socketPath);
+
+  delete (vehicle);
+  return 0;
+}
+
+bool
+runBroker(Vehicle* vehicle, const char* socketPath)
+{
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  ShmTelemetryPublisher telemetry(vehicle);
+  if (!telemetry.start())
+  {
+    std::cout << "Shared-memory telemetry unavailable, continuing without.\n";
+  }
+
+  VehicleBroker broker(vehicle);
+  if (!broker.start(socketPath))
+  {
+    return false;
+  }
+
+  std::cout << "Broker running on " << socketPath << ", Ctrl-C to stop.\n";
+  while (!stopRequested)
+  {
+    sleep(5);
+    Broker::Stats s = broker.getStats();
+    std::cout << "requests " << s.requests << " forwarded " << s.forwarded
+              << " acked " << s.acked << " timeout " << s.timedOut
+              << " rejected " << s.rejected << " pushed " << s.pushed
+              << std::endl;
+  }
+
+  broker.stop();
+  telemetry.stop();
+  return true;
+}
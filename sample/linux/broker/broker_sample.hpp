@@ -0,0 +1,30 @@
+/*! @file broker_sample.hpp
+ *  @version 3.3
+ *  @date Jun 05 2017
+ *
+ *  @brief
+ *  Broker daemon in a Linux environment.
+ *  Owns the serial link and serves commands, ACKs and push data to other
+ *  local processes, and mirrors telemetry into shared memory.
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#ifndef DJIOSDK_BROKERSAMPLE_HPP
+#define DJIOSDK_BROKERSAMPLE_HPP
+
+// System Includes
+#include <iostream>
+
+// DJI OSDK includes
+#include <dji_vehicle.hpp>
+#include <linux_broker.hpp>
+#include <linux_shm_telemetry.hpp>
+
+// Helpers
+#include <dji_linux_helpers.hpp>
+
+bool runBroker(DJI::OSDK::Vehicle* vehiclePtr, const char* socketPath);
+
+#endif // DJIOSDK_BROKERSAMPLE_HPP
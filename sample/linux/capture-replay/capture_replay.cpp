@@ -0,0 +1,229 @@
+/*! @file capture_replay.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Record the raw serial stream of a flight, replay a capture through
+ *  Protocol and Vehicle to measure parse and dispatch throughput offline,
+ *  and decode a capture on all cores.
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#include "capture_replay.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace DJI::OSDK;
+
+bool
+recordLink(const char* device, uint32_t baudRate, const char* path,
+           int seconds)
+{
+  CaptureDriver* capture =
+    new CaptureDriver(new LinuxSerialDevice(device, baudRate), path);
+  if (!capture->getWriter()->isOpen())
+  {
+    delete capture;
+    return false;
+  }
+
+  //! Version query and broadcast set up go into the capture as well
+  Vehicle* vehicle = new Vehicle(capture, true);
+  vehicle->functionalSetUp();
+  sleep(seconds);
+
+  uint64_t bytes = capture->getWriter()->getBytes();
+  delete vehicle;
+  std::cout << "Captured " << bytes << " bytes into " << path << "\n";
+  return true;
+}
+
+bool
+generateCapture(const char* path, int frameNumber)
+{
+  CaptureWriter writer;
+  if (!writer.open(path))
+    return false;
+
+  //! Flight-like sizes, delivered in reads that split frames
+  uint8_t frame[sizeof(Header) + 2 + 96 + Protocol::CRCData];
+  memset(frame, 0, sizeof(frame));
+  Header* head              = (Header*)frame;
+  head->sof                 = Protocol::SOF;
+  head->length              = sizeof(frame);
+  frame[sizeof(Header)]     = OpenProtocol::CMDSet::Broadcast::broadcast[0];
+  frame[sizeof(Header) + 1] = OpenProtocol::CMDSet::Broadcast::broadcast[1];
+
+  uint8_t chunk[4 * sizeof(frame)];
+  size_t  used = 0;
+  srand(1);
+  for (int i = 0; i < frameNumber; ++i)
+  {
+    for (size_t k = sizeof(Header) + 2; k < sizeof(frame) - Protocol::CRCData;
+         ++k)
+      frame[k] = rand();
+    head->sequenceNumber = i;
+    Protocol::calculateCRC(frame);
+
+    memcpy(chunk + used, frame, sizeof(frame));
+    used += sizeof(frame);
+    size_t cut = sizeof(frame) + rand() % sizeof(frame);
+    if (used >= cut)
+    {
+      writer.write(Capture::RX, chunk, cut);
+      memmove(chunk, chunk + cut, used - cut);
+      used -= cut;
+    }
+  }
+  writer.write(Capture::RX, chunk, used);
+  std::cout << "Wrote " << frameNumber << " frames, " << writer.getBytes()
+            << " bytes into " << path << "\n";
+  writer.close();
+  return true;
+}
+
+bool
+replayCapture(const char* path, ReplayDriver::Mode mode)
+{
+  ReplayDriver* replay = new ReplayDriver(path, mode);
+  if (!replay->getDeviceStatus())
+  {
+    delete replay;
+    return false;
+  }
+
+  Vehicle* vehicle = new Vehicle(replay, true, false);
+  uint64_t frames  = 0;
+  while (!replay->isFinished())
+  {
+    frames += vehicle->pollReceive();
+    vehicle->callbackPoll();
+  }
+
+  double       seconds = replay->getElapsedNs() / 1e9;
+  double       mb      = replay->getReplayedBytes() / 1e6;
+  LinkSnapshot stats;
+  vehicle->getLinkStats(&stats);
+
+  printf("%llu frames, %.1f MB in %.3f s: %.0f frames/s, %.1f MB/s\n",
+         (unsigned long long)frames, mb, seconds,
+         seconds > 0 ? frames / seconds : 0.0, seconds > 0 ? mb / seconds : 0.0);
+  printf("header CRC errors %llu, data CRC errors %llu, resync bytes %llu\n",
+         (unsigned long long)stats.headerCrcErrors,
+         (unsigned long long)stats.dataCrcErrors,
+         (unsigned long long)stats.resyncBytes);
+
+  delete vehicle;
+  return true;
+}
+
+typedef struct DecodeSummary
+{
+  uint64_t frames;
+  uint64_t broadcasts;
+  uint64_t digest; //! of frame offsets and lengths, in order
+  uint32_t lastTimeMs;
+} DecodeSummary;
+
+static void
+summarizeFrame(const DecodedFrame* frame, UserData userData)
+{
+  DecodeSummary* s = (DecodeSummary*)userData;
+  s->frames++;
+  s->digest = (s->digest ^ (frame->offset << 16 | frame->length)) *
+              1099511628211ULL;
+  if (frame->type == DecodedFrame::BROADCAST)
+  {
+    s->broadcasts++;
+    s->lastTimeMs = frame->broadcast.timeStamp.time_ms;
+  }
+}
+
+static bool
+timeDecode(CaptureDecoder* decoder, int threadNumber, DecodeSummary* summary,
+           double* seconds)
+{
+  struct timespec begin, end;
+  memset(summary, 0, sizeof(DecodeSummary));
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  bool ok = decoder->decode(summarizeFrame, summary, threadNumber);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  *seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+  return ok;
+}
+
+bool
+decodeCapture(const char* path, int threadNumber)
+{
+  CaptureDecoder decoder;
+  if (!decoder.open(path))
+    return false;
+
+  DecodeSummary serial, parallel;
+  double        serialSeconds, parallelSeconds;
+  if (!timeDecode(&decoder, 1, &serial, &serialSeconds) ||
+      !timeDecode(&decoder, threadNumber, &parallel, &parallelSeconds))
+    return false;
+
+  const DecodeStats* stats = decoder.getStats();
+  double             mb    = stats->bytes / 1e6;
+  printf("%llu frames (%llu broadcast) in %.1f MB, %llu chunks\n",
+         (unsigned long long)parallel.frames,
+         (unsigned long long)parallel.broadcasts, mb,
+         (unsigned long long)stats->chunks);
+  printf("serial        %.3f s, %.1f MB/s\n", serialSeconds,
+         serialSeconds > 0 ? mb / serialSeconds : 0.0);
+  printf("%2d workers    %.3f s, %.1f MB/s, %.1fx, %llu chunks resynced\n",
+         threadNumber > 0 ? threadNumber : (int)sysconf(_SC_NPROCESSORS_ONLN),
+         parallelSeconds, parallelSeconds > 0 ? mb / parallelSeconds : 0.0,
+         parallelSeconds > 0 ? serialSeconds / parallelSeconds : 0.0,
+         (unsigned long long)stats->resyncedChunks);
+
+  bool same = serial.frames == parallel.frames &&
+              serial.digest == parallel.digest;
+  printf("frames %s\n", same ? "match" : "DIFFER");
+  return same;
+}
+
+int
+main(int argc, char** argv)
+{
+  const char* mode = (argc > 1) ? argv[1] : "";
+
+  if (!strcmp(mode, "record") && argc > 4)
+  {
+    int seconds = (argc > 5) ? atoi(argv[5]) : 60;
+    return recordLink(argv[2], atoi(argv[3]), argv[4], seconds) ? 0 : 1;
+  }
+  if (!strcmp(mode, "generate") && argc > 2)
+  {
+    int frames = (argc > 3) ? atoi(argv[3]) : 1000000;
+    return generateCapture(argv[2], frames) ? 0 : 1;
+  }
+  if (!strcmp(mode, "replay") && argc > 2)
+  {
+    bool timed = (argc > 3) && !strcmp(argv[3], "timed");
+    return replayCapture(argv[2], timed ? ReplayDriver::TIMED
+                                        : ReplayDriver::FAST)
+             ? 0
+             : 1;
+  }
+
+  if (!strcmp(mode, "decode") && argc > 2)
+  {
+    int threads = (argc > 3) ? atoi(argv[3]) : 0;
+    return decodeCapture(argv[2], threads) ? 0 : 1;
+  }
+
+  std::cout << "Usage:\n"
+            << "  " << argv[0] << " record <device> <baud> <file> [seconds]\n"
+            << "  " << argv[0] << " generate <file> [frames]\n"
+            << "  " << argv[0] << " replay <file> [timed]\n"
+            << "  " << argv[0] << " decode <file> [threads]\n";
+  return 1;
+}
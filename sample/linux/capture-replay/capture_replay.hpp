@@ -0,0 +1,39 @@
+/*! @file capture_replay.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Record the raw serial stream of a flight, replay a capture through
+ *  Protocol and Vehicle to measure parse and dispatch throughput offline,
+ *  and decode a capture on all cores.
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#ifndef DJIOSDK_CAPTUREREPLAY_HPP
+#define DJIOSDK_CAPTUREREPLAY_HPP
+
+// System Includes
+#include <iostream>
+
+// DJI OSDK includes
+#include <dji_vehicle.hpp>
+#include <linux_capture.hpp>
+#include <linux_capture_decoder.hpp>
+
+//! Capture both directions of a live link for the given time
+bool recordLink(const char* device, uint32_t baudRate, const char* path,
+                int seconds);
+
+//! Write a synthetic capture of broadcast frames, for runs without hardware
+bool generateCapture(const char* path, int frameNumber);
+
+//! Feed a capture through a thread-less Vehicle and print the throughput
+bool replayCapture(const char* path, DJI::OSDK::ReplayDriver::Mode mode);
+
+//! Decode a capture or raw dump on one thread, then on threadNumber threads,
+//! and check both find the same frames
+bool decodeCapture(const char* path, int threadNumber);
+
+#endif // DJIOSDK_CAPTUREREPLAY_HPP
@@ -0,0 +1,497 @@
+/*! @file fault_benchmark.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Goodput, frame loss, resync CPU cost and command completion latency of
+ *  the protocol over a faulty line, across error rates.
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#include "fault_benchmark.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace DJI::OSDK;
+
+//! Command pacing, commands in flight at once, and how each is sent
+static const int      WINDOW        = 4;
+static const int      CMD_HZ        = 200;
+static const int      CMD_TIMEOUTMS = 50;
+static const int      CMD_RETRY     = 3;
+static const int      BROADCAST_HZ  = 1000;
+static const size_t   PAYLOAD_SIZE  = 96;
+static const uint32_t MAX_COMMANDS  = 1 << 20;
+
+static uint64_t
+clockNs(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+EchoPeer::EchoPeer(int broadcastHz, size_t payloadSize)
+  : broadcastHz(broadcastHz)
+  , payloadSize(payloadSize)
+  , startUs(0)
+  , broadcasts(0)
+  , commands(0)
+  , inputUsed(0)
+  , output(NULL)
+  , outputCapacity(0)
+  , outputHead(0)
+  , outputTail(0)
+{
+}
+
+EchoPeer::~EchoPeer()
+{
+  free(output);
+}
+
+void
+EchoPeer::init()
+{
+}
+
+time_ms
+EchoPeer::getTimeStamp()
+{
+  return clockNs(CLOCK_MONOTONIC) / 1000000;
+}
+
+size_t
+EchoPeer::send(const uint8_t* buf, size_t len)
+{
+  //! Keep the newest bytes if garbage piled up
+  if (len > sizeof(input))
+  {
+    buf += len - sizeof(input);
+    len = sizeof(input);
+  }
+  if (inputUsed + len > sizeof(input))
+  {
+    size_t drop = inputUsed + len - sizeof(input);
+    memmove(input, input + drop, inputUsed - drop);
+    inputUsed -= drop;
+  }
+  memcpy(input + inputUsed, buf, len);
+  inputUsed += len;
+  parse();
+  return len;
+}
+
+void
+EchoPeer::parse()
+{
+  size_t at = 0;
+  while (inputUsed - at >= sizeof(Header))
+  {
+    Header head;
+    memcpy(&head, input + at, sizeof(head));
+    if (input[at] != Protocol::SOF ||
+        Protocol::sdk_stream_crc16_calc(input + at, Protocol::CRCHeadLen) !=
+          head.crc ||
+        head.length < Protocol::PackageMin + 2 ||
+        head.length > Protocol::maxRecv)
+    {
+      at++;
+      continue;
+    }
+    size_t length = head.length;
+    if (inputUsed - at < length)
+      break;
+    uint32_t crc;
+    memcpy(&crc, input + at + length - Protocol::CRCData, sizeof(crc));
+    if (Protocol::sdk_stream_crc32_calc(input + at,
+                                        length - Protocol::CRCData) != crc)
+    {
+      at++;
+      continue;
+    }
+
+    //! Ack with the command data after cmd set and id
+    if (!head.isAck && head.sessionID > 1)
+    {
+      uint8_t ack[Protocol::maxRecv];
+      size_t  data = length - Protocol::PackageMin - 2;
+      size_t  size = Protocol::PackageMin + data;
+      memset(ack, 0, sizeof(Header));
+      Header* reply         = (Header*)ack;
+      reply->sof            = Protocol::SOF;
+      reply->length         = size;
+      reply->sessionID      = head.sessionID;
+      reply->isAck          = 1;
+      reply->sequenceNumber = head.sequenceNumber;
+      memcpy(ack + sizeof(Header), input + at + sizeof(Header) + 2, data);
+      Protocol::calculateCRC(ack);
+      queue(ack, size);
+      commands++;
+    }
+    at += length;
+  }
+  memmove(input, input + at, inputUsed - at);
+  inputUsed -= at;
+}
+
+void
+EchoPeer::queue(const uint8_t* frame, size_t length)
+{
+  if (outputTail + length > outputCapacity && output)
+  {
+    memmove(output, output + outputHead, outputTail - outputHead);
+    outputTail -= outputHead;
+    outputHead = 0;
+  }
+  if (outputTail + length > outputCapacity)
+  {
+    size_t   capacity = outputCapacity ? 2 * outputCapacity : 16384;
+    uint8_t* grown    = (uint8_t*)realloc(output, capacity);
+    if (!grown)
+      return;
+    output         = grown;
+    outputCapacity = capacity;
+  }
+  memcpy(output + outputTail, frame, length);
+  outputTail += length;
+}
+
+//! Frames due since the first read, a running counter first in the data
+void
+EchoPeer::broadcast()
+{
+  uint64_t now = clockNs(CLOCK_MONOTONIC) / 1000;
+  if (!startUs)
+    startUs = now;
+  uint64_t due = (now - startUs) * broadcastHz / 1000000;
+
+  uint8_t frame[Protocol::maxRecv];
+  size_t  size = Protocol::PackageMin + 2 + payloadSize;
+  while (broadcasts < due)
+  {
+    memset(frame, 0, size);
+    Header* head         = (Header*)frame;
+    head->sof            = Protocol::SOF;
+    head->length         = size;
+    head->sequenceNumber = broadcasts;
+    frame[sizeof(Header)]     = OpenProtocol::CMDSet::Broadcast::broadcast[0];
+    frame[sizeof(Header) + 1] = OpenProtocol::CMDSet::Broadcast::broadcast[1];
+    uint32_t counter          = broadcasts;
+    memcpy(frame + sizeof(Header) + 2, &counter, sizeof(counter));
+    Protocol::calculateCRC(frame);
+    queue(frame, size);
+    broadcasts++;
+  }
+}
+
+size_t
+EchoPeer::readall(uint8_t* buf, size_t maxlen)
+{
+  broadcast();
+  size_t n = outputTail - outputHead;
+  if (n > maxlen)
+    n = maxlen;
+  memcpy(buf, output + outputHead, n);
+  outputHead += n;
+  return n;
+}
+
+uint64_t
+EchoPeer::getBroadcasts() const
+{
+  return broadcasts;
+}
+
+uint64_t
+EchoPeer::getCommands() const
+{
+  return commands;
+}
+
+TimedDriver::TimedDriver(HardDriver* driver)
+  : driver(driver)
+  , readCpuNs(0)
+{
+}
+
+TimedDriver::~TimedDriver()
+{
+  delete driver;
+}
+
+void
+TimedDriver::init()
+{
+  driver->init();
+}
+
+time_ms
+TimedDriver::getTimeStamp()
+{
+  return driver->getTimeStamp();
+}
+
+size_t
+TimedDriver::send(const uint8_t* buf, size_t len)
+{
+  return driver->send(buf, len);
+}
+
+size_t
+TimedDriver::readall(uint8_t* buf, size_t maxlen)
+{
+  uint64_t begin = clockNs(CLOCK_THREAD_CPUTIME_ID);
+  size_t   n     = driver->readall(buf, maxlen);
+  readCpuNs += clockNs(CLOCK_THREAD_CPUTIME_ID) - begin;
+  return n;
+}
+
+uint64_t
+TimedDriver::getReadCpuNs() const
+{
+  return readCpuNs;
+}
+
+typedef struct RunResult
+{
+  double   rate;
+  double   goodputKBs;
+  uint64_t broadcastsSent;
+  uint64_t broadcastsLost;
+  uint64_t resyncBytes;
+  uint64_t crcErrors;
+  double   parseCpuUsPerKB;
+  uint32_t commandsSent;
+  uint32_t commandsDone;
+  uint64_t retransmits;
+  double   p50Ms;
+  double   p99Ms;
+  double   maxMs;
+} RunResult;
+
+static int
+compareU32(const void* a, const void* b)
+{
+  uint32_t x = *(const uint32_t*)a;
+  uint32_t y = *(const uint32_t*)b;
+  return x < y ? -1 : (x > y);
+}
+
+static void
+applyKind(FaultConfig* config, const char* kind, double rate)
+{
+  if (!strcmp(kind, "flip") || !strcmp(kind, "mixed"))
+    config->bitFlipRate = rate;
+  if (!strcmp(kind, "drop") || !strcmp(kind, "mixed"))
+    config->byteDropRate = rate;
+  //! Frame faults are per frame; ten times the byte rate keeps the sweep
+  //! short of losing every frame at the top rate
+  if (!strcmp(kind, "truncate") || !strcmp(kind, "mixed"))
+    config->truncateRate = rate * 10;
+  if (!strcmp(kind, "duplicate") || !strcmp(kind, "mixed"))
+    config->duplicateRate = rate * 10;
+}
+
+static bool
+runOnce(const FaultConfig& config, int seconds, RunResult* result)
+{
+  EchoPeer*    peer     = new EchoPeer(BROADCAST_HZ, PAYLOAD_SIZE);
+  FaultDriver* fault    = new FaultDriver(peer, config);
+  TimedDriver* timed    = new TimedDriver(fault);
+  Protocol*    protocol = new (std::nothrow) Protocol(timed);
+  if (!protocol)
+  {
+    delete timed;
+    return false;
+  }
+
+  uint64_t* startNs = (uint64_t*)calloc(MAX_COMMANDS, sizeof(uint64_t));
+  uint32_t* latency = (uint32_t*)malloc(MAX_COMMANDS * sizeof(uint32_t));
+  uint8_t*  seen    = (uint8_t*)calloc(BROADCAST_HZ * (seconds + 1), 1);
+  if (!startNs || !latency || !seen)
+  {
+    free(startNs);
+    free(latency);
+    free(seen);
+    delete protocol;
+    return false;
+  }
+
+  //! Outstanding command ids; given up on after every retry timed out
+  uint32_t inFlight[WINDOW];
+  int      inFlightNumber = 0;
+  uint64_t expireNs       = (uint64_t)CMD_TIMEOUTMS * (CMD_RETRY + 1) * 2000000;
+  uint32_t sent           = 0;
+  uint32_t done           = 0;
+  uint64_t unique         = 0;
+  uint64_t parseNs        = 0;
+
+  uint64_t begin = clockNs(CLOCK_MONOTONIC);
+  uint64_t end   = begin + (uint64_t)seconds * 1000000000ULL;
+  for (uint64_t now = begin; now < end; now = clockNs(CLOCK_MONOTONIC))
+  {
+    for (int i = 0; i < inFlightNumber;)
+    {
+      if (now - startNs[inFlight[i]] > expireNs)
+        inFlight[i] = inFlight[--inFlightNumber];
+      else
+        ++i;
+    }
+    uint64_t due = (now - begin) * CMD_HZ / 1000000000ULL + 1;
+    while (inFlightNumber < WINDOW && sent < due && sent < MAX_COMMANDS)
+    {
+      uint32_t id   = sent++;
+      startNs[id]   = now;
+      inFlight[inFlightNumber++] = id;
+      protocol->send(2, false, OpenProtocol::CMDSet::Activation::getVersion,
+                     &id, sizeof(id), CMD_TIMEOUTMS, CMD_RETRY);
+    }
+    protocol->sendPoll();
+
+    uint64_t      cpu  = clockNs(CLOCK_THREAD_CPUTIME_ID);
+    uint64_t      read = timed->getReadCpuNs();
+    RecvContainer frame;
+    bool          any  = false;
+    for (;;)
+    {
+      if (!protocol->pollFrame(&frame))
+      {
+        if (!protocol->hasBufferedData())
+          break;
+        continue;
+      }
+      any = true;
+
+      uint32_t value;
+      memcpy(&value, frame.recvData.raw_ack_array, sizeof(value));
+      if (frame.dispatchInfo.isAck)
+      {
+        if (value < sent)
+        {
+          uint64_t t = clockNs(CLOCK_MONOTONIC) - startNs[value];
+          latency[done++] = t / 1000;
+          for (int i = 0; i < inFlightNumber; ++i)
+          {
+            if (inFlight[i] == value)
+            {
+              inFlight[i] = inFlight[--inFlightNumber];
+              break;
+            }
+          }
+        }
+      }
+      else if (frame.recvInfo.cmd_set ==
+                 OpenProtocol::CMDSet::Broadcast::broadcast[0] &&
+               value < (uint64_t)BROADCAST_HZ * (seconds + 1) && !seen[value])
+      {
+        seen[value] = 1;
+        unique++;
+      }
+    }
+    parseNs += clockNs(CLOCK_THREAD_CPUTIME_ID) - cpu -
+               (timed->getReadCpuNs() - read);
+    if (!any)
+      usleep(200);
+  }
+  double elapsed = (clockNs(CLOCK_MONOTONIC) - begin) / 1e9;
+
+  LinkSnapshot link;
+  protocol->getLinkSnapshot(&link);
+
+  result->broadcastsSent = peer->getBroadcasts();
+  result->broadcastsLost =
+    result->broadcastsSent > unique ? result->broadcastsSent - unique : 0;
+  result->goodputKBs   = unique * PAYLOAD_SIZE / 1024.0 / elapsed;
+  result->resyncBytes  = link.resyncBytes;
+  result->crcErrors    = link.headerCrcErrors + link.dataCrcErrors;
+  result->commandsSent = sent;
+  result->commandsDone = done;
+  result->retransmits  = link.retransmits;
+  result->parseCpuUsPerKB =
+    link.bytesIn ? parseNs / 1000.0 / (link.bytesIn / 1024.0) : 0;
+
+  qsort(latency, done, sizeof(uint32_t), compareU32);
+  result->p50Ms = done ? latency[done / 2] / 1000.0 : 0;
+  result->p99Ms = done ? latency[done * 99 / 100] / 1000.0 : 0;
+  result->maxMs = done ? latency[done - 1] / 1000.0 : 0;
+
+  free(startNs);
+  free(latency);
+  free(seen);
+  delete protocol;
+  return true;
+}
+
+bool
+runSweep(const char* kind, int seconds, uint32_t latencyUs, uint32_t jitterUs)
+{
+  static const double rates[] = { 0, 1e-5, 1e-4, 1e-3, 3e-3, 1e-2 };
+  const int           number  = sizeof(rates) / sizeof(rates[0]);
+  RunResult           results[number];
+
+  for (int i = 0; i < number; ++i)
+  {
+    FaultConfig config;
+    memset(&config, 0, sizeof(config));
+    config.latencyUs  = latencyUs;
+    config.jitterUs   = jitterUs;
+    config.seed       = 1 + i;
+    config.directions = FaultConfig::BOTH;
+    applyKind(&config, kind, rates[i]);
+
+    results[i].rate = rates[i];
+    if (!runOnce(config, seconds, &results[i]))
+      return false;
+  }
+
+  //! After the run, so protocol logging does not break up the table
+  printf("\n%s faults, %d s per rate, %u us latency, %u us jitter, "
+         "%d Hz x %zu B broadcast\n",
+         kind, seconds, latencyUs, jitterUs, BROADCAST_HZ, PAYLOAD_SIZE);
+  printf("%8s %9s %8s %9s %8s %10s %9s %8s %7s %7s %7s\n", "rate",
+         "goodput", "lost", "resync B", "CRC err", "parse us", "cmd done",
+         "retrans", "p50 ms", "p99 ms", "max ms");
+  printf("%8s %9s %8s %9s %8s %10s %9s %8s\n", "", "KB/s", "frames", "", "",
+         "per KB", "/ sent", "");
+  for (int i = 0; i < number; ++i)
+  {
+    const RunResult* r = &results[i];
+    char             done[32];
+    snprintf(done, sizeof(done), "%u/%u", r->commandsDone, r->commandsSent);
+    printf("%8.0e %9.1f %8llu %9llu %8llu %10.2f %9s %8llu %7.2f %7.2f "
+           "%7.2f\n",
+           r->rate, r->goodputKBs, (unsigned long long)r->broadcastsLost,
+           (unsigned long long)r->resyncBytes,
+           (unsigned long long)r->crcErrors, r->parseCpuUsPerKB, done,
+           (unsigned long long)r->retransmits, r->p50Ms, r->p99Ms, r->maxMs);
+  }
+  return true;
+}
+
+int
+main(int argc, char** argv)
+{
+  const char* kind      = (argc > 1) ? argv[1] : "mixed";
+  int         seconds   = (argc > 2) ? atoi(argv[2]) : 3;
+  uint32_t    latencyUs = (argc > 3) ? atoi(argv[3]) : 0;
+  uint32_t    jitterUs  = (argc > 4) ? atoi(argv[4]) : 0;
+
+  if (strcmp(kind, "flip") && strcmp(kind, "drop") &&
+      strcmp(kind, "truncate") && strcmp(kind, "duplicate") &&
+      strcmp(kind, "mixed"))
+  {
+    std::cout << "Usage: " << argv[0]
+              << " [flip|drop|truncate|duplicate|mixed] [seconds per rate]"
+                 " [latency us] [jitter us]\n";
+    return 1;
+  }
+  return runSweep(kind, seconds > 0 ? seconds : 3, latencyUs, jitterUs) ? 0
+                                                                        : 1;
+}
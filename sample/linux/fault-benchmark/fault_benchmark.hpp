@@ -0,0 +1,88 @@
+/*! @file fault_benchmark.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Goodput, frame loss, resync CPU cost and command completion latency of
+ *  the protocol over a faulty line, across error rates.
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#ifndef DJIOSDK_FAULTBENCHMARK_HPP
+#define DJIOSDK_FAULTBENCHMARK_HPP
+
+// System Includes
+#include <iostream>
+
+// DJI OSDK includes
+#include <dji_vehicle.hpp>
+#include <linux_fault_driver.hpp>
+
+/*! @brief In-process flight controller end of the line
+ *
+ *  @details Acks every command that asks for one, echoing its data, and
+ *  streams broadcast frames carrying a running counter. Frames failing
+ *  either CRC are dropped, as the FC would.
+ */
+class EchoPeer : public DJI::OSDK::HardDriver
+{
+public:
+  EchoPeer(int broadcastHz, size_t payloadSize);
+  ~EchoPeer();
+
+  void               init();
+  DJI::OSDK::time_ms getTimeStamp();
+  size_t send(const uint8_t* buf, size_t len);
+  size_t readall(uint8_t* buf, size_t maxlen);
+
+  uint64_t getBroadcasts() const;
+  uint64_t getCommands() const;
+
+private:
+  void parse();
+  void queue(const uint8_t* frame, size_t length);
+  void broadcast();
+
+private:
+  int      broadcastHz;
+  size_t   payloadSize;
+  uint64_t startUs;
+  uint64_t broadcasts;
+  uint64_t commands;
+
+  uint8_t  input[2 * DJI::OSDK::FaultDriver::MAX_FRAME];
+  size_t   inputUsed;
+  uint8_t* output;
+  size_t   outputCapacity;
+  size_t   outputHead;
+  size_t   outputTail;
+};
+
+//! Thread CPU time spent below Protocol in readall()
+class TimedDriver : public DJI::OSDK::HardDriver
+{
+public:
+  TimedDriver(DJI::OSDK::HardDriver* driver);
+  ~TimedDriver();
+
+  void               init();
+  DJI::OSDK::time_ms getTimeStamp();
+  size_t send(const uint8_t* buf, size_t len);
+  size_t readall(uint8_t* buf, size_t maxlen);
+
+  uint64_t getReadCpuNs() const;
+
+private:
+  DJI::OSDK::HardDriver* driver;
+  uint64_t               readCpuNs;
+};
+
+/*! @brief Sweep one fault kind over a range of rates
+ *  @param kind flip, drop, truncate, duplicate or mixed
+ */
+bool runSweep(const char* kind, int seconds, uint32_t latencyUs,
+              uint32_t jitterUs);
+
+#endif // DJIOSDK_FAULTBENCHMARK_HPP
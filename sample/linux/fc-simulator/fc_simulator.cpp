@@ -0,0 +1,317 @@
+/*! @file fc_simulator.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Flight controller simulator on a pseudo terminal, and an end-to-end
+ *  benchmark of command RTT, telemetry latency and CPU usage against it.
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#include "fc_simulator.hpp"
+
+#include <algorithm>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace DJI::OSDK;
+using namespace DJI::OSDK::Telemetry;
+
+static const uint32_t APP_ID      = 1024576;
+static const char     APP_KEY[]   = "8f0d7c3e4a1b52960de1c7a3f4b8e2d1"
+                                    "6a9c0b3e5f7d2a4c6e8b1d3f5a7c9e0b";
+static const int      BAUD_RATE   = 230400;
+static const int      TIMEOUT_S   = 1;
+static const int      PACKAGE_ID  = 0;
+static const int      PACKAGE_HZ  = 50;
+static const size_t   MAX_SAMPLES = 1 << 18;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void
+onSignal(int)
+{
+  stopRequested = 1;
+}
+
+static uint64_t
+clockNs(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//! Latency samples in us, written by the SDK callback thread only
+typedef struct Samples
+{
+  uint32_t* us;
+  size_t    count;
+} Samples;
+
+static Samples broadcastLatency;
+static Samples packageLatency;
+
+static void
+addSample(Samples* samples, uint64_t us)
+{
+  if (samples->count < MAX_SAMPLES)
+    samples->us[samples->count++] = (uint32_t)us;
+}
+
+static void
+printSamples(const char* name, Samples* samples)
+{
+  if (!samples->count)
+  {
+    printf("%-20s no samples\n", name);
+    return;
+  }
+  std::sort(samples->us, samples->us + samples->count);
+  size_t n = samples->count;
+  printf("%-20s n %7zu  p50 %6u us  p99 %6u us  max %6u us\n", name, n,
+         samples->us[n / 2], samples->us[n * 99 / 100], samples->us[n - 1]);
+}
+
+//! Both timestamps are the simulator's CLOCK_MONOTONIC at send time
+static void
+onPush(Vehicle* vehicle, RecvContainer recvFrame, UserData userData)
+{
+  uint64_t       nowUs = clockNs(CLOCK_MONOTONIC) / 1000;
+  const uint8_t* data  = recvFrame.recvData.raw_ack_array;
+  const uint8_t  cmd[] = { recvFrame.recvInfo.cmd_set,
+                          recvFrame.recvInfo.cmd_id };
+  Samples*       samples;
+
+  TimeStamp time;
+  if (memcmp(cmd, OpenProtocol::CMDSet::Broadcast::broadcast, sizeof(cmd)) ==
+      0)
+  {
+    uint16_t flag;
+    memcpy(&flag, data, sizeof(flag));
+    if (!(flag & DataBroadcast::HAS_TIME))
+      return;
+    memcpy(&time, data + sizeof(flag), sizeof(time));
+    samples = &broadcastLatency;
+  }
+  else if (memcmp(cmd, OpenProtocol::CMDSet::Broadcast::subscribe,
+                  sizeof(cmd)) == 0 &&
+           data[0] == PACKAGE_ID)
+  {
+    memcpy(&time, data + 1, sizeof(time));
+    samples = &packageLatency;
+  }
+  else
+    return;
+
+  //! time_ms carries the low 32 bits of the milliseconds
+  uint64_t nowMs  = nowUs / 1000;
+  uint64_t sentMs = (nowMs & ~0xFFFFFFFFULL) | time.time_ms;
+  if (sentMs > nowMs)
+    sentMs -= 1ULL << 32;
+  uint64_t sentUs = sentMs * 1000 + time.time_ns / 1000;
+  if (nowUs >= sentUs)
+    addSample(samples, nowUs - sentUs);
+}
+
+static void
+printStats(const FCSimulatorStats& s)
+{
+  printf("in %8llu frames %4llu crc  commands %6llu controls %6llu  "
+         "out %8llu frames %9llu B  broadcast %7llu packages %7llu "
+         "dropped %llu\n",
+         (unsigned long long)s.framesIn, (unsigned long long)s.crcErrors,
+         (unsigned long long)s.commands, (unsigned long long)s.controls,
+         (unsigned long long)s.framesOut, (unsigned long long)s.bytesOut,
+         (unsigned long long)s.broadcasts, (unsigned long long)s.packages,
+         (unsigned long long)s.dropped);
+}
+
+bool
+runServer(uint16_t broadcastHz, const char* linkPath, uint32_t baudRate)
+{
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  FCSimulatorConfig config;
+  FCSimulator::getDefaultConfig(&config);
+  config.broadcastHz = broadcastHz;
+  config.baudRate    = baudRate;
+
+  FCSimulator simulator(config);
+  if (!simulator.openPty(linkPath) || !simulator.start())
+  {
+    std::cout << "Failed to start the simulator.\n";
+    return false;
+  }
+  std::cout << "Simulated " << config.hardware << " " << config.firmware
+            << " on " << simulator.getPtyName() << ", broadcast at "
+            << broadcastHz << " Hz, Ctrl-C to stop.\n"
+            << "Any app ID and key activate.\n";
+
+  while (!stopRequested)
+  {
+    sleep(5);
+    FCSimulatorStats s;
+    simulator.getStats(&s);
+    printStats(s);
+  }
+  simulator.stop();
+  return true;
+}
+
+bool
+runBenchmark(int seconds, uint16_t broadcastHz)
+{
+  FCSimulatorConfig config;
+  FCSimulator::getDefaultConfig(&config);
+  config.broadcastHz = broadcastHz;
+  config.appId       = APP_ID;
+  config.encKey      = APP_KEY;
+
+  FCSimulator simulator(config);
+  if (!simulator.openPty() || !simulator.start())
+  {
+    std::cout << "Failed to start the simulator.\n";
+    return false;
+  }
+
+  broadcastLatency.us    = (uint32_t*)malloc(MAX_SAMPLES * sizeof(uint32_t));
+  packageLatency.us      = (uint32_t*)malloc(MAX_SAMPLES * sizeof(uint32_t));
+  broadcastLatency.count = 0;
+  packageLatency.count   = 0;
+  uint32_t* rtt          = (uint32_t*)malloc(MAX_SAMPLES * sizeof(uint32_t));
+  if (!broadcastLatency.us || !packageLatency.us || !rtt)
+  {
+    free(broadcastLatency.us);
+    free(packageLatency.us);
+    free(rtt);
+    return false;
+  }
+
+  bool     ok       = false;
+  Vehicle* vehicle  = new Vehicle(simulator.getPtyName(), BAUD_RATE, true);
+  uint64_t cpuStart = clockNs(CLOCK_PROCESS_CPUTIME_ID);
+  FCSimulatorStats before;
+  simulator.getStats(&before);
+  size_t attempts = 0, commands = 0, failures = 0;
+
+  if (!vehicle->getFwVersion())
+  {
+    std::cout << "Vehicle did not get the firmware version.\n";
+    goto done;
+  }
+  {
+    Vehicle::ActivateData activateData;
+    char                  key[sizeof(APP_KEY)];
+    strcpy(key, APP_KEY);
+    activateData.ID      = APP_ID;
+    activateData.encKey  = key;
+    activateData.version = vehicle->getFwVersion();
+    ACK::ErrorCode ack   = vehicle->activate(&activateData, TIMEOUT_S);
+    if (ACK::getError(ack))
+    {
+      ACK::getErrorCodeMessage(ack, __func__);
+      goto done;
+    }
+  }
+
+  if (vehicle->subscribe &&
+      !ACK::getError(vehicle->subscribe->verify(TIMEOUT_S)))
+  {
+    TopicName topics[] = { TOPIC_QUATERNION, TOPIC_VELOCITY,
+                           TOPIC_GPS_FUSED, TOPIC_STATUS_FLIGHT };
+    if (vehicle->subscribe->initPackageFromTopicList(
+          PACKAGE_ID, sizeof(topics) / sizeof(topics[0]), topics, true,
+          PACKAGE_HZ))
+    {
+      ACK::ErrorCode ack =
+        vehicle->subscribe->startPackage(PACKAGE_ID, TIMEOUT_S);
+      if (ACK::getError(ack))
+        ACK::getErrorCodeMessage(ack, __func__);
+    }
+  }
+
+  cpuStart = clockNs(CLOCK_PROCESS_CPUTIME_ID);
+  simulator.getStats(&before);
+  vehicle->addPushDataListener(onPush);
+  {
+    //! Blocking commands back to back while telemetry streams
+    uint64_t endNs = clockNs(CLOCK_MONOTONIC) + seconds * 1000000000ULL;
+    while (clockNs(CLOCK_MONOTONIC) < endNs && commands < MAX_SAMPLES)
+    {
+      uint64_t       startNs = clockNs(CLOCK_MONOTONIC);
+      ACK::ErrorCode ack     = attempts++ % 2
+                             ? vehicle->releaseCtrlAuthority(TIMEOUT_S)
+                             : vehicle->obtainCtrlAuthority(TIMEOUT_S);
+      uint64_t       doneNs  = clockNs(CLOCK_MONOTONIC);
+      if (ACK::getError(ack))
+        failures++;
+      else
+        rtt[commands++] = (doneNs - startNs) / 1000;
+    }
+  }
+  vehicle->removePushDataListener(onPush);
+  ok = true;
+
+done:
+  uint64_t         cpuNs = clockNs(CLOCK_PROCESS_CPUTIME_ID) - cpuStart;
+  FCSimulatorStats after;
+  simulator.getStats(&after);
+  if (vehicle->subscribe && ok)
+    vehicle->subscribe->removePackage(PACKAGE_ID, TIMEOUT_S);
+  delete vehicle;
+  simulator.stop();
+
+  if (ok)
+  {
+    Samples rttSamples = { rtt, commands };
+    double  wallNs     = seconds * 1e9;
+    uint64_t simNs     = after.cpuNs - before.cpuNs;
+    printf("%d s, broadcast at %u Hz, package at %d Hz, %d baud\n", seconds,
+           broadcastHz, PACKAGE_HZ, BAUD_RATE);
+    printSamples("command rtt", &rttSamples);
+    printSamples("broadcast latency", &broadcastLatency);
+    printSamples("package latency", &packageLatency);
+    printf("%-20s %zu\n", "command failures", failures);
+    printf("%-20s simulator %5.1f %%  sdk %5.1f %% of one core\n", "cpu",
+           100.0 * simNs / wallNs,
+           100.0 * (cpuNs > simNs ? cpuNs - simNs : 0) / wallNs);
+    printStats(after);
+  }
+
+  free(broadcastLatency.us);
+  free(packageLatency.us);
+  free(rtt);
+  return ok;
+}
+
+int
+main(int argc, char** argv)
+{
+  const char* mode = (argc > 1) ? argv[1] : "bench";
+
+  if (strcmp(mode, "serve") == 0)
+  {
+    int         hz       = (argc > 2) ? atoi(argv[2]) : 50;
+    const char* linkPath = (argc > 3) ? argv[3] : NULL;
+    int         baudRate = (argc > 4) ? atoi(argv[4]) : 0;
+    return runServer(hz, linkPath, baudRate) ? 0 : 1;
+  }
+  if (strcmp(mode, "bench") == 0)
+  {
+    int seconds = (argc > 2) ? atoi(argv[2]) : 5;
+    int hz      = (argc > 3) ? atoi(argv[3]) : 100;
+    return runBenchmark(seconds > 0 ? seconds : 5, hz) ? 0 : 1;
+  }
+  std::cout << "Usage: " << argv[0]
+            << " serve [broadcast Hz] [link path] [baud]\n"
+            << "       " << argv[0] << " bench [seconds] [broadcast Hz]\n";
+  return 1;
+}
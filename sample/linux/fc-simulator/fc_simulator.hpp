@@ -0,0 +1,35 @@
+/*! @file fc_simulator.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Flight controller simulator on a pseudo terminal, and an end-to-end
+ *  benchmark of command RTT, telemetry latency and CPU usage against it.
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#ifndef DJIOSDK_FCSIMULATOR_HPP
+#define DJIOSDK_FCSIMULATOR_HPP
+
+// System Includes
+#include <iostream>
+
+// DJI OSDK includes
+#include <dji_vehicle.hpp>
+#include <linux_fc_simulator.hpp>
+
+/*! @brief Serve a simulated flight controller until interrupted
+ *  @param linkPath symlink to the pty slave, NULL to only print its name
+ *  @param baudRate pace the output like a UART; 0 does not pace
+ */
+bool runServer(uint16_t broadcastHz, const char* linkPath, uint32_t baudRate);
+
+/*! @brief Activate a Vehicle against an in-process simulator and measure
+ *  blocking command RTT, broadcast and subscription latency, and the CPU
+ *  used on each side of the pty
+ */
+bool runBenchmark(int seconds, uint16_t broadcastHz);
+
+#endif // DJIOSDK_FCSIMULATOR_HPP
@@ -0,0 +1,137 @@
+/*! @file log_benchmark.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Cost per DSTATUS/DDEBUG call seen by the calling thread, with the
+ *  synchronous Log and with AsyncLog.
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#include "log_benchmark.hpp"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace DJI::OSDK;
+
+static uint64_t
+nowNs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+typedef struct LogTask
+{
+  int      iterations;
+  int      batch;
+  uint64_t elapsedNs;
+} LogTask;
+
+static void*
+statusCall(void* param)
+{
+  LogTask* task = (LogTask*)param;
+  task->elapsedNs = 0;
+  for (int done = 0; done < task->iterations; done += task->batch)
+  {
+    uint64_t begin = nowNs();
+    for (int i = done; i < done + task->batch; ++i)
+    {
+      DSTATUS("seq %d altitude %.2f mode %s\n", i, i * 0.25, "P-GPS");
+    }
+    task->elapsedNs += nowNs() - begin;
+
+    //! Bursts that fit the ring, like a real control loop; no-op when sync
+    AsyncLog::flush();
+  }
+  return NULL;
+}
+
+double
+measureStatus(int threadNumber, int iterations, int batch)
+{
+  std::vector<pthread_t> threads(threadNumber);
+  std::vector<LogTask>   tasks(threadNumber);
+
+  for (int i = 0; i < threadNumber; ++i)
+  {
+    tasks[i].iterations = iterations;
+    tasks[i].batch      = batch;
+    pthread_create(&threads[i], NULL, statusCall, &tasks[i]);
+  }
+  uint64_t total = 0;
+  for (int i = 0; i < threadNumber; ++i)
+  {
+    pthread_join(threads[i], NULL);
+    total += tasks[i].elapsedNs;
+  }
+  return (double)total / threadNumber / iterations;
+}
+
+double
+measureDisabled(int iterations)
+{
+  uint64_t begin = nowNs();
+  for (int i = 0; i < iterations; ++i)
+  {
+    DDEBUG("seq %d altitude %.2f mode %s\n", i, i * 0.25, "P-GPS");
+  }
+  return (double)(nowNs() - begin) / iterations;
+}
+
+int
+main(int argc, char** argv)
+{
+  int iterations = (argc > 1) ? atoi(argv[1]) : 200000;
+
+  //! The synchronous Log prints to stdout; send it to /dev/null while
+  //! measuring so both loggers pay for the same destination
+  fflush(stdout);
+  int console = dup(STDOUT_FILENO);
+  int null    = open("/dev/null", O_WRONLY);
+
+  double disabled = measureDisabled(iterations);
+
+  dup2(null, STDOUT_FILENO);
+  double sync1 = measureStatus(1, iterations, iterations);
+  double sync4 = measureStatus(4, iterations, iterations);
+  fflush(stdout);
+  dup2(console, STDOUT_FILENO);
+
+  FileLogSink sink("/dev/null");
+  AsyncLog::start(&sink);
+  double async1 = measureStatus(1, iterations, 256);
+  double async4 = measureStatus(4, iterations, 256);
+  AsyncLog::stop();
+
+  printf("DDEBUG (compiled out)      %8.1f ns/call\n", disabled);
+  printf("DSTATUS sync,  1 thread    %8.1f ns/call\n", sync1);
+  printf("DSTATUS sync,  4 threads   %8.1f ns/call\n", sync4);
+  printf("DSTATUS async, 1 thread    %8.1f ns/call\n", async1);
+  printf("DSTATUS async, 4 threads   %8.1f ns/call\n", async4);
+  printf("async records dropped      %8llu\n",
+         (unsigned long long)AsyncLog::getDropped());
+
+  //! Same lines through both loggers, for eyeballing
+  DSTATUS("sync  %d %5.2f %-6s|%x %c %lu\n", -3, 3.14159, "abc", 255, 'z',
+          123456789UL);
+  fflush(stdout);
+  AsyncLog::start();
+  DSTATUS("sync  %d %5.2f %-6s|%x %c %lu\n", -3, 3.14159, "abc", 255, 'z',
+          123456789UL);
+  DSTATUS("%*d|%.*s|%lld|%p|100%%\n", 6, 42, 2, "xyz", -5LL, (void*)0x10);
+  AsyncLog::stop();
+
+  close(null);
+  close(console);
+  return 0;
+}
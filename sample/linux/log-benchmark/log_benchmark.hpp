@@ -0,0 +1,30 @@
+/*! @file log_benchmark.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Cost per DSTATUS/DDEBUG call seen by the calling thread, with the
+ *  synchronous Log and with AsyncLog.
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#ifndef DJIOSDK_LOGBENCHMARK_HPP
+#define DJIOSDK_LOGBENCHMARK_HPP
+
+// System Includes
+#include <iostream>
+
+// DJI OSDK includes
+#include <linux_async_log.hpp>
+
+/*! @brief Mean nanoseconds per log call over iterations calls on each of
+ *  threadNumber threads, issued in bursts of batch calls.
+ */
+double measureStatus(int threadNumber, int iterations, int batch);
+
+//! Same, for a level disabled at compile time
+double measureDisabled(int iterations);
+
+#endif // DJIOSDK_LOGBENCHMARK_HPP
@@ -260,12 +260,15 @@ uploadWaypoints(Vehicle*                                  vehicle,
   {
     printf("Waypoint created at (LLA): %f \t%f \t%f\n ", wp->latitude,
            wp->longitude, wp->altitude);
-    ACK::WayPointIndex wpDataACK =
-      vehicle->missionManager->wpMission->uploadIndexData(&(*wp),
-                                                          responseTimeout);
-
-    ACK::getErrorCodeMessage(wpDataACK.ack, __func__);
   }
+
+  //! All waypoints in one pipelined upload instead of one round trip each
+  ACK::ErrorCode wpDataACK =
+    vehicle->missionManager->wpMission->uploadAllIndexData(
+      &wp_list[0], WaypointMission::DEFAULT_UPLOAD_WINDOW,
+      responseTimeout * (int)wp_list.size());
+
+  ACK::getErrorCodeMessage(wpDataACK, __func__);
 }
 
 bool
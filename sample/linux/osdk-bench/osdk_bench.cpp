@@ -0,0 +1,1001 @@
+/*! @file osdk_bench.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Microbenchmarks of the protocol and dispatch hot paths over an in-memory
+ *  link, with JSON results for comparing builds.
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#include "osdk_bench.hpp"
+
+#include <algorithm>
+#include <dji_aes.hpp>
+#include <dji_waypoint_preprocess.hpp>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace DJI::OSDK;
+using namespace DJI::OSDK::Telemetry;
+
+static const uint32_t APP_ID      = 1024576;
+static const char     APP_KEY[]   = "8f0d7c3e4a1b52960de1c7a3f4b8e2d1"
+                                    "6a9c0b3e5f7d2a4c6e8b1d3f5a7c9e0b";
+static const int      TIMEOUT_S   = 1;
+static const int      PACKAGE_ID  = 0;
+static const int      PACKAGE_HZ  = 50;
+static const int      BATCHES     = 7;
+static const int      MAX_RESULTS = 64;
+static const int      MAX_METRICS = 4;
+static const size_t   STREAM_SIZE = 64 * 1024;
+static const int      MISSION_SIZE = 10000;
+//! One flipped bit per this many bytes, about one frame in five at 200 B
+static const uint32_t CORRUPT_ONE_IN = 1000;
+
+static uint64_t
+clockNs(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t
+xorshift(uint64_t* state)
+{
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 0x2545F4914F6CDD1DULL;
+}
+
+MemoryLink::MemoryLink()
+  : peer(NULL)
+  , capture(NULL)
+  , captureCapacity(0)
+  , captured(0)
+{
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&ready, NULL);
+}
+
+MemoryLink::~MemoryLink()
+{
+  pthread_cond_destroy(&ready);
+  pthread_mutex_destroy(&lock);
+}
+
+void
+MemoryLink::init()
+{
+}
+
+time_ms
+MemoryLink::getTimeStamp()
+{
+  return clockNs(CLOCK_MONOTONIC) / 1000000;
+}
+
+size_t
+MemoryLink::send(const uint8_t* buf, size_t len)
+{
+  pthread_mutex_lock(&lock);
+  if (capture && captured + len <= captureCapacity)
+  {
+    memcpy(capture + captured, buf, len);
+    captured += len;
+  }
+  if (peer)
+  {
+    peer->receive(buf, len, FCSimulator::monotonicUs());
+    pthread_cond_signal(&ready);
+  }
+  pthread_mutex_unlock(&lock);
+  return len;
+}
+
+size_t
+MemoryLink::readall(uint8_t* buf, size_t maxlen)
+{
+  pthread_mutex_lock(&lock);
+  size_t n = 0;
+  if (peer)
+  {
+    peer->step(FCSimulator::monotonicUs());
+    n = peer->transmit(buf, maxlen);
+  }
+  if (!n)
+  {
+    //! Idle like a serial read timeout, but wake up for an answer
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&ready, &lock, &deadline);
+  }
+  pthread_mutex_unlock(&lock);
+  return n;
+}
+
+void
+MemoryLink::setPeer(FCSimulator* peer)
+{
+  pthread_mutex_lock(&lock);
+  this->peer = peer;
+  pthread_mutex_unlock(&lock);
+}
+
+void
+MemoryLink::setCapture(uint8_t* buf, size_t capacity)
+{
+  pthread_mutex_lock(&lock);
+  capture         = buf;
+  captureCapacity = buf ? capacity : 0;
+  captured        = 0;
+  pthread_mutex_unlock(&lock);
+}
+
+size_t
+MemoryLink::getCaptured()
+{
+  pthread_mutex_lock(&lock);
+  size_t n = captured;
+  pthread_mutex_unlock(&lock);
+  return n;
+}
+
+/******************************Harness*************************************/
+
+//! Runs iterations operations of one case
+typedef void (*BenchBody)(void* context, uint64_t iterations);
+
+typedef struct Metric
+{
+  const char* name;
+  double      value;
+} Metric;
+
+typedef struct Result
+{
+  const char* name;
+  const char* unit;       //! what one operation is
+  double      bytesPerOp; //! 0 if the case has no throughput
+  uint64_t    ops;
+  double      nsMin;
+  double      nsMedian;
+  double      nsMax;
+  int         metricNumber;
+  Metric      metric[MAX_METRICS];
+} Result;
+
+static Result      results[MAX_RESULTS];
+static int         resultNumber = 0;
+static const char* benchFilter  = NULL;
+static uint64_t    batchNs      = 0;
+
+//! Keeps results of the measured code alive
+static volatile uint64_t sink;
+
+static bool
+selected(const char* name)
+{
+  return !benchFilter || strstr(name, benchFilter) != NULL;
+}
+
+/*! @brief Size a batch to about batchNs, then time BATCHES of them; the
+ *  median is the figure to compare, min and max show the noise
+ *  @return NULL if the case is filtered out
+ */
+static Result*
+measure(const char* name, const char* unit, double bytesPerOp,
+        BenchBody body, void* context)
+{
+  if (!selected(name) || resultNumber == MAX_RESULTS)
+    return NULL;
+
+  body(context, 1);
+  uint64_t n = 1;
+  for (;;)
+  {
+    uint64_t start   = clockNs(CLOCK_MONOTONIC);
+    body(context, n);
+    uint64_t elapsed = clockNs(CLOCK_MONOTONIC) - start;
+    if (elapsed >= batchNs / 8 || n >= (1ULL << 32))
+    {
+      n = elapsed ? n * batchNs / elapsed : n * 8;
+      if (!n)
+        n = 1;
+      break;
+    }
+    n *= 4;
+  }
+
+  double ns[BATCHES];
+  for (int b = 0; b < BATCHES; ++b)
+  {
+    uint64_t start = clockNs(CLOCK_MONOTONIC);
+    body(context, n);
+    ns[b] = (double)(clockNs(CLOCK_MONOTONIC) - start) / n;
+  }
+  std::sort(ns, ns + BATCHES);
+
+  Result* r = &results[resultNumber++];
+  memset(r, 0, sizeof(*r));
+  r->name       = name;
+  r->unit       = unit;
+  r->bytesPerOp = bytesPerOp;
+  r->ops        = n * BATCHES;
+  r->nsMin      = ns[0];
+  r->nsMedian   = ns[BATCHES / 2];
+  r->nsMax      = ns[BATCHES - 1];
+
+  printf("%-32s %10.1f ns/%-8s min %10.1f  max %10.1f", name, r->nsMedian,
+         unit, r->nsMin, r->nsMax);
+  if (bytesPerOp > 0)
+    printf("  %8.1f MB/s", bytesPerOp * 1e3 / r->nsMedian);
+  printf("\n");
+  return r;
+}
+
+static void
+addMetric(Result* r, const char* name, double value)
+{
+  if (!r || r->metricNumber == MAX_METRICS)
+    return;
+  r->metric[r->metricNumber].name  = name;
+  r->metric[r->metricNumber].value = value;
+  r->metricNumber++;
+  printf("%-32s %10.3f %s\n", "", value, name);
+}
+
+static bool
+writeJson(const char* path, int msPerCase)
+{
+  FILE* f = fopen(path, "w");
+  if (!f)
+  {
+    std::cout << "Failed to open " << path << ".\n";
+    return false;
+  }
+  struct utsname host;
+  if (uname(&host) != 0)
+    memset(&host, 0, sizeof(host));
+
+  fprintf(f, "{\n");
+  fprintf(f, "  \"version\": 1,\n");
+  fprintf(f, "  \"time\": %lld,\n", (long long)time(NULL));
+  fprintf(f, "  \"host\": \"%s\",\n", host.nodename);
+  fprintf(f, "  \"machine\": \"%s\",\n", host.machine);
+  fprintf(f, "  \"cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+  fprintf(f, "  \"compiler\": \"%s\",\n", __VERSION__);
+  fprintf(f, "  \"ms_per_case\": %d,\n", msPerCase);
+  fprintf(f, "  \"batches\": %d,\n", BATCHES);
+  fprintf(f, "  \"results\": [");
+  for (int i = 0; i < resultNumber; ++i)
+  {
+    const Result* r = &results[i];
+    fprintf(f, "%s\n    {\"name\": \"%s\", \"unit\": \"%s\", \"ops\": %llu, "
+               "\"ns_median\": %.3f, \"ns_min\": %.3f, \"ns_max\": %.3f",
+            i ? "," : "", r->name, r->unit, (unsigned long long)r->ops,
+            r->nsMedian, r->nsMin, r->nsMax);
+    if (r->bytesPerOp > 0)
+      fprintf(f, ", \"mb_per_s\": %.3f", r->bytesPerOp * 1e3 / r->nsMedian);
+    for (int m = 0; m < r->metricNumber; ++m)
+      fprintf(f, ", \"%s\": %.6g", r->metric[m].name, r->metric[m].value);
+    fprintf(f, "}");
+  }
+  fprintf(f, "\n  ]\n}\n");
+  return fclose(f) == 0;
+}
+
+/******************************CRC and AES*********************************/
+
+typedef struct Block
+{
+  uint8_t*       data;
+  size_t         length;
+  aes256_context aes;
+} Block;
+
+static void
+crc16Body(void* context, uint64_t iterations)
+{
+  Block*   b   = (Block*)context;
+  uint32_t acc = 0;
+  for (uint64_t i = 0; i < iterations; ++i)
+    acc += Protocol::sdk_stream_crc16_calc(b->data, b->length);
+  sink += acc;
+}
+
+static void
+crc32Body(void* context, uint64_t iterations)
+{
+  Block*   b   = (Block*)context;
+  uint32_t acc = 0;
+  for (uint64_t i = 0; i < iterations; ++i)
+    acc += Protocol::sdk_stream_crc32_calc(b->data, b->length);
+  sink += acc;
+}
+
+static void
+aesEncryptBody(void* context, uint64_t iterations)
+{
+  Block* b = (Block*)context;
+  for (uint64_t i = 0; i < iterations; ++i)
+    aes256_encrypt_ecb(&b->aes, b->data);
+  sink += b->data[0];
+}
+
+static void
+aesDecryptBody(void* context, uint64_t iterations)
+{
+  Block* b = (Block*)context;
+  for (uint64_t i = 0; i < iterations; ++i)
+    aes256_decrypt_ecb(&b->aes, b->data);
+  sink += b->data[0];
+}
+
+//! The protocol expands the key for every frame it encodes
+static void
+aesKeyBody(void* context, uint64_t iterations)
+{
+  Block* b = (Block*)context;
+  for (uint64_t i = 0; i < iterations; ++i)
+  {
+    aes256_init(&b->aes, b->data);
+    aes256_done(&b->aes);
+  }
+}
+
+static void
+benchChecksums()
+{
+  uint8_t data[1024];
+  for (size_t i = 0; i < sizeof(data); ++i)
+    data[i] = (uint8_t)(i * 131 + 7);
+
+  Block b;
+  b.data   = data;
+  b.length = Protocol::CRCHeadLen;
+  measure("crc16_header", "header", b.length, crc16Body, &b);
+  b.length = 100;
+  measure("crc32_100B", "frame", b.length, crc32Body, &b);
+  b.length = 1000;
+  measure("crc32_1000B", "frame", b.length, crc32Body, &b);
+
+  uint8_t key[32];
+  memcpy(key, data, sizeof(key));
+  aes256_init(&b.aes, key);
+  b.data = data + 32;
+  measure("aes_encrypt_block", "block", 16, aesEncryptBody, &b);
+  measure("aes_decrypt_block", "block", 16, aesDecryptBody, &b);
+  aes256_done(&b.aes);
+  b.data = key;
+  measure("aes_key_expand", "key", 0, aesKeyBody, &b);
+}
+
+/******************************Frame parser********************************/
+
+typedef struct Parser
+{
+  Protocol*      protocol;
+  const uint8_t* stream;
+  size_t         length;
+  size_t         opBytes;
+  size_t         pos;
+  uint64_t       bytes;
+  uint64_t       frames;
+  RecvContainer  frame;
+} Parser;
+
+static void
+parseBody(void* context, uint64_t iterations)
+{
+  Parser*  p = (Parser*)context;
+  uint64_t n = iterations * p->opBytes;
+  for (uint64_t i = 0; i < n; ++i)
+  {
+    if (p->protocol->byteHandler(p->stream[p->pos], &p->frame))
+      p->frames++;
+    if (++p->pos == p->length)
+      p->pos = 0;
+  }
+  p->bytes += n;
+}
+
+//! Parse a stream on a fresh receiver, so counters start from zero
+static Result*
+measureParse(const char* name, const char* unit, const uint8_t* stream,
+             size_t length, size_t opBytes, const char* key)
+{
+  if (!selected(name) || !length)
+    return NULL;
+
+  Parser p;
+  memset(&p, 0, sizeof(p));
+  p.protocol = new Protocol(new MemoryLink);
+  p.stream   = stream;
+  p.length   = length;
+  p.opBytes  = opBytes;
+  if (key)
+    p.protocol->setKey(key);
+
+  Result* r = measure(name, unit, opBytes, parseBody, &p);
+  if (r && p.bytes)
+  {
+    static LinkSnapshot snapshot;
+    p.protocol->getLinkSnapshot(&snapshot);
+    double framesPerOp = (double)p.frames * opBytes / p.bytes;
+    if (p.frames)
+      addMetric(r, "frames_per_s", framesPerOp * 1e9 / r->nsMedian);
+    if (snapshot.headerCrcErrors || snapshot.dataCrcErrors)
+    {
+      addMetric(r, "header_crc_errors_per_mb",
+                snapshot.headerCrcErrors * 1e6 / p.bytes);
+      addMetric(r, "data_crc_errors_per_mb",
+                snapshot.dataCrcErrors * 1e6 / p.bytes);
+    }
+  }
+  delete p.protocol;
+  return r;
+}
+
+//! What the simulator puts on the line at 100 Hz broadcast
+static size_t
+recordBroadcast(uint8_t* stream, size_t capacity)
+{
+  FCSimulatorConfig config;
+  FCSimulator::getDefaultConfig(&config);
+  config.broadcastHz = 100;
+  FCSimulator simulator(config);
+
+  size_t   length = 0;
+  uint64_t nowUs  = 1000000;
+  while (length + FCSimulator::MAX_FRAME < capacity)
+  {
+    simulator.step(nowUs);
+    length += simulator.transmit(stream + length, capacity - length);
+    nowUs += 10000;
+  }
+  return length;
+}
+
+static void
+corrupt(uint8_t* stream, size_t length)
+{
+  uint64_t random = 0x9E3779B97F4A7C15ULL;
+  for (size_t i = 0; i < length; ++i)
+    if (xorshift(&random) % CORRUPT_ONE_IN == 0)
+      stream[i] ^= 1 << (xorshift(&random) % 8);
+}
+
+static void
+benchParser()
+{
+  uint8_t* stream = (uint8_t*)malloc(STREAM_SIZE);
+  if (!stream)
+    return;
+
+  //! Bare ACK headers only reach verifyHead
+  Header header;
+  memset(&header, 0, sizeof(header));
+  header.sof    = Protocol::SOF;
+  header.length = sizeof(Header);
+  header.isAck  = 1;
+  size_t length = 0;
+  for (uint16_t seq = 0; length + sizeof(Header) <= STREAM_SIZE; ++seq)
+  {
+    header.sequenceNumber = seq;
+    memcpy(stream + length, &header, sizeof(header));
+    Protocol::calculateCRC(stream + length);
+    length += sizeof(header);
+  }
+  measureParse("verify_head", "header", stream, length, sizeof(Header), NULL);
+  for (size_t i = 0; i < length; i += sizeof(Header))
+    stream[i + sizeof(Header) - 1] ^= 0x5A;
+  measureParse("verify_head_reject", "header", stream, length,
+               sizeof(Header), NULL);
+
+  length = recordBroadcast(stream, STREAM_SIZE);
+  measureParse("parse_broadcast_clean", "byte", stream, length, 1, NULL);
+  corrupt(stream, length);
+  measureParse("parse_broadcast_corrupt", "byte", stream, length, 1, NULL);
+  free(stream);
+}
+
+/******************************Send path***********************************/
+
+typedef struct Sender
+{
+  Protocol*      protocol;
+  bool           encrypt;
+  const uint8_t* cmd;
+  uint8_t        payload[1024];
+  size_t         length;
+} Sender;
+
+static void
+sendBody(void* context, uint64_t iterations)
+{
+  Sender* s = (Sender*)context;
+  for (uint64_t i = 0; i < iterations; ++i)
+    s->protocol->send(0, s->encrypt, s->cmd, s->payload, s->length);
+}
+
+static void
+templateBody(void* context, uint64_t iterations)
+{
+  Sender* s = (Sender*)context;
+  int     t = s->protocol->registerTemplate(s->cmd, s->length);
+  for (uint64_t i = 0; i < iterations; ++i)
+    s->protocol->sendTemplate(t, s->payload);
+  s->protocol->releaseTemplate(t);
+}
+
+static void
+benchSend()
+{
+  MemoryLink* link = new MemoryLink;
+  Sender      s;
+  s.protocol = new Protocol(link);
+  s.cmd      = OpenProtocol::CMDSet::Control::control;
+  for (size_t i = 0; i < sizeof(s.payload); ++i)
+    s.payload[i] = (uint8_t)(i * 37 + 11);
+  s.protocol->setKey(APP_KEY);
+
+  s.encrypt = false;
+  s.length  = 17;
+  measure("send_plain_17B", "frame", s.length, sendBody, &s);
+  s.length = 100;
+  measure("send_plain_100B", "frame", s.length, sendBody, &s);
+  s.length = 17;
+  measure("send_template_17B", "frame", s.length, templateBody, &s);
+  s.length = 100;
+  measure("send_template_100B", "frame", s.length, templateBody, &s);
+  s.encrypt = true;
+  s.length  = 17;
+  measure("send_enc_17B", "frame", s.length, sendBody, &s);
+  s.length = 100;
+  measure("send_enc_100B", "frame", s.length, sendBody, &s);
+
+  //! The same encrypted frames on the receive side
+  uint8_t* stream = (uint8_t*)malloc(STREAM_SIZE);
+  if (stream)
+  {
+    link->setCapture(stream, STREAM_SIZE);
+    while (link->getCaptured() + 2 * s.length < STREAM_SIZE)
+      sendBody(&s, 1);
+    size_t length = link->getCaptured();
+    link->setCapture(NULL, 0);
+    measureParse("parse_enc_100B", "byte", stream, length, 1, APP_KEY);
+    free(stream);
+  }
+  delete s.protocol;
+}
+
+/******************************MMU*****************************************/
+
+typedef struct Allocator
+{
+  MMU      mmu;
+  MMU_Tab* live[MMU::MMU_TABLE_NUM];
+  int      liveNumber;
+  uint64_t random;
+  uint64_t allocs;
+  uint64_t failures;
+} Allocator;
+
+static uint16_t
+blockSize(Allocator* a)
+{
+  return 16 + xorshift(&a->random) % 65;
+}
+
+static void
+allocFreeBody(void* context, uint64_t iterations)
+{
+  Allocator* a = (Allocator*)context;
+  for (uint64_t i = 0; i < iterations; ++i)
+  {
+    MMU_Tab* tab = a->mmu.allocMemory(100);
+    if (tab)
+      a->mmu.freeMemory(tab);
+  }
+}
+
+//! Swap a random live block for one of a random size
+static void
+fragmentedBody(void* context, uint64_t iterations)
+{
+  Allocator* a = (Allocator*)context;
+  for (uint64_t i = 0; i < iterations; ++i)
+  {
+    int slot = xorshift(&a->random) % a->liveNumber;
+    if (a->live[slot])
+      a->mmu.freeMemory(a->live[slot]);
+    a->live[slot] = a->mmu.allocMemory(blockSize(a));
+    a->allocs++;
+    if (!a->live[slot])
+      a->failures++;
+  }
+}
+
+static void
+benchMMU()
+{
+  Allocator* a = new Allocator;
+  memset(a->live, 0, sizeof(a->live));
+  a->mmu.setupMMU();
+  a->random     = 0x2545F4914F6CDD1DULL;
+  a->liveNumber = 0;
+  a->allocs     = 0;
+  a->failures   = 0;
+  measure("mmu_alloc_free", "pair", 0, allocFreeBody, a);
+
+  //! Fill to about three quarters, then free every other block so the free
+  //! space is scattered and allocations have to compact
+  while (a->liveNumber < 20)
+  {
+    MMU_Tab* tab = a->mmu.allocMemory(blockSize(a));
+    if (!tab)
+      break;
+    a->live[a->liveNumber++] = tab;
+  }
+  for (int i = 0; i < a->liveNumber; i += 2)
+  {
+    a->mmu.freeMemory(a->live[i]);
+    a->live[i] = NULL;
+  }
+  if (a->liveNumber)
+  {
+    Result* r = measure("mmu_alloc_fragmented", "pair", 0, fragmentedBody, a);
+    if (r && a->allocs)
+      addMetric(r, "failure_rate", (double)a->failures / a->allocs);
+  }
+  delete a;
+}
+
+/******************************Mission preprocessing***********************/
+
+typedef struct Survey
+{
+  WaypointPreprocessor preprocessor;
+  WayPointInitSettings info;
+  WayPointSettings*    path;
+  WayPointSettings*    out;
+  WaypointViolation    violation[16];
+  int                  kept;
+  int                  found;
+} Survey;
+
+static void
+simplifyBody(void* context, uint64_t iterations)
+{
+  Survey* s = (Survey*)context;
+  for (uint64_t i = 0; i < iterations; ++i)
+    s->kept = s->preprocessor.simplify(s->path, MISSION_SIZE, 0.5f, s->out,
+                                       MISSION_SIZE);
+  sink += s->kept;
+}
+
+static void
+validateBody(void* context, uint64_t iterations)
+{
+  Survey* s = (Survey*)context;
+  for (uint64_t i = 0; i < iterations; ++i)
+    s->found = s->preprocessor.validate(&s->info, s->path, MISSION_SIZE,
+                                        s->violation, 16);
+  sink += s->found;
+}
+
+//! Lawnmower survey: rows of 100 points 1 m apart with a few cm of
+//! altitude noise, 20 m between rows
+static void
+benchMission()
+{
+  Survey* s = new Survey;
+  s->path   = new WayPointSettings[MISSION_SIZE];
+  s->out    = new WayPointSettings[MISSION_SIZE];
+  memset(s->path, 0, MISSION_SIZE * sizeof(WayPointSettings));
+  memset(&s->info, 0, sizeof(s->info));
+  s->info.indexNumber  = 255;
+  s->info.maxVelocity  = 10;
+  s->info.idleVelocity = 5;
+
+  uint64_t  random = 0x2545F4914F6CDD1DULL;
+  float64_t meter  = 1.0 / 6378137;
+  for (int i = 0; i < MISSION_SIZE; ++i)
+  {
+    int row                 = i / 100;
+    int column              = (row % 2) ? 99 - i % 100 : i % 100;
+    s->path[i].index        = (uint8_t)i;
+    s->path[i].latitude     = 0.3917 + row * 20 * meter;
+    s->path[i].longitude    = 2.0308 + column * meter / cos(0.3917);
+    s->path[i].altitude     = 30 + (float32_t)(xorshift(&random) % 9) / 100;
+    s->path[i].hasAction    = (i % 1000) == 0;
+    s->path[i].actionNumber = s->path[i].hasAction;
+  }
+
+  Result* r = measure("mission_simplify_10k", "mission", 0, simplifyBody, s);
+  if (r)
+    addMetric(r, "kept", s->kept);
+  r = measure("mission_validate_10k", "mission", 0, validateBody, s);
+  if (r)
+    addMetric(r, "violations", s->found);
+
+  delete[] s->out;
+  delete[] s->path;
+  delete s;
+}
+
+/******************************Vehicle dispatch****************************/
+
+typedef struct Dispatch
+{
+  Vehicle*          vehicle;
+  RecvContainer     broadcast;
+  RecvContainer     package;
+  bool              hasBroadcast;
+  bool              hasPackage;
+  volatile bool     stop;
+  volatile uint64_t reads;
+} Dispatch;
+
+static Dispatch dispatch;
+
+//! Keep the last broadcast and package frame as the parser produced them
+static void
+capturePush(Vehicle* vehicle, RecvContainer recvFrame, UserData userData)
+{
+  const uint8_t cmd[] = { recvFrame.recvInfo.cmd_set,
+                          recvFrame.recvInfo.cmd_id };
+  if (memcmp(cmd, OpenProtocol::CMDSet::Broadcast::broadcast, sizeof(cmd)) ==
+      0)
+  {
+    dispatch.broadcast    = recvFrame;
+    dispatch.hasBroadcast = true;
+  }
+  else if (memcmp(cmd, OpenProtocol::CMDSet::Broadcast::subscribe,
+                  sizeof(cmd)) == 0 &&
+           recvFrame.recvData.raw_ack_array[0] == PACKAGE_ID)
+  {
+    dispatch.package    = recvFrame;
+    dispatch.hasPackage = true;
+  }
+}
+
+static void
+dispatchBroadcastBody(void* context, uint64_t iterations)
+{
+  Dispatch* d = (Dispatch*)context;
+  for (uint64_t i = 0; i < iterations; ++i)
+    d->vehicle->processReceivedData(d->broadcast);
+}
+
+static void
+dispatchPackageBody(void* context, uint64_t iterations)
+{
+  Dispatch* d = (Dispatch*)context;
+  for (uint64_t i = 0; i < iterations; ++i)
+    d->vehicle->processReceivedData(d->package);
+}
+
+//! DataBroadcast::unpackData through the handler dispatch calls
+static void
+unpackBroadcastBody(void* context, uint64_t iterations)
+{
+  Dispatch*              d = (Dispatch*)context;
+  VehicleCallBackHandler h = d->vehicle->broadcast->unpackHandler;
+  for (uint64_t i = 0; i < iterations; ++i)
+    h.callback(d->vehicle, d->broadcast, h.userData);
+}
+
+//! DataSubscription::extractOnePackage through the handler dispatch calls
+static void
+extractPackageBody(void* context, uint64_t iterations)
+{
+  Dispatch*              d = (Dispatch*)context;
+  VehicleCallBackHandler h =
+    d->vehicle->subscribe->subscriptionDataDecodeHandler;
+  for (uint64_t i = 0; i < iterations; ++i)
+    h.callback(d->vehicle, d->package, h.userData);
+}
+
+static void
+getValueBody(void* context, uint64_t iterations)
+{
+  Dispatch* d   = (Dispatch*)context;
+  float32_t acc = 0;
+  for (uint64_t i = 0; i < iterations; ++i)
+    acc += d->vehicle->subscribe->getValue<TOPIC_QUATERNION>().q0;
+  sink += (uint64_t)acc;
+}
+
+static void*
+readerCall(void* param)
+{
+  Dispatch* d     = (Dispatch*)param;
+  uint64_t  reads = 0;
+  while (!d->stop)
+  {
+    getValueBody(d, 64);
+    reads += 64;
+  }
+  __sync_fetch_and_add(&d->reads, reads);
+  return NULL;
+}
+
+//! Package extraction while readers poll getValue, both under lockMSG
+static void
+benchContention(const char* name, int readerNumber)
+{
+  if (!selected(name))
+    return;
+  pthread_t readers[8];
+  dispatch.stop  = false;
+  dispatch.reads = 0;
+  int started    = 0;
+  for (; started < readerNumber; ++started)
+    if (pthread_create(&readers[started], NULL, readerCall, &dispatch) != 0)
+      break;
+
+  uint64_t start = clockNs(CLOCK_MONOTONIC);
+  Result*  r     = measure(name, "package", 0, extractPackageBody, &dispatch);
+  uint64_t wall  = clockNs(CLOCK_MONOTONIC) - start;
+
+  dispatch.stop = true;
+  for (int i = 0; i < started; ++i)
+    pthread_join(readers[i], NULL);
+  addMetric(r, "readers", started);
+  if (wall)
+    addMetric(r, "reads_per_s", dispatch.reads * 1e9 / wall);
+}
+
+static bool
+setUpVehicle()
+{
+  Vehicle* vehicle = dispatch.vehicle;
+  vehicle->functionalSetUp();
+  if (!vehicle->getFwVersion() || !vehicle->broadcast || !vehicle->subscribe)
+  {
+    std::cout << "Vehicle did not set up over the memory link.\n";
+    return false;
+  }
+
+  Vehicle::ActivateData activateData;
+  char                  key[sizeof(APP_KEY)];
+  strcpy(key, APP_KEY);
+  activateData.ID      = APP_ID;
+  activateData.encKey  = key;
+  activateData.version = vehicle->getFwVersion();
+  ACK::ErrorCode ack   = vehicle->activate(&activateData, TIMEOUT_S);
+  if (ACK::getError(ack))
+  {
+    ACK::getErrorCodeMessage(ack, __func__);
+    return false;
+  }
+
+  TopicName topics[] = { TOPIC_QUATERNION, TOPIC_VELOCITY, TOPIC_GPS_FUSED,
+                         TOPIC_STATUS_FLIGHT };
+  if (ACK::getError(vehicle->subscribe->verify(TIMEOUT_S)) ||
+      !vehicle->subscribe->initPackageFromTopicList(
+        PACKAGE_ID, sizeof(topics) / sizeof(topics[0]), topics, true, PACKAGE_HZ))
+    return false;
+  ack = vehicle->subscribe->startPackage(PACKAGE_ID, TIMEOUT_S);
+  if (ACK::getError(ack))
+  {
+    ACK::getErrorCodeMessage(ack, __func__);
+    return false;
+  }
+
+  vehicle->addPushDataListener(capturePush);
+  for (int i = 0; i < 200 && !(dispatch.hasBroadcast && dispatch.hasPackage);
+       ++i)
+    usleep(10000);
+  vehicle->removePushDataListener(capturePush);
+  return dispatch.hasBroadcast && dispatch.hasPackage;
+}
+
+static void
+benchVehicle()
+{
+  static const char* const names[] = {
+    "dispatch_", "unpack_", "extract_", "getvalue"
+  };
+  bool wanted = false;
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+    wanted = wanted || !benchFilter || strstr(names[i], benchFilter) ||
+             strstr(benchFilter, names[i]);
+  if (!wanted)
+    return;
+
+  FCSimulatorConfig config;
+  FCSimulator::getDefaultConfig(&config);
+  config.broadcastHz = 100;
+  config.appId       = APP_ID;
+  config.encKey      = APP_KEY;
+  FCSimulator simulator(config);
+
+  MemoryLink* link = new MemoryLink;
+  link->setPeer(&simulator);
+  dispatch.vehicle = new Vehicle(link, true);
+  if (!setUpVehicle())
+  {
+    std::cout << "Skipping the Vehicle cases.\n";
+    delete dispatch.vehicle;
+    return;
+  }
+  //! Silence the link so only the measured calls touch the vehicle
+  link->setPeer(NULL);
+  usleep(20000);
+
+  measure("dispatch_broadcast", "frame", 0, dispatchBroadcastBody, &dispatch);
+  measure("dispatch_package", "frame", 0, dispatchPackageBody, &dispatch);
+  measure("unpack_broadcast", "frame", 0, unpackBroadcastBody, &dispatch);
+  measure("extract_package", "package", 0, extractPackageBody, &dispatch);
+  measure("getvalue", "call", 0, getValueBody, &dispatch);
+  benchContention("extract_package_readers_1", 1);
+  benchContention("extract_package_readers_2", 2);
+  benchContention("extract_package_readers_4", 4);
+
+  link->setPeer(&simulator);
+  dispatch.vehicle->subscribe->removePackage(PACKAGE_ID, TIMEOUT_S);
+  delete dispatch.vehicle;
+}
+
+bool
+runBenchmarks(const char* filter, int msPerCase, const char* outPath)
+{
+  benchFilter  = filter;
+  batchNs      = (uint64_t)msPerCase * 1000000 / BATCHES;
+  resultNumber = 0;
+
+  benchChecksums();
+  benchParser();
+  benchSend();
+  benchMMU();
+  benchMission();
+  benchVehicle();
+
+  if (!resultNumber)
+  {
+    std::cout << "No case matches the filter.\n";
+    return false;
+  }
+  if (!writeJson(outPath, msPerCase))
+    return false;
+  std::cout << resultNumber << " results written to " << outPath << "\n";
+  return true;
+}
+
+int
+main(int argc, char** argv)
+{
+  const char* filter  = (argc > 1) ? argv[1] : "all";
+  int         ms      = (argc > 2) ? atoi(argv[2]) : 300;
+  const char* outPath = (argc > 3) ? argv[3] : "osdk-bench.json";
+
+  if (strcmp(filter, "-h") == 0 || strcmp(filter, "--help") == 0 || ms <= 0)
+  {
+    std::cout << "Usage: " << argv[0]
+              << " [all|name filter] [ms per case] [output.json]\n";
+    return 1;
+  }
+  return runBenchmarks(strcmp(filter, "all") ? filter : NULL, ms, outPath)
+           ? 0
+           : 1;
+}
@@ -0,0 +1,60 @@
+/*! @file osdk_bench.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Microbenchmarks of the protocol and dispatch hot paths over an in-memory
+ *  link, with JSON results for comparing builds.
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#ifndef DJIOSDK_OSDKBENCH_HPP
+#define DJIOSDK_OSDKBENCH_HPP
+
+// System Includes
+#include <iostream>
+#include <pthread.h>
+
+// DJI OSDK includes
+#include <dji_vehicle.hpp>
+#include <linux_fc_simulator.hpp>
+
+/*! @brief HardDriver kept in memory: sends are optionally captured, and
+ *  an attached FCSimulator answers them, so a Vehicle can be
+ *  set up without a serial port and then silenced for the measurements.
+ */
+class MemoryLink : public DJI::OSDK::HardDriver
+{
+public:
+  MemoryLink();
+  ~MemoryLink();
+
+  void               init();
+  DJI::OSDK::time_ms getTimeStamp();
+  size_t send(const uint8_t* buf, size_t len);
+  size_t readall(uint8_t* buf, size_t maxlen);
+
+  //! Answer sends with peer and read what it streams; NULL detaches it
+  void setPeer(DJI::OSDK::FCSimulator* peer);
+  //! Keep a copy of what is sent, up to capacity bytes; NULL stops
+  void setCapture(uint8_t* buf, size_t capacity);
+  size_t getCaptured();
+
+private:
+  pthread_mutex_t         lock;
+  pthread_cond_t          ready;
+  DJI::OSDK::FCSimulator* peer;
+  uint8_t*                capture;
+  size_t                  captureCapacity;
+  size_t                  captured;
+};
+
+/*! @brief Run every benchmark whose name contains filter
+ *  @param msPerCase measuring time of each case, split in repeated batches
+ *  @param outPath JSON results; the SDK logs to stdout, so always a file
+ */
+bool runBenchmarks(const char* filter, int msPerCase, const char* outPath);
+
+#endif // DJIOSDK_OSDKBENCH_HPP
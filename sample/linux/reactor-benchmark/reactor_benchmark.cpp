@@ -0,0 +1,249 @@
+/*! @file reactor_benchmark.cpp
+ *  @version 3.3
+ *  @date Jun 05 2017
+ *
+ *  @brief
+ *  CPU cost of serving 1 to N simulated links from one process, with the
+ *  per-vehicle read/callback threads and with a shared LinuxReactor.
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#include "reactor_benchmark.hpp"
+
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace DJI::OSDK;
+
+static uint64_t
+nowNs(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t
+processCpuNs()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return ((uint64_t)usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+           1000000000ULL +
+         ((uint64_t)usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000;
+}
+
+SocketLink::SocketLink(int fd)
+  : fd(fd)
+{
+}
+
+SocketLink::~SocketLink()
+{
+  close(fd);
+}
+
+void
+SocketLink::init()
+{
+}
+
+time_ms
+SocketLink::getTimeStamp()
+{
+  return nowNs(CLOCK_MONOTONIC) / 1000000;
+}
+
+size_t
+SocketLink::send(const uint8_t* buf, size_t len)
+{
+  ssize_t n = ::send(fd, buf, len, MSG_NOSIGNAL);
+  return n < 0 ? 0 : n;
+}
+
+size_t
+SocketLink::readall(uint8_t* buf, size_t maxlen)
+{
+  struct pollfd p;
+  p.fd     = fd;
+  p.events = POLLIN;
+  if (poll(&p, 1, 10) <= 0)
+    return 0;
+
+  ssize_t n = recv(fd, buf, maxlen, MSG_DONTWAIT);
+  return n < 0 ? 0 : n;
+}
+
+int
+SocketLink::getFd() const
+{
+  return fd;
+}
+
+typedef struct FeedTask
+{
+  std::vector<int> fds;
+  int              rate;
+  volatile bool    running;
+  volatile int64_t cpuNs;
+  uint8_t          frame[sizeof(Header) + 2 + 64 + Protocol::CRCData];
+} FeedTask;
+
+//! Plays the flight controllers: one broadcast frame per link per period
+static void*
+feedCall(void* param)
+{
+  FeedTask*       task   = (FeedTask*)param;
+  uint64_t        period = 1000000000ULL / task->rate;
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+
+  while (task->running)
+  {
+    for (size_t i = 0; i < task->fds.size(); ++i)
+    {
+      if (::send(task->fds[i], task->frame, sizeof(task->frame),
+                 MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+      {
+        //! Reader fell behind; drop like a full UART FIFO would
+      }
+    }
+    task->cpuNs = nowNs(CLOCK_THREAD_CPUTIME_ID);
+
+    next.tv_nsec += period;
+    while (next.tv_nsec >= 1000000000)
+    {
+      next.tv_sec++;
+      next.tv_nsec -= 1000000000;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+  }
+  return NULL;
+}
+
+static void
+countFrame(Vehicle* vehicle, RecvContainer recvFrame, UserData userData)
+{
+  __atomic_add_fetch((uint64_t*)userData, 1, __ATOMIC_RELAXED);
+}
+
+double
+measureLinks(int linkNumber, bool useReactor, int workerNumber, int pushRate,
+             int seconds, uint64_t* framesReceived)
+{
+  std::vector<SocketLink*> links(linkNumber);
+  std::vector<Vehicle*>    vehicles(linkNumber);
+  std::vector<uint64_t>    counts(linkNumber, 0);
+  FeedTask                 task;
+  LinuxReactor             reactor(workerNumber);
+
+  memset(task.frame, 0, sizeof(task.frame));
+  Header* head       = (Header*)task.frame;
+  head->sof          = Protocol::SOF;
+  head->length       = sizeof(task.frame);
+  task.frame[sizeof(Header)]     = OpenProtocol::CMDSet::Broadcast::broadcast[0];
+  task.frame[sizeof(Header) + 1] = OpenProtocol::CMDSet::Broadcast::broadcast[1];
+  Protocol::calculateCRC(task.frame);
+
+  for (int i = 0; i < linkNumber; ++i)
+  {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+    {
+      std::cout << "socketpair failed, stopping at " << i << " links\n";
+      return -1;
+    }
+    links[i] = new SocketLink(sv[0]);
+    task.fds.push_back(sv[1]);
+
+    vehicles[i] = new Vehicle(links[i], true, !useReactor);
+    vehicles[i]->addPushDataListener(countFrame, &counts[i]);
+    if (useReactor)
+    {
+      reactor.attach(vehicles[i], links[i]->getFd());
+    }
+  }
+  if (useReactor && !reactor.start())
+  {
+    return -1;
+  }
+
+  pthread_t feeder;
+  task.rate    = pushRate;
+  task.running = true;
+  task.cpuNs   = 0;
+  pthread_create(&feeder, NULL, feedCall, &task);
+
+  //! Warm up, then measure over a steady window
+  usleep(200 * 1000);
+  uint64_t wall0   = nowNs(CLOCK_MONOTONIC);
+  uint64_t cpu0    = processCpuNs();
+  int64_t  feed0   = task.cpuNs;
+  uint64_t frames0 = 0;
+  for (int i = 0; i < linkNumber; ++i)
+    frames0 += __atomic_load_n(&counts[i], __ATOMIC_RELAXED);
+
+  sleep(seconds);
+
+  uint64_t wall1   = nowNs(CLOCK_MONOTONIC);
+  uint64_t cpu1    = processCpuNs();
+  int64_t  feed1   = task.cpuNs;
+  uint64_t frames1 = 0;
+  for (int i = 0; i < linkNumber; ++i)
+    frames1 += __atomic_load_n(&counts[i], __ATOMIC_RELAXED);
+
+  //! Keep feeding while the vehicles shut down: their read threads only
+  //! leave Protocol::receive() on a complete frame. Each Protocol deletes
+  //! its SocketLink.
+  reactor.stop();
+  for (int i = 0; i < linkNumber; ++i)
+  {
+    if (useReactor)
+      reactor.detach(vehicles[i]);
+    delete vehicles[i];
+  }
+  task.running = false;
+  pthread_join(feeder, NULL);
+  for (int i = 0; i < linkNumber; ++i)
+  {
+    close(task.fds[i]);
+  }
+
+  *framesReceived = frames1 - frames0;
+  return 100.0 * ((cpu1 - cpu0) - (feed1 - feed0)) / (wall1 - wall0);
+}
+
+int
+main(int argc, char** argv)
+{
+  int maxLinks = (argc > 1) ? atoi(argv[1]) : 32;
+  int seconds  = (argc > 2) ? atoi(argv[2]) : 2;
+  int workers  = (argc > 3) ? atoi(argv[3]) : 2;
+  int pushRate = (argc > 4) ? atoi(argv[4]) : 100;
+
+  std::cout << "links  threads cpu%  reactor(" << workers
+            << ") cpu%  frames threads/reactor/expected" << std::endl;
+  for (int links = 1; links <= maxLinks; links *= 2)
+  {
+    uint64_t threadFrames  = 0;
+    uint64_t reactorFrames = 0;
+    double   threadCpu =
+      measureLinks(links, false, workers, pushRate, seconds, &threadFrames);
+    double reactorCpu =
+      measureLinks(links, true, workers, pushRate, seconds, &reactorFrames);
+
+    printf("%5d  %12.1f  %12.1f  %llu/%llu/%llu\n", links, threadCpu,
+           reactorCpu, (unsigned long long)threadFrames,
+           (unsigned long long)reactorFrames,
+           (unsigned long long)links * pushRate * seconds);
+  }
+  return 0;
+}
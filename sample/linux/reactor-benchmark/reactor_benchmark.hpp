@@ -0,0 +1,49 @@
+/*! @file reactor_benchmark.hpp
+ *  @version 3.3
+ *  @date Jun 05 2017
+ *
+ *  @brief
+ *  CPU cost of serving 1 to N simulated links from one process, with the
+ *  per-vehicle read/callback threads and with a shared LinuxReactor.
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#ifndef DJIOSDK_REACTORBENCHMARK_HPP
+#define DJIOSDK_REACTORBENCHMARK_HPP
+
+// System Includes
+#include <iostream>
+
+// DJI OSDK includes
+#include <dji_vehicle.hpp>
+#include <linux_reactor.hpp>
+
+/*! @brief One end of a socketpair standing in for a serial port. Reads wait
+ *  up to 10 ms for data, like a port configured with VTIME. Owns fd.
+ */
+class SocketLink : public DJI::OSDK::HardDriver
+{
+public:
+  SocketLink(int fd);
+  ~SocketLink();
+
+  void               init();
+  DJI::OSDK::time_ms getTimeStamp();
+  size_t send(const uint8_t* buf, size_t len);
+  size_t readall(uint8_t* buf, size_t maxlen);
+
+  int getFd() const;
+
+private:
+  int fd;
+};
+
+/*! @brief Mean CPU load (in % of one core) of the OSDK side while every
+ *  link receives pushRate broadcast frames per second.
+ */
+double measureLinks(int linkNumber, bool useReactor, int workerNumber,
+                    int pushRate, int seconds, uint64_t* framesReceived);
+
+#endif // DJIOSDK_REACTORBENCHMARK_HPP
@@ -0,0 +1,300 @@
+/*! @file rt_benchmark.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  cyclictest-style latency of the read path under synthetic CPU and
+ *  memory load, with default and with real-time thread configuration.
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#include "rt_benchmark.hpp"
+
+#include <algorithm>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace DJI::OSDK;
+
+static uint64_t
+nowNs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+SocketLink::SocketLink(int fd)
+  : fd(fd)
+{
+}
+
+SocketLink::~SocketLink()
+{
+  close(fd);
+}
+
+void
+SocketLink::init()
+{
+}
+
+time_ms
+SocketLink::getTimeStamp()
+{
+  return nowNs() / 1000000;
+}
+
+size_t
+SocketLink::send(const uint8_t* buf, size_t len)
+{
+  ssize_t n = ::send(fd, buf, len, MSG_NOSIGNAL);
+  return n < 0 ? 0 : n;
+}
+
+size_t
+SocketLink::readall(uint8_t* buf, size_t maxlen)
+{
+  struct pollfd p;
+  p.fd     = fd;
+  p.events = POLLIN;
+  if (poll(&p, 1, 10) <= 0)
+    return 0;
+
+  ssize_t n = recv(fd, buf, maxlen, MSG_DONTWAIT);
+  return n < 0 ? 0 : n;
+}
+
+static const int SEND_SLOT = 4096;
+
+typedef struct BenchTask
+{
+  int                   fd;
+  int                   rate;
+  volatile bool         running;
+  volatile bool         measuring;
+  volatile uint64_t     sent;
+  uint64_t              sendNs[SEND_SLOT];
+  std::vector<uint32_t> latencyNs;
+  uint64_t              samples;
+} BenchTask;
+
+//! Plays the flight controller: one broadcast frame carrying its sequence
+//! number per period
+static void*
+feedCall(void* param)
+{
+  BenchTask* task = (BenchTask*)param;
+  uint8_t    frame[sizeof(Header) + 2 + sizeof(uint32_t) + Protocol::CRCData];
+  uint64_t   period = 1000000000ULL / task->rate;
+  uint32_t   seq    = 0;
+
+  memset(frame, 0, sizeof(frame));
+  Header* head                = (Header*)frame;
+  head->sof                   = Protocol::SOF;
+  head->length                = sizeof(frame);
+  frame[sizeof(Header)]       = OpenProtocol::CMDSet::Broadcast::broadcast[0];
+  frame[sizeof(Header) + 1]   = OpenProtocol::CMDSet::Broadcast::broadcast[1];
+
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  while (task->running)
+  {
+    seq++;
+    memcpy(frame + sizeof(Header) + 2, &seq, sizeof(seq));
+    Protocol::calculateCRC(frame);
+
+    task->sendNs[seq % SEND_SLOT] = nowNs();
+    ::send(task->fd, frame, sizeof(frame), MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (task->measuring)
+      task->sent++;
+
+    next.tv_nsec += period;
+    while (next.tv_nsec >= 1000000000)
+    {
+      next.tv_sec++;
+      next.tv_nsec -= 1000000000;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+  }
+  return NULL;
+}
+
+//! Runs on the SDK read thread
+static void
+frameListener(Vehicle* vehicle, RecvContainer recvFrame, UserData userData)
+{
+  uint64_t   now  = nowNs();
+  BenchTask* task = (BenchTask*)userData;
+  uint32_t   seq;
+  memcpy(&seq, recvFrame.recvData.raw_ack_array, sizeof(seq));
+
+  if (task->measuring && task->samples < task->latencyNs.size())
+  {
+    task->latencyNs[task->samples++] =
+      (uint32_t)(now - task->sendNs[seq % SEND_SLOT]);
+  }
+}
+
+typedef struct LoadTask
+{
+  volatile bool* running;
+} LoadTask;
+
+//! Burns CPU and keeps the kernel busy with page faults
+static void*
+loadCall(void* param)
+{
+  LoadTask*    task = (LoadTask*)param;
+  const size_t size = 4 << 20;
+  uint8_t*     buf  = (uint8_t*)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf == MAP_FAILED)
+    return NULL;
+
+  for (uint8_t v = 0; *task->running; ++v)
+  {
+    memset(buf, v, size);
+    madvise(buf, size, MADV_DONTNEED);
+  }
+  munmap(buf, size);
+  return NULL;
+}
+
+static double
+percentileUs(const std::vector<uint32_t>& sorted, double fraction)
+{
+  size_t index = (size_t)(fraction * (sorted.size() - 1));
+  return sorted[index] / 1000.0;
+}
+
+bool
+measureReadPath(const ThreadConfig* config, int rate, int loadThreads,
+                int seconds, LatencyResult* result)
+{
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+  {
+    std::cout << "socketpair failed\n";
+    return false;
+  }
+
+  BenchTask* task = new BenchTask;
+  task->fd        = sv[1];
+  task->rate      = rate;
+  task->running   = true;
+  task->measuring = false;
+  task->sent      = 0;
+  task->samples   = 0;
+  task->latencyNs.resize((size_t)rate * seconds * 2 + 1024);
+
+  SocketLink* link    = new SocketLink(sv[0]);
+  Vehicle*    vehicle = new Vehicle(link, true, true, config);
+  vehicle->addPushDataListener(frameListener, task);
+
+  pthread_t feeder;
+  pthread_create(&feeder, NULL, feedCall, task);
+  //! The feeder stands in for hardware; keep it ahead of both setups
+  ThreadSchedule feederSchedule;
+  memset(&feederSchedule, 0, sizeof(feederSchedule));
+  feederSchedule.policy   = ThreadSchedule::POLICY_FIFO;
+  feederSchedule.priority = 90;
+  PosixThread::setSchedule(feeder, feederSchedule, "feeder");
+
+  volatile bool          loadRunning = true;
+  LoadTask               load        = { &loadRunning };
+  std::vector<pthread_t> loaders(loadThreads);
+  for (int i = 0; i < loadThreads; ++i)
+    pthread_create(&loaders[i], NULL, loadCall, &load);
+
+  usleep(200 * 1000);
+  task->measuring = true;
+  sleep(seconds);
+  task->measuring = false;
+
+  loadRunning = false;
+  for (int i = 0; i < loadThreads; ++i)
+    pthread_join(loaders[i], NULL);
+
+  //! Keep feeding while the vehicle shuts down: its read thread only
+  //! leaves Protocol::receive() on a complete frame. Protocol deletes link.
+  delete vehicle;
+  task->running = false;
+  pthread_join(feeder, NULL);
+  close(sv[1]);
+
+  std::vector<uint32_t> sorted(task->latencyNs.begin(),
+                               task->latencyNs.begin() + task->samples);
+  std::sort(sorted.begin(), sorted.end());
+
+  memset(result, 0, sizeof(LatencyResult));
+  result->samples = sorted.size();
+  result->lost    = task->sent > sorted.size() ? task->sent - sorted.size() : 0;
+  if (!sorted.empty())
+  {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < sorted.size(); ++i)
+      sum += sorted[i];
+    result->minUs  = sorted.front() / 1000.0;
+    result->avgUs  = sum / 1000.0 / sorted.size();
+    result->p99Us  = percentileUs(sorted, 0.99);
+    result->p999Us = percentileUs(sorted, 0.999);
+    result->maxUs  = sorted.back() / 1000.0;
+  }
+  delete task;
+  return true;
+}
+
+static void
+printResult(const char* name, const LatencyResult& r)
+{
+  printf("%-9s %8llu %6llu %8.1f %8.1f %8.1f %8.1f %9.1f\n", name,
+         (unsigned long long)r.samples, (unsigned long long)r.lost, r.minUs,
+         r.avgUs, r.p99Us, r.p999Us, r.maxUs);
+}
+
+int
+main(int argc, char** argv)
+{
+  int cpuNumber = sysconf(_SC_NPROCESSORS_ONLN);
+  int seconds   = (argc > 1) ? atoi(argv[1]) : 5;
+  int rate      = (argc > 2) ? atoi(argv[2]) : 1000;
+  int load      = (argc > 3) ? atoi(argv[3]) : cpuNumber * 2;
+  int priority  = (argc > 4) ? atoi(argv[4]) : 80;
+  int cpu       = (argc > 5) ? atoi(argv[5]) : -1;
+
+  ThreadConfig realtime;
+  memset(&realtime, 0, sizeof(realtime));
+  realtime.read.policy         = ThreadSchedule::POLICY_FIFO;
+  realtime.read.priority       = priority;
+  realtime.callback.policy     = ThreadSchedule::POLICY_FIFO;
+  realtime.callback.priority   = priority - 1;
+  realtime.lockMemory          = true;
+  realtime.prefaultStack       = 64 * 1024;
+  realtime.priorityInheritance = true;
+  if (cpu >= 0)
+  {
+    realtime.read.cpuMask     = (uint64_t)1 << cpu;
+    realtime.callback.cpuMask = (uint64_t)1 << cpu;
+  }
+
+  std::cout << rate << " frames/s, " << load << " load threads on "
+            << cpuNumber << " CPUs, " << seconds << " s per run\n";
+  printf("%-9s %8s %6s %8s %8s %8s %8s %9s  (us)\n", "config", "samples",
+         "lost", "min", "avg", "p99", "p99.9", "max");
+
+  LatencyResult result;
+  if (measureReadPath(NULL, rate, load, seconds, &result))
+    printResult("default", result);
+  if (measureReadPath(&realtime, rate, load, seconds, &result))
+    printResult("realtime", result);
+  return 0;
+}
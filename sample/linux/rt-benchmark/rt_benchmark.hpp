@@ -0,0 +1,59 @@
+/*! @file rt_benchmark.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  cyclictest-style latency of the read path under synthetic CPU and
+ *  memory load, with default and with real-time thread configuration.
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#ifndef DJIOSDK_RTBENCHMARK_HPP
+#define DJIOSDK_RTBENCHMARK_HPP
+
+// System Includes
+#include <iostream>
+
+// DJI OSDK includes
+#include <dji_vehicle.hpp>
+
+/*! @brief One end of a socketpair standing in for a serial port. Reads wait
+ *  up to 10 ms for data, like a port configured with VTIME. Owns fd.
+ */
+class SocketLink : public DJI::OSDK::HardDriver
+{
+public:
+  SocketLink(int fd);
+  ~SocketLink();
+
+  void               init();
+  DJI::OSDK::time_ms getTimeStamp();
+  size_t send(const uint8_t* buf, size_t len);
+  size_t readall(uint8_t* buf, size_t maxlen);
+
+private:
+  int fd;
+};
+
+typedef struct LatencyResult
+{
+  uint64_t samples;
+  uint64_t lost;
+  double   minUs;
+  double   avgUs;
+  double   p99Us;
+  double   p999Us;
+  double   maxUs;
+} LatencyResult;
+
+/*! @brief Time from writing a frame into the link to the push data
+ *  listener running on the read thread, at rate frames per second while
+ *  loadThreads threads keep every CPU busy.
+ *  @param config NULL for the OS defaults
+ */
+bool measureReadPath(const DJI::OSDK::ThreadConfig* config, int rate,
+                     int loadThreads, int seconds, LatencyResult* result);
+
+#endif // DJIOSDK_RTBENCHMARK_HPP
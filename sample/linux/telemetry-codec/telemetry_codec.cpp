@@ -0,0 +1,392 @@
+/*! @file telemetry_codec.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Compression ratio and encode/decode throughput of the telemetry codec
+ *  on recorded stores, link captures, or a synthetic flight.
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#include "telemetry_codec.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+using namespace DJI::OSDK;
+using namespace DJI::OSDK::Telemetry;
+
+//! Records per compressed block
+static const uint32_t BLOCK_RECORDS = 4096;
+
+//! Records of one column, in the store's record layout
+typedef struct Series
+{
+  int      column;
+  size_t   recordSize;
+  size_t   number;
+  size_t   capacity;
+  uint8_t* records;
+} Series;
+
+static uint64_t
+nowNs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+initSeries(Series* series, int column)
+{
+  series->column     = column;
+  series->recordSize = (sizeof(TelemetryStore::RecordHeader) +
+                        TelemetryStore::getValueSize(column) + 7) &
+                       ~(size_t)7;
+  series->number   = 0;
+  series->capacity = 0;
+  series->records  = NULL;
+}
+
+static bool
+addRecord(Series* series, uint64_t hostTimeNs, uint32_t fcTimeMs,
+          const void* value)
+{
+  if (series->number == series->capacity)
+  {
+    size_t   capacity = series->capacity ? series->capacity * 2 : 1024;
+    uint8_t* grown =
+      (uint8_t*)realloc(series->records, capacity * series->recordSize);
+    if (!grown)
+      return false;
+    series->records  = grown;
+    series->capacity = capacity;
+  }
+
+  uint8_t* r = series->records + series->number++ * series->recordSize;
+  TelemetryStore::RecordHeader* header = (TelemetryStore::RecordHeader*)r;
+  header->hostTimeNs                   = hostTimeNs;
+  header->fcTimeMs                     = fcTimeMs;
+  header->reserved                     = 0;
+  memcpy(r + sizeof(TelemetryStore::RecordHeader), value,
+         TelemetryStore::getValueSize(series->column));
+  return true;
+}
+
+static void
+freeSeries(Series* series)
+{
+  free(series->records);
+  series->records = NULL;
+  series->number  = 0;
+}
+
+static const char*
+columnName(int column)
+{
+  switch (column)
+  {
+    case TOPIC_QUATERNION:
+      return "QUATERNION";
+    case TOPIC_ACCELERATION_RAW:
+      return "ACCELERATION_RAW";
+    case TOPIC_ANGULAR_RATE_RAW:
+      return "ANGULAR_RATE_RAW";
+    case TOPIC_GPS_POSITION:
+      return "GPS_POSITION";
+    case TelemetryStore::BROADCAST_COLUMN:
+      return "broadcast";
+    default:
+      return NULL;
+  }
+}
+
+static void
+printHeading()
+{
+  printf("%-18s %9s %10s %10s %6s %9s %9s\n", "column", "records", "raw B",
+         "packed B", "ratio", "enc MB/s", "dec MB/s");
+}
+
+/*! Encode a series in blocks, decode it back, check it round trips.
+ *  Raw size counts the two timestamps and the value: 12 + value bytes
+ */
+static bool
+benchSeries(const Series* series, uint64_t* rawTotal, uint64_t* packedTotal)
+{
+  if (!series->number)
+    return true;
+
+  size_t valueSize = TelemetryStore::getValueSize(series->column);
+  size_t raw       = series->number * (12 + valueSize);
+
+  size_t   capacity = raw + 1024;
+  uint8_t* packed   = (uint8_t*)malloc(capacity);
+  size_t   used     = 0;
+  if (!packed)
+    return false;
+
+  TelemetryEncoder encoder;
+  uint64_t         begin = nowNs();
+  for (size_t i = 0; i < series->number; i += BLOCK_RECORDS)
+  {
+    if (!encoder.begin(series->column))
+    {
+      free(packed);
+      return false;
+    }
+    size_t end = i + BLOCK_RECORDS;
+    if (end > series->number)
+      end = series->number;
+    for (size_t k = i; k < end; ++k)
+    {
+      const uint8_t* r = series->records + k * series->recordSize;
+      encoder.encode((const TelemetryStore::RecordHeader*)r,
+                     r + sizeof(TelemetryStore::RecordHeader));
+    }
+    size_t         size;
+    const uint8_t* block = encoder.finish(&size);
+    if (used + size > capacity)
+    {
+      capacity       = 2 * (used + size);
+      uint8_t* grown = (uint8_t*)realloc(packed, capacity);
+      if (!grown)
+      {
+        free(packed);
+        return false;
+      }
+      packed = grown;
+    }
+    memcpy(packed + used, block, size);
+    used += size;
+  }
+  uint64_t encodeNs = nowNs() - begin;
+
+  TelemetryDecoder             decoder;
+  TelemetryStore::RecordHeader header;
+  uint8_t*                     value   = (uint8_t*)malloc(valueSize);
+  size_t                       decoded = 0;
+  size_t                       wrong   = 0;
+  begin                                = nowNs();
+  for (size_t at = 0; at < used;)
+  {
+    if (!decoder.begin(packed + at, used - at))
+      break;
+    at += ((const TelemetryCodec::CodecBlock*)(packed + at))->size;
+    while (decoder.decode(&header, value))
+    {
+      const uint8_t* r = series->records + decoded * series->recordSize;
+      const TelemetryStore::RecordHeader* h =
+        (const TelemetryStore::RecordHeader*)r;
+      if (h->hostTimeNs != header.hostTimeNs ||
+          h->fcTimeMs != header.fcTimeMs ||
+          memcmp(r + sizeof(TelemetryStore::RecordHeader), value, valueSize))
+        wrong++;
+      decoded++;
+    }
+  }
+  uint64_t decodeNs = nowNs() - begin;
+  free(value);
+  free(packed);
+
+  char        number[16];
+  const char* name = columnName(series->column);
+  if (!name)
+  {
+    snprintf(number, sizeof(number), "column %d", series->column);
+    name = number;
+  }
+  printf("%-18s %9zu %10zu %10zu %6.2f %9.1f %9.1f%s\n", name,
+         series->number, raw, used, (double)raw / used,
+         encodeNs ? raw * 1e3 / encodeNs : 0.0,
+         decodeNs ? raw * 1e3 / decodeNs : 0.0,
+         (decoded != series->number || wrong) ? "  ROUND TRIP FAILED" : "");
+
+  *rawTotal += raw;
+  *packedTotal += used;
+  return decoded == series->number && !wrong;
+}
+
+static void
+printTotal(uint64_t raw, uint64_t packed)
+{
+  if (packed)
+    printf("%-18s %9s %10llu %10llu %6.2f\n", "total", "",
+           (unsigned long long)raw, (unsigned long long)packed,
+           (double)raw / packed);
+}
+
+bool
+benchStore(const char* directory)
+{
+  TelemetryStoreReader reader;
+  if (!reader.open(directory))
+    return false;
+
+  bool     ok  = true;
+  uint64_t raw = 0, packed = 0;
+  printHeading();
+  for (int column = 0; column < TelemetryStore::COLUMN_NUMBER; ++column)
+  {
+    Series series;
+    initSeries(&series, column);
+
+    ColumnCursor cursor;
+    ColumnSpan   span;
+    reader.scan(column, 0, UINT64_MAX, &cursor);
+    while (reader.next(&cursor, &span))
+    {
+      for (size_t i = 0; i < span.number; ++i)
+      {
+        const uint8_t* r = span.records + i * span.recordSize;
+        const TelemetryStore::RecordHeader* h =
+          TelemetryStoreReader::getHeader(r);
+        addRecord(&series, h->hostTimeNs, h->fcTimeMs,
+                  r + sizeof(TelemetryStore::RecordHeader));
+      }
+    }
+    ok = benchSeries(&series, &raw, &packed) && ok;
+    freeSeries(&series);
+  }
+  printTotal(raw, packed);
+  return ok;
+}
+
+static void
+broadcastHandler(const DecodedFrame* frame, UserData userData)
+{
+  if (frame->type != DecodedFrame::BROADCAST)
+    return;
+  addRecord((Series*)userData, frame->timeNs,
+            frame->broadcast.timeStamp.time_ms, &frame->broadcast);
+}
+
+bool
+benchCapture(const char* path)
+{
+  CaptureDecoder decoder;
+  if (!decoder.open(path))
+    return false;
+
+  Series series;
+  initSeries(&series, TelemetryStore::BROADCAST_COLUMN);
+  if (!decoder.decode(broadcastHandler, &series))
+    return false;
+
+  uint64_t raw = 0, packed = 0;
+  printHeading();
+  bool ok = benchSeries(&series, &raw, &packed);
+  freeSeries(&series);
+  return ok;
+}
+
+//! Zero mean noise of the given deviation
+static double
+noise(double deviation)
+{
+  double sum = 0;
+  for (int i = 0; i < 4; ++i)
+    sum += rand() / (double)RAND_MAX - 0.5;
+  return sum * deviation * 1.732;
+}
+
+bool
+benchSynthetic(int seconds)
+{
+  Series accel, gyro, attitude, gps;
+  initSeries(&accel, TOPIC_ACCELERATION_RAW);
+  initSeries(&gyro, TOPIC_ANGULAR_RATE_RAW);
+  initSeries(&attitude, TOPIC_QUATERNION);
+  initSeries(&gps, TOPIC_GPS_POSITION);
+
+  //! A slow yawing, climbing orbit; IMU readings carry the sensor LSB
+  const double accelLsb = 1.0 / 4096;   // g
+  const double gyroLsb  = 0.00106526;   // rad/s
+  uint64_t     start    = 1000000000ULL;
+  srand(1);
+  for (int tick = 0; tick < seconds * 400; ++tick)
+  {
+    double   t      = tick / 400.0;
+    uint64_t hostNs = start + tick * 2500000ULL + (rand() % 40000);
+    uint32_t fcMs   = (uint32_t)(t * 1000);
+    double   yaw    = 0.2 * t;
+
+    Vector3f a;
+    a.x = (float)(accelLsb * floor((0.05 * sin(yaw) + noise(0.02)) / accelLsb));
+    a.y = (float)(accelLsb * floor((0.05 * cos(yaw) + noise(0.02)) / accelLsb));
+    a.z = (float)(accelLsb * floor((-1.0 + noise(0.03)) / accelLsb));
+    addRecord(&accel, hostNs, fcMs, &a);
+
+    Vector3f w;
+    w.x = (float)(gyroLsb * floor(noise(0.01) / gyroLsb));
+    w.y = (float)(gyroLsb * floor(noise(0.01) / gyroLsb));
+    w.z = (float)(gyroLsb * floor((0.2 + noise(0.01)) / gyroLsb));
+    addRecord(&gyro, hostNs, fcMs, &w);
+
+    if (tick % 2 == 0)
+    {
+      Quaternion q;
+      double     tilt = 0.02 * sin(0.5 * t);
+      q.q0            = (float)(cos(yaw / 2) * cos(tilt / 2));
+      q.q1            = (float)(cos(yaw / 2) * sin(tilt / 2));
+      q.q2            = (float)(sin(yaw / 2) * sin(tilt / 2));
+      q.q3            = (float)(sin(yaw / 2) * cos(tilt / 2));
+      addRecord(&attitude, hostNs, fcMs, &q);
+    }
+
+    if (tick % 8 == 0)
+    {
+      Vector3d p;
+      p.x = (int32_t)(1139000000 + 2000 * cos(yaw) + noise(5));
+      p.y = (int32_t)(225400000 + 2000 * sin(yaw) + noise(5));
+      p.z = (int32_t)(50000 + 1000 * t + noise(100));
+      addRecord(&gps, hostNs, fcMs, &p);
+    }
+  }
+
+  uint64_t raw = 0, packed = 0;
+  printHeading();
+  bool ok = benchSeries(&accel, &raw, &packed);
+  ok      = benchSeries(&gyro, &raw, &packed) && ok;
+  ok      = benchSeries(&attitude, &raw, &packed) && ok;
+  ok      = benchSeries(&gps, &raw, &packed) && ok;
+  printTotal(raw, packed);
+
+  freeSeries(&accel);
+  freeSeries(&gyro);
+  freeSeries(&attitude);
+  freeSeries(&gps);
+  return ok;
+}
+
+int
+main(int argc, char** argv)
+{
+  const char* mode = (argc > 1) ? argv[1] : "";
+
+  if (!strcmp(mode, "store") && argc > 2)
+  {
+    return benchStore(argv[2]) ? 0 : 1;
+  }
+  if (!strcmp(mode, "capture") && argc > 2)
+  {
+    return benchCapture(argv[2]) ? 0 : 1;
+  }
+  if (!strcmp(mode, "synthetic"))
+  {
+    int seconds = (argc > 2) ? atoi(argv[2]) : 600;
+    return benchSynthetic(seconds) ? 0 : 1;
+  }
+
+  std::cout << "Usage:\n"
+            << "  " << argv[0] << " store <directory>\n"
+            << "  " << argv[0] << " capture <file>\n"
+            << "  " << argv[0] << " synthetic [seconds]\n";
+  return 1;
+}
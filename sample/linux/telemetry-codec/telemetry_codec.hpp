@@ -0,0 +1,34 @@
+/*! @file telemetry_codec.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Compression ratio and encode/decode throughput of the telemetry codec
+ *  on recorded stores, link captures, or a synthetic flight.
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#ifndef DJIOSDK_TELEMETRYCODEC_HPP
+#define DJIOSDK_TELEMETRYCODEC_HPP
+
+// System Includes
+#include <iostream>
+
+// DJI OSDK includes
+#include <dji_vehicle.hpp>
+#include <linux_capture_decoder.hpp>
+#include <linux_telemetry_codec.hpp>
+#include <linux_telemetry_store.hpp>
+
+//! Every column of a TelemetryRecorder store
+bool benchStore(const char* directory);
+
+//! The broadcast packages of a CaptureWriter file or raw serial dump
+bool benchCapture(const char* path);
+
+//! IMU, attitude and GPS topics of a generated flight, at their flight rates
+bool benchSynthetic(int seconds);
+
+#endif // DJIOSDK_TELEMETRYCODEC_HPP
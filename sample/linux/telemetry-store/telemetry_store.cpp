@@ -0,0 +1,165 @@
+/*! @file telemetry_store.cpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Record telemetry into a columnar store at flight rates and read it back
+ *  with time seeks and range scans.
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#include "telemetry_store.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+using namespace DJI::OSDK;
+using namespace DJI::OSDK::Telemetry;
+
+static uint64_t
+nowNs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//! Sample pairs queued between flushes, well within the recorder queue
+static const int BURST = 4096;
+
+bool
+benchStore(const char* directory, int sampleNumber)
+{
+  TelemetryRecorder recorder(NULL);
+  if (!recorder.start(directory))
+    return false;
+
+  //! What a 400 Hz subscription package carries for these two topics
+  Quaternion q;
+  Vector3f   a;
+  uint64_t   recordNs = 0;
+  uint64_t   worstNs  = 0;
+  uint64_t   begin    = nowNs();
+  for (int i = 0; i < sampleNumber; ++i)
+  {
+    uint32_t fcTime = i * 5 / 2;
+    q.q0            = 1.0f;
+    q.q1            = i * 1e-6f;
+    q.q2            = 0;
+    q.q3            = 0;
+    a.x             = i;
+    a.y             = 0;
+    a.z             = -9.8f;
+
+    uint64_t t = nowNs();
+    recorder.record(TOPIC_QUATERNION, &q, sizeof(q), fcTime);
+    recorder.record(TOPIC_ACCELERATION_GROUND, &a, sizeof(a), fcTime);
+    t = nowNs() - t;
+    recordNs += t;
+    if (t > worstNs)
+      worstNs = t;
+
+    //! Keep the synthetic rate within what the writer drains, as a real
+    //! 400 Hz feed would; drops here would only measure the disk
+    if (i % BURST == BURST - 1)
+      recorder.flush();
+  }
+  recorder.flush();
+  uint64_t writtenNs = nowNs() - begin;
+  recorder.stop();
+
+  std::cout << "Recorded " << recorder.getRecorded() << " samples, dropped "
+            << recorder.getDropped() << "\n"
+            << "  record(): " << (double)recordNs / (2.0 * sampleNumber)
+            << " ns/sample, worst pair " << worstNs << " ns\n"
+            << "  on disk after " << writtenNs / 1000000 << " ms\n";
+
+  TelemetryStoreReader reader;
+  if (!reader.open(directory))
+    return false;
+
+  uint64_t first, last;
+  if (!reader.getTimeRange(TOPIC_QUATERNION, &first, &last))
+  {
+    std::cout << "No quaternion records\n";
+    return false;
+  }
+
+  //! Seek: the first record of the last tenth of the run
+  ColumnCursor cursor;
+  ColumnSpan   span;
+  uint64_t     middle = first + (last - first) / 10 * 9;
+  begin               = nowNs();
+  reader.scan(TOPIC_QUATERNION, middle, last + 1, &cursor);
+  bool     found  = reader.next(&cursor, &span);
+  uint64_t seekNs = nowNs() - begin;
+  if (found)
+    std::cout << "  seek: " << seekNs << " ns to record at "
+              << TelemetryStoreReader::getHeader(span.records)->hostTimeNs -
+                   first
+              << " ns into the run\n";
+
+  //! Range scan over everything, touching every value
+  size_t records = 0;
+  double sum     = 0;
+  begin          = nowNs();
+  reader.scan(TOPIC_QUATERNION, 0, UINT64_MAX, &cursor);
+  while (reader.next(&cursor, &span))
+  {
+    for (size_t i = 0; i < span.number; ++i)
+    {
+      const uint8_t* r = span.records + i * span.recordSize;
+      sum += TelemetryStoreReader::getValue<TOPIC_QUATERNION>(r)->q1;
+    }
+    records += span.number;
+  }
+  uint64_t scanNs = nowNs() - begin;
+  std::cout << "  scan: " << records << " records in " << scanNs / 1000
+            << " us (" << (records ? (double)scanNs / records : 0)
+            << " ns/record, checksum " << sum << ")\n";
+
+  return records == reader.getRecordNumber(TOPIC_QUATERNION);
+}
+
+bool
+dumpStore(const char* directory)
+{
+  TelemetryStoreReader reader;
+  if (!reader.open(directory))
+    return false;
+
+  for (int column = 0; column < TelemetryStore::COLUMN_NUMBER; ++column)
+  {
+    uint64_t first, last;
+    if (!reader.getTimeRange(column, &first, &last))
+      continue;
+    std::cout << "column " << column << ": "
+              << reader.getRecordNumber(column) << " records, "
+              << (last - first) / 1000000 << " ms\n";
+  }
+  return true;
+}
+
+int
+main(int argc, char** argv)
+{
+  const char* mode = (argc > 1) ? argv[1] : "";
+
+  if (!strcmp(mode, "bench") && argc > 2)
+  {
+    int samples = (argc > 3) ? atoi(argv[3]) : 400 * 600;
+    return benchStore(argv[2], samples) ? 0 : 1;
+  }
+  if (!strcmp(mode, "dump") && argc > 2)
+  {
+    return dumpStore(argv[2]) ? 0 : 1;
+  }
+
+  std::cout << "Usage:\n"
+            << "  " << argv[0] << " bench <directory> [samples]\n"
+            << "  " << argv[0] << " dump <directory>\n";
+  return 1;
+}
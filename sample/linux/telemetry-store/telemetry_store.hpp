@@ -0,0 +1,30 @@
+/*! @file telemetry_store.hpp
+ *  @version 3.3
+ *  @date Jun 15 2017
+ *
+ *  @brief
+ *  Record telemetry into a columnar store at flight rates and read it back
+ *  with time seeks and range scans.
+ *
+ *  @copyright
+ *  2017 DJI. All rights reserved.
+ * */
+
+#ifndef DJIOSDK_TELEMETRYSTORE_HPP
+#define DJIOSDK_TELEMETRYSTORE_HPP
+
+// System Includes
+#include <iostream>
+
+// DJI OSDK includes
+#include <dji_vehicle.hpp>
+#include <linux_telemetry_store.hpp>
+
+//! Push sampleNumber synthetic 400 Hz quaternion and acceleration samples
+//! into a store as fast as possible, then time seeks and scans over it
+bool benchStore(const char* directory, int sampleNumber);
+
+//! Print the record count and time range of every column in a store
+bool dumpStore(const char* directory);
+
+#endif // DJIOSDK_TELEMETRYSTORE_HPP